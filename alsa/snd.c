@@ -30,6 +30,10 @@
 #include <pulse/pulseaudio.h>
 #endif
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #if defined(UT)
 #include "unity_fixture.h"
 #endif
@@ -58,7 +62,9 @@ struct mypulse_t {
     pa_context *context;
     pa_mainloop_api *api;
     pa_stream *stream;
+    pa_stream *record;
     pa_sample_spec spec;
+    pa_sample_spec rec_spec;
     pa_buffer_attr attr;
 } mypulse = { 0 };
 #endif
@@ -78,16 +84,56 @@ struct mypcm_t {
     uint8_t *buf;
 } mypcm = { 0 };
 
+struct myresample_t {
+    int taps;
+    uint64_t pos;
+    uint64_t step;
+    uint32_t frames;
+    int16_t coef[RESAMPLE_PHASES][RESAMPLE_MAX_TAPS];
+    int16_t hist[(RESAMPLE_MAX_TAPS + RESAMPLE_CHUNK) * SND_CHANNELS];
+    int16_t out[RESAMPLE_CHUNK * 2 * SND_CHANNELS];
+} myresample = { 0 };
+
+struct mystretch_t {
+    int active;
+    int primed;
+    uint32_t frames;
+    uint32_t skip;
+    uint32_t frac;
+    int64_t rate;
+    uint64_t last_us;
+    int16_t mid[STRETCH_OVERLAP * SND_CHANNELS];
+    int16_t buf[(STRETCH_SEEK + STRETCH_SEQ + STRETCH_CHUNK) * SND_CHANNELS];
+    int16_t out[STRETCH_SEQ * 3 * SND_CHANNELS];
+} mystretch = { 0 };
+
+struct mystats_t {
+    int enable;
+    int flowing;
+    uint64_t last_us;
+    uint32_t chunks;
+    uint32_t underruns;
+    uint32_t overruns;
+    uint64_t dropped;
+    int64_t latency_us;
+    uint32_t chunk_hist[STATS_BINS];
+    uint32_t fill_hist[STATS_BINS];
+    uint32_t write_hist[STATS_BINS];
+} mystats = { 0 };
+
 #if defined(TRIMUI_SMART) || defined(UT) || defined(TRIMUI_BRICK)
 static int dsp_fd = -1;
 #endif
 
 extern nds_hook myhook;
+extern nds_config myconfig;
 
 static int cur_vol = 0;
 static pthread_t thread = { 0 };
 
 static queue_t queue = { 0 };
+static int stats_bin(uint32_t);
+static int init_resampler(resampler_type_t, uint32_t, uint32_t);
 static int init_queue(queue_t *, size_t);
 static int quit_queue(queue_t *);
 static int put_queue(queue_t *, uint8_t *, size_t);
@@ -265,6 +311,350 @@ TEST(alsa, prehook_adpcm_decode_block)
 }
 #endif
 
+static int16_t read_spu_sample(spu_channel_struct *c, uint32_t idx)
+{
+    switch (c->format) {
+    case SPU_FMT_PCM8:
+    case SPU_FMT_PCM8_LOOP:
+        return (int16_t)((uint16_t)c->samples[idx] << 8);
+    case SPU_FMT_PCM16:
+    case SPU_FMT_PCM16_LOOP:
+        return ((int16_t *)c->samples)[idx];
+    case SPU_FMT_ADPCM:
+        while (c->adpcm_cache_block_offset <= idx) {
+            prehook_adpcm_decode_block(c);
+        }
+        return c->adpcm_sample_cache[idx & 0x3f];
+    }
+    return 0;
+}
+
+#if defined(UT)
+TEST(alsa, read_spu_sample)
+{
+    uint8_t pcm8[] = { 0x01, 0x80 };
+    int16_t pcm16[] = { 0x1234, -2 };
+    spu_channel_struct c = { 0 };
+
+    c.format = SPU_FMT_PCM8;
+    c.samples = pcm8;
+    TEST_ASSERT_EQUAL_INT(0x0100, read_spu_sample(&c, 0));
+    TEST_ASSERT_EQUAL_INT(-32768, read_spu_sample(&c, 1));
+
+    c.format = SPU_FMT_PCM16_LOOP;
+    c.samples = (uint8_t *)pcm16;
+    TEST_ASSERT_EQUAL_INT(0x1234, read_spu_sample(&c, 0));
+    TEST_ASSERT_EQUAL_INT(-2, read_spu_sample(&c, 1));
+}
+#endif
+
+static void lerp_spu_block(int16_t *out, const int16_t *s0, const int16_t *s1, const int16_t *frac, uint32_t len)
+{
+    uint32_t cc = 0;
+
+#if defined(__ARM_NEON)
+    for (; (cc + 8) <= len; cc += 8) {
+        int16x8_t a = vld1q_s16(s0 + cc);
+        int16x8_t b = vld1q_s16(s1 + cc);
+        int16x8_t f = vld1q_s16(frac + cc);
+        int32x4_t lo = vmulq_s32(vsubl_s16(vget_low_s16(b), vget_low_s16(a)), vmovl_s16(vget_low_s16(f)));
+        int32x4_t hi = vmulq_s32(vsubl_s16(vget_high_s16(b), vget_high_s16(a)), vmovl_s16(vget_high_s16(f)));
+
+        lo = vaddq_s32(vmovl_s16(vget_low_s16(a)), vshrq_n_s32(lo, 15));
+        hi = vaddq_s32(vmovl_s16(vget_high_s16(a)), vshrq_n_s32(hi, 15));
+        vst1q_s16(out + cc, vcombine_s16(vmovn_s32(lo), vmovn_s32(hi)));
+    }
+#endif
+
+    for (; cc < len; cc++) {
+        out[cc] = s0[cc] + ((((int32_t)s1[cc] - s0[cc]) * frac[cc]) >> 15);
+    }
+}
+
+#if defined(UT)
+TEST(alsa, lerp_spu_block)
+{
+    int cc = 0;
+    int16_t out[11] = { 0 };
+    int16_t s0[11] = { 0 };
+    int16_t s1[11] = { 0 };
+    int16_t frac[11] = { 0 };
+
+    for (cc = 0; cc < 11; cc++) {
+        s0[cc] = -32768;
+        s1[cc] = 32767;
+        frac[cc] = cc * 0xccc;
+    }
+    lerp_spu_block(out, s0, s1, frac, 11);
+    for (cc = 0; cc < 11; cc++) {
+        TEST_ASSERT_EQUAL_INT(-32768 + ((65535 * cc * 0xccc) >> 15), out[cc]);
+    }
+}
+#endif
+
+static uint32_t fetch_spu_samples(spu_channel_struct *c, int16_t *buf, uint32_t len, int interp)
+{
+    uint32_t cc = 0;
+    uint32_t k = 0;
+    uint32_t idx = 0;
+    uint32_t next = 0;
+    uint32_t *io = (uint32_t *)c->io_region;
+    uint64_t pos = c->sample_offset;
+    int16_t s0 = 0;
+    int16_t s1 = 0;
+    int16_t v0[SPU_FETCH_BLOCK] = { 0 };
+    int16_t v1[SPU_FETCH_BLOCK] = { 0 };
+    int16_t frac[SPU_FETCH_BLOCK] = { 0 };
+    int looping = 0;
+
+    looping = (c->format == SPU_FMT_PCM16_LOOP) || (c->format == SPU_FMT_PCM8_LOOP);
+    for (cc = 0; cc < len; cc++) {
+        // whole block stays inside the sample, so neither the loop nor the end can be hit
+        while (interp && ((cc + SPU_FETCH_BLOCK) <= len) &&
+            (((pos + (uint64_t)c->frequency_step * (SPU_FETCH_BLOCK - 1)) >> 32) + 1) < c->sample_length)
+        {
+            for (k = 0; k < SPU_FETCH_BLOCK; k++) {
+                idx = (uint32_t)(pos >> 32);
+                v0[k] = read_spu_sample(c, idx);
+                v1[k] = read_spu_sample(c, idx + 1);
+                frac[k] = (int16_t)((uint32_t)pos >> 17);
+                pos += c->frequency_step;
+            }
+            lerp_spu_block(buf + cc, v0, v1, frac, SPU_FETCH_BLOCK);
+            cc += SPU_FETCH_BLOCK;
+        }
+        if (cc >= len) {
+            break;
+        }
+
+        idx = (uint32_t)(pos >> 32);
+        s0 = read_spu_sample(c, idx);
+        if (interp) {
+            s1 = s0;
+            next = idx + 1;
+            if (next < c->sample_length) {
+                s1 = read_spu_sample(c, next);
+            }
+            else if ((c->format != SPU_FMT_ADPCM) && (looping || (*io & SPU_IO_REPEAT))) {
+                s1 = read_spu_sample(c, next - c->loop_wrap);
+            }
+            s0 += (((int32_t)s1 - s0) * (int32_t)((uint32_t)pos >> 17)) >> 15;
+        }
+        buf[cc] = s0;
+
+        pos += c->frequency_step;
+        if ((uint32_t)(pos >> 32) < c->sample_length) {
+            continue;
+        }
+
+        if (!looping && !(*io & SPU_IO_REPEAT)) {
+            *io &= ~SPU_IO_START;
+            c->active = 0;
+            cc += 1;
+            break;
+        }
+
+        if (c->format == SPU_FMT_ADPCM) {
+            if (!c->adpcm_looped) {
+                c->sample_length += c->loop_wrap;
+                c->adpcm_loop_sample = c->adpcm_sample;
+                c->adpcm_loop_index = c->adpcm_current_index;
+                c->adpcm_looped = 1;
+                continue;
+            }
+            c->adpcm_cache_block_offset -= c->loop_wrap;
+            c->adpcm_sample = c->adpcm_loop_sample;
+            c->adpcm_current_index = c->adpcm_loop_index;
+        }
+        pos -= (uint64_t)c->loop_wrap << 32;
+    }
+    c->sample_offset = pos;
+
+    return cc;
+}
+
+#if defined(UT)
+TEST(alsa, fetch_spu_samples)
+{
+    int cc = 0;
+    int16_t buf[8] = { 0 };
+    int16_t buf16[20] = { 0 };
+    int16_t pcm16x[32] = { 0 };
+    uint32_t io = SPU_IO_START;
+    int16_t pcm16[] = { 100, 200, 300, 400 };
+    spu_channel_struct c = { 0 };
+
+    c.format = SPU_FMT_PCM16;
+    c.samples = (uint8_t *)pcm16;
+    c.io_region = (uint8_t *)&io;
+    c.sample_length = 4;
+    c.loop_wrap = 2;
+    c.frequency_step = 1ULL << 32;
+    c.active = 1;
+    TEST_ASSERT_EQUAL_INT(4, fetch_spu_samples(&c, buf, 8, 0));
+    TEST_ASSERT_EQUAL_INT(400, buf[3]);
+    TEST_ASSERT_EQUAL_INT(0, c.active);
+    TEST_ASSERT_EQUAL_INT(0, io & SPU_IO_START);
+
+    io = SPU_IO_START | SPU_IO_REPEAT;
+    c.active = 1;
+    c.sample_offset = 0;
+    TEST_ASSERT_EQUAL_INT(8, fetch_spu_samples(&c, buf, 8, 0));
+    TEST_ASSERT_EQUAL_INT(300, buf[4]);
+    TEST_ASSERT_EQUAL_INT(400, buf[7]);
+    TEST_ASSERT_EQUAL_INT(1, c.active);
+
+    c.sample_offset = 1ULL << 31;
+    c.frequency_step = 1ULL << 32;
+    TEST_ASSERT_EQUAL_INT(4, fetch_spu_samples(&c, buf, 4, 1));
+    TEST_ASSERT_EQUAL_INT(150, buf[0]);
+    TEST_ASSERT_EQUAL_INT(350, buf[2]);
+    TEST_ASSERT_EQUAL_INT(350, buf[3]);
+
+    memset(pcm16x, 0, sizeof(pcm16x));
+    for (cc = 0; cc < 32; cc++) {
+        pcm16x[cc] = cc * 100;
+    }
+    io = SPU_IO_START;
+    c.samples = (uint8_t *)pcm16x;
+    c.sample_length = 32;
+    c.sample_offset = 1ULL << 30;
+    c.frequency_step = 3ULL << 31;
+    TEST_ASSERT_EQUAL_INT(20, fetch_spu_samples(&c, buf16, 20, 1));
+    for (cc = 0; cc < 20; cc++) {
+        TEST_ASSERT_EQUAL_INT(cc * 150 + 25, buf16[cc]);
+    }
+}
+#endif
+
+static void mix_spu_block(int32_t *out, const int16_t *buf, uint32_t len, int16_t vol_l, int16_t vol_r)
+{
+    uint32_t cc = 0;
+
+#if defined(__ARM_NEON)
+    for (; (cc + 8) <= len; cc += 8) {
+        int16x8_t s = vld1q_s16(buf + cc);
+        int32x4x2_t o0 = vld2q_s32(out + (cc << 1));
+        int32x4x2_t o1 = vld2q_s32(out + (cc << 1) + 8);
+
+        o0.val[0] = vmlal_n_s16(o0.val[0], vget_low_s16(s), vol_l);
+        o0.val[1] = vmlal_n_s16(o0.val[1], vget_low_s16(s), vol_r);
+        o1.val[0] = vmlal_n_s16(o1.val[0], vget_high_s16(s), vol_l);
+        o1.val[1] = vmlal_n_s16(o1.val[1], vget_high_s16(s), vol_r);
+        vst2q_s32(out + (cc << 1), o0);
+        vst2q_s32(out + (cc << 1) + 8, o1);
+    }
+#endif
+
+    for (; cc < len; cc++) {
+        out[(cc << 1) + 0] += (int32_t)buf[cc] * vol_l;
+        out[(cc << 1) + 1] += (int32_t)buf[cc] * vol_r;
+    }
+}
+
+#if defined(UT)
+TEST(alsa, mix_spu_block)
+{
+    int cc = 0;
+    int16_t buf[11] = { 0 };
+    int32_t out[22] = { 0 };
+
+    for (cc = 0; cc < 11; cc++) {
+        buf[cc] = cc - 5;
+        out[(cc << 1) + 0] = 1;
+    }
+    mix_spu_block(out, buf, 11, 3, -2);
+    for (cc = 0; cc < 11; cc++) {
+        TEST_ASSERT_EQUAL_INT(1 + (cc - 5) * 3, out[(cc << 1) + 0]);
+        TEST_ASSERT_EQUAL_INT((cc - 5) * -2, out[(cc << 1) + 1]);
+    }
+}
+#endif
+
+static void prehook_spu_render_samples(spu_struct *spu, int32_t *out, uint32_t samples)
+{
+    int ch = 0;
+    int interp = 0;
+    uint32_t cc = 0;
+    uint32_t len = 0;
+    uint32_t cnt = 0;
+    uint32_t mask = 0;
+    spu_channel_struct *c = NULL;
+    int16_t buf[SPU_BLOCK_SIZE] = { 0 };
+    nds_spu_update_channel_settings pfn = (nds_spu_update_channel_settings)myhook.fun.spu_update_channel_settings;
+
+    trace("call %s(spu=%p, out=%p, samples=%d)\n", __func__, spu, out, samples);
+
+    if (!spu || !out) {
+        error("invalid input\n");
+        return;
+    }
+
+    for (ch = 0; ch < MAX_SPU_CHANNEL; ch++) {
+        if (spu->channels[ch].active) {
+            mask |= (1 << ch);
+        }
+    }
+
+    interp = (myconfig.snd.mixer == MIXER_INTERP);
+    while (mask) {
+        ch = __builtin_ctz(mask);
+        mask &= (mask - 1);
+        c = &spu->channels[ch];
+
+        if (c->dirty_bits & 3) {
+            pfn(spu, c);
+        }
+
+        for (cc = 0; cc < samples; cc += len) {
+            len = samples - cc;
+            if (len > SPU_BLOCK_SIZE) {
+                len = SPU_BLOCK_SIZE;
+            }
+
+            cnt = fetch_spu_samples(c, buf, len, interp);
+            mix_spu_block(out + (cc << 1), buf, cnt, c->volume_multiplier_left, c->volume_multiplier_right);
+            if (cnt < len) {
+                break;
+            }
+        }
+    }
+}
+
+#if defined(UT)
+TEST(alsa, prehook_spu_render_samples)
+{
+    int cc = 0;
+    uint32_t io = SPU_IO_START | SPU_IO_REPEAT;
+    int16_t pcm16[100] = { 0 };
+    int32_t out[200] = { 0 };
+    spu_struct spu = { 0 };
+
+    for (cc = 0; cc < 100; cc++) {
+        pcm16[cc] = cc;
+    }
+
+    spu.channels[3].format = SPU_FMT_PCM16;
+    spu.channels[3].samples = (uint8_t *)pcm16;
+    spu.channels[3].io_region = (uint8_t *)&io;
+    spu.channels[3].sample_length = 100;
+    spu.channels[3].loop_wrap = 100;
+    spu.channels[3].frequency_step = 1ULL << 32;
+    spu.channels[3].volume_multiplier_left = 2;
+    spu.channels[3].volume_multiplier_right = 1;
+    spu.channels[3].active = 1;
+
+    myconfig.snd.mixer = MIXER_EXACT;
+    prehook_spu_render_samples(NULL, out, 0);
+    prehook_spu_render_samples(&spu, out, 100);
+    for (cc = 0; cc < 100; cc++) {
+        TEST_ASSERT_EQUAL_INT(cc * 2, out[(cc << 1) + 0]);
+        TEST_ASSERT_EQUAL_INT(cc * 1, out[(cc << 1) + 1]);
+    }
+    TEST_ASSERT_EQUAL_INT(0, spu.channels[3].sample_offset >> 32);
+}
+#endif
+
 #if defined(FXTEC_QX1000) || defined(MOTO_XT897) || defined(UT)
 static void pulse_context_state(pa_context *context, void *userdata)
 {
@@ -353,6 +743,41 @@ TEST(alsa, pulse_stream_request)
     TEST_PASS();
 }
 #endif
+
+static void pulse_stream_read(pa_stream *stream, size_t length, void *userdata)
+{
+    const void *data = NULL;
+
+    trace("call %s(stream=%p, length=%ld)\n", __func__, stream, length);
+
+    if (!stream) {
+        return;
+    }
+
+    while (pa_stream_readable_size(stream) > 0) {
+        if (pa_stream_peek(stream, &data, &length) < 0) {
+            error("failed to read record stream\n");
+            break;
+        }
+
+        if (length == 0) {
+            break;
+        }
+
+        if (data && myhook.use_mic) {
+            write_mic_samples((const int16_t *)data, length / sizeof(int16_t));
+        }
+        pa_stream_drop(stream);
+    }
+}
+
+#if defined(UT)
+TEST(alsa, pulse_stream_read)
+{
+    pulse_stream_read(NULL, 0, NULL);
+    TEST_PASS();
+}
+#endif
 #endif
 
 #if defined(UT) || defined(TRIMUI_SMART) || defined(TRIMUI_BRICK)
@@ -392,6 +817,26 @@ TEST(alsa, open_dsp)
 }
 #endif
 
+static int stats_bin(uint32_t v)
+{
+    int r = 0;
+
+    if (v) {
+        r = 32 - __builtin_clz(v);
+    }
+    return (r < STATS_BINS) ? r : (STATS_BINS - 1);
+}
+
+#if defined(UT)
+TEST(alsa, stats_bin)
+{
+    TEST_ASSERT_EQUAL_INT(0, stats_bin(0));
+    TEST_ASSERT_EQUAL_INT(1, stats_bin(1));
+    TEST_ASSERT_EQUAL_INT(11, stats_bin(1470));
+    TEST_ASSERT_EQUAL_INT(STATS_BINS - 1, stats_bin(0xffffffff));
+}
+#endif
+
 static int init_queue(queue_t *q, size_t s)
 {
     trace("call %s(q=%p, s=%ld)\n", __func__, q, s);
@@ -550,6 +995,10 @@ static int put_queue(queue_t *q, uint8_t *buf, size_t size)
     pthread_mutex_lock(&q->lock);
     avai = get_available_wsize(q);
     if (size > avai) {
+        if (__atomic_load_n(&mystats.enable, __ATOMIC_RELAXED)) {
+            __atomic_fetch_add(&mystats.overruns, 1, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&mystats.dropped, size - avai, __ATOMIC_RELAXED);
+        }
         size = avai;
     }
     r = size;
@@ -568,6 +1017,14 @@ static int put_queue(queue_t *q, uint8_t *buf, size_t size)
             q->wsize += size;
         }
     }
+
+    if (__atomic_load_n(&mystats.enable, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(
+            &mystats.fill_hist[((uint64_t)get_available_rsize(q) * STATS_BINS) / (q->size + 1)],
+            1,
+            __ATOMIC_RELAXED
+        );
+    }
     pthread_mutex_unlock(&q->lock);
 
     return r;
@@ -589,6 +1046,14 @@ TEST(alsa, put_queue)
     TEST_ASSERT_EQUAL_INT(sizeof(buf), put_queue(&t, buf, sizeof(buf)));
     TEST_ASSERT_EQUAL_INT(sizeof(buf), put_queue(&t, buf, sizeof(buf)));
 
+    memset(&mystats, 0, sizeof(mystats));
+    mystats.enable = 1;
+    while (put_queue(&t, buf, sizeof(buf)) == sizeof(buf));
+    TEST_ASSERT_EQUAL_INT(1, mystats.overruns);
+    TEST_ASSERT_TRUE(mystats.dropped > 0);
+    TEST_ASSERT_TRUE(mystats.fill_hist[STATS_BINS - 1] > 0);
+    memset(&mystats, 0, sizeof(mystats));
+
     TEST_ASSERT_EQUAL_INT(0, quit_queue(&t));
     TEST_ASSERT_NULL(t.buf);
 }
@@ -669,21 +1134,30 @@ static void* audio_handler(void *id)
     int r = 0;
     int idx = 0;
     int len = mypcm.len;
+    uint64_t t0 = 0;
 
     trace("call %s()++\n", __func__);
 
+    init_crash_stack();
 #if defined(UT)
     mypcm.ready = 0;
 #endif
 
     while (mypcm.ready) {
         r = get_queue(&queue, &mypcm.buf[idx], len);
+        if ((r <= 0) && mystats.flowing && __atomic_load_n(&mystats.enable, __ATOMIC_RELAXED)) {
+            mystats.flowing = 0;
+            __atomic_fetch_add(&mystats.underruns, 1, __ATOMIC_RELAXED);
+        }
+
         if (r > 0) {
             idx+= r;
             len-= r;
+            mystats.flowing = 1;
             if (len == 0) {
                 idx = 0;
                 len = mypcm.len;
+                t0 = __atomic_load_n(&mystats.enable, __ATOMIC_RELAXED) ? get_tick_count_us() : 0;
 #if defined(MIYOO_MINI) || defined(UT)
                 frame.eBitwidth = myao.gattr.eBitwidth;
                 frame.eSoundmode = myao.gattr.eSoundmode;
@@ -704,6 +1178,10 @@ static void* audio_handler(void *id)
                     pa_threaded_mainloop_unlock(mypulse.mainloop);
                 }
 #endif
+
+                if (t0) {
+                    __atomic_fetch_add(&mystats.write_hist[stats_bin(get_tick_count_us() - t0)], 1, __ATOMIC_RELAXED);
+                }
             }
         }
 
@@ -897,7 +1375,11 @@ int snd_pcm_hw_params_set_rate_near(
 {
     trace("call %s(pcm=%p, params=%p, val=%p, dir=%p)\n", __func__, pcm, params, val, dir);
 
-    *val = SND_FREQ;
+    if (init_resampler(myconfig.snd.resampler, SPU_FREQ, SND_FREQ) < 0) {
+        error("failed to initialize resampler, fall back to %d\n", SND_FREQ);
+    }
+
+    *val = myresample.taps ? SPU_FREQ : SND_FREQ;
     return 0;
 }
 
@@ -906,8 +1388,19 @@ TEST(alsa, snd_pcm_hw_params_set_rate_near)
 {
     unsigned int v = 0;
 
+    myconfig.snd.resampler = RESAMPLER_NONE;
     TEST_ASSERT_EQUAL_INT(0, snd_pcm_hw_params_set_rate_near(NULL, NULL, &v, NULL));
     TEST_ASSERT_EQUAL_INT(SND_FREQ, v);
+
+    myconfig.snd.resampler = RESAMPLER_8TAP;
+    TEST_ASSERT_EQUAL_INT(0, snd_pcm_hw_params_set_rate_near(NULL, NULL, &v, NULL));
+    TEST_ASSERT_EQUAL_INT(SPU_FREQ, v);
+
+    myconfig.snd.resampler = RESAMPLER_MAX;
+    TEST_ASSERT_EQUAL_INT(0, snd_pcm_hw_params_set_rate_near(NULL, NULL, &v, NULL));
+    TEST_ASSERT_EQUAL_INT(SND_FREQ, v);
+    TEST_ASSERT_EQUAL_INT(0, myresample.taps);
+    myconfig.snd.resampler = RESAMPLER_NONE;
 }
 #endif
 
@@ -982,8 +1475,647 @@ TEST(alsa, snd_pcm_recover)
 }
 #endif
 
+static int init_resampler(resampler_type_t type, uint32_t in_rate, uint32_t out_rate)
+{
+    int k = 0;
+    int ph = 0;
+    int sum = 0;
+    int taps = 0;
+    double h = 0;
+    double x = 0;
+    double t = 0;
+    double fc = 0;
+    double half = 0;
+
+    trace("call %s(type=%d, in_rate=%d, out_rate=%d)\n", __func__, type, in_rate, out_rate);
+
+    memset(&myresample, 0, sizeof(myresample));
+    if (!in_rate || !out_rate) {
+        error("invalid rate\n");
+        return -1;
+    }
+
+    switch (type) {
+    case RESAMPLER_NONE:
+        return 0;
+    case RESAMPLER_LINEAR:
+        taps = 2;
+        break;
+    case RESAMPLER_8TAP:
+        taps = 8;
+        break;
+    case RESAMPLER_16TAP:
+        taps = 16;
+        break;
+    default:
+        error("invalid resampler type\n");
+        return -1;
+    }
+
+    half = taps >> 1;
+    fc = (out_rate < in_rate) ? ((double)out_rate / in_rate) : 1.0;
+    fc *= 0.9;
+    for (ph = 0; ph < RESAMPLE_PHASES; ph++) {
+        sum = 0;
+        for (k = 0; k < taps; k++) {
+            x = (k - (half - 1)) - ((double)ph / RESAMPLE_PHASES);
+            if (taps == 2) {
+                h = 1.0 - fabs(x);
+            }
+            else {
+                t = x / half;
+                h = fc * ((x == 0) ? 1.0 : (sin(M_PI * fc * x) / (M_PI * fc * x)));
+                h *= 0.42 + 0.5 * cos(M_PI * t) + 0.08 * cos(2 * M_PI * t);
+            }
+            myresample.coef[ph][k] = (int16_t)lround(h * (1 << RESAMPLE_SHIFT));
+            sum += myresample.coef[ph][k];
+        }
+        k = (half - 1) + (ph >= (RESAMPLE_PHASES >> 1));
+        myresample.coef[ph][k] += (1 << RESAMPLE_SHIFT) - sum;
+    }
+
+    myresample.taps = taps;
+    myresample.step = ((uint64_t)in_rate << 32) / out_rate;
+    return 0;
+}
+
+#if defined(UT)
+TEST(alsa, init_resampler)
+{
+    int k = 0;
+    int ph = 0;
+    int sum = 0;
+
+    TEST_ASSERT_EQUAL_INT(-1, init_resampler(RESAMPLER_LINEAR, 0, SND_FREQ));
+    TEST_ASSERT_EQUAL_INT(-1, init_resampler(RESAMPLER_MAX, SPU_FREQ, SND_FREQ));
+    TEST_ASSERT_EQUAL_INT(0, init_resampler(RESAMPLER_NONE, SPU_FREQ, SND_FREQ));
+    TEST_ASSERT_EQUAL_INT(0, myresample.taps);
+
+    TEST_ASSERT_EQUAL_INT(0, init_resampler(RESAMPLER_LINEAR, SPU_FREQ, SND_FREQ));
+    TEST_ASSERT_EQUAL_INT(2, myresample.taps);
+    TEST_ASSERT_EQUAL_INT(1 << RESAMPLE_SHIFT, myresample.coef[0][0]);
+    TEST_ASSERT_EQUAL_INT(0, myresample.coef[0][1]);
+
+    TEST_ASSERT_EQUAL_INT(0, init_resampler(RESAMPLER_16TAP, SPU_FREQ, SND_FREQ));
+    TEST_ASSERT_EQUAL_INT(16, myresample.taps);
+    for (ph = 0; ph < RESAMPLE_PHASES; ph++) {
+        sum = 0;
+        for (k = 0; k < myresample.taps; k++) {
+            sum += myresample.coef[ph][k];
+        }
+        TEST_ASSERT_EQUAL_INT(1 << RESAMPLE_SHIFT, sum);
+    }
+}
+#endif
+
+static void filter_frame(const int16_t *s, const int16_t *c, int taps, int16_t *out)
+{
+    int k = 0;
+    int32_t l = 0;
+    int32_t r = 0;
+
+#if defined(__ARM_NEON)
+    if ((taps & 7) == 0) {
+        int32x2_t sl;
+        int32x2_t sr;
+        int16x4_t lr;
+        int32x4_t al = vdupq_n_s32(0);
+        int32x4_t ar = vdupq_n_s32(0);
+
+        for (k = 0; k < taps; k += 8) {
+            int16x8x2_t v = vld2q_s16(s + (k << 1));
+            int16x8_t cv = vld1q_s16(c + k);
+
+            al = vmlal_s16(al, vget_low_s16(v.val[0]), vget_low_s16(cv));
+            al = vmlal_s16(al, vget_high_s16(v.val[0]), vget_high_s16(cv));
+            ar = vmlal_s16(ar, vget_low_s16(v.val[1]), vget_low_s16(cv));
+            ar = vmlal_s16(ar, vget_high_s16(v.val[1]), vget_high_s16(cv));
+        }
+        sl = vpadd_s32(vget_low_s32(al), vget_high_s32(al));
+        sr = vpadd_s32(vget_low_s32(ar), vget_high_s32(ar));
+        sl = vpadd_s32(sl, sr);
+        lr = vqrshrn_n_s32(vcombine_s32(sl, sl), RESAMPLE_SHIFT);
+        out[0] = vget_lane_s16(lr, 0);
+        out[1] = vget_lane_s16(lr, 1);
+        return;
+    }
+#endif
+
+    for (k = 0; k < taps; k++) {
+        l += (int32_t)s[(k << 1) + 0] * c[k];
+        r += (int32_t)s[(k << 1) + 1] * c[k];
+    }
+    l = (l + (1 << (RESAMPLE_SHIFT - 1))) >> RESAMPLE_SHIFT;
+    r = (r + (1 << (RESAMPLE_SHIFT - 1))) >> RESAMPLE_SHIFT;
+    out[0] = (l > 32767) ? 32767 : ((l < -32768) ? -32768 : l);
+    out[1] = (r > 32767) ? 32767 : ((r < -32768) ? -32768 : r);
+}
+
+#if defined(UT)
+TEST(alsa, filter_frame)
+{
+    int16_t out[2] = { 0 };
+    int16_t c[8] = { 0, 0, 0, 8192, 8192, 0, 0, 0 };
+    int16_t s[16] = { 0, 0, 0, 0, 0, 0, 100, -100, 300, 32767, 0, 0, 0, 0, 0, 0 };
+
+    filter_frame(s, c, 8, out);
+    TEST_ASSERT_EQUAL_INT(200, out[0]);
+    TEST_ASSERT_EQUAL_INT(16334, out[1]);
+}
+#endif
+
+static int resample_audio(const int16_t *in, uint32_t cnt, int16_t *out)
+{
+    int r = 0;
+    uint32_t idx = 0;
+    const int16_t *c = NULL;
+
+    trace("call %s(in=%p, cnt=%d, out=%p)\n", __func__, in, cnt, out);
+
+    if (!in || !out || (cnt > RESAMPLE_CHUNK) || !myresample.taps) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    memcpy(&myresample.hist[myresample.frames * SND_CHANNELS], in, cnt * SND_CHANNELS * sizeof(int16_t));
+    myresample.frames += cnt;
+
+    while (1) {
+        idx = (uint32_t)(myresample.pos >> 32);
+        if ((idx + myresample.taps) > myresample.frames) {
+            break;
+        }
+
+        c = myresample.coef[(uint32_t)myresample.pos >> (32 - RESAMPLE_PHASE_BITS)];
+        filter_frame(&myresample.hist[idx * SND_CHANNELS], c, myresample.taps, &out[r * SND_CHANNELS]);
+        myresample.pos += myresample.step;
+        r += 1;
+    }
+
+    memmove(
+        myresample.hist,
+        &myresample.hist[idx * SND_CHANNELS],
+        (myresample.frames - idx) * SND_CHANNELS * sizeof(int16_t)
+    );
+    myresample.frames -= idx;
+    myresample.pos -= (uint64_t)idx << 32;
+
+    return r;
+}
+
+#if defined(UT)
+TEST(alsa, resample_audio)
+{
+    int cc = 0;
+    int r0 = 0;
+    int r1 = 0;
+    static int16_t in[RESAMPLE_CHUNK * SND_CHANNELS] = { 0 };
+    static int16_t out[RESAMPLE_CHUNK * 2 * SND_CHANNELS] = { 0 };
+
+    for (cc = 0; cc < (RESAMPLE_CHUNK * SND_CHANNELS); cc++) {
+        in[cc] = (cc & 1) ? -1000 : 1000;
+    }
+
+    TEST_ASSERT_EQUAL_INT(0, init_resampler(RESAMPLER_NONE, SPU_FREQ, SND_FREQ));
+    TEST_ASSERT_EQUAL_INT(-1, resample_audio(in, RESAMPLE_CHUNK, out));
+
+    TEST_ASSERT_EQUAL_INT(0, init_resampler(RESAMPLER_8TAP, SPU_FREQ, SND_FREQ));
+    TEST_ASSERT_EQUAL_INT(-1, resample_audio(in, RESAMPLE_CHUNK + 1, out));
+    r0 = resample_audio(in, RESAMPLE_CHUNK, out);
+    TEST_ASSERT_TRUE(myresample.frames < myresample.taps);
+    for (cc = 0; cc < r0; cc++) {
+        TEST_ASSERT_EQUAL_INT(1000, out[(cc << 1) + 0]);
+        TEST_ASSERT_EQUAL_INT(-1000, out[(cc << 1) + 1]);
+    }
+    r1 = resample_audio(in, RESAMPLE_CHUNK, out);
+    TEST_ASSERT_INT_WITHIN(myresample.taps * 2, (RESAMPLE_CHUNK * 2 * SND_FREQ) / SPU_FREQ, r0 + r1);
+}
+#endif
+
+static int64_t correlate_audio(const int16_t *a, const int16_t *b, int cnt)
+{
+    int cc = 0;
+    int64_t r = 0;
+
+#if defined(__ARM_NEON)
+    int64x2_t acc = vdupq_n_s64(0);
+
+    for (; (cc + 4) <= cnt; cc += 4) {
+        int16x8_t va = vld1q_s16(a + (cc << 1));
+        int16x8_t vb = vld1q_s16(b + (cc << 1));
+
+        acc = vpadalq_s32(acc, vmull_s16(vget_low_s16(va), vget_low_s16(vb)));
+        acc = vpadalq_s32(acc, vmull_s16(vget_high_s16(va), vget_high_s16(vb)));
+    }
+    r = vgetq_lane_s64(acc, 0) + vgetq_lane_s64(acc, 1);
+#endif
+
+    for (; cc < cnt; cc++) {
+        r += (int32_t)a[(cc << 1) + 0] * b[(cc << 1) + 0];
+        r += (int32_t)a[(cc << 1) + 1] * b[(cc << 1) + 1];
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(alsa, correlate_audio)
+{
+    int cc = 0;
+    int16_t a[18] = { 0 };
+    int16_t b[18] = { 0 };
+
+    for (cc = 0; cc < 18; cc++) {
+        a[cc] = 32767;
+        b[cc] = (cc & 1) ? -32768 : 32767;
+    }
+    TEST_ASSERT_TRUE(correlate_audio(a, a, 9) == (int64_t)18 * 32767 * 32767);
+    TEST_ASSERT_TRUE(correlate_audio(a, b, 9) == (int64_t)9 * 32767 * 32767 - (int64_t)9 * 32767 * 32768);
+}
+#endif
+
+static void crossfade_audio(int16_t *out, const int16_t *a, const int16_t *b, int cnt)
+{
+    int cc = 0;
+    int32_t w = 0;
+
+    for (cc = 0; cc < cnt; cc++) {
+        w = (cc << 15) / cnt;
+        out[(cc << 1) + 0] = (int16_t)((a[(cc << 1) + 0] * (32768 - w) + b[(cc << 1) + 0] * w) >> 15);
+        out[(cc << 1) + 1] = (int16_t)((a[(cc << 1) + 1] * (32768 - w) + b[(cc << 1) + 1] * w) >> 15);
+    }
+}
+
+#if defined(UT)
+TEST(alsa, crossfade_audio)
+{
+    int16_t a[4] = { 1000, 1000, 1000, 1000 };
+    int16_t b[4] = { -1000, 3000, -1000, 3000 };
+    int16_t out[4] = { 0 };
+
+    crossfade_audio(out, a, b, 2);
+    TEST_ASSERT_EQUAL_INT(1000, out[0]);
+    TEST_ASSERT_EQUAL_INT(1000, out[1]);
+    TEST_ASSERT_EQUAL_INT(0, out[2]);
+    TEST_ASSERT_EQUAL_INT(2000, out[3]);
+}
+#endif
+
+static int seek_audio(const int16_t *in, const int16_t *ref)
+{
+    int cc = 0;
+    int best = 0;
+    int64_t e = 0;
+    int64_t c = 0;
+    double v = 0;
+    double max = -1e30;
+
+    for (cc = 0; cc < STRETCH_SEEK; cc += 2) {
+        c = correlate_audio(&in[cc * SND_CHANNELS], ref, STRETCH_OVERLAP);
+        e = correlate_audio(&in[cc * SND_CHANNELS], &in[cc * SND_CHANNELS], STRETCH_OVERLAP);
+        v = (double)c / sqrt((double)e + 1.0);
+        if (v > max) {
+            max = v;
+            best = cc;
+        }
+    }
+
+    return best;
+}
+
+#if defined(UT)
+TEST(alsa, seek_audio)
+{
+    int cc = 0;
+    static int16_t in[(STRETCH_SEEK + STRETCH_OVERLAP) * SND_CHANNELS] = { 0 };
+
+    for (cc = 0; cc < (STRETCH_SEEK + STRETCH_OVERLAP); cc++) {
+        in[(cc * SND_CHANNELS) + 0] = (int16_t)(10000 * sin(2 * M_PI * cc / 100.0));
+        in[(cc * SND_CHANNELS) + 1] = in[(cc * SND_CHANNELS) + 0];
+    }
+    TEST_ASSERT_EQUAL_INT(0, seek_audio(in, &in[100 * SND_CHANNELS]) % 100);
+}
+#endif
+
+static int stretch_audio(const int16_t *in, uint32_t cnt, int16_t *out, uint32_t ratio)
+{
+    int r = 0;
+    int len = 0;
+    int best = 0;
+    uint32_t acc = 0;
+    int16_t *buf = mystretch.buf;
+
+    trace("call %s(in=%p, cnt=%d, out=%p, ratio=0x%x)\n", __func__, in, cnt, out, ratio);
+
+    if (!in || !out || (cnt > STRETCH_CHUNK)) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    if (ratio <= (1 << 16)) {
+        if (!mystretch.active) {
+            memcpy(out, in, cnt * SND_CHANNELS * sizeof(int16_t));
+            return cnt;
+        }
+
+        memcpy(&buf[mystretch.frames * SND_CHANNELS], in, cnt * SND_CHANNELS * sizeof(int16_t));
+        mystretch.frames += cnt;
+
+        len = (mystretch.frames < STRETCH_OVERLAP) ? mystretch.frames : STRETCH_OVERLAP;
+        if (mystretch.primed) {
+            crossfade_audio(out, mystretch.mid, buf, len);
+        }
+        else {
+            memcpy(out, buf, len * SND_CHANNELS * sizeof(int16_t));
+        }
+        memcpy(
+            &out[len * SND_CHANNELS],
+            &buf[len * SND_CHANNELS],
+            (mystretch.frames - len) * SND_CHANNELS * sizeof(int16_t)
+        );
+        r = mystretch.frames;
+
+        mystretch.active = 0;
+        mystretch.primed = 0;
+        mystretch.frames = 0;
+        mystretch.skip = 0;
+        mystretch.frac = 0;
+        return r;
+    }
+
+    if (ratio > STRETCH_MAX_RATIO) {
+        ratio = STRETCH_MAX_RATIO;
+    }
+
+    if (!mystretch.active) {
+        mystretch.active = 1;
+        mystretch.primed = 0;
+        mystretch.frames = 0;
+        mystretch.skip = 0;
+        mystretch.frac = 0;
+    }
+
+    memcpy(&buf[mystretch.frames * SND_CHANNELS], in, cnt * SND_CHANNELS * sizeof(int16_t));
+    mystretch.frames += cnt;
+
+    while (1) {
+        if (mystretch.skip) {
+            len = (mystretch.skip < mystretch.frames) ? mystretch.skip : mystretch.frames;
+            memmove(buf, &buf[len * SND_CHANNELS], (mystretch.frames - len) * SND_CHANNELS * sizeof(int16_t));
+            mystretch.frames -= len;
+            mystretch.skip -= len;
+            if (mystretch.skip) {
+                break;
+            }
+        }
+
+        if (!mystretch.primed) {
+            if (mystretch.frames < STRETCH_OVERLAP) {
+                break;
+            }
+            memcpy(mystretch.mid, buf, sizeof(mystretch.mid));
+            mystretch.primed = 1;
+            mystretch.skip = STRETCH_OVERLAP;
+            continue;
+        }
+
+        if (mystretch.frames < (STRETCH_SEEK + STRETCH_SEQ)) {
+            break;
+        }
+
+        best = seek_audio(buf, mystretch.mid);
+        crossfade_audio(&out[r * SND_CHANNELS], mystretch.mid, &buf[best * SND_CHANNELS], STRETCH_OVERLAP);
+        r += STRETCH_OVERLAP;
+
+        len = STRETCH_SEQ - (STRETCH_OVERLAP << 1);
+        memcpy(
+            &out[r * SND_CHANNELS],
+            &buf[(best + STRETCH_OVERLAP) * SND_CHANNELS],
+            len * SND_CHANNELS * sizeof(int16_t)
+        );
+        r += len;
+
+        memcpy(
+            mystretch.mid,
+            &buf[(best + STRETCH_SEQ - STRETCH_OVERLAP) * SND_CHANNELS],
+            sizeof(mystretch.mid)
+        );
+
+        acc = mystretch.frac + ((STRETCH_SEQ - STRETCH_OVERLAP) * ratio);
+        mystretch.skip = acc >> 16;
+        mystretch.frac = acc & 0xffff;
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(alsa, stretch_audio)
+{
+    int cc = 0;
+    int total = 0;
+    static int16_t in[STRETCH_CHUNK * SND_CHANNELS] = { 0 };
+    static int16_t out[STRETCH_SEQ * 3 * SND_CHANNELS] = { 0 };
+
+    for (cc = 0; cc < (STRETCH_CHUNK * SND_CHANNELS); cc++) {
+        in[cc] = 1000;
+    }
+
+    memset(&mystretch, 0, sizeof(mystretch));
+    TEST_ASSERT_EQUAL_INT(-1, stretch_audio(NULL, 0, out, 1 << 16));
+    TEST_ASSERT_EQUAL_INT(STRETCH_CHUNK, stretch_audio(in, STRETCH_CHUNK, out, 1 << 16));
+    TEST_ASSERT_EQUAL_INT(0, mystretch.active);
+
+    for (cc = 0; cc < 32; cc++) {
+        total += stretch_audio(in, STRETCH_CHUNK, out, 4 << 16);
+        TEST_ASSERT_EQUAL_INT(1000, out[0]);
+    }
+    TEST_ASSERT_EQUAL_INT(1, mystretch.active);
+    TEST_ASSERT_INT_WITHIN(STRETCH_SEQ * 2, (32 * STRETCH_CHUNK) / 4, total);
+
+    total = stretch_audio(in, STRETCH_CHUNK, out, 1 << 16);
+    TEST_ASSERT_TRUE(total >= STRETCH_CHUNK);
+    TEST_ASSERT_EQUAL_INT(1000, out[0]);
+    TEST_ASSERT_EQUAL_INT(1000, out[(total * SND_CHANNELS) - 1]);
+    TEST_ASSERT_EQUAL_INT(0, mystretch.active);
+}
+#endif
+
+static uint32_t update_stretch_ratio(uint32_t frames, uint32_t rate)
+{
+    uint64_t now = get_tick_count_us();
+    uint64_t dt = now - mystretch.last_us;
+    uint32_t r = 1 << 16;
+
+    if (mystretch.last_us && dt && (dt < 1000000)) {
+        mystretch.rate += ((int64_t)((frames * 1000000ULL) / dt) - mystretch.rate) / 8;
+    }
+    mystretch.last_us = now;
+
+    if (myhook.use_fast && rate && (mystretch.rate > rate)) {
+        r = (uint32_t)(((uint64_t)mystretch.rate << 16) / rate);
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(alsa, update_stretch_ratio)
+{
+    mystretch.last_us = 0;
+    mystretch.rate = SND_FREQ * 3;
+    myhook.use_fast = 0;
+    TEST_ASSERT_EQUAL_INT(1 << 16, update_stretch_ratio(0, SND_FREQ));
+
+    mystretch.last_us = 0;
+    mystretch.rate = SND_FREQ * 3;
+    myhook.use_fast = 1;
+    TEST_ASSERT_EQUAL_INT(3 << 16, update_stretch_ratio(0, SND_FREQ));
+
+    mystretch.last_us = get_tick_count_us() - 100000;
+    mystretch.rate = SND_FREQ * 3;
+    TEST_ASSERT_EQUAL_INT(
+        (uint32_t)((((uint64_t)SND_FREQ * 3 - (SND_FREQ * 3) / 8) << 16) / SND_FREQ),
+        update_stretch_ratio(0, SND_FREQ)
+    );
+    myhook.use_fast = 0;
+    mystretch.last_us = 0;
+    mystretch.rate = 0;
+}
+#endif
+
+static int push_audio(int16_t *buf, uint32_t frames)
+{
+    int r = 0;
+    uint32_t cc = 0;
+    uint32_t len = 0;
+
+    if (!buf) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    if (!myresample.taps) {
+        return put_queue(&queue, (uint8_t *)buf, frames * SND_CHANNELS * sizeof(int16_t));
+    }
+
+    for (cc = 0; cc < frames; cc += len) {
+        len = frames - cc;
+        if (len > RESAMPLE_CHUNK) {
+            len = RESAMPLE_CHUNK;
+        }
+
+        r = resample_audio(&buf[cc * SND_CHANNELS], len, myresample.out);
+        if (r > 0) {
+            put_queue(&queue, (uint8_t *)myresample.out, r * SND_CHANNELS * sizeof(int16_t));
+        }
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(alsa, push_audio)
+{
+    TEST_ASSERT_EQUAL_INT(-1, push_audio(NULL, 0));
+}
+#endif
+
+static int report_audio_stats(void)
+{
+    int cc = 0;
+    int pos = 0;
+    int enable = 0;
+    uint64_t now = 0;
+    char buf[512] = { 0 };
+    uint32_t hist[STATS_BINS] = { 0 };
+#if defined(FXTEC_QX1000) || defined(MOTO_XT897)
+    int neg = 0;
+    pa_usec_t usec = 0;
+#endif
+
+    enable = (myconfig.snd.stats > 0);
+    __atomic_store_n(&mystats.enable, enable, __ATOMIC_RELAXED);
+    if (!enable) {
+        return 0;
+    }
+
+    now = get_tick_count_us();
+    if (!mystats.last_us) {
+        mystats.last_us = now;
+    }
+    if ((now - mystats.last_us) < (myconfig.snd.stats * 1000000ULL)) {
+        return 0;
+    }
+
+#if defined(FXTEC_QX1000) || defined(MOTO_XT897)
+    if (mypulse.mainloop && mypulse.stream) {
+        pa_threaded_mainloop_lock(mypulse.mainloop);
+        if (pa_stream_get_latency(mypulse.stream, &usec, &neg) >= 0) {
+            mystats.latency_us = neg ? -(int64_t)usec : (int64_t)usec;
+        }
+        pa_threaded_mainloop_unlock(mypulse.mainloop);
+    }
+#endif
+
+    // counters are taken and cleared with one exchange each, so nothing counted meanwhile is lost
+    pos += snprintf(&buf[pos], sizeof(buf) - pos, "chunk");
+    for (cc = 0; cc < STATS_BINS; cc++) {
+        hist[cc] = __atomic_exchange_n(&mystats.chunk_hist[cc], 0, __ATOMIC_RELAXED);
+        pos += snprintf(&buf[pos], sizeof(buf) - pos, "%c%d", cc ? ',' : '[', hist[cc]);
+    }
+    pos += snprintf(&buf[pos], sizeof(buf) - pos, "] fill");
+    for (cc = 0; cc < STATS_BINS; cc++) {
+        hist[cc] = __atomic_exchange_n(&mystats.fill_hist[cc], 0, __ATOMIC_RELAXED);
+        pos += snprintf(&buf[pos], sizeof(buf) - pos, "%c%d", cc ? ',' : '[', hist[cc]);
+    }
+    pos += snprintf(&buf[pos], sizeof(buf) - pos, "] write");
+    for (cc = 0; cc < STATS_BINS; cc++) {
+        hist[cc] = __atomic_exchange_n(&mystats.write_hist[cc], 0, __ATOMIC_RELAXED);
+        pos += snprintf(&buf[pos], sizeof(buf) - pos, "%c%d", cc ? ',' : '[', hist[cc]);
+    }
+    snprintf(&buf[pos], sizeof(buf) - pos, "]");
+
+    printf("[STATS] chunks=%d underruns=%d overruns=%d dropped=%lld latency=%lldus %s\n",
+        __atomic_exchange_n(&mystats.chunks, 0, __ATOMIC_RELAXED),
+        __atomic_exchange_n(&mystats.underruns, 0, __ATOMIC_RELAXED),
+        __atomic_exchange_n(&mystats.overruns, 0, __ATOMIC_RELAXED),
+        (long long)__atomic_exchange_n(&mystats.dropped, 0, __ATOMIC_RELAXED),
+        (long long)mystats.latency_us,
+        buf
+    );
+    mystats.last_us = now;
+
+    return 1;
+}
+
+#if defined(UT)
+TEST(alsa, report_audio_stats)
+{
+    myconfig.snd.stats = 0;
+    TEST_ASSERT_EQUAL_INT(0, report_audio_stats());
+    TEST_ASSERT_EQUAL_INT(0, mystats.enable);
+
+    myconfig.snd.stats = 1;
+    mystats.chunks = 10;
+    mystats.last_us = 1;
+    TEST_ASSERT_EQUAL_INT(1, report_audio_stats());
+    TEST_ASSERT_EQUAL_INT(0, mystats.chunks);
+    TEST_ASSERT_EQUAL_INT(0, report_audio_stats());
+
+    myconfig.snd.stats = 0;
+    memset(&mystats, 0, sizeof(mystats));
+}
+#endif
+
 static void prehook_audio_synchronous_update(audio_struct *audio, uint32_t non_blocking, uint32_t audio_capture)
 {
+    int r = 0;
+    uint32_t cc = 0;
+    uint32_t len = 0;
+    uint32_t ratio = 0;
+    uint32_t frames = 0;
+
 #if 0
     int iVar3 = 0;
     int error_value = 0;
@@ -1021,7 +2153,30 @@ static void prehook_audio_synchronous_update(audio_struct *audio, uint32_t non_b
 
 #if USE_CIRCLE_QUEUE
     // audio->buffer_index = 1470
-    put_queue(&queue, (uint8_t *)audio, audio->buffer_index * SND_CHANNELS);
+    frames = audio->buffer_index / SND_CHANNELS;
+    if (__atomic_load_n(&mystats.enable, __ATOMIC_RELAXED)) {
+        __atomic_fetch_add(&mystats.chunks, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&mystats.chunk_hist[stats_bin(frames)], 1, __ATOMIC_RELAXED);
+    }
+    report_audio_stats();
+
+    ratio = update_stretch_ratio(frames, audio->output_frequency);
+    if ((ratio == (1 << 16)) && !mystretch.active) {
+        push_audio(audio->buffer, frames);
+    }
+    else {
+        for (cc = 0; cc < frames; cc += len) {
+            len = frames - cc;
+            if (len > STRETCH_CHUNK) {
+                len = STRETCH_CHUNK;
+            }
+
+            r = stretch_audio(&audio->buffer[cc * SND_CHANNELS], len, mystretch.out, ratio);
+            if (r > 0) {
+                push_audio(mystretch.out, r);
+            }
+        }
+    }
 #else
 
 #if defined(MOTO_XT897)
@@ -1177,12 +2332,29 @@ int snd_pcm_start(snd_pcm_t *pcm)
         pa_threaded_mainloop_wait(mypulse.mainloop);
     }
 
+    if (myconfig.snd.mic == MIC_SRC_DEVICE) {
+        mypulse.rec_spec.format = PA_SAMPLE_S16LE;
+        mypulse.rec_spec.channels = 1;
+        mypulse.rec_spec.rate = myresample.taps ? SPU_FREQ : SND_FREQ;
+
+        mypulse.record = pa_stream_new(mypulse.context, "Mic", &mypulse.rec_spec, NULL);
+        pa_stream_set_read_callback(mypulse.record, pulse_stream_read, &mypulse);
+        pa_stream_connect_record(mypulse.record, NULL, NULL, PA_STREAM_ADJUST_LATENCY);
+    }
+
     pa_threaded_mainloop_unlock(mypulse.mainloop);
 #endif
 
-    add_prehook((void *)myhook.fun.spu_adpcm_decode_block, prehook_adpcm_decode_block, NULL);
+    begin_patch();
+    add_replace("spu_adpcm_decode_block", (void *)myhook.fun.spu_adpcm_decode_block, prehook_adpcm_decode_block);
     add_prehook((void *)myhook.fun.audio_synchronous_update, prehook_audio_synchronous_update, NULL);
     add_prehook((void *)myhook.fun.audio_buffer_force_feed, prehook_audio_buffer_force_feed, NULL);
+    if (myconfig.snd.mixer != MIXER_DRASTIC) {
+        add_prehook((void *)myhook.fun.spu_render_samples, prehook_spu_render_samples, NULL);
+    }
+    if (commit_patch() < 0) {
+        error("failed to hook audio functions\n");
+    }
 
 #if USE_CIRCLE_QUEUE
     trace("use circle queue\n");
@@ -1240,6 +2412,11 @@ int snd_pcm_close(snd_pcm_t *pcm)
         pa_stream_unref(mypulse.stream);
         mypulse.stream = NULL;
     }
+    if (mypulse.record) {
+        pa_stream_disconnect(mypulse.record);
+        pa_stream_unref(mypulse.record);
+        mypulse.record = NULL;
+    }
     if (mypulse.context) {
         pa_context_disconnect(mypulse.context);
         pa_context_unref(mypulse.context);
@@ -6,11 +6,36 @@
 
 #define DSP_DEV             "/dev/dsp"
 #define SND_FREQ            44100
+#define SPU_FREQ            32768
 #define SND_PERIOD          2048
 #define SND_CHANNELS        2
 #define SND_SAMPLES         8192
 #define DEF_QUEUE_SIZE      (SND_SAMPLES * 10)
 #define USE_CIRCLE_QUEUE    1
 
+#define SPU_BLOCK_SIZE      64
+#define SPU_FETCH_BLOCK     8
+#define SPU_FMT_PCM8        0
+#define SPU_FMT_PCM16       1
+#define SPU_FMT_ADPCM       2
+#define SPU_FMT_PCM16_LOOP  3
+#define SPU_FMT_PCM8_LOOP   4
+#define SPU_IO_REPEAT       0x08000000
+#define SPU_IO_START        0x80000000
+
+#define RESAMPLE_CHUNK      1024
+#define RESAMPLE_SHIFT      14
+#define RESAMPLE_MAX_TAPS   16
+#define RESAMPLE_PHASE_BITS 7
+#define RESAMPLE_PHASES     (1 << RESAMPLE_PHASE_BITS)
+
+#define STRETCH_CHUNK       1024
+#define STRETCH_SEQ         1024
+#define STRETCH_SEEK        256
+#define STRETCH_OVERLAP     256
+#define STRETCH_MAX_RATIO   (8 << 16)
+
+#define STATS_BINS          16
+
 #endif
 
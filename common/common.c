@@ -55,6 +55,24 @@ uint64_t get_tick_count_ms(void)
     return (ts.tv_sec * 1000ULL) + (ts.tv_nsec / 1000000ULL);
 }
 
+uint64_t get_tick_count_us(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (ts.tv_sec * 1000000ULL) + (ts.tv_nsec / 1000ULL);
+}
+
+#if defined(UT)
+TEST(common, get_tick_count_us)
+{
+    uint64_t t = get_tick_count_us();
+
+    usleep(2000);
+    TEST_ASSERT_TRUE((get_tick_count_us() - t) >= 2000);
+}
+#endif
+
 int read_file(const char *path, void *buf, int len)
 {
     int r = 0;
@@ -198,8 +216,30 @@ int reset_config(void)
     myconfig.layout.swin.alpha = DEF_SWIN_ALPHA;
     myconfig.layout.swin.border = DEF_SWIN_BORDER;
     myconfig.pen.speed = DEF_PEN_SPEED;
+    myconfig.pen.predict = DEF_PEN_PREDICT;
     myconfig.auto_state = DEF_AUTO_STATE;
     myconfig.fast_forward = DEF_FAST_FORWARD;
+    myconfig.snd.mixer = DEF_SND_MIXER;
+    myconfig.snd.resampler = DEF_SND_RESAMPLER;
+    myconfig.snd.mic = DEF_SND_MIC;
+    myconfig.snd.stats = DEF_SND_STATS;
+    myconfig.input_latency = DEF_INPUT_LATENCY;
+    myconfig.analog.mode = DEF_ANALOG_MODE;
+    myconfig.analog.dzone = DEF_ANALOG_DZONE;
+    myconfig.analog.curve = DEF_ANALOG_CURVE;
+    myconfig.analog.speed = DEF_ANALOG_SPEED;
+    myconfig.analog.hyst = DEF_ANALOG_HYST;
+    myconfig.turbo.mask = DEF_TURBO_MASK;
+    myconfig.turbo.on = DEF_TURBO_ON;
+    myconfig.turbo.off = DEF_TURBO_OFF;
+    myconfig.macro.key = DEF_MACRO_KEY;
+    myconfig.profile.enable = DEF_PROFILE;
+    myconfig.profile.key = DEF_PROFILE_KEY;
+    myconfig.replace.key = DEF_REPLACE_KEY;
+    myconfig.memtrace.rate = DEF_MEM_TRACE_RATE;
+    myconfig.memtrace.key = DEF_MEM_TRACE_KEY;
+    myconfig.crash.ring = DEF_CRASH_RING;
+    strncpy(myconfig.replace.off, DEF_REPLACE_OFF, sizeof(myconfig.replace.off));
 
 #if defined(MOTO_XT897) || defined(FXTEC_QX1000)
     strncpy(myconfig.state_path, DEF_STATE_PATH, sizeof(myconfig.state_path));
@@ -214,6 +254,18 @@ TEST(common, reset_config)
     myconfig.fast_forward = 100;
     TEST_ASSERT_EQUAL_INT(0, reset_config());
     TEST_ASSERT_EQUAL_INT(DEF_FAST_FORWARD, myconfig.fast_forward);
+    TEST_ASSERT_EQUAL_INT(DEF_SND_MIXER, myconfig.snd.mixer);
+    TEST_ASSERT_EQUAL_INT(DEF_SND_RESAMPLER, myconfig.snd.resampler);
+    TEST_ASSERT_EQUAL_INT(DEF_SND_STATS, myconfig.snd.stats);
+    TEST_ASSERT_EQUAL_INT(DEF_INPUT_LATENCY, myconfig.input_latency);
+    TEST_ASSERT_EQUAL_INT(DEF_ANALOG_MODE, myconfig.analog.mode);
+    TEST_ASSERT_EQUAL_INT(DEF_ANALOG_DZONE, myconfig.analog.dzone);
+    TEST_ASSERT_EQUAL_INT(DEF_TURBO_MASK, myconfig.turbo.mask);
+    TEST_ASSERT_EQUAL_INT(DEF_TURBO_ON, myconfig.turbo.on);
+    TEST_ASSERT_EQUAL_INT(DEF_PROFILE, myconfig.profile.enable);
+    TEST_ASSERT_EQUAL_STRING(DEF_REPLACE_OFF, myconfig.replace.off);
+    TEST_ASSERT_EQUAL_INT(DEF_MEM_TRACE_RATE, myconfig.memtrace.rate);
+    TEST_ASSERT_EQUAL_INT(DEF_CRASH_RING, myconfig.crash.ring);
 }
 #endif
 
@@ -322,7 +374,29 @@ int load_config(const char *home_path)
         JSON_GET_INT(JSON_PEN_SEL, myconfig.pen.sel);
         JSON_GET_INT(JSON_PEN_MAX, myconfig.pen.max);
         JSON_GET_INT(JSON_PEN_SPEED, myconfig.pen.speed);
+        JSON_GET_INT(JSON_PEN_PREDICT, myconfig.pen.predict);
         JSON_GET_INT(JSON_PEN_TYPE, myconfig.pen.type);
+        JSON_GET_INT(JSON_SND_MIXER, myconfig.snd.mixer);
+        JSON_GET_INT(JSON_SND_RESAMPLER, myconfig.snd.resampler);
+        JSON_GET_INT(JSON_SND_MIC, myconfig.snd.mic);
+        JSON_GET_INT(JSON_SND_STATS, myconfig.snd.stats);
+        JSON_GET_INT(JSON_INPUT_LATENCY, myconfig.input_latency);
+        JSON_GET_INT(JSON_ANALOG_MODE, myconfig.analog.mode);
+        JSON_GET_INT(JSON_ANALOG_DZONE, myconfig.analog.dzone);
+        JSON_GET_INT(JSON_ANALOG_CURVE, myconfig.analog.curve);
+        JSON_GET_INT(JSON_ANALOG_SPEED, myconfig.analog.speed);
+        JSON_GET_INT(JSON_ANALOG_HYST, myconfig.analog.hyst);
+        JSON_GET_INT(JSON_TURBO_MASK, myconfig.turbo.mask);
+        JSON_GET_INT(JSON_TURBO_ON, myconfig.turbo.on);
+        JSON_GET_INT(JSON_TURBO_OFF, myconfig.turbo.off);
+        JSON_GET_INT(JSON_MACRO_KEY, myconfig.macro.key);
+        JSON_GET_INT(JSON_PROFILE, myconfig.profile.enable);
+        JSON_GET_INT(JSON_PROFILE_KEY, myconfig.profile.key);
+        JSON_GET_STR(JSON_REPLACE_OFF, myconfig.replace.off);
+        JSON_GET_INT(JSON_REPLACE_KEY, myconfig.replace.key);
+        JSON_GET_INT(JSON_MEM_TRACE_RATE, myconfig.memtrace.rate);
+        JSON_GET_INT(JSON_MEM_TRACE_KEY, myconfig.memtrace.key);
+        JSON_GET_INT(JSON_CRASH_RING, myconfig.crash.ring);
 
 #if defined(MIYOO_FLIP) || defined(UT)
         JSON_GET_INT(JSON_JOY_MAX_X, myconfig.joy.max_x);
@@ -436,7 +510,29 @@ int update_config(const char *path)
         JSON_SET_INT(JSON_PEN_SEL, myconfig.pen.sel);
         JSON_SET_INT(JSON_PEN_MAX, myconfig.pen.max);
         JSON_SET_INT(JSON_PEN_SPEED, myconfig.pen.speed);
+        JSON_SET_INT(JSON_PEN_PREDICT, myconfig.pen.predict);
         JSON_SET_INT(JSON_PEN_TYPE, myconfig.pen.type);
+        JSON_SET_INT(JSON_SND_MIXER, myconfig.snd.mixer);
+        JSON_SET_INT(JSON_SND_RESAMPLER, myconfig.snd.resampler);
+        JSON_SET_INT(JSON_SND_MIC, myconfig.snd.mic);
+        JSON_SET_INT(JSON_SND_STATS, myconfig.snd.stats);
+        JSON_SET_INT(JSON_INPUT_LATENCY, myconfig.input_latency);
+        JSON_SET_INT(JSON_ANALOG_MODE, myconfig.analog.mode);
+        JSON_SET_INT(JSON_ANALOG_DZONE, myconfig.analog.dzone);
+        JSON_SET_INT(JSON_ANALOG_CURVE, myconfig.analog.curve);
+        JSON_SET_INT(JSON_ANALOG_SPEED, myconfig.analog.speed);
+        JSON_SET_INT(JSON_ANALOG_HYST, myconfig.analog.hyst);
+        JSON_SET_INT(JSON_TURBO_MASK, myconfig.turbo.mask);
+        JSON_SET_INT(JSON_TURBO_ON, myconfig.turbo.on);
+        JSON_SET_INT(JSON_TURBO_OFF, myconfig.turbo.off);
+        JSON_SET_INT(JSON_MACRO_KEY, myconfig.macro.key);
+        JSON_SET_INT(JSON_PROFILE, myconfig.profile.enable);
+        JSON_SET_INT(JSON_PROFILE_KEY, myconfig.profile.key);
+        JSON_SET_STR(JSON_REPLACE_OFF, myconfig.replace.off);
+        JSON_SET_INT(JSON_REPLACE_KEY, myconfig.replace.key);
+        JSON_SET_INT(JSON_MEM_TRACE_RATE, myconfig.memtrace.rate);
+        JSON_SET_INT(JSON_MEM_TRACE_KEY, myconfig.memtrace.key);
+        JSON_SET_INT(JSON_CRASH_RING, myconfig.crash.ring);
 
 #if defined(MIYOO_FLIP) || defined(UT)
         JSON_SET_INT(JSON_JOY_MAX_X, myconfig.joy.max_x);
@@ -21,6 +21,7 @@
 #define MASK_PATH       RES_PATH"/mask"
 #define SHADER_PATH     RES_PATH"/shader"
 #define CFG_FILE        RES_PATH"/nds.cfg"
+#define MIC_FILE        RES_PATH"/mic.raw"
 #define FONT_FILE       RES_PATH"/font.ttf"
 
 #define MENU_COLOR_DIS              0x808080
@@ -94,12 +95,34 @@ enum layout_mode_t {
 
 #define DEF_LANG            "en_US"
 #define DEF_PEN_SPEED       10
+#define DEF_PEN_PREDICT     0
 #define DEF_FAST_FORWARD    6
 #define DEF_SWIN_ALPHA      6
 #define DEF_SWIN_BORDER     1
 #define DEF_JOY_DZONE       25
 #define DEF_AUTO_STATE      0
 #define DEF_AUTO_SLOT       10
+#define DEF_SND_MIXER       MIXER_EXACT
+#define DEF_SND_RESAMPLER   RESAMPLER_NONE
+#define DEF_SND_MIC         MIC_SRC_NOISE
+#define DEF_SND_STATS       0
+#define DEF_INPUT_LATENCY   0
+#define DEF_ANALOG_MODE     ANALOG_MODE_OFF
+#define DEF_ANALOG_DZONE    15
+#define DEF_ANALOG_CURVE    20
+#define DEF_ANALOG_SPEED    6
+#define DEF_ANALOG_HYST     10
+#define DEF_TURBO_MASK      0
+#define DEF_TURBO_ON        2
+#define DEF_TURBO_OFF       2
+#define DEF_MACRO_KEY       0
+#define DEF_PROFILE         0
+#define DEF_PROFILE_KEY     0
+#define DEF_REPLACE_OFF     ""
+#define DEF_REPLACE_KEY     0
+#define DEF_MEM_TRACE_RATE  0
+#define DEF_MEM_TRACE_KEY   0
+#define DEF_CRASH_RING      0
 
 #if defined(MOTO_XT897) || defined(FXTEC_QX1000)
 #define DEF_LAYOUT_MODE     LAYOUT_MODE_C0
@@ -186,6 +209,35 @@ typedef enum {
     FILTER_PIXEL,
 } filter_type_t;
 
+typedef enum {
+    MIXER_DRASTIC = 0,
+    MIXER_EXACT,
+    MIXER_INTERP,
+    MIXER_MAX
+} mixer_type_t;
+
+typedef enum {
+    RESAMPLER_NONE = 0,
+    RESAMPLER_LINEAR,
+    RESAMPLER_8TAP,
+    RESAMPLER_16TAP,
+    RESAMPLER_MAX
+} resampler_type_t;
+
+typedef enum {
+    MIC_SRC_NOISE = 0,
+    MIC_SRC_FILE,
+    MIC_SRC_DEVICE,
+    MIC_SRC_MAX
+} mic_source_t;
+
+typedef enum {
+    ANALOG_MODE_OFF = 0,
+    ANALOG_MODE_STYLUS,
+    ANALOG_MODE_DPAD,
+    ANALOG_MODE_MAX
+} analog_mode_t;
+
 #define CFG_USING_JSON_FORMAT   1
 #define JSON_MAGIC              "magic"
 #define JSON_SWAP_SCREEN        "swap_screen"
@@ -214,6 +266,7 @@ typedef enum {
 #define JSON_PEN_TYPE           "pen_sel_type"
 #define JSON_PEN_MAX            "pen_max_img_cnt"
 #define JSON_PEN_SPEED          "pen_speed"
+#define JSON_PEN_PREDICT        "pen_predict_ms"
 #define JSON_JOY_MAX_X          "joy_max_x"
 #define JSON_JOY_ZERO_X         "joy_zero_x"
 #define JSON_JOY_MIN_X          "joy_max_x"
@@ -240,6 +293,27 @@ typedef enum {
 #define JSON_RJOY_CUST_KEY1     "right_joy_cust_key1"
 #define JSON_RJOY_CUST_KEY2     "right_joy_cust_key2"
 #define JSON_RJOY_CUST_KEY3     "right_joy_cust_key3"
+#define JSON_SND_MIXER          "snd_mixer"
+#define JSON_SND_RESAMPLER      "snd_resampler"
+#define JSON_SND_MIC            "snd_mic_source"
+#define JSON_SND_STATS          "snd_stats_interval"
+#define JSON_INPUT_LATENCY      "input_latency_interval"
+#define JSON_ANALOG_MODE        "analog_mode"
+#define JSON_ANALOG_DZONE       "analog_dead_zone"
+#define JSON_ANALOG_CURVE       "analog_curve"
+#define JSON_ANALOG_SPEED       "analog_speed"
+#define JSON_ANALOG_HYST        "analog_hysteresis"
+#define JSON_TURBO_MASK         "turbo_key_mask"
+#define JSON_TURBO_ON           "turbo_on_frames"
+#define JSON_TURBO_OFF          "turbo_off_frames"
+#define JSON_MACRO_KEY          "macro_key_mask"
+#define JSON_PROFILE            "hook_profile"
+#define JSON_PROFILE_KEY        "hook_profile_key_mask"
+#define JSON_REPLACE_OFF        "hook_replace_off"
+#define JSON_REPLACE_KEY        "hook_replace_key_mask"
+#define JSON_MEM_TRACE_RATE     "mem_trace_rate"
+#define JSON_MEM_TRACE_KEY      "mem_trace_key_mask"
+#define JSON_CRASH_RING         "crash_hook_ring"
 
 #define JSON_SET_INT(_X_, _BUF_)    json_object_object_add(root, _X_, json_object_new_int64(_BUF_));
 #define JSON_GET_INT(_X_, _BUF_)    _BUF_ = json_object_get_int64(json_object_object_get(root, _X_))
@@ -266,6 +340,7 @@ typedef struct {
     int shader;
     int cpu_core;
     int fast_forward;
+    int input_latency;
     filter_type_t filter;
 
     int auto_state;
@@ -298,8 +373,53 @@ typedef struct {
         int sel;
         int max;
         int speed;
+        int predict;
         pen_type_t type;
     } pen;
+
+    struct {
+        mixer_type_t mixer;
+        resampler_type_t resampler;
+        mic_source_t mic;
+        int stats;
+    } snd;
+
+    struct {
+        analog_mode_t mode;
+        int dzone;
+        int curve;
+        int speed;
+        int hyst;
+    } analog;
+
+    struct {
+        uint32_t mask;
+        int on;
+        int off;
+    } turbo;
+
+    struct {
+        uint32_t key;
+    } macro;
+
+    struct {
+        int enable;
+        uint32_t key;
+    } profile;
+
+    struct {
+        char off[MAX_PATH];
+        uint32_t key;
+    } replace;
+
+    struct {
+        int rate;
+        uint32_t key;
+    } memtrace;
+
+    struct {
+        int ring;
+    } crash;
 } nds_config;
 
 #ifdef __cplusplus
@@ -325,6 +445,7 @@ int get_debug_level(int);
 int update_debug_level(int);
 char* upper_string(char *);
 uint64_t get_tick_count_ms(void);
+uint64_t get_tick_count_us(void);
 uint32_t rgb565_to_rgb888(uint16_t);
 
 #ifdef __cplusplus
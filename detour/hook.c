@@ -12,7 +12,12 @@
 #include <stdbool.h>
 #include <string.h>
 #include <pthread.h>
+#include <time.h>
 #include <sys/mman.h>
+#include <link.h>
+#include <dlfcn.h>
+#include <signal.h>
+#include <ucontext.h>
 
 #if defined(UT)
 #include "unity_fixture.h"
@@ -29,7 +34,240 @@ static size_t page_size = 4096;
 static char home_path[MAX_PATH] = { 0 };
 static char state_path[MAX_PATH] = { 0 };
 
+static struct {
+    int running;
+    mic_source_t source;
+    uint32_t freq;
+    uint32_t seed;
+    int32_t env;
+    int32_t lp;
+    pthread_t thread;
+    char path[MAX_PATH];
+    int16_t ring[MIC_RING_SIZE];
+    uint32_t head;
+    uint32_t tail;
+} mymic = { 0 };
+
+static struct {
+    pthread_mutex_t lock;
+    int cnt;
+    uint8_t *pool;
+    int pool_used;
+    hook_t hook[MAX_HOOK];
+} myreg = { PTHREAD_MUTEX_INITIALIZER };
+
+static struct {
+    pthread_mutex_t lock;
+    int active;
+    pthread_t owner;
+    int cnt;
+    int hooks;
+    patch_t patch[MAX_PATCH_TXN];
+} mytxn = { PTHREAD_MUTEX_INITIALIZER };
+
+static struct {
+    int cnt;
+    int max;
+    int valid;
+    int has_hash;
+    uint32_t hash;
+    uintptr_t base;
+    symbol_t *sym;
+} mysym = { 0 };
+
+static struct {
+    uintptr_t start;
+    uintptr_t end;
+    uintptr_t bias;
+} mytext = { 0 };
+
+static struct {
+    int enable;
+    int thread_cnt;
+    hook_prof_t slot[MAX_PROF_THREAD][MAX_HOOK];
+} myprof = { 0 };
+
+static __thread struct {
+    int slot;
+    int depth;
+    struct {
+        uint64_t start;
+        uintptr_t id;
+        uintptr_t lr;
+    } stack[MAX_PROF_DEPTH];
+} myprof_stack = { 0 };
+
+static struct {
+    int cnt;
+    int next;
+    int measure;
+    uint32_t frames;
+    uint64_t last;
+    uint64_t sum;
+    uint64_t prev;
+    uint64_t before;
+    struct {
+        const char *name;
+        void *org;
+        void *cb;
+        int enable;
+        int req;
+    } slot[MAX_REPLACE];
+} myrepl = { 0 };
+
+static struct {
+    pthread_mutex_t lock;
+    struct {
+        int active;
+        uint32_t arg;
+        void *addr;
+        uint32_t cur[RESTORE_BUF_SIZE / 4];
+    } slot[MAX_CODE_PATCH];
+} mycode = { PTHREAD_MUTEX_INITIALIZER };
+
+static struct {
+    int active;
+    int req;
+    int rate;
+    int cnt;
+    uint64_t start;
+    uint8_t *buf;
+    void *addr[MAX_MEMTRACE];
+    void *org[MAX_MEMTRACE];
+} mymtrace = { 0 };
+
+static __thread int mymtrace_tick = 0;
+
+static const int mycrash_sig[] = { SIGSEGV, SIGBUS, SIGILL };
+
+static struct {
+    int fd;
+    int ready;
+    int record;
+    int code_cnt;
+    uint32_t pos;
+    uint32_t tick;
+    char path[MAX_PATH + 32];
+    struct {
+        uintptr_t start;
+        uintptr_t end;
+    } code[MAX_CRASH_CODE];
+    struct sigaction prev[sizeof(mycrash_sig) / sizeof(mycrash_sig[0])];
+    struct {
+        uint32_t id;
+        uintptr_t lr;
+        uint64_t ns;
+    } ring[MAX_CRASH_RING];
+} mycrash = { 0 };
+
+static __thread uint8_t *mycrash_stack = NULL;
+
+#define SYM_FUN(n)  { #n, (void **)&myhook.fun.n }
+#define SYM_VAR(n)  { "var." #n, (void **)&myhook.var.n }
+
+#if defined(NDS_ARM64)
+// init_table() nulls these on arm64, the prehooks behind them assume the
+// 32-bit structure layouts (spu_channel_struct has pointers) or are missing
+static void ** const mysym_off[] = {
+    (void **)&myhook.fun.savestate_pre,
+    (void **)&myhook.fun.savestate_post,
+    (void **)&myhook.fun.spu_adpcm_decode_block,
+    (void **)&myhook.fun.spu_render_samples,
+    (void **)&myhook.fun.spu_update_channel_settings,
+    (void **)&myhook.fun.render_scanline_tiled_4bpp,
+    (void **)&myhook.fun.render_polygon_setup_perspective_steps,
+};
+#endif
+
+// manifest names are the decom function names, variables use "var." paths
+static const struct {
+    const char *name;
+    void **slot;
+} mysym_slot[] = {
+    SYM_FUN(menu),
+    SYM_FUN(free),
+    SYM_FUN(quit),
+    SYM_FUN(malloc),
+    SYM_FUN(realloc),
+    SYM_FUN(screen_copy16),
+    SYM_FUN(print_string),
+    SYM_FUN(load_state_index),
+    SYM_FUN(save_state_index),
+    SYM_FUN(savestate_pre),
+    SYM_FUN(savestate_post),
+    SYM_FUN(update_screen),
+    SYM_FUN(load_state),
+    SYM_FUN(save_state),
+    SYM_FUN(blit_screen_menu),
+    SYM_FUN(initialize_backup),
+    SYM_FUN(platform_get_input),
+    SYM_FUN(set_screen_swap),
+    SYM_FUN(set_screen_menu_off),
+    SYM_FUN(get_screen_ptr),
+    SYM_FUN(spu_adpcm_decode_block),
+    SYM_FUN(spu_render_samples),
+    SYM_FUN(spu_update_channel_settings),
+    SYM_FUN(render_scanline_tiled_4bpp),
+    SYM_FUN(render_polygon_setup_perspective_steps),
+    SYM_FUN(puts),
+    { "__printf_chk", (void **)&myhook.fun.printf_chk },
+    SYM_FUN(select_quit),
+    SYM_FUN(config_setup_input_map),
+    SYM_FUN(print_string_ext),
+    SYM_FUN(nds_file_get_icon_data),
+    SYM_FUN(audio_capture_flush),
+    SYM_FUN(audio_synchronous_update),
+    SYM_FUN(audio_buffer_force_feed),
+    SYM_FUN(save_directory_config_file),
+    SYM_VAR(system.base),
+    SYM_VAR(system.gamecard_name),
+    SYM_VAR(system.savestate_num),
+    SYM_VAR(system.config.base),
+    SYM_VAR(system.config.hires_3d),
+    SYM_VAR(system.config.controls_a),
+    SYM_VAR(system.config.controls_b),
+    SYM_VAR(system.config.rom_directory),
+    SYM_VAR(system.config.file_list_display_type),
+    SYM_VAR(system.video.realtime_speed_percentage),
+    SYM_VAR(system.video.rendered_frames_percentage),
+    SYM_VAR(system.micphone_status),
+    SYM_VAR(system.spu.audio),
+    SYM_VAR(system.user_root_path),
+    SYM_VAR(sdl.swap_screens),
+    SYM_VAR(sdl.bytes_per_pixel),
+    SYM_VAR(sdl.needs_reinitializing),
+    SYM_VAR(sdl.window),
+    SYM_VAR(sdl.renderer),
+    SYM_VAR(sdl.screen[0].texture),
+    SYM_VAR(sdl.screen[0].pixels),
+    SYM_VAR(sdl.screen[0].x),
+    SYM_VAR(sdl.screen[0].y),
+    SYM_VAR(sdl.screen[0].w),
+    SYM_VAR(sdl.screen[0].h),
+    SYM_VAR(sdl.screen[0].show),
+    SYM_VAR(sdl.screen[0].hires_mode),
+    SYM_VAR(sdl.screen[1].texture),
+    SYM_VAR(sdl.screen[1].pixels),
+    SYM_VAR(sdl.screen[1].x),
+    SYM_VAR(sdl.screen[1].y),
+    SYM_VAR(sdl.screen[1].w),
+    SYM_VAR(sdl.screen[1].h),
+    SYM_VAR(sdl.screen[1].show),
+    SYM_VAR(sdl.screen[1].hires_mode),
+    SYM_VAR(adpcm.step_table),
+    SYM_VAR(adpcm.index_step_table),
+    SYM_VAR(desmume_footer_str),
+    SYM_VAR(pcm_handler),
+    SYM_VAR(fast_forward),
+    SYM_VAR(pcm_handle),
+    SYM_VAR(capture_handle),
+    SYM_VAR(mic_en),
+    SYM_VAR(savestate_thread),
+};
+
 static int init_table(void);
+static void finish_hook_txn(void);
+static void sync_replace(void);
 
 #if defined(UT)
 TEST_GROUP(detour);
@@ -55,10 +293,6 @@ int unlock_area(const void *p)
         return r;
     }
 
-#if defined(UT)
-    return 0;
-#endif
-
     r = mprotect(ALIGN_ADDR(p), page_size, PROT_READ | PROT_WRITE | PROT_EXEC);
     trace("mprotect()=%d\n", r);
 
@@ -68,33 +302,70 @@ int unlock_area(const void *p)
 #if defined(UT)
 TEST(detour, unlock_area)
 {
+    void *p = NULL;
+
     TEST_ASSERT_EQUAL_INT(-1, unlock_area(NULL));
-    TEST_ASSERT_EQUAL_INT(0, unlock_area((const void *)0xdead));
+
+    p = mmap(NULL, page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_ASSERT_TRUE(p != MAP_FAILED);
+    TEST_ASSERT_EQUAL_INT(0, unlock_area((uint8_t *)p + 4));
+    *(uint32_t *)p = 0xe1a00000;
+    munmap(p, page_size);
 }
 #endif
 
-int set_fast_forward(uint8_t v)
+static int encode_fast_forward(uint32_t v, uint32_t *w)
 {
-    uint32_t *ff = (uint32_t*)CODE_FAST_FORWARD;
-
-    // 0xe3a03006
-    unlock_area((void *)CODE_FAST_FORWARD);
+    if (!w || (v > 0xff)) {
+        error("invalid input\n");
+        return -1;
+    }
 
-#if defined(UT)
-    return 0;
+#if defined(NDS_ARM64)
+    w[0] = 0x52800002 | (v << 5);   // mov w2, #v
+#else
+    w[0] = 0xe3a03000 | v;          // mov r3, #v
 #endif
 
-    *ff = 0xe3a03000 | v;
-    return 0;
+    return 4;
 }
 
 #if defined(UT)
-TEST(detour, set_fast_forward)
+TEST(detour, encode_fast_forward)
 {
-    TEST_ASSERT_EQUAL_INT(0, set_fast_forward(0));
+    uint32_t w = 0;
+
+    TEST_ASSERT_EQUAL_INT(-1, encode_fast_forward(0, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, encode_fast_forward(0x100, &w));
+    TEST_ASSERT_EQUAL_INT(4, encode_fast_forward(6, &w));
+    TEST_ASSERT_EQUAL_HEX32(0xe3a03006, w);
 }
 #endif
 
+// every runtime instruction rewrite in drastic, addresses come from the
+// symbol table so a manifest can move them, arm64 uses file offsets
+static const code_patch_t mycode_table[] = {
+    {
+        "fast_forward",
+        "frame sync speed-up factor while fast forward is on",
+        (void **)&myhook.var.fast_forward,
+#if defined(NDS_ARM64)
+        { 0x528000c2 },             // mov w2, #6
+#else
+        { 0xe3a03006 },             // mov r3, #6
+#endif
+        4,
+        encode_fast_forward
+    },
+};
+
+int set_fast_forward(uint8_t v)
+{
+    trace("call %s(v=%d)\n", __func__, v);
+
+    return set_code_patch("fast_forward", v);
+}
+
 static int prehook_puts(const char *s)
 {
     trace("call %s(s=%p)\n", __func__, s);
@@ -643,266 +914,5388 @@ TEST(detour, patch_drastic64)
 }
 #endif
 
-int add_prehook(void *org, void *cb, uint8_t *restore)
+static uint32_t get_arm_ror_imm(uint32_t ins)
 {
-    int r = -1;
-
-    trace("call %s(org=%p, cb=%p)\n", __func__, org, cb);
+    uint32_t imm = ins & 0xff;
+    uint32_t rot = ((ins >> 8) & 0xf) * 2;
 
-    if (!org || !cb) {
-        error("invalid pointer\n");
-        return r;
+    if (!rot) {
+        return imm;
     }
+    return (imm >> rot) | (imm << (32 - rot));
+}
 
 #if defined(UT)
-    return 0;
+TEST(detour, get_arm_ror_imm)
+{
+    TEST_ASSERT_EQUAL_HEX32(0x10, get_arm_ror_imm(0xe28f1010));
+    TEST_ASSERT_EQUAL_HEX32(0x3fc00, get_arm_ror_imm(0xe28f1bff));
+}
 #endif
 
-#if defined(NDS_ARM64)
-    r = patch_drastic64((uintptr_t)org, (uintptr_t)cb);
-#else
-    if (unlock_area(org) >= 0) {
-        uintptr_t c = (uintptr_t)cb;
-        volatile uint8_t *m = (uint8_t *)(intptr_t)org;
+static int relocate_arm(const uint32_t *src, uint32_t *dst)
+{
+    int rd = 0;
+    uint32_t v = 0;
+    uint32_t ins = 0;
+    uint32_t cond = 0;
+    uint32_t pc = 0;
 
-        if (restore) {
-            trace("backup prehook data\n");
-            memcpy(restore, org, RESTORE_BUF_SIZE);
-        }
+    trace("call %s(src=%p, dst=%p)\n", __func__, src, dst);
 
-        r = 0;
-        m[0] = 0x04;
-        m[1] = 0xf0;
-        m[2] = 0x1f;
-        m[3] = 0xe5;
-        m[4] = c >> 0;
-        m[5] = c >> 8;
-        m[6] = c >> 16;
-        m[7] = c >> 24;
+    if (!src || !dst) {
+        error("invalid input\n");
+        return -1;
     }
-#endif
 
-    return r;
-}
+    ins = src[0];
+    cond = ins & 0xf0000000;
+    pc = (uint32_t)(uintptr_t)src + 8;
+    rd = (ins >> 12) & 0xf;
 
-#if defined(UT)
-TEST(detour, add_prehook)
-{
-    TEST_ASSERT_EQUAL_INT(-1, add_prehook(0, 0, 0));
-    TEST_ASSERT_EQUAL_INT(0, add_prehook((void *)0xdead, (void *)0xdead, (uint8_t *)0xdead));
-}
-#endif
+    // blx imm, pld and the rest of the unconditional space
+    if (cond == 0xf0000000) {
+        return -1;
+    }
 
-int restore_prehook(void *pfn, uint8_t *org)
-{
-    int r = -1;
+    // b/bl imm24
+    if ((ins & 0x0e000000) == 0x0a000000) {
+        v = pc + (uint32_t)(((int32_t)(ins << 8)) >> 6);
+        if (ins & (1 << 24)) {
+            if (cond != 0xe0000000) {
+                return -1;
+            }
+            dst[0] = 0xe28fe004;                    // add lr, pc, #4
+            dst[1] = 0xe51ff004;                    // ldr pc, [pc, #-4]
+            dst[2] = v;
+            return 3;
+        }
+        dst[0] = cond | 0x059ff000;                 // ldr<c> pc, [pc]
+        dst[1] = 0xea000000;                        // b over literal
+        dst[2] = v;
+        return 3;
+    }
 
-    trace("call %s(pfn=%p, org=%p)\n", __func__, pfn, org);
+    // ldr/ldrb rt, [pc, #imm]
+    if (((ins & 0x0e000000) == 0x04000000) && (((ins >> 16) & 0xf) == 15)) {
+        if ((ins & 0x01300000) != 0x01100000) {
+            return -1;
+        }
 
-    if (!pfn || !org) {
-        error("invalid parameter\n");
-        return r;
+        v = ins & 0xfff;
+        if (!(ins & (1 << 23))) {
+            v = -v;
+        }
+
+        if (rd == 15) {
+            if ((cond != 0xe0000000) || (ins & (1 << 22))) {
+                return -1;
+            }
+            dst[0] = 0xe51ff004;                    // ldr pc, [pc, #-4]
+            dst[1] = *(const uint32_t *)((const uint8_t *)src + 8 + (int32_t)v);
+            return 2;
+        }
+
+        dst[0] = cond | 0x059f0004 | (rd << 12);    // ldr<c> rt, [pc, #4]
+        dst[1] = cond | 0x05900000 | (ins & (1 << 22)) | (rd << 16) | (rd << 12);
+        dst[2] = 0xea000000;
+        dst[3] = pc + v;
+        return 4;
     }
 
-#if defined(UT)
-    return 0;
-#endif
+    // adr, i.e. add/sub rd, pc, #imm
+    if (((ins & 0x0e000000) == 0x02000000) && (((ins >> 16) & 0xf) == 15)) {
+        if ((rd == 15) || (ins & (1 << 20))) {
+            return -1;
+        }
+
+        v = get_arm_ror_imm(ins);
+        if ((ins & 0x01e00000) == 0x00800000) {
+            v = pc + v;
+        }
+        else if ((ins & 0x01e00000) == 0x00400000) {
+            v = pc - v;
+        }
+        else {
+            return -1;
+        }
 
-    r = 0;
-    memcpy(pfn, org, RESTORE_BUF_SIZE);
+        dst[0] = cond | 0x059f0000 | (rd << 12);    // ldr<c> rd, [pc]
+        dst[1] = 0xea000000;
+        dst[2] = v;
+        return 3;
+    }
 
-    return r;
+    // bx/blx rm and mrs have all-ones fields, they only need rm/rd checked
+    if (((ins & 0x0ffffff0) == 0x012fff10) || ((ins & 0x0ffffff0) == 0x012fff30)) {
+        if ((ins & 0xf) == 15) {
+            return -1;
+        }
+        dst[0] = ins;
+        return 1;
+    }
+
+    if ((ins & 0x0fbf0fff) == 0x010f0000) {
+        if (rd == 15) {
+            return -1;
+        }
+        dst[0] = ins;
+        return 1;
+    }
+
+    // anything else that still reads pc cannot be moved
+    if ((ins & 0x0c000000) == 0x00000000) {
+        if ((((ins >> 16) & 0xf) == 15) || (rd == 15)) {
+            return -1;
+        }
+        if (!(ins & (1 << 25)) && ((ins & 0xf) == 15)) {
+            return -1;
+        }
+    }
+    else if ((ins & 0x0c000000) == 0x04000000) {
+        // register offset with rn/rm == pc, or str pc, both read pc
+        if ((ins & (1 << 25)) && ((((ins >> 16) & 0xf) == 15) || ((ins & 0xf) == 15))) {
+            return -1;
+        }
+        if (!(ins & (1 << 20)) && (rd == 15)) {
+            return -1;
+        }
+    }
+    else if ((ins & 0x0e000000) == 0x08000000) {
+        if ((((ins >> 16) & 0xf) == 15) || (!(ins & (1 << 20)) && (ins & (1 << 15)))) {
+            return -1;
+        }
+    }
+    else if ((ins & 0x0e000000) == 0x0c000000) {
+        if (((ins >> 16) & 0xf) == 15) {
+            return -1;
+        }
+    }
+
+    dst[0] = ins;
+    return 1;
 }
 
 #if defined(UT)
-TEST(detour, restore_prehook)
+TEST(detour, relocate_arm)
 {
-    TEST_ASSERT_EQUAL_INT(-1, restore_prehook(0, 0));
-    TEST_ASSERT_EQUAL_INT(0, restore_prehook((void *)0xdead, (void *)0xdead));
+    uint32_t dst[4] = { 0 };
+    uint32_t src[4] = { 0 };
+    uint32_t pc = (uint32_t)(uintptr_t)src + 8;
+
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm(NULL, dst));
+
+    src[0] = 0xe92d4010;    // push {r4, lr}
+    TEST_ASSERT_EQUAL_INT(1, relocate_arm(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(src[0], dst[0]);
+
+    src[0] = 0xeb000010;    // bl +0x40
+    TEST_ASSERT_EQUAL_INT(3, relocate_arm(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0xe28fe004, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, dst[1]);
+    TEST_ASSERT_EQUAL_HEX32(pc + 0x40, dst[2]);
+
+    src[0] = 0x1afffffe;    // bne .
+    TEST_ASSERT_EQUAL_INT(3, relocate_arm(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0x159ff000, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xea000000, dst[1]);
+    TEST_ASSERT_EQUAL_HEX32(pc - 8, dst[2]);
+
+    src[0] = 0xe59f3004;    // ldr r3, [pc, #4]
+    TEST_ASSERT_EQUAL_INT(4, relocate_arm(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0xe59f3004, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xe5933000, dst[1]);
+    TEST_ASSERT_EQUAL_HEX32(0xea000000, dst[2]);
+    TEST_ASSERT_EQUAL_HEX32(pc + 4, dst[3]);
+
+    src[0] = 0xe51ff004;    // ldr pc, [pc, #-4]
+    src[1] = 0x12345678;
+    TEST_ASSERT_EQUAL_INT(2, relocate_arm(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x12345678, dst[1]);
+
+    src[0] = 0xe28f1010;    // add r1, pc, #16
+    TEST_ASSERT_EQUAL_INT(3, relocate_arm(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0xe59f1000, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32(pc + 16, dst[2]);
+
+    src[0] = 0xe24f2004;    // sub r2, pc, #4
+    TEST_ASSERT_EQUAL_INT(3, relocate_arm(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(pc - 4, dst[2]);
+
+    src[0] = 0xe12fff1e;    // bx lr
+    TEST_ASSERT_EQUAL_INT(1, relocate_arm(src, dst));
+
+    src[0] = 0xe08f0001;    // add r0, pc, r1
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm(src, dst));
+    src[0] = 0xe1a0000f;    // mov r0, pc
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm(src, dst));
+    src[0] = 0xfa000000;    // blx imm
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm(src, dst));
+    src[0] = 0xed9f0b02;    // vldr d0, [pc, #8]
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm(src, dst));
+    src[0] = 0x1b000000;    // blne
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm(src, dst));
+    src[0] = 0xe79f0001;    // ldr r0, [pc, r1]
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm(src, dst));
+    src[0] = 0xe78f0001;    // str r0, [pc, r1]
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm(src, dst));
+    src[0] = 0xe75f2003;    // ldrb r2, [pc, -r3]
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm(src, dst));
+    src[0] = 0xe580f004;    // str pc, [r0, #4]
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm(src, dst));
+
+    src[0] = 0xe7910002;    // ldr r0, [r1, r2]
+    TEST_ASSERT_EQUAL_INT(1, relocate_arm(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(src[0], dst[0]);
 }
 #endif
 
-static int init_table(void)
+static uint32_t* alloc_tramp(void)
 {
-    trace("call %s()\n", __func__);
+    uint32_t *p = NULL;
 
-    myhook.var.system.base = (uintptr_t *)0x083f4000;
-    myhook.var.system.gamecard_name = (uint32_t *)0x0847e8e8;
-    myhook.var.system.savestate_num = (uint32_t *)0x08479780;
-    myhook.var.system.config.base = (uintptr_t *)0x08479328;
-    myhook.var.system.config.hires_3d = (uint32_t *)0x084797c4;
-    myhook.var.system.config.controls_a = (uint16_t *)0x084797dc;
-    myhook.var.system.config.controls_b = (uint16_t *)0x0847982c;
-    myhook.var.system.config.rom_directory = (uint32_t *)0x08479364;
-    myhook.var.system.config.file_list_display_type = (uint32_t *)0x08479764;
-    myhook.var.system.video.realtime_speed_percentage = (float *)0x0aedec08;
-    myhook.var.system.video.rendered_frames_percentage = (float *)0x0aedec0c;
-    myhook.var.system.micphone_status = (uint8_t *)0xaedee69;
-    myhook.var.system.spu.audio = (audio_struct *)0x995a000;
-    myhook.var.system.user_root_path = (uint32_t *)0x0847e0e8;
+    trace("call %s()\n", __func__);
 
-    myhook.var.sdl.swap_screens = (uint32_t *)0x0aee9598;
-    myhook.var.sdl.bytes_per_pixel = (uint32_t *)0x0aee957c;
-    myhook.var.sdl.needs_reinitializing = (uint32_t *)0x0aee95a0;
-    myhook.var.sdl.window = (uintptr_t *)0x0aee9564;
-    myhook.var.sdl.renderer = (uintptr_t *)0x0aee9568;
-    myhook.var.sdl.screen[0].texture = (uintptr_t *)0x0aee952c;
-    myhook.var.sdl.screen[0].pixels = (uintptr_t *)0x0aee9530;
-    myhook.var.sdl.screen[0].x = (uint32_t *)0x0aee9534;
-    myhook.var.sdl.screen[0].y = (uint32_t *)0x0aee9538;
-    myhook.var.sdl.screen[0].w = (uint32_t *)0x0aee953c;
-    myhook.var.sdl.screen[0].h = (uint32_t *)0x0aee9540;
-    myhook.var.sdl.screen[0].show = (uint8_t *)0x0aee9544;
-    myhook.var.sdl.screen[0].hires_mode = (uint8_t *)0x0aee9545;
-    myhook.var.sdl.screen[1].texture = (uintptr_t *)0x0aee9548;
-    myhook.var.sdl.screen[1].pixels = (uintptr_t *)0x0aee954c;
-    myhook.var.sdl.screen[1].x = (uint32_t *)0x0aee9550;
-    myhook.var.sdl.screen[1].y = (uint32_t *)0x0aee9554;
-    myhook.var.sdl.screen[1].w = (uint32_t *)0x0aee9558;
-    myhook.var.sdl.screen[1].h = (uint32_t *)0x0aee955c;
-    myhook.var.sdl.screen[1].show = (uint8_t *)0x0aee9560;
-    myhook.var.sdl.screen[1].hires_mode = (uint8_t *)0x0aee9561;
-    myhook.var.adpcm.step_table = (uint32_t *)0x0815a600;
-    myhook.var.adpcm.index_step_table = (uint32_t *)0x0815a6b8;
-    myhook.var.desmume_footer_str = (uint32_t *)0x0815a740;
-    myhook.var.pcm_handler = (uint32_t *)0x083e532c;
-    myhook.var.fast_forward = (uint32_t *)0x08006ad0;
-    myhook.var.pcm_handle = (uint32_t *)0x83e532c;
-    myhook.var.capture_handle = (uint32_t *)0x83e5330;
-    myhook.var.mic_en = (uint8_t *)0x83e5310;
-    myhook.var.savestate_thread = (savestate_thread_data_struct *)0x083e4ad0;
+    if (!myreg.pool) {
+        p = mmap(
+            NULL,
+            MAX_HOOK_TRAMP * HOOK_TRAMP_SIZE,
+            PROT_READ | PROT_WRITE | PROT_EXEC,
+            MAP_PRIVATE | MAP_ANONYMOUS,
+            -1,
+            0
+        );
 
-#if defined(NDS_ARM64)
-    myhook.fun.menu = (void *)0x0007fbd0;
-    myhook.fun.free = (void *)0x0000d660;
-    myhook.fun.realloc = (void *)0x0000d740;
-    myhook.fun.malloc = (void *)0x0000dfb0;
-    myhook.fun.screen_copy16 = (void *)0x00088290;
-    myhook.fun.print_string = (void *)0x00087f00;
-    myhook.fun.print_string_ext = (void *)0x00087bf0;
-    myhook.fun.load_state_index = (void *)0x00075230;
-    myhook.fun.save_state_index = (void *)0x00075150;
-    myhook.fun.quit = (void *)0x0000e8d0;
-    myhook.fun.savestate_pre = (void *)0;
-    myhook.fun.savestate_post = (void *)0;
-    myhook.fun.update_screen = (void *)0x0008a120;
-    myhook.fun.load_state = (void *)0x000746f0;
-    myhook.fun.save_state = (void *)0x00074da0;
-    myhook.fun.blit_screen_menu = (void *)0x00088570;
-    myhook.fun.initialize_backup = (void *)0x00072530;
-    myhook.fun.set_screen_menu_off = (void *)0x0008a4a0;
-    myhook.fun.get_screen_ptr = (void *)0x0008a9c0;
-    myhook.fun.select_quit = (void *)0x0007a260;
-    myhook.fun.platform_get_input = (void *)0x0008acc0;
+        if (p == MAP_FAILED) {
+            error("failed to allocate trampoline pool\n");
+            return NULL;
+        }
+        myreg.pool = (uint8_t *)p;
+    }
 
-    myhook.fun.spu_adpcm_decode_block = (void *)0;
-    myhook.fun.render_scanline_tiled_4bpp = (void *)0;
-    myhook.fun.render_polygon_setup_perspective_steps = (void *)0;
-#else
-    myhook.fun.menu = (void *)0x080a0a18;
-    myhook.fun.free = (void *)0x08003e58;
-    myhook.fun.realloc = (void *)0x0800435c;
-    myhook.fun.malloc = (void *)0x080046e0;
-    myhook.fun.screen_copy16 = (void *)0x080a59d8;
-    myhook.fun.print_string = (void *)0x080a5398;
-    myhook.fun.load_state_index = (void *)0x08095ce4;
-    myhook.fun.save_state_index = (void *)0x08095c10;
-    myhook.fun.quit = (void *)0x08006444;
-    myhook.fun.savestate_pre = (void *)0x08095a80;
-    myhook.fun.savestate_post = (void *)0x08095154;
-    myhook.fun.update_screen = (void *)0x080a83c0;
-    myhook.fun.load_state = (void *)0x080951c0;
-    myhook.fun.save_state = (void *)0x0809580c;
-    myhook.fun.blit_screen_menu = (void *)0x080a62d8;
-    myhook.fun.initialize_backup = (void *)0x08092f40;
-    myhook.fun.platform_get_input = (void *)0x080a8c30;
-    myhook.fun.set_screen_menu_off = (void *)0x080a8240;
-    myhook.fun.set_screen_swap = (void *)0x080a88fc;
-    myhook.fun.get_screen_ptr = (void *)0x080a890c;
-    myhook.fun.spu_adpcm_decode_block = (void *)0x0808d268;
-    myhook.fun.render_scanline_tiled_4bpp = (void *)0x080bcf74;
-    myhook.fun.render_polygon_setup_perspective_steps = (void *)0x080c1cd4;
-    myhook.fun.printf_chk = (void *)0x08004a04;
-    myhook.fun.puts = (void *)0x0800405c;
-    myhook.fun.select_quit = (void *)0x0809b134;
-    myhook.fun.config_setup_input_map = (void *)0x08097250;
-    myhook.fun.nds_file_get_icon_data = (void *)0x08096d90;
-    myhook.fun.audio_capture_flush = (void *)0x080aa894;
-    myhook.fun.audio_synchronous_update = (void *)0x080aa7c0;
-    myhook.fun.audio_buffer_force_feed = (void *)0x080aa760;
-    myhook.fun.save_directory_config_file = (void *)0x0809a4b0;
-#endif
+    // slots are never recycled, a thread may still be running inside one
+    if (myreg.pool_used >= MAX_HOOK_TRAMP) {
+        error("out of trampoline slots\n");
+        return NULL;
+    }
 
-    srand(time(NULL));
+    p = (uint32_t *)(myreg.pool + (myreg.pool_used * HOOK_TRAMP_SIZE));
+    myreg.pool_used += 1;
 
-    return 0;
+    return p;
 }
 
 #if defined(UT)
-TEST(detour, init_table)
+TEST(detour, alloc_tramp)
 {
-    TEST_ASSERT_EQUAL_INT(0, init_table());
-    TEST_ASSERT_EQUAL_INT(0x08006ad0, myhook.var.fast_forward);
-    TEST_ASSERT_EQUAL_INT(0x080a0a18, myhook.fun.menu);
+    uint32_t *p0 = NULL;
+    uint32_t *p1 = NULL;
+    int used = myreg.pool_used;
+
+    p0 = alloc_tramp();
+    TEST_ASSERT_NOT_NULL(p0);
+    p1 = alloc_tramp();
+    TEST_ASSERT_EQUAL_INT(HOOK_TRAMP_SIZE, (uint8_t *)p1 - (uint8_t *)p0);
+    TEST_ASSERT_EQUAL_INT(used + 2, myreg.pool_used);
 }
 #endif
 
-static void prehook_audio_capture_flush(audio_struct *audio)
+#if defined(NDS_ARM64) || defined(UT)
+static uint64_t get_arm64_simm(uint64_t v, int bits)
 {
-    trace("call %s()\n", __func__);
+    return (uint64_t)((int64_t)(v << (64 - bits)) >> (64 - bits));
 }
 
 #if defined(UT)
-TEST(detour, prehook_audio_capture_flush)
+TEST(detour, get_arm64_simm)
 {
+    TEST_ASSERT_EQUAL_HEX64(0x10, get_arm64_simm(0x10, 19));
+    TEST_ASSERT_EQUAL_HEX64(-1, get_arm64_simm(0x7ffff, 19));
+    TEST_ASSERT_EQUAL_HEX64(-2, get_arm64_simm(0x3fffffe, 26));
 }
 #endif
 
-int32_t prehook_save_directory_config_file(void* system, char* file_name)
+static int put_arm64_addr(uint32_t *dst, uint64_t v)
 {
-    FILE *f = NULL;
-    uint32_t *ptr = NULL;
-    char buf[1024] = { 0 };
+    dst[0] = (uint32_t)v;
+    dst[1] = (uint32_t)(v >> 32);
 
-    if (myconfig.auto_state) {
-        printf("save state...\n");
-        save_state(DEF_AUTO_SLOT);
-        usleep(1000000);
-        printf("save state complete\n");
-    }
+    return 2;
+}
 
-    snprintf(buf, sizeof(buf), "%s/config/%s", (const char *)myhook.var.system.user_root_path, file_name);
-    printf("Saving directory config to file named %s\n", buf);
+#if defined(UT)
+TEST(detour, put_arm64_addr)
+{
+    uint32_t dst[2] = { 0 };
 
-    ptr = (uint32_t *)malloc(0x414);
-    if (!ptr) {
-        error("failed to allocate buffer to file path\n");
-        return -1;
+    TEST_ASSERT_EQUAL_INT(2, put_arm64_addr(dst, 0x1122334455667788));
+    TEST_ASSERT_EQUAL_HEX32(0x55667788, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x11223344, dst[1]);
+}
+#endif
+
+static int relocate_arm64(const uint32_t *src, uint32_t *dst)
+{
+    int rt = 0;
+    int br = 0;
+    uint64_t v = 0;
+    uint64_t pc = 0;
+    uint32_t ins = 0;
+    uint32_t ld = 0;
+
+    if (!src || !dst) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    ins = src[0];
+    rt = ins & 0x1f;
+    pc = (uintptr_t)src;
+
+    // adr/adrp xd, label
+    if ((ins & 0x1f000000) == 0x10000000) {
+        v = get_arm64_simm((((ins >> 5) & 0x7ffff) << 2) | ((ins >> 29) & 3), 21);
+        if (ins & 0x80000000) {
+            v = (pc & ~(uint64_t)0xfff) + (v << 12);
+        }
+        else {
+            v = pc + v;
+        }
+
+        dst[0] = 0x58000040 | rt;   // ldr xd, #8
+        dst[1] = 0x14000003;        // b #12
+        put_arm64_addr(&dst[2], v);
+        return 4;
+    }
+
+    // b/bl label
+    if ((ins & 0x7c000000) == 0x14000000) {
+        v = pc + (get_arm64_simm(ins & 0x3ffffff, 26) << 2);
+        if (ins & 0x80000000) {
+            dst[0] = 0x58000070;    // ldr x16, #12
+            dst[1] = 0xd63f0200;    // blr x16
+            dst[2] = 0x14000003;    // b #12
+            put_arm64_addr(&dst[3], v);
+            return 5;
+        }
+
+        dst[0] = 0x58000050;        // ldr x16, #8
+        dst[1] = 0xd61f0200;        // br x16
+        put_arm64_addr(&dst[2], v);
+        return 4;
+    }
+
+    // b.cond, cbz/cbnz and tbz/tbnz keep their condition but jump to a
+    // local "ldr x16; br x16" pair when taken
+    if (((ins & 0xff000010) == 0x54000000) || ((ins & 0x7e000000) == 0x34000000)) {
+        br = 1;
+        v = pc + (get_arm64_simm((ins >> 5) & 0x7ffff, 19) << 2);
+        dst[0] = (ins & ~0x00ffffe0) | (2 << 5);
+    }
+    else if ((ins & 0x7e000000) == 0x36000000) {
+        br = 1;
+        v = pc + (get_arm64_simm((ins >> 5) & 0x3fff, 14) << 2);
+        dst[0] = (ins & ~0x0007ffe0) | (2 << 5);
+    }
+
+    if (br) {
+        dst[1] = 0x14000005;        // b #20
+        dst[2] = 0x58000050;        // ldr x16, #8
+        dst[3] = 0xd61f0200;        // br x16
+        put_arm64_addr(&dst[4], v);
+        return 6;
+    }
+
+    // ldr/ldrsw/prfm literal
+    if ((ins & 0x3b000000) == 0x18000000) {
+        if (ins & 0x04000000) {
+            return -1;
+        }
+
+        switch (ins >> 30) {
+        case 0:
+            ld = 0xb9400000;        // ldr wt, [xt]
+            break;
+        case 1:
+            ld = 0xf9400000;        // ldr xt, [xt]
+            break;
+        case 2:
+            ld = 0xb9800000;        // ldrsw xt, [xt]
+            break;
+        default:
+            dst[0] = 0xd503201f;    // prefetch hint only, nop is fine
+            return 1;
+        }
+
+        v = pc + (get_arm64_simm((ins >> 5) & 0x7ffff, 19) << 2);
+        dst[0] = 0x58000060 | rt;   // ldr xt, #12
+        dst[1] = ld | (rt << 5) | rt;
+        dst[2] = 0x14000003;        // b #12
+        put_arm64_addr(&dst[3], v);
+        return 5;
+    }
+
+    dst[0] = ins;
+    return 1;
+}
+
+#if defined(UT)
+TEST(detour, relocate_arm64)
+{
+    uint32_t dst[8] = { 0 };
+    uint32_t src[4] = { 0 };
+    uint64_t pc = (uintptr_t)src;
+
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm64(NULL, dst));
+
+    src[0] = 0xa9bf7bfd;    // stp x29, x30, [sp, #-16]!
+    TEST_ASSERT_EQUAL_INT(1, relocate_arm64(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(src[0], dst[0]);
+
+    src[0] = 0x94000010;    // bl +0x40
+    TEST_ASSERT_EQUAL_INT(5, relocate_arm64(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0x58000070, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xd63f0200, dst[1]);
+    TEST_ASSERT_EQUAL_HEX32(0x14000003, dst[2]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(pc + 0x40), dst[3]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)((pc + 0x40) >> 32), dst[4]);
+
+    src[0] = 0x17ffffff;    // b -4
+    TEST_ASSERT_EQUAL_INT(4, relocate_arm64(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0x58000050, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xd61f0200, dst[1]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(pc - 4), dst[2]);
+
+    src[0] = 0x54000081;    // b.ne +16
+    TEST_ASSERT_EQUAL_INT(6, relocate_arm64(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0x54000041, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x14000005, dst[1]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(pc + 16), dst[4]);
+
+    src[0] = 0xb4000040;    // cbz x0, +8
+    TEST_ASSERT_EQUAL_INT(6, relocate_arm64(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0xb4000040, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(pc + 8), dst[4]);
+
+    src[0] = 0x37080061;    // tbnz w1, #1, +12
+    TEST_ASSERT_EQUAL_INT(6, relocate_arm64(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0x37080041, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(pc + 12), dst[4]);
+
+    src[0] = 0x10000083;    // adr x3, +16
+    TEST_ASSERT_EQUAL_INT(4, relocate_arm64(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0x58000043, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(pc + 16), dst[2]);
+
+    src[0] = 0xb0000001;    // adrp x1, +0x1000
+    TEST_ASSERT_EQUAL_INT(4, relocate_arm64(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0x58000041, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)((pc & ~0xfffULL) + 0x1000), dst[2]);
+
+    src[0] = 0x58000042;    // ldr x2, #8
+    TEST_ASSERT_EQUAL_INT(5, relocate_arm64(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0x58000062, dst[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xf9400042, dst[1]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(pc + 8), dst[3]);
+
+    src[0] = 0x98000025;    // ldrsw x5, #4
+    TEST_ASSERT_EQUAL_INT(5, relocate_arm64(src, dst));
+    TEST_ASSERT_EQUAL_HEX32(0xb98000a5, dst[1]);
+
+    src[0] = 0x5c000040;    // ldr d0, #8
+    TEST_ASSERT_EQUAL_INT(-1, relocate_arm64(src, dst));
+}
+#endif
+
+static int build_tramp64(void *target, uint32_t *tramp)
+{
+    int r = 0;
+    int cc = 0;
+    int len = 0;
+    uint32_t *src = (uint32_t *)target;
+
+    trace("call %s(target=%p, tramp=%p)\n", __func__, target, tramp);
+
+    if (!target || !tramp) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    // already patched by us or by the offline drastic64 patch, the literal
+    // is data, so chain to where the stub goes instead of relocating it
+    if (((src[0] == 0x58000050) && (src[1] == 0xd61f0200)) ||
+        ((src[0] == 0x58000042) && (src[1] == 0xd61f0040)))
+    {
+        trace("%p is a stub to 0x%lx, chain to it\n", target, (unsigned long)(src[2] | ((uint64_t)src[3] << 32)));
+        tramp[len++] = 0x58000050;                  // ldr x16, #8
+        tramp[len++] = 0xd61f0200;                  // br x16
+        tramp[len++] = src[2];
+        tramp[len++] = src[3];
+        __builtin___clear_cache((char *)tramp, (char *)&tramp[len]);
+        return len;
+    }
+
+    for (cc = 0; cc < (HOOK_PATCH_SIZE64 / 4); cc++) {
+        r = relocate_arm64(&src[cc], &tramp[len]);
+        if (r < 0) {
+            error("unable to relocate 0x%08x at %p\n", src[cc], &src[cc]);
+            return -1;
+        }
+        len += r;
+    }
+
+    tramp[len++] = 0x58000050;                      // ldr x16, #8
+    tramp[len++] = 0xd61f0200;                      // br x16
+    len += put_arm64_addr(&tramp[len], (uintptr_t)(src + (HOOK_PATCH_SIZE64 / 4)));
+    __builtin___clear_cache((char *)tramp, (char *)&tramp[len]);
+
+    return len;
+}
+
+#if defined(UT)
+TEST(detour, build_tramp64)
+{
+    uint32_t fn[4] = { 0xa9bf7bfd, 0x910003fd, 0x94000010, 0xa8c17bfd };
+    uint32_t tramp[HOOK_TRAMP_SIZE / 4] = { 0 };
+    uint64_t next = (uintptr_t)&fn[4];
+
+    TEST_ASSERT_EQUAL_INT(-1, build_tramp64(NULL, tramp));
+    TEST_ASSERT_EQUAL_INT(12, build_tramp64(fn, tramp));
+    TEST_ASSERT_EQUAL_HEX32(0xa9bf7bfd, tramp[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x910003fd, tramp[1]);
+    TEST_ASSERT_EQUAL_HEX32(0x58000070, tramp[2]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)((uintptr_t)&fn[2] + 0x40), tramp[5]);
+    TEST_ASSERT_EQUAL_HEX32(0xa8c17bfd, tramp[7]);
+    TEST_ASSERT_EQUAL_HEX32(0x58000050, tramp[8]);
+    TEST_ASSERT_EQUAL_HEX32(0xd61f0200, tramp[9]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)next, tramp[10]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(next >> 32), tramp[11]);
+
+    fn[0] = 0x5c000040;
+    TEST_ASSERT_EQUAL_INT(-1, build_tramp64(fn, tramp));
+
+    // an existing stub is chained, not relocated
+    fn[0] = 0x58000042;
+    fn[1] = 0xd61f0040;
+    fn[2] = 0x12345678;
+    fn[3] = 0x9abc;
+    TEST_ASSERT_EQUAL_INT(4, build_tramp64(fn, tramp));
+    TEST_ASSERT_EQUAL_HEX32(0x58000050, tramp[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xd61f0200, tramp[1]);
+    TEST_ASSERT_EQUAL_HEX32(0x12345678, tramp[2]);
+    TEST_ASSERT_EQUAL_HEX32(0x9abc, tramp[3]);
+}
+#endif
+
+static uintptr_t get_text_offset_addr(const struct dl_phdr_info *info, uint64_t off)
+{
+    int cc = 0;
+    const ElfW(Phdr) *p = NULL;
+
+    if (!info || !info->dlpi_phdr) {
+        return 0;
+    }
+
+    for (cc = 0; cc < info->dlpi_phnum; cc++) {
+        p = &info->dlpi_phdr[cc];
+        if ((p->p_type != PT_LOAD) || !(p->p_flags & PF_X)) {
+            continue;
+        }
+
+        if ((off >= p->p_offset) && (off < (p->p_offset + p->p_filesz))) {
+            return (uintptr_t)(info->dlpi_addr + p->p_vaddr + (off - p->p_offset));
+        }
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, get_text_offset_addr)
+{
+    ElfW(Phdr) phdr[2] = { 0 };
+    struct dl_phdr_info info = { 0 };
+
+    phdr[0].p_type = PT_LOAD;
+    phdr[0].p_flags = PF_R;
+    phdr[0].p_filesz = 0x1000;
+    phdr[1].p_type = PT_LOAD;
+    phdr[1].p_flags = PF_R | PF_X;
+    phdr[1].p_offset = 0x1000;
+    phdr[1].p_vaddr = 0x11000;
+    phdr[1].p_filesz = 0x9000;
+
+    info.dlpi_addr = 0x400000;
+    info.dlpi_phdr = phdr;
+    info.dlpi_phnum = 2;
+
+    TEST_ASSERT_EQUAL_INT(0, get_text_offset_addr(NULL, 0));
+    TEST_ASSERT_EQUAL_INT(0, get_text_offset_addr(&info, 0x800));
+    TEST_ASSERT_EQUAL_INT(0, get_text_offset_addr(&info, 0xa000));
+    TEST_ASSERT_EQUAL_HEX32(0x419120, get_text_offset_addr(&info, 0x9120));
+}
+#endif
+
+static int find_main_text(struct dl_phdr_info *info, size_t size, void *data)
+{
+    uint64_t *v = (uint64_t *)data;
+
+    // the main program is always reported first, drastic itself
+    v[1] = get_text_offset_addr(info, v[0]);
+
+    return 1;
+}
+
+#if defined(UT)
+TEST(detour, find_main_text)
+{
+    uint64_t v[2] = { (uint64_t)-1, 1 };
+
+    TEST_ASSERT_EQUAL_INT(1, find_main_text(NULL, 0, v));
+    TEST_ASSERT_EQUAL_INT(0, v[1]);
+}
+#endif
+
+static void* get_text_addr(uint64_t off)
+{
+    uint64_t v[2] = { off, 0 };
+
+    trace("call %s(off=0x%lx)\n", __func__, (unsigned long)off);
+
+    dl_iterate_phdr(find_main_text, v);
+    if (!v[1]) {
+        error("0x%lx is not in the text segment\n", (unsigned long)off);
+    }
+
+    return (void *)(uintptr_t)v[1];
+}
+
+#if defined(UT)
+TEST(detour, get_text_addr)
+{
+    TEST_ASSERT_NULL(get_text_addr((uint64_t)-1));
+}
+#endif
+#endif
+
+static int build_tramp(void *target, uint32_t *tramp)
+{
+    int r = 0;
+    int cc = 0;
+    int len = 0;
+    uint32_t *src = (uint32_t *)target;
+
+    trace("call %s(target=%p, tramp=%p)\n", __func__, target, tramp);
+
+    if (!target || !tramp) {
+        error("invalid input\n");
+        return -1;
+    }
+
+#if defined(NDS_ARM64)
+    return build_tramp64(target, tramp);
+#endif
+
+    // already patched, the second word is data, so chain to where the stub
+    // goes instead of relocating it
+    if (src[0] == 0xe51ff004) {
+        trace("%p is a stub to 0x%x, chain to it\n", target, src[1]);
+        tramp[len++] = 0xe51ff004;                  // ldr pc, [pc, #-4]
+        tramp[len++] = src[1];
+        __builtin___clear_cache((char *)tramp, (char *)&tramp[len]);
+        return len;
+    }
+
+    for (cc = 0; cc < (HOOK_PATCH_SIZE32 / 4); cc++) {
+        r = relocate_arm(&src[cc], &tramp[len]);
+        if (r < 0) {
+            error("unable to relocate 0x%08x at %p\n", src[cc], &src[cc]);
+            return -1;
+        }
+        len += r;
+    }
+
+    tramp[len++] = 0xe51ff004;                      // ldr pc, [pc, #-4]
+    tramp[len++] = (uint32_t)(uintptr_t)(src + (HOOK_PATCH_SIZE32 / 4));
+    __builtin___clear_cache((char *)tramp, (char *)&tramp[len]);
+
+    return len;
+}
+
+#if defined(UT)
+TEST(detour, build_tramp)
+{
+    uint32_t fn[4] = { 0xe92d4010, 0xeb000010, 0xe3a00000, 0xe8bd8010 };
+    uint32_t tramp[HOOK_TRAMP_SIZE / 4] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, build_tramp(NULL, tramp));
+    TEST_ASSERT_EQUAL_INT(6, build_tramp(fn, tramp));
+    TEST_ASSERT_EQUAL_HEX32(0xe92d4010, tramp[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xe28fe004, tramp[1]);
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, tramp[2]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(uintptr_t)&fn[1] + 8 + 0x40, tramp[3]);
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, tramp[4]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(uintptr_t)&fn[2], tramp[5]);
+
+    fn[0] = 0xe1a0000f;
+    TEST_ASSERT_EQUAL_INT(-1, build_tramp(fn, tramp));
+
+    // an existing stub is chained, not relocated
+    fn[0] = 0xe51ff004;
+    fn[1] = 0x1234;
+    TEST_ASSERT_EQUAL_INT(2, build_tramp(fn, tramp));
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, tramp[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x1234, tramp[1]);
+}
+#endif
+
+static uint64_t get_prof_ns(void)
+{
+    struct timespec ts = { 0 };
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+
+    return ((uint64_t)ts.tv_sec * 1000000000ULL) + ts.tv_nsec;
+}
+
+#if defined(UT)
+TEST(detour, get_prof_ns)
+{
+    uint64_t t0 = get_prof_ns();
+
+    TEST_ASSERT_TRUE(get_prof_ns() >= t0);
+}
+#endif
+
+static hook_prof_t* get_prof_slot(uintptr_t id)
+{
+    int slot = myprof_stack.slot;
+
+    if (!slot) {
+        slot = __atomic_add_fetch(&myprof.thread_cnt, 1, __ATOMIC_RELAXED);
+        if (slot > MAX_PROF_THREAD) {
+            // late threads share the last slot, counts may race there
+            slot = MAX_PROF_THREAD;
+        }
+        myprof_stack.slot = slot;
+    }
+
+    return &myprof.slot[slot - 1][id];
+}
+
+#if defined(UT)
+TEST(detour, get_prof_slot)
+{
+    hook_prof_t *p = get_prof_slot(1);
+
+    TEST_ASSERT_NOT_NULL(p);
+    TEST_ASSERT_EQUAL_PTR(p, get_prof_slot(1));
+    TEST_ASSERT_NOT_EQUAL(0, myprof_stack.slot);
+}
+#endif
+
+static uint32_t note_hook_call(uintptr_t id, uintptr_t lr)
+{
+    uint32_t pos = __atomic_fetch_add(&mycrash.pos, 1, __ATOMIC_RELAXED) % MAX_CRASH_RING;
+
+    // the crash handler reports the most recent hook calls
+    mycrash.ring[pos].id = id;
+    mycrash.ring[pos].lr = lr;
+    mycrash.ring[pos].ns = 0;
+
+    return pos;
+}
+
+#if defined(UT)
+TEST(detour, note_hook_call)
+{
+    uint32_t pos = note_hook_call(5, 0x1234);
+
+    TEST_ASSERT_EQUAL_INT(5, mycrash.ring[pos].id);
+    TEST_ASSERT_EQUAL_HEX32(0x1234, mycrash.ring[pos].lr);
+    TEST_ASSERT_EQUAL_INT((pos + 1) % MAX_CRASH_RING, mycrash.pos % MAX_CRASH_RING);
+}
+#endif
+
+static void prof_enter(uintptr_t id, uintptr_t lr)
+{
+    int d = myprof_stack.depth;
+    uint32_t pos = 0;
+
+    // the thunk has nowhere else to keep the caller's lr
+    if (d >= MAX_PROF_DEPTH) {
+        error("hook profiler is nested too deep\n");
+        abort();
+    }
+
+    myprof_stack.stack[d].id = id;
+    myprof_stack.stack[d].lr = lr;
+    myprof_stack.stack[d].start = get_prof_ns();
+    myprof_stack.depth = d + 1;
+
+    pos = note_hook_call(id, lr);
+    mycrash.ring[pos].ns = myprof_stack.stack[d].start;
+}
+
+#if defined(UT)
+TEST(detour, prof_enter)
+{
+    int depth = myprof_stack.depth;
+
+    prof_enter(0, 0x1234);
+    TEST_ASSERT_EQUAL_INT(depth + 1, myprof_stack.depth);
+    TEST_ASSERT_EQUAL_HEX32(0x1234, myprof_stack.stack[depth].lr);
+    myprof_stack.depth = depth;
+}
+#endif
+
+static uintptr_t prof_exit(uintptr_t id)
+{
+    int d = myprof_stack.depth - 1;
+    hook_prof_t *p = get_prof_slot(id);
+
+    p->cnt += 1;
+    p->ns += get_prof_ns() - myprof_stack.stack[d].start;
+    myprof_stack.depth = d;
+
+    return myprof_stack.stack[d].lr;
+}
+
+#if defined(UT)
+TEST(detour, prof_exit)
+{
+    hook_prof_t *p = get_prof_slot(2);
+    uint64_t cnt = p->cnt;
+
+    prof_enter(2, 0x1234);
+    prof_enter(2, 0x5678);
+    TEST_ASSERT_EQUAL_HEX32(0x5678, prof_exit(2));
+    TEST_ASSERT_EQUAL_HEX32(0x1234, prof_exit(2));
+    TEST_ASSERT_EQUAL_INT(cnt + 2, p->cnt);
+}
+#endif
+
+static int build_prof_thunk32(uint32_t *thunk, uintptr_t id, const void *cb)
+{
+    static const uint32_t code[] = {
+        0xe92d500f,     // push {r0-r3, r12, lr}
+        0xed2d0b10,     // vpush {d0-d7}
+        0xe59f003c,     // ldr r0, id
+        0xe1a0100e,     // mov r1, lr
+        0xe59fc038,     // ldr r12, prof_enter
+        0xe12fff3c,     // blx r12
+        0xecbd0b10,     // vpop {d0-d7}
+        0xe8bd500f,     // pop {r0-r3, r12, lr}
+        0xe28fe000,     // add lr, pc, #0
+        0xe59ff02c,     // ldr pc, cb
+        0xe92d000f,     // push {r0-r3}
+        0xed2d0b10,     // vpush {d0-d7}
+        0xe59f0014,     // ldr r0, id
+        0xe59fc018,     // ldr r12, prof_exit
+        0xe12fff3c,     // blx r12
+        0xe1a0e000,     // mov lr, r0
+        0xecbd0b10,     // vpop {d0-d7}
+        0xe8bd000f,     // pop {r0-r3}
+        0xe12fff1e,     // bx lr
+    };
+    int len = sizeof(code) / 4;
+
+    if (!thunk || !cb) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    memcpy(thunk, code, sizeof(code));
+    thunk[len++] = (uint32_t)id;
+    thunk[len++] = (uint32_t)(uintptr_t)prof_enter;
+    thunk[len++] = (uint32_t)(uintptr_t)prof_exit;
+    thunk[len++] = (uint32_t)(uintptr_t)cb;
+
+    return len;
+}
+
+#if defined(UT)
+TEST(detour, build_prof_thunk32)
+{
+    uint32_t thunk[HOOK_TRAMP_SIZE / 4] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, build_prof_thunk32(NULL, 0, NULL));
+    TEST_ASSERT_EQUAL_INT(23, build_prof_thunk32(thunk, 3, (void *)0x1000));
+    TEST_ASSERT_EQUAL_HEX32(0xe92d500f, thunk[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xe12fff1e, thunk[18]);
+    TEST_ASSERT_EQUAL_HEX32(3, thunk[19]);
+    TEST_ASSERT_EQUAL_HEX32(0x1000, thunk[22]);
+}
+#endif
+
+#if defined(NDS_ARM64) || defined(UT)
+static int build_prof_thunk64(uint32_t *thunk, uintptr_t id, const void *cb)
+{
+    // x0-x7 and the full q0-q7 are argument and result registers, both ways
+    static const uint32_t code[] = {
+        0xa9b27bfd,     // stp x29, x30, [sp, #-0xe0]!
+        0xa90107e0,     // stp x0, x1, [sp, #0x10]
+        0xa9020fe2,     // stp x2, x3, [sp, #0x20]
+        0xa90317e4,     // stp x4, x5, [sp, #0x30]
+        0xa9041fe6,     // stp x6, x7, [sp, #0x40]
+        0xf9002be8,     // str x8, [sp, #0x50]
+        0xad0307e0,     // stp q0, q1, [sp, #0x60]
+        0xad040fe2,     // stp q2, q3, [sp, #0x80]
+        0xad0517e4,     // stp q4, q5, [sp, #0xa0]
+        0xad061fe6,     // stp q6, q7, [sp, #0xc0]
+        0x580004c0,     // ldr x0, id
+        0xaa1e03e1,     // mov x1, x30
+        0x580004d0,     // ldr x16, prof_enter
+        0xd63f0200,     // blr x16
+        0xa94107e0,     // ldp x0, x1, [sp, #0x10]
+        0xa9420fe2,     // ldp x2, x3, [sp, #0x20]
+        0xa94317e4,     // ldp x4, x5, [sp, #0x30]
+        0xa9441fe6,     // ldp x6, x7, [sp, #0x40]
+        0xf9402be8,     // ldr x8, [sp, #0x50]
+        0xad4307e0,     // ldp q0, q1, [sp, #0x60]
+        0xad440fe2,     // ldp q2, q3, [sp, #0x80]
+        0xad4517e4,     // ldp q4, q5, [sp, #0xa0]
+        0xad461fe6,     // ldp q6, q7, [sp, #0xc0]
+        0xa8ce7bfd,     // ldp x29, x30, [sp], #0xe0
+        0x1000007e,     // adr x30, #12
+        0x580003b0,     // ldr x16, cb
+        0xd61f0200,     // br x16
+        0xa9b407e0,     // stp x0, x1, [sp, #-0xc0]!
+        0xa9010fe2,     // stp x2, x3, [sp, #0x10]
+        0xa90217e4,     // stp x4, x5, [sp, #0x20]
+        0xa9031fe6,     // stp x6, x7, [sp, #0x30]
+        0xad0207e0,     // stp q0, q1, [sp, #0x40]
+        0xad030fe2,     // stp q2, q3, [sp, #0x60]
+        0xad0417e4,     // stp q4, q5, [sp, #0x80]
+        0xad051fe6,     // stp q6, q7, [sp, #0xa0]
+        0x580001a0,     // ldr x0, id
+        0x58000210,     // ldr x16, prof_exit
+        0xd63f0200,     // blr x16
+        0xaa0003fe,     // mov x30, x0
+        0xa9410fe2,     // ldp x2, x3, [sp, #0x10]
+        0xa94217e4,     // ldp x4, x5, [sp, #0x20]
+        0xa9431fe6,     // ldp x6, x7, [sp, #0x30]
+        0xad4207e0,     // ldp q0, q1, [sp, #0x40]
+        0xad430fe2,     // ldp q2, q3, [sp, #0x60]
+        0xad4417e4,     // ldp q4, q5, [sp, #0x80]
+        0xad451fe6,     // ldp q6, q7, [sp, #0xa0]
+        0xa8cc07e0,     // ldp x0, x1, [sp], #0xc0
+        0xd65f03c0,     // ret
+    };
+    int len = sizeof(code) / 4;
+
+    if (!thunk || !cb) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    memcpy(thunk, code, sizeof(code));
+    len += put_arm64_addr(&thunk[len], id);
+    len += put_arm64_addr(&thunk[len], (uintptr_t)prof_enter);
+    len += put_arm64_addr(&thunk[len], (uintptr_t)prof_exit);
+    len += put_arm64_addr(&thunk[len], (uintptr_t)cb);
+
+    return len;
+}
+
+#if defined(UT)
+TEST(detour, build_prof_thunk64)
+{
+    uint32_t thunk[HOOK_TRAMP_SIZE / 4] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, build_prof_thunk64(NULL, 0, NULL));
+    TEST_ASSERT_EQUAL_INT(56, build_prof_thunk64(thunk, 3, (void *)0x1000));
+    TEST_ASSERT_EQUAL_HEX32(0xa9b27bfd, thunk[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xd65f03c0, thunk[47]);
+    TEST_ASSERT_EQUAL_HEX32(3, thunk[48]);
+    TEST_ASSERT_EQUAL_HEX32(0x1000, thunk[54]);
+    TEST_ASSERT_EQUAL_HEX32(0, thunk[55]);
+}
+#endif
+#endif
+
+static int build_note_thunk32(uint32_t *thunk, uintptr_t id, const void *cb)
+{
+    // no way back through the thunk, cb returns straight to the caller
+    static const uint32_t code[] = {
+        0xe92d500f,     // push {r0-r3, r12, lr}
+        0xed2d0b10,     // vpush {d0-d7}
+        0xe59f0014,     // ldr r0, id
+        0xe1a0100e,     // mov r1, lr
+        0xe59fc010,     // ldr r12, note_hook_call
+        0xe12fff3c,     // blx r12
+        0xecbd0b10,     // vpop {d0-d7}
+        0xe8bd500f,     // pop {r0-r3, r12, lr}
+        0xe59ff004,     // ldr pc, cb
+    };
+    int len = sizeof(code) / 4;
+
+    if (!thunk || !cb) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    memcpy(thunk, code, sizeof(code));
+    thunk[len++] = (uint32_t)id;
+    thunk[len++] = (uint32_t)(uintptr_t)note_hook_call;
+    thunk[len++] = (uint32_t)(uintptr_t)cb;
+
+    return len;
+}
+
+#if defined(UT)
+TEST(detour, build_note_thunk32)
+{
+    uint32_t thunk[HOOK_TRAMP_SIZE / 4] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, build_note_thunk32(NULL, 0, NULL));
+    TEST_ASSERT_EQUAL_INT(12, build_note_thunk32(thunk, 3, (void *)0x1000));
+    TEST_ASSERT_EQUAL_HEX32(0xe92d500f, thunk[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xe59ff004, thunk[8]);
+    TEST_ASSERT_EQUAL_HEX32(3, thunk[9]);
+    TEST_ASSERT_EQUAL_HEX32(0x1000, thunk[11]);
+}
+#endif
+
+#if defined(NDS_ARM64) || defined(UT)
+static int build_note_thunk64(uint32_t *thunk, uintptr_t id, const void *cb)
+{
+    static const uint32_t code[] = {
+        0xa9b27bfd,     // stp x29, x30, [sp, #-0xe0]!
+        0xa90107e0,     // stp x0, x1, [sp, #0x10]
+        0xa9020fe2,     // stp x2, x3, [sp, #0x20]
+        0xa90317e4,     // stp x4, x5, [sp, #0x30]
+        0xa9041fe6,     // stp x6, x7, [sp, #0x40]
+        0xf9002be8,     // str x8, [sp, #0x50]
+        0xad0307e0,     // stp q0, q1, [sp, #0x60]
+        0xad040fe2,     // stp q2, q3, [sp, #0x80]
+        0xad0517e4,     // stp q4, q5, [sp, #0xa0]
+        0xad061fe6,     // stp q6, q7, [sp, #0xc0]
+        0x58000200,     // ldr x0, id
+        0xaa1e03e1,     // mov x1, x30
+        0x58000210,     // ldr x16, note_hook_call
+        0xd63f0200,     // blr x16
+        0xa94107e0,     // ldp x0, x1, [sp, #0x10]
+        0xa9420fe2,     // ldp x2, x3, [sp, #0x20]
+        0xa94317e4,     // ldp x4, x5, [sp, #0x30]
+        0xa9441fe6,     // ldp x6, x7, [sp, #0x40]
+        0xf9402be8,     // ldr x8, [sp, #0x50]
+        0xad4307e0,     // ldp q0, q1, [sp, #0x60]
+        0xad440fe2,     // ldp q2, q3, [sp, #0x80]
+        0xad4517e4,     // ldp q4, q5, [sp, #0xa0]
+        0xad461fe6,     // ldp q6, q7, [sp, #0xc0]
+        0xa8ce7bfd,     // ldp x29, x30, [sp], #0xe0
+        0x580000d0,     // ldr x16, cb
+        0xd61f0200,     // br x16
+    };
+    int len = sizeof(code) / 4;
+
+    if (!thunk || !cb) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    memcpy(thunk, code, sizeof(code));
+    len += put_arm64_addr(&thunk[len], id);
+    len += put_arm64_addr(&thunk[len], (uintptr_t)note_hook_call);
+    len += put_arm64_addr(&thunk[len], (uintptr_t)cb);
+
+    return len;
+}
+
+#if defined(UT)
+TEST(detour, build_note_thunk64)
+{
+    uint32_t thunk[HOOK_TRAMP_SIZE / 4] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, build_note_thunk64(NULL, 0, NULL));
+    TEST_ASSERT_EQUAL_INT(32, build_note_thunk64(thunk, 3, (void *)0x1000));
+    TEST_ASSERT_EQUAL_HEX32(0xa9b27bfd, thunk[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xd61f0200, thunk[25]);
+    TEST_ASSERT_EQUAL_HEX32(3, thunk[26]);
+    TEST_ASSERT_EQUAL_HEX32(0x1000, thunk[30]);
+}
+#endif
+#endif
+
+// with hook_profile the thunk times the call, otherwise it only leaves the
+// call in the crash ring, a slot always gets the same kind for the whole run
+static void* build_hook_thunk(uintptr_t id, const void *cb, uint32_t *thunk, int prof)
+{
+    int len = 0;
+
+    trace("call %s(id=%ld, cb=%p, thunk=%p, prof=%d)\n", __func__, (long)id, cb, thunk, prof);
+
+    if (!cb) {
+        error("invalid input\n");
+        return NULL;
+    }
+
+    if (!thunk) {
+        thunk = alloc_tramp();
+    }
+    if (!thunk) {
+        return NULL;
+    }
+
+#if defined(NDS_ARM64)
+    len = prof ? build_prof_thunk64(thunk, id, cb) : build_note_thunk64(thunk, id, cb);
+#else
+    len = prof ? build_prof_thunk32(thunk, id, cb) : build_note_thunk32(thunk, id, cb);
+#endif
+    if (len < 0) {
+        return NULL;
+    }
+    __builtin___clear_cache((char *)thunk, (char *)&thunk[len]);
+
+    return thunk;
+}
+
+#if defined(UT)
+TEST(detour, build_hook_thunk)
+{
+    int used = 0;
+    uint32_t *thunk = build_hook_thunk(1, (void *)0x1000, NULL, 1);
+
+    TEST_ASSERT_NOT_NULL(thunk);
+    TEST_ASSERT_EQUAL_HEX32(0xe92d500f, thunk[0]);
+    TEST_ASSERT_NULL(build_hook_thunk(1, NULL, NULL, 1));
+
+    used = myreg.pool_used;
+    TEST_ASSERT_EQUAL_PTR(thunk, build_hook_thunk(1, (void *)0x2000, thunk, 1));
+    TEST_ASSERT_EQUAL_HEX32(0x2000, thunk[22]);
+    TEST_ASSERT_EQUAL_INT(used, myreg.pool_used);
+
+    TEST_ASSERT_EQUAL_PTR(thunk, build_hook_thunk(1, (void *)0x3000, thunk, 0));
+    TEST_ASSERT_EQUAL_HEX32(0x3000, thunk[11]);
+}
+#endif
+
+int print_hook_profile(void)
+{
+    int i = 0;
+    int cc = 0;
+    int cnt = 0;
+    int tmp = 0;
+    int idx[MAX_HOOK] = { 0 };
+    uint64_t sum = 0;
+    uint64_t calls[MAX_HOOK] = { 0 };
+    uint64_t ns[MAX_HOOK] = { 0 };
+    const char *name = NULL;
+
+    trace("call %s()\n", __func__);
+
+    if (!myprof.enable) {
+        printf("[PROFILE] (hook profiling disabled)\n");
+        return 0;
+    }
+
+    for (cc = 0; cc < MAX_HOOK; cc++) {
+        for (i = 0; i < MAX_PROF_THREAD; i++) {
+            calls[cc] += myprof.slot[i][cc].cnt;
+            ns[cc] += myprof.slot[i][cc].ns;
+        }
+
+        if (calls[cc]) {
+            sum += ns[cc];
+            for (i = cnt++; (i > 0) && (ns[idx[i - 1]] < ns[cc]); i--) {
+                idx[i] = idx[i - 1];
+            }
+            idx[i] = cc;
+        }
+    }
+
+    pthread_mutex_lock(&myreg.lock);
+    printf("[PROFILE] %-40s %10s %10s %8s %6s\n", "hook", "calls", "total ms", "avg us", "share");
+    for (cc = 0; cc < cnt; cc++) {
+        tmp = idx[cc];
+        name = myreg.hook[tmp].name;
+        printf(
+            "[PROFILE] %-40s %10llu %10.3f %8.2f %5.1f%%\n",
+            name ? name : "(unnamed)",
+            (unsigned long long)calls[tmp],
+            ns[tmp] / 1000000.0,
+            (ns[tmp] / 1000.0) / calls[tmp],
+            sum ? ((ns[tmp] * 100.0) / sum) : 0.0
+        );
+    }
+    pthread_mutex_unlock(&myreg.lock);
+
+    return cnt;
+}
+
+#if defined(UT)
+TEST(detour, print_hook_profile)
+{
+    int enable = myprof.enable;
+
+    myprof.enable = 0;
+    TEST_ASSERT_EQUAL_INT(0, print_hook_profile());
+
+    myprof.enable = 1;
+    memset(myprof.slot, 0, sizeof(myprof.slot));
+    myprof.slot[0][4].cnt = 2;
+    myprof.slot[0][4].ns = 1000;
+    myprof.slot[1][5].cnt = 1;
+    myprof.slot[1][5].ns = 3000;
+    TEST_ASSERT_EQUAL_INT(2, print_hook_profile());
+
+    memset(myprof.slot, 0, sizeof(myprof.slot));
+    myprof.enable = enable;
+}
+#endif
+
+static int protect_range(uintptr_t start, uintptr_t end, int prot)
+{
+    int r = 0;
+
+    trace("call %s(start=0x%lx, end=0x%lx, prot=%d)\n", __func__, (unsigned long)start, (unsigned long)end, prot);
+
+    if (end <= start) {
+        error("invalid input\n");
+        return -1;
+    }
+
+#if defined(UT)
+    return 0;
+#endif
+
+    start &= ~(uintptr_t)(page_size - 1);
+    end = (end + page_size - 1) & ~(uintptr_t)(page_size - 1);
+    r = mprotect((void *)start, end - start, prot);
+    if (r < 0) {
+        error("failed to mprotect 0x%lx-0x%lx (err=%d)\n", (unsigned long)start, (unsigned long)end, errno);
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, protect_range)
+{
+    TEST_ASSERT_EQUAL_INT(-1, protect_range(0x2000, 0x1000, PROT_READ));
+    TEST_ASSERT_EQUAL_INT(0, protect_range(0x1ffc, 0x2004, PROT_READ));
+}
+#endif
+
+static int get_range_prot(uintptr_t start, uintptr_t end, uintptr_t *s, uintptr_t *e, int *prot, int max)
+{
+    int cnt = 0;
+    FILE *fp = NULL;
+    char perm[8] = { 0 };
+    char buf[MAX_PATH] = { 0 };
+    unsigned long lo = 0;
+    unsigned long hi = 0;
+
+    trace("call %s(start=0x%lx, end=0x%lx)\n", __func__, (unsigned long)start, (unsigned long)end);
+
+    if ((end <= start) || !s || !e || !prot) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    fp = fopen("/proc/self/maps", "r");
+    if (!fp) {
+        error("failed to open /proc/self/maps\n");
+        return -1;
+    }
+
+    // one entry per mapping the range touches, clipped to the range
+    while (fgets(buf, sizeof(buf), fp)) {
+        if (sscanf(buf, "%lx-%lx %4s", &lo, &hi, perm) != 3) {
+            continue;
+        }
+        if ((hi <= start) || (lo >= end)) {
+            continue;
+        }
+        if (cnt >= max) {
+            error("too many mappings in 0x%lx-0x%lx\n", (unsigned long)start, (unsigned long)end);
+            cnt = -1;
+            break;
+        }
+
+        s[cnt] = (lo > start) ? lo : start;
+        e[cnt] = (hi < end) ? hi : end;
+        prot[cnt] = ((perm[0] == 'r') ? PROT_READ : 0) |
+            ((perm[1] == 'w') ? PROT_WRITE : 0) |
+            ((perm[2] == 'x') ? PROT_EXEC : 0);
+        cnt += 1;
+    }
+    fclose(fp);
+
+    return cnt;
+}
+
+#if defined(UT)
+TEST(detour, get_range_prot)
+{
+    int prot[2] = { 0 };
+    uintptr_t s[2] = { 0 };
+    uintptr_t e[2] = { 0 };
+    uint8_t *p = NULL;
+
+    TEST_ASSERT_EQUAL_INT(-1, get_range_prot(0x2000, 0x1000, s, e, prot, 2));
+
+    p = mmap(NULL, page_size * 2, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_ASSERT_TRUE(p != MAP_FAILED);
+    TEST_ASSERT_EQUAL_INT(0, mprotect(p + page_size, page_size, PROT_READ | PROT_EXEC));
+    TEST_ASSERT_EQUAL_INT(2, get_range_prot((uintptr_t)p, (uintptr_t)p + page_size * 2, s, e, prot, 2));
+    TEST_ASSERT_EQUAL_INT(PROT_READ, prot[0]);
+    TEST_ASSERT_EQUAL_INT(PROT_READ | PROT_EXEC, prot[1]);
+    TEST_ASSERT_EQUAL_HEX32((uintptr_t)p + page_size, e[0]);
+    TEST_ASSERT_EQUAL_HEX32((uintptr_t)p + page_size, s[1]);
+    TEST_ASSERT_EQUAL_INT(-1, get_range_prot((uintptr_t)p, (uintptr_t)p + page_size * 2, s, e, prot, 1));
+    munmap(p, page_size * 2);
+}
+#endif
+
+static int write_patch(const patch_t *p)
+{
+    int cc = 0;
+    int cnt = 0;
+    uint32_t w[RESTORE_BUF_SIZE / 4] = { 0 };
+    uint32_t *m = NULL;
+
+    if (!p || !p->addr || (p->len <= 0) || (p->len > RESTORE_BUF_SIZE)) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    m = (uint32_t *)p->addr;
+    if ((((uintptr_t)m | p->len) & 3)) {
+        memcpy(p->addr, p->data, p->len);
+        return 0;
+    }
+
+    // a core entering the function sees either the old or the new first
+    // word, so the literal goes in before "ldr pc, [pc, #-4]" (or the arm64
+    // "ldr x16, #8") and the first word goes back before the rest on removal
+    cnt = p->len / 4;
+    memcpy(w, p->data, p->len);
+    if ((w[0] == 0xe51ff004) || (w[0] == 0x58000050)) {
+        for (cc = cnt - 1; cc >= 0; cc--) {
+            __atomic_store_n(&m[cc], w[cc], __ATOMIC_RELEASE);
+        }
+    }
+    else {
+        for (cc = 0; cc < cnt; cc++) {
+            __atomic_store_n(&m[cc], w[cc], __ATOMIC_RELEASE);
+        }
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, write_patch)
+{
+    uint32_t fn[2] = { 0 };
+    uint8_t buf[3] = { 0 };
+    patch_t p = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, write_patch(NULL));
+    TEST_ASSERT_EQUAL_INT(-1, write_patch(&p));
+
+    p.addr = fn;
+    p.len = 8;
+    ((uint32_t *)p.data)[0] = 0xe51ff004;
+    ((uint32_t *)p.data)[1] = 0x1234;
+    TEST_ASSERT_EQUAL_INT(0, write_patch(&p));
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, fn[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x1234, fn[1]);
+
+    p.addr = &buf[1];
+    p.len = 2;
+    TEST_ASSERT_EQUAL_INT(0, write_patch(&p));
+    TEST_ASSERT_EQUAL_HEX8(0x04, buf[1]);
+}
+#endif
+
+int begin_patch(void)
+{
+    trace("call %s()\n", __func__);
+
+    pthread_mutex_lock(&mytxn.lock);
+    mytxn.active = 1;
+    mytxn.owner = pthread_self();
+    mytxn.cnt = 0;
+    mytxn.hooks = 0;
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, begin_patch)
+{
+    TEST_ASSERT_EQUAL_INT(0, begin_patch());
+    TEST_ASSERT_EQUAL_INT(1, mytxn.active);
+    TEST_ASSERT_EQUAL_INT(0, commit_patch());
+    TEST_ASSERT_EQUAL_INT(0, mytxn.active);
+}
+#endif
+
+static int queue_patch(void *addr, const void *data, int len)
+{
+    patch_t *p = NULL;
+
+    trace("call %s(addr=%p, data=%p, len=%d)\n", __func__, addr, data, len);
+
+    if (!addr || !data || (len <= 0) || (len > RESTORE_BUF_SIZE)) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    if (mytxn.cnt >= MAX_PATCH_TXN) {
+        error("too many patches in one transaction\n");
+        return -1;
+    }
+
+    p = &mytxn.patch[mytxn.cnt++];
+    p->addr = addr;
+    p->len = len;
+    memcpy(p->data, data, len);
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, queue_patch)
+{
+    uint32_t v = 0;
+
+    mytxn.cnt = 0;
+    TEST_ASSERT_EQUAL_INT(-1, queue_patch(NULL, &v, 4));
+    TEST_ASSERT_EQUAL_INT(-1, queue_patch(&v, &v, RESTORE_BUF_SIZE + 1));
+    TEST_ASSERT_EQUAL_INT(0, queue_patch(&v, &v, 4));
+    TEST_ASSERT_EQUAL_INT(1, mytxn.cnt);
+    mytxn.cnt = 0;
+}
+#endif
+
+static int get_patch_ranges(uintptr_t *start, uintptr_t *end, int max)
+{
+    int i = 0;
+    int cc = 0;
+    int cnt = 0;
+    uintptr_t s = 0;
+    uintptr_t e = 0;
+    uintptr_t mask = ~(uintptr_t)(page_size - 1);
+
+    if (mytxn.cnt > max) {
+        error("too many ranges\n");
+        return -1;
+    }
+
+    for (cc = 0; cc < mytxn.cnt; cc++) {
+        s = (uintptr_t)mytxn.patch[cc].addr & mask;
+        e = ((uintptr_t)mytxn.patch[cc].addr + mytxn.patch[cc].len + page_size - 1) & mask;
+
+        for (i = cnt; (i > 0) && (start[i - 1] > s); i--) {
+            start[i] = start[i - 1];
+            end[i] = end[i - 1];
+        }
+        start[i] = s;
+        end[i] = e;
+        cnt += 1;
+    }
+
+    // merge overlapping or adjacent pages so each gets one mprotect()
+    for (cc = 0, i = 0; cc < cnt; cc++) {
+        if (i && (start[cc] <= end[i - 1])) {
+            if (end[cc] > end[i - 1]) {
+                end[i - 1] = end[cc];
+            }
+            continue;
+        }
+        start[i] = start[cc];
+        end[i] = end[cc];
+        i += 1;
+    }
+
+    return i;
+}
+
+#if defined(UT)
+TEST(detour, get_patch_ranges)
+{
+    uint32_t v = 0;
+    uintptr_t start[MAX_PATCH_TXN] = { 0 };
+    uintptr_t end[MAX_PATCH_TXN] = { 0 };
+
+    mytxn.cnt = 0;
+    TEST_ASSERT_EQUAL_INT(0, get_patch_ranges(start, end, MAX_PATCH_TXN));
+
+    queue_patch((void *)0x5000, &v, 4);
+    queue_patch((void *)0x1ffc, &v, 8);
+    queue_patch((void *)0x1000, &v, 4);
+    queue_patch((void *)0x3010, &v, 4);
+    TEST_ASSERT_EQUAL_INT(2, get_patch_ranges(start, end, MAX_PATCH_TXN));
+    TEST_ASSERT_EQUAL_HEX32(0x1000, start[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x4000, end[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x5000, start[1]);
+    TEST_ASSERT_EQUAL_HEX32(0x6000, end[1]);
+    mytxn.cnt = 0;
+}
+#endif
+
+int commit_patch(void)
+{
+    int r = 0;
+    int n = 0;
+    int cc = 0;
+    int cnt = 0;
+    int fail = 0;
+    uintptr_t start[MAX_PATCH_TXN] = { 0 };
+    uintptr_t end[MAX_PATCH_TXN] = { 0 };
+    uintptr_t ps[MAX_PATCH_PROT] = { 0 };
+    uintptr_t pe[MAX_PATCH_PROT] = { 0 };
+    int prot[MAX_PATCH_PROT] = { 0 };
+
+    trace("call %s(cnt=%d)\n", __func__, mytxn.cnt);
+
+    if (!mytxn.active || !pthread_equal(mytxn.owner, pthread_self())) {
+        error("no transaction in progress\n");
+        return -1;
+    }
+
+    cnt = get_patch_ranges(start, end, MAX_PATCH_TXN);
+    for (cc = 0; cc < cnt; cc++) {
+        r = get_range_prot(start[cc], end[cc], &ps[n], &pe[n], &prot[n], MAX_PATCH_PROT - n);
+        if (r <= 0) {
+            error("failed to read protection of 0x%lx-0x%lx\n", (unsigned long)start[cc], (unsigned long)end[cc]);
+            r = -1;
+            break;
+        }
+        n += r;
+        r = 0;
+
+        if (protect_range(start[cc], end[cc], PROT_READ | PROT_WRITE | PROT_EXEC) < 0) {
+            error("failed to unprotect 0x%lx-0x%lx\n", (unsigned long)start[cc], (unsigned long)end[cc]);
+            r = -1;
+            break;
+        }
+    }
+
+    if (cnt < 0) {
+        r = -1;
+    }
+
+    for (cc = 0; cc < mytxn.cnt; cc++) {
+        mytxn.patch[cc].done = 0;
+        if (r < 0) {
+            fail += 1;
+            continue;
+        }
+
+        mytxn.patch[cc].done = (write_patch(&mytxn.patch[cc]) == 0);
+        fail += !mytxn.patch[cc].done;
+        __builtin___clear_cache(
+            (char *)mytxn.patch[cc].addr,
+            (char *)mytxn.patch[cc].addr + mytxn.patch[cc].len
+        );
+    }
+
+    // put back what each mapping had before, even after a failure
+    while (n-- > 0) {
+        protect_range(ps[n], pe[n], prot[n]);
+    }
+
+    if (fail) {
+        error("failed to write %d of %d patches\n", fail, mytxn.cnt);
+        r = -1;
+    }
+    trace("committed %d patches over %d ranges\n", mytxn.cnt - fail, cnt);
+
+    if (mytxn.hooks) {
+        finish_hook_txn();
+    }
+    if (fail) {
+        sync_replace();
+    }
+    mytxn.cnt = 0;
+    mytxn.hooks = 0;
+    mytxn.active = 0;
+    pthread_mutex_unlock(&mytxn.lock);
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, commit_patch)
+{
+    uint32_t fn[4] = { 0 };
+    uint32_t w[2] = { 0xe51ff004, 0x1000 };
+
+    TEST_ASSERT_EQUAL_INT(-1, commit_patch());
+
+    TEST_ASSERT_EQUAL_INT(0, begin_patch());
+    TEST_ASSERT_EQUAL_INT(0, apply_patch(&fn[0], w, sizeof(w)));
+    TEST_ASSERT_EQUAL_INT(0, apply_patch(&fn[2], w, sizeof(w)));
+    TEST_ASSERT_EQUAL_HEX32(0, fn[0]);
+    TEST_ASSERT_EQUAL_INT(0, commit_patch());
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, fn[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x1000, fn[3]);
+}
+#endif
+
+int apply_patch(void *addr, const void *data, int len)
+{
+    trace("call %s(addr=%p, data=%p, len=%d)\n", __func__, addr, data, len);
+
+    if (!addr || !data) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    if (mytxn.active && pthread_equal(mytxn.owner, pthread_self())) {
+        return queue_patch(addr, data, len);
+    }
+
+    begin_patch();
+    if (queue_patch(addr, data, len) < 0) {
+        mytxn.active = 0;
+        pthread_mutex_unlock(&mytxn.lock);
+        return -1;
+    }
+
+    return commit_patch();
+}
+
+#if defined(UT)
+TEST(detour, apply_patch)
+{
+    uint32_t v = 0;
+    uint32_t w = 0xe3a03006;
+
+    TEST_ASSERT_EQUAL_INT(-1, apply_patch(NULL, &w, 4));
+    TEST_ASSERT_EQUAL_INT(0, apply_patch(&v, &w, 4));
+    TEST_ASSERT_EQUAL_HEX32(w, v);
+    TEST_ASSERT_EQUAL_INT(-1, apply_patch(&v, &w, 0));
+    TEST_ASSERT_EQUAL_INT(0, mytxn.active);
+}
+#endif
+
+static int build_hook_stub(const void *cb, uint32_t *w)
+{
+    if (!w) {
+        error("invalid input\n");
+        return -1;
+    }
+
+#if defined(NDS_ARM64)
+    // same shape as the offline drastic64 patch but through x16 (ip0),
+    // which the callee may clobber, instead of the x2 argument register
+    w[0] = 0x58000050;          // ldr x16, #8
+    w[1] = 0xd61f0200;          // br x16
+    put_arm64_addr(&w[2], (uintptr_t)cb);
+#else
+    w[0] = 0xe51ff004;          // ldr pc, [pc, #-4]
+    w[1] = (uint32_t)(uintptr_t)cb;
+#endif
+
+    return HOOK_PATCH_SIZE;
+}
+
+#if defined(UT)
+TEST(detour, build_hook_stub)
+{
+    uint32_t w[HOOK_PATCH_SIZE / 4] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, build_hook_stub(NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(HOOK_PATCH_SIZE, build_hook_stub((void *)0x1234, w));
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, w[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x1234, w[1]);
+}
+#endif
+
+static int write_hook_patch(void *target, const void *data)
+{
+    trace("call %s(target=%p, data=%p)\n", __func__, target, data);
+
+    return apply_patch(target, data, HOOK_PATCH_SIZE);
+}
+
+#if defined(UT)
+TEST(detour, write_hook_patch)
+{
+    uint32_t fn[2] = { 0 };
+    uint32_t w[2] = { 0xe51ff004, 0x1234 };
+
+    TEST_ASSERT_EQUAL_INT(-1, write_hook_patch(NULL, w));
+    TEST_ASSERT_EQUAL_INT(0, write_hook_patch(fn, w));
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, fn[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x1234, fn[1]);
+}
+#endif
+
+static hook_t* find_hook(const void *target)
+{
+    int cc = 0;
+
+    for (cc = 0; cc < MAX_HOOK; cc++) {
+        if ((myreg.hook[cc].applied || myreg.hook[cc].pending) && (myreg.hook[cc].target == target)) {
+            return &myreg.hook[cc];
+        }
+    }
+
+    return NULL;
+}
+
+#if defined(UT)
+TEST(detour, find_hook)
+{
+    TEST_ASSERT_NULL(find_hook((void *)0xdead));
+}
+#endif
+
+static int is_hook_applied(const void *target)
+{
+    int r = 0;
+    hook_t *h = NULL;
+
+    pthread_mutex_lock(&myreg.lock);
+    h = find_hook(target);
+    r = h && h->applied;
+    pthread_mutex_unlock(&myreg.lock);
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, is_hook_applied)
+{
+    uint32_t fn[2] = { 0xe3a00001, 0xe12fff1e };
+
+    TEST_ASSERT_EQUAL_INT(0, is_hook_applied(fn));
+    TEST_ASSERT_EQUAL_INT(0, add_hook(NULL, fn, (void *)0x1000, NULL));
+    TEST_ASSERT_EQUAL_INT(1, is_hook_applied(fn));
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn));
+    TEST_ASSERT_EQUAL_INT(0, is_hook_applied(fn));
+}
+#endif
+
+static int set_hook_pos(const void *target, uintptr_t pos)
+{
+    int r = -1;
+    hook_t *h = NULL;
+
+    pthread_mutex_lock(&myreg.lock);
+    h = find_hook(target);
+    if (h) {
+        h->pos = pos;
+        r = 0;
+    }
+    pthread_mutex_unlock(&myreg.lock);
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, set_hook_pos)
+{
+    uint32_t fn[2] = { 0xe3a00001, 0xe12fff1e };
+
+    TEST_ASSERT_EQUAL_INT(-1, set_hook_pos(fn, 0x100));
+    TEST_ASSERT_EQUAL_INT(0, begin_patch());
+    TEST_ASSERT_EQUAL_INT(0, add_hook(NULL, fn, (void *)0x1000, NULL));
+    TEST_ASSERT_EQUAL_INT(0, set_hook_pos(fn, 0x100));
+    TEST_ASSERT_EQUAL_HEX32(0x100, find_hook(fn)->pos);
+    TEST_ASSERT_EQUAL_INT(0, commit_patch());
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn));
+}
+#endif
+
+int add_hook(const char *name, void *target, void *cb, void **org)
+{
+    int r = -1;
+    int cc = 0;
+    int own = 0;
+    hook_t *h = NULL;
+    void *thunk = NULL;
+    void *spare = NULL;
+    uint32_t *tramp = NULL;
+    uint32_t stub[HOOK_PATCH_SIZE / 4] = { 0 };
+
+    trace("call %s(name=%s, target=%p, cb=%p, org=%p)\n", __func__, name ? name : "", target, cb, org);
+
+    if (!target || !cb) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    // always take mytxn.lock before myreg.lock, commit_patch() finalizes
+    // the registry while it still holds the transaction
+    own = !mytxn.active || !pthread_equal(mytxn.owner, pthread_self());
+    if (own) {
+        begin_patch();
+    }
+
+    pthread_mutex_lock(&myreg.lock);
+    do {
+        h = find_hook(target);
+        if (h) {
+            if (h->cb == cb) {
+                r = 0;
+                if (org) {
+                    *org = h->tramp;
+                }
+            }
+            else {
+                error("%p is already hooked by %p\n", target, h->cb);
+            }
+            break;
+        }
+
+        // prefer the slot this target had before, then one never used
+        for (cc = 0; cc < MAX_HOOK; cc++) {
+            if (!myreg.hook[cc].applied && !myreg.hook[cc].pending && (myreg.hook[cc].target == target)) {
+                h = &myreg.hook[cc];
+                break;
+            }
+        }
+        for (cc = 0; !h && (cc < MAX_HOOK); cc++) {
+            if (!myreg.hook[cc].applied && !myreg.hook[cc].pending && !myreg.hook[cc].target) {
+                h = &myreg.hook[cc];
+            }
+        }
+        for (cc = 0; !h && (cc < MAX_HOOK); cc++) {
+            if (!myreg.hook[cc].applied && !myreg.hook[cc].pending) {
+                h = &myreg.hook[cc];
+            }
+        }
+
+        if (!h) {
+            error("too many hooks\n");
+            break;
+        }
+
+        // a removed hook keeps its trampoline and thunk, a thread may still
+        // run through them, so they are only rebuilt with the same code: the
+        // trampoline for the same target, the thunk for the same slot id
+        if (h->target == target) {
+            tramp = h->tramp;
+        }
+        if (org) {
+            if (!tramp) {
+                tramp = alloc_tramp();
+            }
+            if (!tramp || (build_tramp(target, tramp) < 0)) {
+                break;
+            }
+        }
+
+        // with neither profiling nor the crash ring the stub goes straight to cb
+        if (myprof.enable || mycrash.record) {
+            thunk = build_hook_thunk(h - myreg.hook, cb, h->thunk, myprof.enable);
+            if (!thunk) {
+                error("unable to wrap %p, hook it directly\n", target);
+            }
+        }
+        if (myprof.enable) {
+            for (cc = 0; cc < MAX_PROF_THREAD; cc++) {
+                memset(&myprof.slot[cc][h - myreg.hook], 0, sizeof(hook_prof_t));
+            }
+        }
+
+        spare = h->thunk;
+        memset(h, 0, sizeof(hook_t));
+        h->name = name;
+        h->target = target;
+        h->cb = cb;
+        h->tramp = tramp;
+        h->thunk = thunk ? thunk : spare;
+        memcpy(h->org, target, HOOK_PATCH_SIZE);
+
+        build_hook_stub(thunk ? thunk : cb, stub);
+        if (write_hook_patch(target, stub) < 0) {
+            break;
+        }
+
+        // the stub is only queued, commit_patch() decides
+        h->pending = 1;
+        mytxn.hooks += 1;
+        if (org) {
+            *org = tramp;
+        }
+        r = 0;
+    } while (0);
+    pthread_mutex_unlock(&myreg.lock);
+
+    if (own && (commit_patch() < 0)) {
+        r = -1;
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, add_hook)
+{
+    int used = 0;
+    void *org = NULL;
+    uint32_t *tramp = NULL;
+    uint32_t fn[4] = { 0xe92d4010, 0xe59f3004, 0xe3a00000, 0xe8bd8010 };
+
+    TEST_ASSERT_EQUAL_INT(-1, add_hook("ut", NULL, NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(0, add_hook("ut", fn, (void *)0x1000, &org));
+    TEST_ASSERT_NOT_NULL(org);
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, fn[0]);
+
+    TEST_ASSERT_EQUAL_HEX32(0x1000, fn[1]);
+    TEST_ASSERT_NULL(find_hook(fn)->thunk);
+
+    tramp = (uint32_t *)org;
+    TEST_ASSERT_EQUAL_HEX32(0xe92d4010, tramp[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xe59f3004, tramp[1]);
+    TEST_ASSERT_EQUAL_HEX32(0xe5933000, tramp[2]);
+    TEST_ASSERT_EQUAL_HEX32(0xea000000, tramp[3]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(uintptr_t)&fn[1] + 12, tramp[4]);
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, tramp[5]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(uintptr_t)&fn[2], tramp[6]);
+
+    TEST_ASSERT_EQUAL_INT(0, add_hook("ut", fn, (void *)0x1000, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, add_hook("ut", fn, (void *)0x2000, NULL));
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn));
+    TEST_ASSERT_EQUAL_HEX32(0xe92d4010, fn[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xe59f3004, fn[1]);
+
+    // the crash ring alone still goes through the note thunk
+    mycrash.record = 1;
+    TEST_ASSERT_EQUAL_INT(0, add_hook("ut", fn, (void *)0x1000, NULL));
+    tramp = (uint32_t *)find_hook(fn)->thunk;
+    TEST_ASSERT_NOT_NULL(tramp);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(uintptr_t)tramp, fn[1]);
+    TEST_ASSERT_EQUAL_HEX32(0x1000, tramp[11]);
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn));
+    mycrash.record = 0;
+
+    myprof.enable = 1;
+    TEST_ASSERT_EQUAL_INT(0, add_hook("ut", fn, (void *)0x1000, NULL));
+    tramp = (uint32_t *)find_hook(fn)->thunk;
+    TEST_ASSERT_NOT_NULL(tramp);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(uintptr_t)tramp, fn[1]);
+    TEST_ASSERT_EQUAL_HEX32(0x1000, tramp[22]);
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn));
+    TEST_ASSERT_EQUAL_HEX32(0xe92d4010, fn[0]);
+
+    // remove and add again reuses the same trampoline and thunk
+    used = myreg.pool_used;
+    TEST_ASSERT_EQUAL_INT(0, add_hook("ut", fn, (void *)0x2000, &org));
+    TEST_ASSERT_EQUAL_PTR(tramp, find_hook(fn)->thunk);
+    TEST_ASSERT_EQUAL_HEX32(0x2000, tramp[22]);
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn));
+    TEST_ASSERT_EQUAL_INT(0, add_hook("ut", fn, (void *)0x2000, &org));
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn));
+    TEST_ASSERT_EQUAL_INT(used, myreg.pool_used);
+    myprof.enable = 0;
+}
+#endif
+
+int remove_hook(void *target)
+{
+    int r = -1;
+    int own = 0;
+    hook_t *h = NULL;
+
+    trace("call %s(target=%p)\n", __func__, target);
+
+    if (!target) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    own = !mytxn.active || !pthread_equal(mytxn.owner, pthread_self());
+    if (own) {
+        begin_patch();
+    }
+
+    pthread_mutex_lock(&myreg.lock);
+    h = find_hook(target);
+    if (h && h->pending) {
+        error("%p is not committed yet\n", target);
+    }
+    else if (h) {
+        r = write_hook_patch(target, h->org);
+        if (r == 0) {
+            h->pending = -1;
+            mytxn.hooks += 1;
+        }
+    }
+    pthread_mutex_unlock(&myreg.lock);
+
+    if (own && (commit_patch() < 0)) {
+        r = -1;
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, remove_hook)
+{
+    uint32_t fn[2] = { 0xe3a00001, 0xe12fff1e };
+
+    TEST_ASSERT_EQUAL_INT(-1, remove_hook(NULL));
+    TEST_ASSERT_EQUAL_INT(-1, remove_hook(fn));
+    TEST_ASSERT_EQUAL_INT(0, add_hook(NULL, fn, (void *)0x1000, NULL));
+    TEST_ASSERT_EQUAL_INT(1, get_hook_cnt());
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn));
+    TEST_ASSERT_EQUAL_INT(0, get_hook_cnt());
+    TEST_ASSERT_EQUAL_HEX32(0xe3a00001, fn[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xe12fff1e, fn[1]);
+}
+#endif
+
+static int is_patch_done(const void *addr)
+{
+    int cc = 0;
+
+    // the last patch queued for an address is what ended up in memory
+    for (cc = mytxn.cnt - 1; cc >= 0; cc--) {
+        if (mytxn.patch[cc].addr == addr) {
+            return mytxn.patch[cc].done;
+        }
+    }
+
+    return 0;
+}
+
+// runs from commit_patch() with mytxn.lock held, only this transaction's
+// hooks are pending, and each follows what its own patch did
+static void finish_hook_txn(void)
+{
+    int cc = 0;
+    hook_t *h = NULL;
+
+    trace("call %s()\n", __func__);
+
+    pthread_mutex_lock(&myreg.lock);
+    for (cc = 0; cc < MAX_HOOK; cc++) {
+        h = &myreg.hook[cc];
+        if (!h->pending || !is_patch_done(h->target)) {
+#if defined(NDS_ARM64)
+            // the offline patch only takes effect on the next launch
+            if ((h->pending == 1) && h->pos) {
+                error("failed to hook %p in memory, patch drastic64 instead\n", h->target);
+                patch_drastic64(h->pos, (uintptr_t)h->cb);
+            }
+#endif
+            h->pending = 0;
+            continue;
+        }
+
+        if (h->pending == 1) {
+            h->applied = 1;
+            myreg.cnt += 1;
+        }
+        else {
+            h->applied = 0;
+            myreg.cnt -= 1;
+        }
+        h->pending = 0;
+    }
+    pthread_mutex_unlock(&myreg.lock);
+}
+
+#if defined(UT)
+TEST(detour, finish_hook_txn)
+{
+    uint32_t fn[2] = { 0xe3a00001, 0xe12fff1e };
+    uint32_t fn2[2] = { 0xe3a00002, 0xe12fff1e };
+
+    TEST_ASSERT_EQUAL_INT(0, begin_patch());
+    TEST_ASSERT_EQUAL_INT(0, add_hook(NULL, fn, (void *)0x1000, NULL));
+    TEST_ASSERT_EQUAL_INT(0, get_hook_cnt());
+    TEST_ASSERT_EQUAL_INT(-1, remove_hook(fn));
+    TEST_ASSERT_EQUAL_INT(0, commit_patch());
+    TEST_ASSERT_EQUAL_INT(1, get_hook_cnt());
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, fn[0]);
+
+    TEST_ASSERT_EQUAL_INT(0, begin_patch());
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn));
+    TEST_ASSERT_EQUAL_INT(1, get_hook_cnt());
+    TEST_ASSERT_EQUAL_INT(0, commit_patch());
+    TEST_ASSERT_EQUAL_INT(0, get_hook_cnt());
+    TEST_ASSERT_EQUAL_HEX32(0xe3a00001, fn[0]);
+
+    // a commit that cannot write leaves the slot free and the count alone
+    TEST_ASSERT_EQUAL_INT(0, begin_patch());
+    TEST_ASSERT_EQUAL_INT(0, add_hook(NULL, fn, (void *)0x1000, NULL));
+    mytxn.patch[0].len = 0;
+    TEST_ASSERT_EQUAL_INT(-1, commit_patch());
+    TEST_ASSERT_EQUAL_INT(0, get_hook_cnt());
+    TEST_ASSERT_NULL(find_hook(fn));
+    TEST_ASSERT_EQUAL_HEX32(0xe3a00001, fn[0]);
+
+    // one bad patch only drops its own hook, the other one is in memory
+    TEST_ASSERT_EQUAL_INT(0, begin_patch());
+    TEST_ASSERT_EQUAL_INT(0, add_hook(NULL, fn, (void *)0x1000, NULL));
+    TEST_ASSERT_EQUAL_INT(0, add_hook(NULL, fn2, (void *)0x2000, NULL));
+    mytxn.patch[0].len = 0;
+    TEST_ASSERT_EQUAL_INT(-1, commit_patch());
+    TEST_ASSERT_EQUAL_INT(1, get_hook_cnt());
+    TEST_ASSERT_NULL(find_hook(fn));
+    TEST_ASSERT_NOT_NULL(find_hook(fn2));
+    TEST_ASSERT_EQUAL_HEX32(0xe3a00001, fn[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, fn2[0]);
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn2));
+    TEST_ASSERT_EQUAL_INT(0, get_hook_cnt());
+}
+#endif
+
+int get_hook_cnt(void)
+{
+    int r = 0;
+
+    pthread_mutex_lock(&myreg.lock);
+    r = myreg.cnt;
+    pthread_mutex_unlock(&myreg.lock);
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, get_hook_cnt)
+{
+    TEST_ASSERT_EQUAL_INT(0, get_hook_cnt());
+}
+#endif
+
+int get_hook_info(int idx, hook_t *info)
+{
+    int r = -1;
+    int cc = 0;
+    int cnt = 0;
+
+    trace("call %s(idx=%d, info=%p)\n", __func__, idx, info);
+
+    if ((idx < 0) || !info) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    pthread_mutex_lock(&myreg.lock);
+    for (cc = 0; cc < MAX_HOOK; cc++) {
+        if (myreg.hook[cc].applied && (cnt++ == idx)) {
+            memcpy(info, &myreg.hook[cc], sizeof(hook_t));
+            r = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&myreg.lock);
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, get_hook_info)
+{
+    hook_t info = { 0 };
+    uint32_t fn[2] = { 0xe3a00001, 0xe12fff1e };
+
+    TEST_ASSERT_EQUAL_INT(-1, get_hook_info(0, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, get_hook_info(0, &info));
+    TEST_ASSERT_EQUAL_INT(0, add_hook("ut", fn, (void *)0x1000, NULL));
+    TEST_ASSERT_EQUAL_INT(0, get_hook_info(0, &info));
+    TEST_ASSERT_EQUAL_STRING("ut", info.name);
+    TEST_ASSERT_EQUAL_PTR(fn, info.target);
+    TEST_ASSERT_EQUAL_HEX32(0xe3a00001, *(uint32_t *)info.org);
+    TEST_ASSERT_EQUAL_INT(0, print_hooks());
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(fn));
+}
+#endif
+
+int print_hooks(void)
+{
+    int cc = 0;
+    hook_t info = { 0 };
+
+    trace("call %s()\n", __func__);
+
+    while (get_hook_info(cc, &info) == 0) {
+        printf(
+            "[HOOK] %-40s %p -> %p (trampoline %p)\n",
+            info.name ? info.name : "(unnamed)",
+            info.target,
+            info.cb,
+            info.tramp
+        );
+        cc += 1;
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, print_hooks)
+{
+    TEST_ASSERT_EQUAL_INT(0, print_hooks());
+}
+#endif
+
+static const char* get_slot_name(const void *addr)
+{
+    int cc = 0;
+
+    for (cc = 0; addr && (cc < (int)(sizeof(mysym_slot) / sizeof(mysym_slot[0]))); cc++) {
+        if (*mysym_slot[cc].slot == addr) {
+            return mysym_slot[cc].name;
+        }
+    }
+
+    return NULL;
+}
+
+#if defined(UT)
+TEST(detour, get_slot_name)
+{
+    void *menu = myhook.fun.menu;
+
+    myhook.fun.menu = (void *)0xbeef;
+    TEST_ASSERT_NULL(get_slot_name(NULL));
+    TEST_ASSERT_EQUAL_STRING("menu", get_slot_name((void *)0xbeef));
+    myhook.fun.menu = menu;
+}
+#endif
+
+static int is_text_range(const void *p, int len)
+{
+    return p && ((uintptr_t)p >= mytext.start) && (((uintptr_t)p + len) <= mytext.end);
+}
+
+#if defined(UT)
+TEST(detour, is_text_range)
+{
+    uintptr_t start = mytext.start;
+    uintptr_t end = mytext.end;
+
+    mytext.start = 0x1000;
+    mytext.end = 0x2000;
+    TEST_ASSERT_EQUAL_INT(0, is_text_range(NULL, 4));
+    TEST_ASSERT_EQUAL_INT(0, is_text_range((void *)0xffc, 4));
+    TEST_ASSERT_EQUAL_INT(1, is_text_range((void *)0x1ffc, 4));
+    TEST_ASSERT_EQUAL_INT(0, is_text_range((void *)0x1ffc, 8));
+    mytext.start = start;
+    mytext.end = end;
+}
+#endif
+
+static const symbol_t* find_symbol_by_value(const void *v)
+{
+    int cc = 0;
+
+    for (cc = 0; v && (cc < mysym.cnt); cc++) {
+        if ((void *)(mysym.sym[cc].addr - mysym.base) == v) {
+            return &mysym.sym[cc];
+        }
+    }
+
+    return NULL;
+}
+
+#if defined(UT)
+TEST(detour, find_symbol_by_value)
+{
+    TEST_ASSERT_NULL(find_symbol_by_value(NULL));
+    TEST_ASSERT_NULL(find_symbol_by_value((void *)0xdead));
+}
+#endif
+
+static int check_prologue(const void *org, const void *addr)
+{
+    const symbol_t *sym = NULL;
+
+    trace("call %s(org=%p, addr=%p)\n", __func__, org, addr);
+
+    if (!is_text_range(addr, RESTORE_BUF_SIZE)) {
+        error("%p is outside drastic text, refuse to hook\n", addr);
+        return -1;
+    }
+
+    sym = find_symbol_by_value(org);
+    if (sym && sym->sig_len && memcmp(addr, sym->sig, sym->sig_len)) {
+        error("prologue of %s at %p does not match, refuse to hook\n", sym->name, addr);
+        return -1;
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, check_prologue)
+{
+    TEST_ASSERT_EQUAL_INT(-1, check_prologue(NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, check_prologue((void *)0xdead, (void *)0xdead));
+}
+#endif
+
+static void* get_prehook_addr(void *org)
+{
+#if defined(NDS_ARM64)
+    // arm64 table entries are file offsets into drastic64
+    return get_text_addr((uintptr_t)org);
+#else
+    return org;
+#endif
+}
+
+#if defined(UT)
+TEST(detour, get_prehook_addr)
+{
+    TEST_ASSERT_NULL(get_prehook_addr(NULL));
+    TEST_ASSERT_EQUAL_PTR((void *)0xdead, get_prehook_addr((void *)0xdead));
+}
+#endif
+
+int add_prehook(void *org, void *cb, uint8_t *restore)
+{
+    int r = -1;
+    void *addr = org;
+
+    trace("call %s(org=%p, cb=%p)\n", __func__, org, cb);
+
+    if (!org || !cb) {
+        error("invalid pointer\n");
+        return r;
+    }
+
+    if (!mysym.valid) {
+        error("symbols are not verified, refuse to hook\n");
+        return -1;
+    }
+
+    addr = get_prehook_addr(org);
+    if (check_prologue(org, addr) < 0) {
+        return -1;
+    }
+
+    if (restore) {
+        trace("backup prehook data\n");
+        memcpy(restore, addr, RESTORE_BUF_SIZE);
+    }
+
+#if defined(NDS_ARM64)
+    if (add_hook(get_slot_name(org), addr, cb, NULL) == 0) {
+        // a queued hook that fails in commit_patch() falls back the same way
+        set_hook_pos(addr, (uintptr_t)org);
+        return 0;
+    }
+
+    // the offline patch only takes effect on the next launch
+    error("failed to hook 0x%lx in memory, patch drastic64 instead\n", (unsigned long)(uintptr_t)org);
+    r = patch_drastic64((uintptr_t)org, (uintptr_t)cb);
+#else
+    r = add_hook(get_slot_name(org), addr, cb, NULL);
+#endif
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, add_prehook)
+{
+    TEST_ASSERT_EQUAL_INT(-1, add_prehook(0, 0, 0));
+    TEST_ASSERT_EQUAL_INT(-1, add_prehook((void *)0xdead, (void *)0xdead, (uint8_t *)0xdead));
+}
+#endif
+
+int restore_prehook(void *pfn, uint8_t *org)
+{
+    int r = -1;
+
+    trace("call %s(pfn=%p, org=%p)\n", __func__, pfn, org);
+
+    if (!pfn || !org) {
+        error("invalid parameter\n");
+        return r;
+    }
+
+    if (!is_text_range(pfn, RESTORE_BUF_SIZE)) {
+        error("%p is outside drastic text\n", pfn);
+        return r;
+    }
+
+    // the registry knows the exact patch, raw bytes are for unknown ones
+    r = remove_hook(pfn);
+    if (r < 0) {
+        r = apply_patch(pfn, org, RESTORE_BUF_SIZE);
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, restore_prehook)
+{
+    TEST_ASSERT_EQUAL_INT(-1, restore_prehook(0, 0));
+    TEST_ASSERT_EQUAL_INT(-1, restore_prehook((void *)0xdead, (void *)0xdead));
+}
+#endif
+
+static int is_replace_off(const char *name)
+{
+    int len = 0;
+    const char *p = myconfig.replace.off;
+
+    if (!name) {
+        return 0;
+    }
+
+    len = strlen(name);
+    while (p && *p) {
+        if (!strncmp(p, name, len) && ((p[len] == ',') || (p[len] == 0))) {
+            return 1;
+        }
+
+        p = strchr(p, ',');
+        if (p) {
+            p += 1;
+        }
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, is_replace_off)
+{
+    strcpy(myconfig.replace.off, "adpcm,neon");
+    TEST_ASSERT_EQUAL_INT(0, is_replace_off(NULL));
+    TEST_ASSERT_EQUAL_INT(1, is_replace_off("adpcm"));
+    TEST_ASSERT_EQUAL_INT(1, is_replace_off("neon"));
+    TEST_ASSERT_EQUAL_INT(0, is_replace_off("neo"));
+    TEST_ASSERT_EQUAL_INT(0, is_replace_off("adpcm_decode"));
+    myconfig.replace.off[0] = 0;
+    TEST_ASSERT_EQUAL_INT(0, is_replace_off("adpcm"));
+}
+#endif
+
+static int find_replace(const char *name)
+{
+    int cc = 0;
+
+    for (cc = 0; name && (cc < myrepl.cnt); cc++) {
+        if (!strcmp(myrepl.slot[cc].name, name)) {
+            return cc;
+        }
+    }
+
+    return -1;
+}
+
+#if defined(UT)
+TEST(detour, find_replace)
+{
+    TEST_ASSERT_EQUAL_INT(-1, find_replace(NULL));
+    TEST_ASSERT_EQUAL_INT(-1, find_replace("ut"));
+}
+#endif
+
+static int switch_replace(int idx, int enable)
+{
+    int r = -1;
+
+    trace("call %s(idx=%d, enable=%d)\n", __func__, idx, enable);
+
+    if ((idx < 0) || (idx >= myrepl.cnt)) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    if (myrepl.slot[idx].enable == enable) {
+        return 0;
+    }
+
+    if (enable) {
+        r = add_prehook(myrepl.slot[idx].org, myrepl.slot[idx].cb, NULL);
+    }
+    else {
+        r = remove_hook(get_prehook_addr(myrepl.slot[idx].org));
+    }
+
+    if (r < 0) {
+        error("failed to switch %s %s\n", myrepl.slot[idx].name, enable ? "on" : "off");
+        return -1;
+    }
+
+    myrepl.slot[idx].enable = enable;
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, switch_replace)
+{
+    TEST_ASSERT_EQUAL_INT(-1, switch_replace(-1, 1));
+    TEST_ASSERT_EQUAL_INT(-1, switch_replace(MAX_REPLACE, 1));
+}
+#endif
+
+static void sync_replace(void)
+{
+    int cc = 0;
+
+    trace("call %s()\n", __func__);
+
+    // commit_patch() calls this after a failure, the flags follow what is
+    // really in memory
+    for (cc = 0; cc < myrepl.cnt; cc++) {
+        myrepl.slot[cc].enable = is_hook_applied(get_prehook_addr(myrepl.slot[cc].org));
+    }
+}
+
+#if defined(UT)
+TEST(detour, sync_replace)
+{
+    sync_replace();
+    TEST_ASSERT_EQUAL_INT(0, myrepl.cnt);
+}
+#endif
+
+int add_replace(const char *name, void *org, void *cb)
+{
+    int idx = -1;
+
+    trace("call %s(name=%s, org=%p, cb=%p)\n", __func__, name ? name : "", org, cb);
+
+    if (!name || !org || !cb) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    idx = find_replace(name);
+    if (idx < 0) {
+        if (myrepl.cnt >= MAX_REPLACE) {
+            error("too many replacements\n");
+            return -1;
+        }
+
+        idx = myrepl.cnt++;
+        myrepl.slot[idx].name = name;
+        myrepl.slot[idx].org = org;
+        myrepl.slot[idx].cb = cb;
+        myrepl.slot[idx].enable = 0;
+    }
+    myrepl.slot[idx].req = -1;
+
+    if (is_replace_off(name)) {
+        printf("[REPLACE] %s stays native\n", name);
+        return 0;
+    }
+
+    return switch_replace(idx, 1);
+}
+
+#if defined(UT)
+TEST(detour, add_replace)
+{
+    TEST_ASSERT_EQUAL_INT(-1, add_replace(NULL, NULL, NULL));
+    TEST_ASSERT_EQUAL_INT(-1, add_replace("ut", NULL, (void *)0x1000));
+}
+#endif
+
+int set_replace(const char *name, int enable)
+{
+    int idx = find_replace(name);
+
+    trace("call %s(name=%s, enable=%d)\n", __func__, name ? name : "", enable);
+
+    if (idx < 0) {
+        error("no replacement named %s\n", name ? name : "");
+        return -1;
+    }
+
+    // applied by tick_replace() on the emulator thread
+    __atomic_store_n(&myrepl.slot[idx].req, !!enable, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, set_replace)
+{
+    TEST_ASSERT_EQUAL_INT(-1, set_replace(NULL, 1));
+    TEST_ASSERT_EQUAL_INT(-1, set_replace("ut", 1));
+}
+#endif
+
+int toggle_replace(void)
+{
+    int idx = 0;
+
+    trace("call %s()\n", __func__);
+
+    if (myrepl.cnt == 0) {
+        printf("[REPLACE] (no replacement registered)\n");
+        return -1;
+    }
+
+    idx = myrepl.next++ % myrepl.cnt;
+    __atomic_store_n(&myrepl.slot[idx].req, !myrepl.slot[idx].enable, __ATOMIC_RELEASE);
+
+    return idx;
+}
+
+#if defined(UT)
+TEST(detour, toggle_replace)
+{
+    TEST_ASSERT_EQUAL_INT(-1, toggle_replace());
+}
+#endif
+
+int tick_replace(void)
+{
+    int cc = 0;
+    int req = 0;
+    uint64_t now = get_prof_ns();
+    uint64_t after = 0;
+
+    if (myrepl.last) {
+        myrepl.sum += now - myrepl.last;
+        myrepl.frames += 1;
+    }
+    myrepl.last = now;
+
+    if (myrepl.frames >= REPLACE_FRAMES) {
+        after = myrepl.sum / myrepl.frames;
+        if (myrepl.measure) {
+            cc = myrepl.measure - 1;
+            printf(
+                "[REPLACE] %s %s: %.3f -> %.3f ms/frame (%+.3f ms)\n",
+                myrepl.slot[cc].name,
+                myrepl.slot[cc].enable ? "on" : "off",
+                myrepl.before / 1000000.0,
+                after / 1000000.0,
+                ((int64_t)after - (int64_t)myrepl.before) / 1000000.0
+            );
+            myrepl.measure = 0;
+        }
+        myrepl.prev = after;
+        myrepl.sum = 0;
+        myrepl.frames = 0;
+    }
+
+    for (cc = 0; cc < myrepl.cnt; cc++) {
+        req = __atomic_exchange_n(&myrepl.slot[cc].req, -1, __ATOMIC_ACQ_REL);
+        if (req < 0) {
+            continue;
+        }
+
+        // compare against the last full window of the old state
+        if (!myrepl.measure) {
+            myrepl.before = myrepl.prev ? myrepl.prev : (myrepl.frames ? (myrepl.sum / myrepl.frames) : 0);
+        }
+
+        begin_patch();
+        switch_replace(cc, req);
+        if (commit_patch() < 0) {
+            error("failed to switch %s %s\n", myrepl.slot[cc].name, req ? "on" : "off");
+            continue;
+        }
+
+        printf(
+            "[REPLACE] %s %s, measuring %d frames\n",
+            myrepl.slot[cc].name,
+            myrepl.slot[cc].enable ? "on" : "off",
+            REPLACE_FRAMES
+        );
+        myrepl.measure = cc + 1;
+        myrepl.sum = 0;
+        myrepl.frames = 0;
+        myrepl.last = get_prof_ns();
+    }
+
+    return myrepl.measure;
+}
+
+#if defined(UT)
+TEST(detour, tick_replace)
+{
+    int cc = 0;
+    uint32_t *t = NULL;
+    uintptr_t start = mytext.start;
+    uintptr_t end = mytext.end;
+    int valid = mysym.valid;
+    const uint32_t prologue[] = { 0xe92d4010, 0xe3a00000, 0xe8bd8010, 0xe1a00000 };
+
+    t = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_ASSERT_TRUE(t != MAP_FAILED);
+    memcpy(t, prologue, sizeof(prologue));
+    mysym.valid = 1;
+    mytext.start = (uintptr_t)t;
+    mytext.end = (uintptr_t)t + 4096;
+
+    TEST_ASSERT_EQUAL_INT(0, tick_replace());
+    TEST_ASSERT_EQUAL_INT(0, add_replace("ut", t, (void *)0x1000));
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, t[0]);
+    TEST_ASSERT_EQUAL_INT(0, add_replace("ut", t, (void *)0x1000));
+    TEST_ASSERT_EQUAL_INT(1, myrepl.cnt);
+
+    // nothing changes until the next frame
+    TEST_ASSERT_EQUAL_INT(0, set_replace("ut", 0));
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, t[0]);
+    TEST_ASSERT_EQUAL_INT(1, tick_replace());
+    TEST_ASSERT_EQUAL_MEMORY(prologue, t, sizeof(prologue));
+
+    TEST_ASSERT_EQUAL_INT(0, toggle_replace());
+    TEST_ASSERT_EQUAL_INT(1, tick_replace());
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, t[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x1000, t[1]);
+
+    for (cc = 0; cc < REPLACE_FRAMES; cc++) {
+        tick_replace();
+    }
+    TEST_ASSERT_EQUAL_INT(0, myrepl.measure);
+
+    TEST_ASSERT_EQUAL_INT(0, set_replace("ut", 0));
+    tick_replace();
+    TEST_ASSERT_EQUAL_MEMORY(prologue, t, sizeof(prologue));
+
+    // configured off, registered but left native
+    strcpy(myconfig.replace.off, "ut");
+    TEST_ASSERT_EQUAL_INT(0, add_replace("ut", t, (void *)0x1000));
+    TEST_ASSERT_EQUAL_MEMORY(prologue, t, sizeof(prologue));
+    myconfig.replace.off[0] = 0;
+
+    memset(&myrepl, 0, sizeof(myrepl));
+    munmap(t, 4096);
+    mysym.valid = valid;
+    mytext.start = start;
+    mytext.end = end;
+}
+#endif
+
+static int find_code_patch(const char *name)
+{
+    int cc = 0;
+
+    for (cc = 0; name && (cc < (int)(sizeof(mycode_table) / sizeof(mycode_table[0]))); cc++) {
+        if (!strcmp(mycode_table[cc].name, name)) {
+            return cc;
+        }
+    }
+
+    return -1;
+}
+
+#if defined(UT)
+TEST(detour, find_code_patch)
+{
+    TEST_ASSERT_EQUAL_INT(-1, find_code_patch(NULL));
+    TEST_ASSERT_EQUAL_INT(-1, find_code_patch("ut"));
+    TEST_ASSERT_EQUAL_INT(0, find_code_patch("fast_forward"));
+}
+#endif
+
+static int check_code_patch(int idx, void **addr)
+{
+    const code_patch_t *p = &mycode_table[idx];
+
+    *addr = get_prehook_addr(*p->addr);
+    if (!is_text_range(*addr, p->len)) {
+        error("%s at %p is outside drastic text\n", p->name, *addr);
+        return -1;
+    }
+
+    // drastic's own bytes, or whatever was written last time
+    if (memcmp(*addr, mycode.slot[idx].active ? mycode.slot[idx].cur : p->org, p->len)) {
+        error("%s at %p has unexpected code, refuse to patch\n", p->name, *addr);
+        return -1;
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, check_code_patch)
+{
+    void *addr = NULL;
+    void *ff = myhook.var.fast_forward;
+
+    myhook.var.fast_forward = NULL;
+    TEST_ASSERT_EQUAL_INT(-1, check_code_patch(0, &addr));
+    myhook.var.fast_forward = ff;
+}
+#endif
+
+int set_code_patch(const char *name, uint32_t arg)
+{
+    int r = -1;
+    int idx = find_code_patch(name);
+    void *addr = NULL;
+    const code_patch_t *p = NULL;
+    uint32_t w[RESTORE_BUF_SIZE / 4] = { 0 };
+
+    trace("call %s(name=%s, arg=%u)\n", __func__, name ? name : "", arg);
+
+    if (idx < 0) {
+        error("no code patch named %s\n", name ? name : "");
+        return -1;
+    }
+
+    if (!mysym.valid) {
+        error("symbols are not verified, refuse to patch\n");
+        return -1;
+    }
+
+    p = &mycode_table[idx];
+    if (p->encode(arg, w) != p->len) {
+        error("unable to encode %s(%u)\n", p->name, arg);
+        return -1;
+    }
+
+    pthread_mutex_lock(&mycode.lock);
+    if ((check_code_patch(idx, &addr) == 0) && (apply_patch(addr, w, p->len) == 0)) {
+        mycode.slot[idx].addr = addr;
+        mycode.slot[idx].arg = arg;
+        mycode.slot[idx].active = !!memcmp(w, p->org, p->len);
+        memcpy(mycode.slot[idx].cur, w, p->len);
+        r = 0;
+    }
+    pthread_mutex_unlock(&mycode.lock);
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, set_code_patch)
+{
+    TEST_ASSERT_EQUAL_INT(-1, set_code_patch(NULL, 0));
+    TEST_ASSERT_EQUAL_INT(-1, set_code_patch("ut", 0));
+}
+#endif
+
+int revert_code_patch(const char *name)
+{
+    int r = -1;
+    int idx = find_code_patch(name);
+    void *addr = NULL;
+    const code_patch_t *p = NULL;
+
+    trace("call %s(name=%s)\n", __func__, name ? name : "");
+
+    if (idx < 0) {
+        error("no code patch named %s\n", name ? name : "");
+        return -1;
+    }
+
+    p = &mycode_table[idx];
+    pthread_mutex_lock(&mycode.lock);
+    if (!mycode.slot[idx].active) {
+        r = 0;
+    }
+    else if ((check_code_patch(idx, &addr) == 0) && (apply_patch(addr, p->org, p->len) == 0)) {
+        mycode.slot[idx].active = 0;
+        r = 0;
+    }
+    pthread_mutex_unlock(&mycode.lock);
+
+    return r;
+}
+
+#if defined(UT)
+TEST(detour, revert_code_patch)
+{
+    TEST_ASSERT_EQUAL_INT(-1, revert_code_patch(NULL));
+    TEST_ASSERT_EQUAL_INT(0, revert_code_patch("fast_forward"));
+}
+#endif
+
+int revert_code_patches(void)
+{
+    int r = 0;
+    int cc = 0;
+    int cnt = 0;
+    void *addr[MAX_CODE_PATCH] = { 0 };
+
+    trace("call %s()\n", __func__);
+
+    pthread_mutex_lock(&mycode.lock);
+    // all or nothing, any unexpected code leaves every patch in place
+    for (cc = 0; cc < (int)(sizeof(mycode_table) / sizeof(mycode_table[0])); cc++) {
+        if (mycode.slot[cc].active) {
+            if (check_code_patch(cc, &addr[cc]) < 0) {
+                r = -1;
+                break;
+            }
+            cnt += 1;
+        }
+    }
+
+    if ((r == 0) && cnt) {
+        begin_patch();
+        for (cc = 0; cc < (int)(sizeof(mycode_table) / sizeof(mycode_table[0])); cc++) {
+            if (mycode.slot[cc].active) {
+                apply_patch(addr[cc], mycode_table[cc].org, mycode_table[cc].len);
+            }
+        }
+
+        r = commit_patch();
+        for (cc = 0; (r == 0) && (cc < (int)(sizeof(mycode_table) / sizeof(mycode_table[0]))); cc++) {
+            mycode.slot[cc].active = 0;
+        }
+    }
+    pthread_mutex_unlock(&mycode.lock);
+
+    return (r < 0) ? r : cnt;
+}
+
+#if defined(UT)
+TEST(detour, revert_code_patches)
+{
+    TEST_ASSERT_EQUAL_INT(0, revert_code_patches());
+}
+#endif
+
+int print_code_patches(void)
+{
+    int cc = 0;
+    int cnt = 0;
+    const code_patch_t *p = NULL;
+
+    trace("call %s()\n", __func__);
+
+    pthread_mutex_lock(&mycode.lock);
+    for (cc = 0; cc < (int)(sizeof(mycode_table) / sizeof(mycode_table[0])); cc++) {
+        p = &mycode_table[cc];
+        if (mycode.slot[cc].active) {
+            printf("[PATCH] %-20s %p %-8u %s\n", p->name, mycode.slot[cc].addr, mycode.slot[cc].arg, p->desc);
+            cnt += 1;
+        }
+        else {
+            printf("[PATCH] %-20s %p %-8s %s\n", p->name, *p->addr, "native", p->desc);
+        }
+    }
+    pthread_mutex_unlock(&mycode.lock);
+
+    return cnt;
+}
+
+#if defined(UT)
+TEST(detour, print_code_patches)
+{
+    TEST_ASSERT_EQUAL_INT(0, print_code_patches());
+}
+#endif
+
+#if defined(UT)
+TEST(detour, set_fast_forward)
+{
+    uint32_t *t = NULL;
+    uintptr_t start = mytext.start;
+    uintptr_t end = mytext.end;
+    int valid = mysym.valid;
+    void *ff = myhook.var.fast_forward;
+
+    t = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_ASSERT_TRUE(t != MAP_FAILED);
+    t[4] = 0xe3a03006;
+    mysym.valid = 1;
+    mytext.start = (uintptr_t)t;
+    mytext.end = (uintptr_t)t + 4096;
+    myhook.var.fast_forward = &t[4];
+
+    TEST_ASSERT_EQUAL_INT(0, set_fast_forward(10));
+    TEST_ASSERT_EQUAL_HEX32(0xe3a0300a, t[4]);
+    TEST_ASSERT_EQUAL_INT(0, set_fast_forward(2));
+    TEST_ASSERT_EQUAL_HEX32(0xe3a03002, t[4]);
+    TEST_ASSERT_EQUAL_INT(1, print_code_patches());
+    TEST_ASSERT_EQUAL_INT(1, revert_code_patches());
+    TEST_ASSERT_EQUAL_HEX32(0xe3a03006, t[4]);
+    TEST_ASSERT_EQUAL_INT(0, print_code_patches());
+
+    // the same value as drastic is not an active patch
+    TEST_ASSERT_EQUAL_INT(0, set_fast_forward(6));
+    TEST_ASSERT_EQUAL_INT(0, print_code_patches());
+
+    // someone else rewrote it, leave it alone
+    TEST_ASSERT_EQUAL_INT(0, set_fast_forward(3));
+    mprotect(t, 4096, PROT_READ | PROT_WRITE);
+    t[4] = 0xe1a00000;
+    TEST_ASSERT_EQUAL_INT(-1, set_fast_forward(4));
+    TEST_ASSERT_EQUAL_INT(-1, revert_code_patch("fast_forward"));
+    TEST_ASSERT_EQUAL_INT(-1, revert_code_patches());
+    TEST_ASSERT_EQUAL_HEX32(0xe1a00000, t[4]);
+
+    memset(&mycode.slot, 0, sizeof(mycode.slot));
+    munmap(t, 4096);
+    mysym.valid = valid;
+    mytext.start = start;
+    mytext.end = end;
+    myhook.var.fast_forward = ff;
+}
+#endif
+
+static int get_mem_shift(int region)
+{
+    // io registers are 4 bytes apart, everything else is bucketed in 8KB
+    return (region == 4) ? 2 : 13;
+}
+
+static int get_mem_bucket(int kind, uint32_t addr)
+{
+    int region = (addr >> 24) & (MEMTRACE_REGIONS - 1);
+    int bucket = ((addr & 0xffffff) >> get_mem_shift(region)) & (MEMTRACE_BUCKETS - 1);
+
+    // 0x04100000 and 0x04800000 would alias onto 0x04000000, fold them into
+    // the unused io buckets instead, 16 registers per 1MB
+    if ((region == 4) && ((addr & 0xffffff) >= MEMTRACE_IO_SIZE)) {
+        bucket = MEMTRACE_IO_HIGH + (((addr >> 20) & 0xf) << 4) + ((addr >> 2) & 0xf);
+    }
+
+    return (((region * 2) + kind) * MEMTRACE_BUCKETS) + bucket;
+}
+
+static uint32_t get_mem_addr(int region, int bucket, uint32_t shift)
+{
+    if ((region == 4) && (bucket >= MEMTRACE_IO_HIGH)) {
+        bucket -= MEMTRACE_IO_HIGH;
+        return 0x04000000 | ((bucket >> 4) << 20) | ((bucket & 0xf) << 2);
+    }
+
+    return (region << 24) | (bucket << shift);
+}
+
+#if defined(UT)
+TEST(detour, get_mem_addr)
+{
+    TEST_ASSERT_EQUAL_HEX32(0x02002000, get_mem_addr(2, 1, 13));
+    TEST_ASSERT_EQUAL_HEX32(0x04000208, get_mem_addr(4, 0x82, 2));
+    TEST_ASSERT_EQUAL_HEX32(0x04100010, get_mem_addr(4, MEMTRACE_IO_HIGH + 0x14, 2));
+}
+#endif
+
+#if defined(UT)
+TEST(detour, get_mem_bucket)
+{
+    TEST_ASSERT_EQUAL_INT(0, get_mem_bucket(MEMTRACE_LOAD, 0x00000000));
+    TEST_ASSERT_EQUAL_INT(((4 * 2) + 1) * MEMTRACE_BUCKETS + 0x82, get_mem_bucket(MEMTRACE_STORE, 0x04000208));
+    TEST_ASSERT_EQUAL_INT((2 * 2) * MEMTRACE_BUCKETS + 1, get_mem_bucket(MEMTRACE_LOAD, 0x02002000));
+    TEST_ASSERT_EQUAL_INT((6 * 2) * MEMTRACE_BUCKETS + 0x400, get_mem_bucket(MEMTRACE_LOAD, 0x06800000));
+    TEST_ASSERT_EQUAL_INT((4 * 2) * MEMTRACE_BUCKETS + MEMTRACE_IO_HIGH + 0x10, get_mem_bucket(MEMTRACE_LOAD, 0x04100000));
+    TEST_ASSERT_EQUAL_INT((4 * 2) * MEMTRACE_BUCKETS + MEMTRACE_IO_HIGH + 0x80, get_mem_bucket(MEMTRACE_LOAD, 0x04800000));
+}
+#endif
+
+static void sample_mem_access(int kind, uint32_t addr)
+{
+    uint32_t *cnt = NULL;
+
+    mymtrace_tick = mymtrace.rate;
+    if (!mymtrace.active) {
+        return;
+    }
+
+    cnt = (uint32_t *)(mymtrace.buf + sizeof(memtrace_hdr_t));
+    __atomic_fetch_add(&cnt[get_mem_bucket(kind, addr)], 1, __ATOMIC_RELAXED);
+}
+
+typedef uint64_t (*memtrace_cb)(uintptr_t, uintptr_t, uintptr_t, uintptr_t);
+
+// io handlers take the register offset, rebase it so it lands in region 4
+#define MEMTRACE_FUN(n, idx, kind, base) \
+static uint64_t memtrace_##n(uintptr_t a, uintptr_t b, uintptr_t c, uintptr_t d) \
+{ \
+    if (--mymtrace_tick <= 0) { \
+        sample_mem_access(kind, (uint32_t)(base | b)); \
+    } \
+    return ((memtrace_cb)mymtrace.org[idx])(a, b, c, d); \
+}
+
+MEMTRACE_FUN(load_memory8, 0, MEMTRACE_LOAD, 0)
+MEMTRACE_FUN(load_memory16, 1, MEMTRACE_LOAD, 0)
+MEMTRACE_FUN(load_memory32, 2, MEMTRACE_LOAD, 0)
+MEMTRACE_FUN(load_memory64, 3, MEMTRACE_LOAD, 0)
+MEMTRACE_FUN(store_memory8, 4, MEMTRACE_STORE, 0)
+MEMTRACE_FUN(store_memory16, 5, MEMTRACE_STORE, 0)
+MEMTRACE_FUN(store_memory32, 6, MEMTRACE_STORE, 0)
+MEMTRACE_FUN(store_memory64, 7, MEMTRACE_STORE, 0)
+MEMTRACE_FUN(load_io_register_arm9_8, 8, MEMTRACE_LOAD, 0x04000000)
+MEMTRACE_FUN(load_io_register_arm9_16, 9, MEMTRACE_LOAD, 0x04000000)
+MEMTRACE_FUN(load_io_register_arm9_32, 10, MEMTRACE_LOAD, 0x04000000)
+MEMTRACE_FUN(load_io_register_arm7_8, 11, MEMTRACE_LOAD, 0x04000000)
+MEMTRACE_FUN(load_io_register_arm7_16, 12, MEMTRACE_LOAD, 0x04000000)
+MEMTRACE_FUN(load_io_register_arm7_32, 13, MEMTRACE_LOAD, 0x04000000)
+MEMTRACE_FUN(store_io_register_arm9_8, 14, MEMTRACE_STORE, 0x04000000)
+MEMTRACE_FUN(store_io_register_arm9_16, 15, MEMTRACE_STORE, 0x04000000)
+MEMTRACE_FUN(store_io_register_arm9_32, 16, MEMTRACE_STORE, 0x04000000)
+MEMTRACE_FUN(store_io_register_arm7_8, 17, MEMTRACE_STORE, 0x04000000)
+MEMTRACE_FUN(store_io_register_arm7_16, 18, MEMTRACE_STORE, 0x04000000)
+MEMTRACE_FUN(store_io_register_arm7_32, 19, MEMTRACE_STORE, 0x04000000)
+
+static uint64_t memtrace_remap_vram(uintptr_t a, uintptr_t b, uintptr_t c, uintptr_t d)
+{
+    memtrace_hdr_t *hdr = (memtrace_hdr_t *)mymtrace.buf;
+
+    if (mymtrace.active) {
+        __atomic_fetch_add(&hdr->remaps, 1, __ATOMIC_RELAXED);
+    }
+    return ((memtrace_cb)mymtrace.org[20])(a, b, c, d);
+}
+
+#if defined(NDS_ARM64)
+#define MT_ADDR(a32, a64)   (a64)
+#else
+#define MT_ADDR(a32, a64)   (a32)
+#endif
+
+// slow-path handlers, the jit calls these for anything it cannot inline,
+// built-in addresses are 32-bit ones or drastic64 file offsets
+static const struct {
+    const char *name;
+    uintptr_t addr;
+    void *cb;
+} mymtrace_fun[] = {
+    { "load_memory8", MT_ADDR(0x0801382c, 0x00019320), memtrace_load_memory8 },
+    { "load_memory16", MT_ADDR(0x080139cc, 0x000194f0), memtrace_load_memory16 },
+    { "load_memory32", MT_ADDR(0x08013b6c, 0x000196c0), memtrace_load_memory32 },
+    { "load_memory64", MT_ADDR(0x08013d0c, 0x00019890), memtrace_load_memory64 },
+    { "store_memory8", MT_ADDR(0x08013da8, 0x00019a80), memtrace_store_memory8 },
+    { "store_memory16", MT_ADDR(0x08013f70, 0x00019c50), memtrace_store_memory16 },
+    { "store_memory32", MT_ADDR(0x08014138, 0x00019e20), memtrace_store_memory32 },
+    { "store_memory64", MT_ADDR(0x08014300, 0x00019fe0), memtrace_store_memory64 },
+    { "load_io_register_arm9_8", MT_ADDR(0x08011b7c, 0x00017940), memtrace_load_io_register_arm9_8 },
+    { "load_io_register_arm9_16", MT_ADDR(0x08010b80, 0x00017020), memtrace_load_io_register_arm9_16 },
+    { "load_io_register_arm9_32", MT_ADDR(0x08011458, 0x000174e0), memtrace_load_io_register_arm9_32 },
+    { "load_io_register_arm7_8", MT_ADDR(0x0800ba88, 0x00012c20), memtrace_load_io_register_arm7_8 },
+    { "load_io_register_arm7_16", MT_ADDR(0x0800be74, 0x00012fd0), memtrace_load_io_register_arm7_16 },
+    { "load_io_register_arm7_32", MT_ADDR(0x0800bc98, 0x00012e50), memtrace_load_io_register_arm7_32 },
+    { "store_io_register_arm9_8", MT_ADDR(0x0800d6c8, 0x000149d0), memtrace_store_io_register_arm9_8 },
+    { "store_io_register_arm9_16", MT_ADDR(0x0800e3c0, 0x000155b0), memtrace_store_io_register_arm9_16 },
+    { "store_io_register_arm9_32", MT_ADDR(0x0800f294, 0x00016060), memtrace_store_io_register_arm9_32 },
+    { "store_io_register_arm7_8", MT_ADDR(0x08008a28, 0x00010fa0), memtrace_store_io_register_arm7_8 },
+    { "store_io_register_arm7_16", MT_ADDR(0x080091d8, 0x000117f0), memtrace_store_io_register_arm7_16 },
+    { "store_io_register_arm7_32", MT_ADDR(0x0800ac58, 0x00012120), memtrace_store_io_register_arm7_32 },
+    { "remap_vram", MT_ADDR(0x0802f694, 0x000307d0), memtrace_remap_vram },
+};
+
+#if defined(UT)
+static uint64_t ut_mem_handler(uintptr_t a, uintptr_t b, uintptr_t c, uintptr_t d)
+{
+    return a + b + c + d;
+}
+
+TEST(detour, sample_mem_access)
+{
+    uint32_t *cnt = NULL;
+    static uint8_t buf[sizeof(memtrace_hdr_t) + (MEMTRACE_REGIONS * 2 * MEMTRACE_BUCKETS * 4)] = { 0 };
+
+    mymtrace.buf = buf;
+    mymtrace.rate = 2;
+    mymtrace.org[2] = ut_mem_handler;
+    mymtrace.org[16] = ut_mem_handler;
+    mymtrace.org[20] = ut_mem_handler;
+    mymtrace_tick = 0;
+    cnt = (uint32_t *)(buf + sizeof(memtrace_hdr_t));
+
+    // off, the handler is still called through
+    TEST_ASSERT_EQUAL_INT(0x02000010, memtrace_load_memory32(0, 0x02000000, 0x10, 0));
+    TEST_ASSERT_EQUAL_INT(0, cnt[get_mem_bucket(MEMTRACE_LOAD, 0x02000000)]);
+
+    // every second access is sampled
+    mymtrace.active = 1;
+    memtrace_load_memory32(0, 0x02000000, 0, 0);
+    memtrace_load_memory32(0, 0x02000000, 0, 0);
+    memtrace_load_memory32(0, 0x02000000, 0, 0);
+    memtrace_load_memory32(0, 0x02000000, 0, 0);
+    TEST_ASSERT_EQUAL_INT(2, cnt[get_mem_bucket(MEMTRACE_LOAD, 0x02000000)]);
+    memtrace_store_io_register_arm9_32(0, 0x208, 1, 0);
+    memtrace_store_io_register_arm9_32(0, 0x208, 1, 0);
+    TEST_ASSERT_EQUAL_INT(1, cnt[get_mem_bucket(MEMTRACE_STORE, 0x04000208)]);
+    memtrace_remap_vram(0, 0, 0, 0);
+    TEST_ASSERT_EQUAL_INT(1, ((memtrace_hdr_t *)buf)->remaps);
+
+    memset(&mymtrace, 0, sizeof(mymtrace));
+}
+#endif
+
+static int write_mem_trace(const char *path)
+{
+    int cc = 0;
+    int kind = 0;
+    int region = 0;
+    int best = 0;
+    int len = 0;
+    FILE *fp = NULL;
+    uint64_t sum[2] = { 0 };
+    uint32_t *cnt = (uint32_t *)(mymtrace.buf + sizeof(memtrace_hdr_t));
+    memtrace_hdr_t *hdr = (memtrace_hdr_t *)mymtrace.buf;
+
+    trace("call %s(path=%p)\n", __func__, path);
+
+    if (!path || !mymtrace.buf) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    len = sizeof(memtrace_hdr_t) + (MEMTRACE_REGIONS * 2 * MEMTRACE_BUCKETS * sizeof(uint32_t));
+    fp = fopen(path, "wb");
+    if (!fp) {
+        error("failed to create \"%s\"\n", path);
+        return -1;
+    }
+    fwrite(mymtrace.buf, len, 1, fp);
+    fclose(fp);
+
+    printf(
+        "[MEMTRACE] \"%s\", %.1f s, 1 in %u, %u vram remaps\n",
+        path,
+        hdr->ns / 1000000000.0,
+        hdr->rate,
+        hdr->remaps
+    );
+    for (region = 0; region < MEMTRACE_REGIONS; region++) {
+        best = (region * 2) * MEMTRACE_BUCKETS;
+        for (kind = 0; kind < 2; kind++) {
+            sum[kind] = 0;
+            for (cc = 0; cc < MEMTRACE_BUCKETS; cc++) {
+                len = (((region * 2) + kind) * MEMTRACE_BUCKETS) + cc;
+                sum[kind] += cnt[len];
+                if (cnt[len] > cnt[best]) {
+                    best = len;
+                }
+            }
+        }
+
+        if (sum[0] || sum[1]) {
+            cc = best % MEMTRACE_BUCKETS;
+            printf(
+                "[MEMTRACE] 0x%02x000000 load %10llu store %10llu, hottest %s 0x%08x (%u)\n",
+                region,
+                (unsigned long long)sum[0],
+                (unsigned long long)sum[1],
+                ((best / MEMTRACE_BUCKETS) & 1) ? "store" : "load",
+                get_mem_addr(region, cc, hdr->shift[region]),
+                cnt[best]
+            );
+        }
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, write_mem_trace)
+{
+    FILE *fp = NULL;
+    memtrace_hdr_t hdr = { 0 };
+    const char *path = "/tmp/memtrace_ut.bin";
+    static uint8_t buf[sizeof(memtrace_hdr_t) + (MEMTRACE_REGIONS * 2 * MEMTRACE_BUCKETS * 4)] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, write_mem_trace(NULL));
+
+    mymtrace.buf = buf;
+    ((memtrace_hdr_t *)buf)->magic = MEMTRACE_MAGIC;
+    ((memtrace_hdr_t *)buf)->shift[4] = 2;
+    ((uint32_t *)(buf + sizeof(memtrace_hdr_t)))[get_mem_bucket(MEMTRACE_STORE, 0x04000208)] = 3;
+    TEST_ASSERT_EQUAL_INT(0, write_mem_trace(path));
+
+    fp = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL_INT(1, fread(&hdr, sizeof(hdr), 1, fp));
+    fseek(fp, 0, SEEK_END);
+    TEST_ASSERT_EQUAL_INT(sizeof(buf), ftell(fp));
+    fclose(fp);
+    unlink(path);
+    TEST_ASSERT_EQUAL_HEX32(MEMTRACE_MAGIC, hdr.magic);
+
+    memset(&mymtrace, 0, sizeof(mymtrace));
+}
+#endif
+
+int start_mem_trace(int rate)
+{
+    int cc = 0;
+    int len = 0;
+    void *v = NULL;
+    memtrace_hdr_t *hdr = NULL;
+
+    trace("call %s(rate=%d)\n", __func__, rate);
+
+    if (rate <= 0) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    if (mymtrace.active) {
+        return mymtrace.cnt;
+    }
+
+    if (!mysym.valid) {
+        error("symbols are not verified, refuse to hook\n");
+        return -1;
+    }
+
+    // kept until quit, a late call through a removed hook may still sample
+    len = sizeof(memtrace_hdr_t) + (MEMTRACE_REGIONS * 2 * MEMTRACE_BUCKETS * sizeof(uint32_t));
+    if (!mymtrace.buf) {
+        mymtrace.buf = malloc(len);
+        if (!mymtrace.buf) {
+            error("failed to allocate trace buffer\n");
+            return -1;
+        }
+    }
+    memset(mymtrace.buf, 0, len);
+
+    hdr = (memtrace_hdr_t *)mymtrace.buf;
+    hdr->magic = MEMTRACE_MAGIC;
+    hdr->version = MEMTRACE_VERSION;
+    hdr->rate = rate;
+    hdr->regions = MEMTRACE_REGIONS;
+    hdr->buckets = MEMTRACE_BUCKETS;
+    for (cc = 0; cc < MEMTRACE_REGIONS; cc++) {
+        hdr->shift[cc] = get_mem_shift(cc);
+    }
+
+    mymtrace.cnt = 0;
+    mymtrace.rate = rate;
+    begin_patch();
+    for (cc = 0; cc < (int)(sizeof(mymtrace_fun) / sizeof(mymtrace_fun[0])); cc++) {
+        v = get_symbol(mymtrace_fun[cc].name);
+        if (!v && !mysym.cnt) {
+            v = (void *)mymtrace_fun[cc].addr;
+        }
+
+        // add_hook() hands back the trampoline the last trace left in the
+        // slot, so start and stop cycles do not use up the pool
+        mymtrace.addr[cc] = get_prehook_addr(v);
+        if ((check_prologue(v, mymtrace.addr[cc]) < 0) ||
+            (add_hook(mymtrace_fun[cc].name, mymtrace.addr[cc], mymtrace_fun[cc].cb, &mymtrace.org[cc]) < 0))
+        {
+            error("unable to trace %s\n", mymtrace_fun[cc].name);
+            mymtrace.addr[cc] = NULL;
+            continue;
+        }
+        mymtrace.cnt += 1;
+    }
+
+    if (commit_patch() < 0) {
+        // keep only the handlers whose hook actually went in
+        mymtrace.cnt = 0;
+        for (cc = 0; cc < (int)(sizeof(mymtrace_fun) / sizeof(mymtrace_fun[0])); cc++) {
+            if (mymtrace.addr[cc] && !is_hook_applied(mymtrace.addr[cc])) {
+                mymtrace.addr[cc] = NULL;
+            }
+            mymtrace.cnt += mymtrace.addr[cc] ? 1 : 0;
+        }
+    }
+
+    mymtrace.start = get_prof_ns();
+    mymtrace.active = mymtrace.cnt > 0;
+    if (!mymtrace.active) {
+        return -1;
+    }
+
+    printf("[MEMTRACE] tracing %d handlers, 1 in %d accesses\n", mymtrace.cnt, rate);
+    return mymtrace.cnt;
+}
+
+#if defined(UT)
+TEST(detour, start_mem_trace)
+{
+    TEST_ASSERT_EQUAL_INT(-1, start_mem_trace(0));
+    TEST_ASSERT_EQUAL_INT(-1, start_mem_trace(1));
+    TEST_ASSERT_EQUAL_INT(0, mymtrace.active);
+}
+#endif
+
+int stop_mem_trace(void)
+{
+    int cc = 0;
+    char buf[MAX_PATH + 32] = { 0 };
+    memtrace_hdr_t *hdr = (memtrace_hdr_t *)mymtrace.buf;
+
+    trace("call %s()\n", __func__);
+
+    if (!mymtrace.active) {
+        return -1;
+    }
+
+    begin_patch();
+    for (cc = 0; cc < (int)(sizeof(mymtrace_fun) / sizeof(mymtrace_fun[0])); cc++) {
+        if (mymtrace.addr[cc]) {
+            remove_hook(mymtrace.addr[cc]);
+        }
+    }
+    if (commit_patch() < 0) {
+        error("failed to remove trace hooks\n");
+    }
+
+    // a hook that is still in memory keeps the trace running
+    mymtrace.cnt = 0;
+    for (cc = 0; cc < (int)(sizeof(mymtrace_fun) / sizeof(mymtrace_fun[0])); cc++) {
+        if (mymtrace.addr[cc] && !is_hook_applied(mymtrace.addr[cc])) {
+            mymtrace.addr[cc] = NULL;
+        }
+        mymtrace.cnt += mymtrace.addr[cc] ? 1 : 0;
+    }
+    if (mymtrace.cnt) {
+        return -1;
+    }
+
+    mymtrace.active = 0;
+    hdr->ns = get_prof_ns() - mymtrace.start;
+    snprintf(buf, sizeof(buf), "%s/memtrace_%lu.bin", home_path, (unsigned long)time(NULL));
+
+    return write_mem_trace(buf);
+}
+
+#if defined(UT)
+TEST(detour, stop_mem_trace)
+{
+    TEST_ASSERT_EQUAL_INT(-1, stop_mem_trace());
+}
+#endif
+
+int toggle_mem_trace(void)
+{
+    trace("call %s()\n", __func__);
+
+    // start and stop patch code, leave that to the emulator thread
+    __atomic_store_n(&mymtrace.req, 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, toggle_mem_trace)
+{
+    TEST_ASSERT_EQUAL_INT(0, toggle_mem_trace());
+    TEST_ASSERT_EQUAL_INT(1, mymtrace.req);
+    mymtrace.req = 0;
+}
+#endif
+
+int tick_mem_trace(void)
+{
+    if (!__atomic_exchange_n(&mymtrace.req, 0, __ATOMIC_ACQ_REL)) {
+        return 0;
+    }
+
+    if (mymtrace.active) {
+        return stop_mem_trace();
+    }
+
+    return start_mem_trace(myconfig.memtrace.rate > 0 ? myconfig.memtrace.rate : MEMTRACE_DEF_RATE);
+}
+
+#if defined(UT)
+TEST(detour, tick_mem_trace)
+{
+    TEST_ASSERT_EQUAL_INT(0, tick_mem_trace());
+    toggle_mem_trace();
+    TEST_ASSERT_EQUAL_INT(-1, tick_mem_trace());
+    TEST_ASSERT_EQUAL_INT(0, mymtrace.req);
+}
+#endif
+
+static uint32_t update_cksum(uint32_t crc, uint8_t c)
+{
+    int cc = 0;
+
+    crc ^= (uint32_t)c << 24;
+    for (cc = 0; cc < 8; cc++) {
+        crc = (crc & 0x80000000) ? ((crc << 1) ^ 0x04c11db7) : (crc << 1);
+    }
+
+    return crc;
+}
+
+#if defined(UT)
+TEST(detour, update_cksum)
+{
+    TEST_ASSERT_EQUAL_HEX32(0, update_cksum(0, 0));
+    TEST_ASSERT_EQUAL_HEX32(0x04c11db7, update_cksum(0, 1));
+}
+#endif
+
+static uint32_t get_cksum(const uint8_t *buf, size_t len)
+{
+    size_t n = 0;
+    uint32_t crc = 0;
+
+    // same crc as cksum(1), so gen_symbol.sh can hash the binary offline
+    for (n = 0; n < len; n++) {
+        crc = update_cksum(crc, buf[n]);
+    }
+
+    for (n = len; n; n >>= 8) {
+        crc = update_cksum(crc, (uint8_t)n);
+    }
+
+    return ~crc;
+}
+
+#if defined(UT)
+TEST(detour, get_cksum)
+{
+    TEST_ASSERT_EQUAL_HEX32(0xffffffff, get_cksum(NULL, 0));
+    TEST_ASSERT_EQUAL_HEX32(930766865, get_cksum((const uint8_t *)"123456789", 9));
+}
+#endif
+
+static int find_main_seg(struct dl_phdr_info *info, size_t size, void *data)
+{
+    int cc = 0;
+    uintptr_t *v = (uintptr_t *)data;
+    const ElfW(Phdr) *p = NULL;
+
+    // the main program is always reported first, drastic itself
+    for (cc = 0; cc < info->dlpi_phnum; cc++) {
+        p = &info->dlpi_phdr[cc];
+        if ((p->p_type == PT_LOAD) && (p->p_flags & PF_X)) {
+            v[0] = (uintptr_t)(info->dlpi_addr + p->p_vaddr);
+            v[1] = (uintptr_t)p->p_filesz;
+            v[2] = (uintptr_t)info->dlpi_addr;
+            break;
+        }
+    }
+
+    return 1;
+}
+
+#if defined(UT)
+TEST(detour, find_main_seg)
+{
+    uintptr_t v[3] = { 0 };
+
+    dl_iterate_phdr(find_main_seg, v);
+    TEST_ASSERT_NOT_EQUAL(0, v[0]);
+    TEST_ASSERT_NOT_EQUAL(0, v[1]);
+}
+#endif
+
+static int get_text_hash(uint32_t *hash)
+{
+    uintptr_t v[3] = { 0 };
+
+    trace("call %s(hash=%p)\n", __func__, hash);
+
+    if (!hash) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    dl_iterate_phdr(find_main_seg, v);
+    if (!v[0]) {
+        error("failed to find text segment\n");
+        return -1;
+    }
+
+    // patches are only ever allowed inside this range
+    mytext.start = v[0];
+    mytext.end = v[0] + v[1];
+    mytext.bias = v[2];
+
+    *hash = get_cksum((const uint8_t *)v[0], v[1]);
+    trace("text segment %p, %ld bytes, hash 0x%08x\n", (void *)v[0], (long)v[1], *hash);
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, get_text_hash)
+{
+    uint32_t h0 = 0;
+    uint32_t h1 = 0;
+
+    TEST_ASSERT_EQUAL_INT(-1, get_text_hash(NULL));
+    TEST_ASSERT_EQUAL_INT(0, get_text_hash(&h0));
+    TEST_ASSERT_EQUAL_INT(0, get_text_hash(&h1));
+    TEST_ASSERT_EQUAL_HEX32(h0, h1);
+    TEST_ASSERT_TRUE(mytext.end > mytext.start);
+}
+#endif
+
+static void free_symbol(void)
+{
+    if (mysym.sym) {
+        free(mysym.sym);
+    }
+
+    mysym.sym = NULL;
+    mysym.cnt = 0;
+    mysym.max = 0;
+    mysym.base = 0;
+    mysym.hash = 0;
+    mysym.has_hash = 0;
+}
+
+#if defined(UT)
+TEST(detour, free_symbol)
+{
+    free_symbol();
+    TEST_ASSERT_NULL(mysym.sym);
+    TEST_ASSERT_EQUAL_INT(0, mysym.cnt);
+}
+#endif
+
+static int add_symbol(const char *name, uintptr_t addr, const uint8_t *sig, int sig_len)
+{
+    symbol_t *p = NULL;
+
+    if (!name || !name[0] || (sig_len < 0) || (sig_len > HOOK_PATCH_SIZE64)) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    if (mysym.cnt >= mysym.max) {
+        p = realloc(mysym.sym, sizeof(symbol_t) * (mysym.max ? (mysym.max * 2) : 1024));
+        if (!p) {
+            error("failed to allocate symbol table\n");
+            return -1;
+        }
+        mysym.sym = p;
+        mysym.max = mysym.max ? (mysym.max * 2) : 1024;
+    }
+
+    p = &mysym.sym[mysym.cnt++];
+    strncpy(p->name, name, sizeof(p->name) - 1);
+    p->name[sizeof(p->name) - 1] = 0;
+    p->addr = addr;
+    p->sig_len = sig ? sig_len : 0;
+    if (p->sig_len) {
+        memcpy(p->sig, sig, p->sig_len);
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, add_symbol)
+{
+    free_symbol();
+    TEST_ASSERT_EQUAL_INT(-1, add_symbol(NULL, 0, NULL, 0));
+    TEST_ASSERT_EQUAL_INT(-1, add_symbol("menu", 0x1000, NULL, HOOK_PATCH_SIZE64 + 1));
+    TEST_ASSERT_EQUAL_INT(0, add_symbol("menu", 0x1000, (const uint8_t *)"\xf0\x4f\x2d\xe9", 4));
+    TEST_ASSERT_EQUAL_INT(1, mysym.cnt);
+    TEST_ASSERT_EQUAL_STRING("menu", mysym.sym[0].name);
+    TEST_ASSERT_EQUAL_INT(4, mysym.sym[0].sig_len);
+    TEST_ASSERT_EQUAL_HEX8(0xe9, mysym.sym[0].sig[3]);
+    free_symbol();
+}
+#endif
+
+static int parse_sig(const char *s, uint8_t *sig, int max)
+{
+    int cc = 0;
+    unsigned int v = 0;
+
+    if (!s || !sig) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    for (cc = 0; s[cc * 2] && s[(cc * 2) + 1]; cc++) {
+        if ((cc >= max) || (sscanf(&s[cc * 2], "%2x", &v) != 1)) {
+            return -1;
+        }
+        sig[cc] = (uint8_t)v;
+    }
+
+    return s[cc * 2] ? -1 : cc;
+}
+
+#if defined(UT)
+TEST(detour, parse_sig)
+{
+    uint8_t sig[4] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, parse_sig(NULL, sig, sizeof(sig)));
+    TEST_ASSERT_EQUAL_INT(2, parse_sig("f04f", sig, sizeof(sig)));
+    TEST_ASSERT_EQUAL_HEX8(0xf0, sig[0]);
+    TEST_ASSERT_EQUAL_HEX8(0x4f, sig[1]);
+    TEST_ASSERT_EQUAL_INT(-1, parse_sig("f04", sig, sizeof(sig)));
+    TEST_ASSERT_EQUAL_INT(-1, parse_sig("zz", sig, sizeof(sig)));
+    TEST_ASSERT_EQUAL_INT(-1, parse_sig("0102030405", sig, sizeof(sig)));
+}
+#endif
+
+static int cmp_symbol(const void *a, const void *b)
+{
+    const symbol_t *s0 = (const symbol_t *)a;
+    const symbol_t *s1 = (const symbol_t *)b;
+
+    if (s0->addr == s1->addr) {
+        return 0;
+    }
+    return (s0->addr < s1->addr) ? -1 : 1;
+}
+
+#if defined(UT)
+TEST(detour, cmp_symbol)
+{
+    symbol_t s0 = { "a", 0x1000 };
+    symbol_t s1 = { "b", 0x2000 };
+
+    TEST_ASSERT_EQUAL_INT(-1, cmp_symbol(&s0, &s1));
+    TEST_ASSERT_EQUAL_INT(1, cmp_symbol(&s1, &s0));
+    TEST_ASSERT_EQUAL_INT(0, cmp_symbol(&s0, &s0));
+}
+#endif
+
+int load_symbol(const char *path)
+{
+    int r = 0;
+    int len = 0;
+    FILE *fp = NULL;
+    unsigned long v = 0;
+    char buf[MAX_PATH] = { 0 };
+    char hex[(HOOK_PATCH_SIZE64 * 2) + 2] = { 0 };
+    char name[MAX_SYMBOL_NAME] = { 0 };
+    uint8_t sig[HOOK_PATCH_SIZE64] = { 0 };
+
+    trace("call %s(path=%s)\n", __func__, path ? path : "");
+
+    if (!path) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    fp = fopen(path, "r");
+    if (!fp) {
+        trace("symbol manifest \"%s\" not found\n", path);
+        return -1;
+    }
+
+    free_symbol();
+    while (fgets(buf, sizeof(buf), fp)) {
+        if ((buf[0] == '#') || (buf[0] == '\n')) {
+            continue;
+        }
+
+        // "name address [prologue bytes]"
+        r = sscanf(buf, "%63s %lx %33s", name, &v, hex);
+        if (r < 2) {
+            error("invalid symbol line \"%s\"\n", buf);
+            continue;
+        }
+
+        len = 0;
+        if (r == 3) {
+            len = parse_sig(hex, sig, sizeof(sig));
+            if (len < 0) {
+                error("invalid signature for \"%s\"\n", name);
+                continue;
+            }
+        }
+
+        if (!strcmp(name, "text")) {
+            mysym.hash = (uint32_t)v;
+            mysym.has_hash = 1;
+        }
+        else if (!strcmp(name, "base")) {
+            mysym.base = (uintptr_t)v;
+        }
+        else if (add_symbol(name, (uintptr_t)v, sig, len) < 0) {
+            break;
+        }
+    }
+    fclose(fp);
+
+    // stable sort is not needed, lookups by name take the lowest address
+    if (mysym.cnt) {
+        qsort(mysym.sym, mysym.cnt, sizeof(symbol_t), cmp_symbol);
+    }
+    trace("loaded %d symbols from \"%s\"\n", mysym.cnt, path);
+
+    return mysym.cnt;
+}
+
+#if defined(UT)
+TEST(detour, load_symbol)
+{
+    FILE *fp = NULL;
+    const char *path = "/tmp/ut_symbol.txt";
+
+    fp = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fprintf(fp, "# ut\ntext 0x12345678\nbase 0x100000\n");
+    fprintf(fp, "update_screen 0x0018a120 ff4302d1\nmenu 0x0017fbd0\ninvalid\n");
+    fclose(fp);
+
+    TEST_ASSERT_EQUAL_INT(-1, load_symbol(NULL));
+    TEST_ASSERT_EQUAL_INT(-1, load_symbol("/tmp/ut_no_symbol.txt"));
+    TEST_ASSERT_EQUAL_INT(2, load_symbol(path));
+    TEST_ASSERT_EQUAL_INT(1, mysym.has_hash);
+    TEST_ASSERT_EQUAL_HEX32(0x12345678, mysym.hash);
+    TEST_ASSERT_EQUAL_HEX32(0x100000, mysym.base);
+    TEST_ASSERT_EQUAL_STRING("menu", mysym.sym[0].name);
+    TEST_ASSERT_EQUAL_INT(0, mysym.sym[0].sig_len);
+    TEST_ASSERT_EQUAL_INT(4, mysym.sym[1].sig_len);
+    TEST_ASSERT_EQUAL_HEX8(0xd1, mysym.sym[1].sig[3]);
+    free_symbol();
+    unlink(path);
+}
+#endif
+
+void* get_symbol(const char *name)
+{
+    int cc = 0;
+
+    if (!name) {
+        error("invalid input\n");
+        return NULL;
+    }
+
+    for (cc = 0; cc < mysym.cnt; cc++) {
+        if (!strcmp(mysym.sym[cc].name, name)) {
+            return (void *)(mysym.sym[cc].addr - mysym.base);
+        }
+    }
+
+    return NULL;
+}
+
+#if defined(UT)
+TEST(detour, get_symbol)
+{
+    free_symbol();
+    mysym.base = 0x100000;
+    add_symbol("puts", 0x04033080, NULL, 0);
+    add_symbol("puts", 0x0010d350, NULL, 0);
+    qsort(mysym.sym, mysym.cnt, sizeof(symbol_t), cmp_symbol);
+
+    TEST_ASSERT_NULL(get_symbol(NULL));
+    TEST_ASSERT_NULL(get_symbol("menu"));
+    TEST_ASSERT_EQUAL_PTR((void *)0xd350, get_symbol("puts"));
+    free_symbol();
+}
+#endif
+
+static int is_slot_off(void **slot)
+{
+#if defined(NDS_ARM64)
+    int cc = 0;
+
+    for (cc = 0; cc < (int)(sizeof(mysym_off) / sizeof(mysym_off[0])); cc++) {
+        if (mysym_off[cc] == slot) {
+            return 1;
+        }
+    }
+#endif
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, is_slot_off)
+{
+#if defined(NDS_ARM64)
+    TEST_ASSERT_EQUAL_INT(1, is_slot_off((void **)&myhook.fun.spu_render_samples));
+#else
+    TEST_ASSERT_EQUAL_INT(0, is_slot_off((void **)&myhook.fun.spu_render_samples));
+#endif
+    TEST_ASSERT_EQUAL_INT(0, is_slot_off((void **)&myhook.fun.menu));
+}
+#endif
+
+static int apply_symbol(void)
+{
+    int cc = 0;
+    int cnt = 0;
+    void *v = NULL;
+
+    trace("call %s()\n", __func__);
+
+    // gen_symbol.sh only knows functions, so anything the manifest leaves
+    // out (every var.* slot at least) keeps its built-in address
+    for (cc = 0; cc < (int)(sizeof(mysym_slot) / sizeof(mysym_slot[0])); cc++) {
+        v = get_symbol(mysym_slot[cc].name);
+
+        // the manifest lists every function, it cannot turn a slot back on
+        if (is_slot_off(mysym_slot[cc].slot)) {
+            trace("%s is disabled on this arch, ignore %p\n", mysym_slot[cc].name, v);
+        }
+        else if (v) {
+            *mysym_slot[cc].slot = v;
+            cnt += 1;
+        }
+        else {
+            trace("%s is not in the manifest, keep built-in %p\n", mysym_slot[cc].name, *mysym_slot[cc].slot);
+        }
+    }
+
+    return cnt;
+}
+
+#if defined(UT)
+TEST(detour, apply_symbol)
+{
+    void *menu = myhook.fun.menu;
+    void *quit = myhook.fun.quit;
+    void *swap = myhook.var.sdl.swap_screens;
+
+    free_symbol();
+    add_symbol("menu", 0x1234, NULL, 0);
+    add_symbol("var.sdl.swap_screens", 0x5678, NULL, 0);
+    myhook.fun.quit = (void *)0xdead;
+    TEST_ASSERT_EQUAL_INT(2, apply_symbol());
+    TEST_ASSERT_EQUAL_PTR((void *)0x1234, myhook.fun.menu);
+    TEST_ASSERT_EQUAL_PTR((void *)0x5678, myhook.var.sdl.swap_screens);
+    TEST_ASSERT_EQUAL_PTR((void *)0xdead, myhook.fun.quit);
+
+    myhook.fun.menu = menu;
+    myhook.fun.quit = quit;
+    myhook.var.sdl.swap_screens = swap;
+    free_symbol();
+}
+
+TEST(detour, apply_symbol_disabled)
+{
+    init_table();
+    free_symbol();
+    add_symbol("spu_adpcm_decode_block", 0x16be80, NULL, 0);
+    add_symbol("spu_render_samples", 0x16c030, NULL, 0);
+    add_symbol("spu_update_channel_settings", 0x16bf60, NULL, 0);
+
+#if defined(NDS_ARM64)
+    // symbol64.txt lists them, the 32-bit spu prehooks must still stay off
+    TEST_ASSERT_EQUAL_INT(0, apply_symbol());
+    TEST_ASSERT_NULL(myhook.fun.spu_adpcm_decode_block);
+    TEST_ASSERT_NULL(myhook.fun.spu_render_samples);
+    TEST_ASSERT_NULL(myhook.fun.spu_update_channel_settings);
+#else
+    TEST_ASSERT_EQUAL_INT(3, apply_symbol());
+    TEST_ASSERT_EQUAL_PTR((void *)0x16c030, myhook.fun.spu_render_samples);
+#endif
+
+    free_symbol();
+    init_table();
+}
+#endif
+
+static int check_symbol(void)
+{
+    uint32_t hash = 0;
+    char buf[MAX_PATH] = { 0 };
+
+    trace("call %s()\n", __func__);
+
+    mysym.valid = 0;
+    if (get_text_hash(&hash) < 0) {
+        return -1;
+    }
+
+    snprintf(buf, sizeof(buf), "%s/%s", home_path, SYMBOL_FILE);
+    if (load_symbol(buf) >= 0) {
+        if (!mysym.has_hash || (mysym.hash != hash)) {
+            error("\"%s\" does not match drastic (text 0x%08x), refuse to hook\n", buf, hash);
+            return -1;
+        }
+
+        apply_symbol();
+    }
+    else if (SYMBOL_TEXT_HASH && (hash != SYMBOL_TEXT_HASH)) {
+        error("unknown drastic (text 0x%08x), refuse to hook\n", hash);
+        return -1;
+    }
+    else if (!SYMBOL_TEXT_HASH) {
+        trace("built-in symbols are not verified (text 0x%08x)\n", hash);
+    }
+
+    mysym.valid = 1;
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, check_symbol)
+{
+    FILE *fp = NULL;
+    char buf[MAX_PATH] = { 0 };
+    char home[MAX_PATH] = { 0 };
+
+    strncpy(home, home_path, sizeof(home));
+    strncpy(home_path, "/tmp", sizeof(home_path));
+    snprintf(buf, sizeof(buf), "/tmp/%s", SYMBOL_FILE);
+
+    unlink(buf);
+    TEST_ASSERT_EQUAL_INT(0, check_symbol());
+    TEST_ASSERT_EQUAL_INT(1, mysym.valid);
+
+    fp = fopen(buf, "w");
+    TEST_ASSERT_NOT_NULL(fp);
+    fprintf(fp, "text 0x0\nmenu 0x1234\n");
+    fclose(fp);
+    TEST_ASSERT_EQUAL_INT(-1, check_symbol());
+    TEST_ASSERT_EQUAL_INT(0, mysym.valid);
+
+    unlink(buf);
+    free_symbol();
+    mysym.valid = 1;
+    strncpy(home_path, home, sizeof(home_path));
+}
+#endif
+
+#if defined(UT)
+// a fake drastic text page with known a32 prologues, so the real patch
+// path runs on the host and every emitted byte can be compared
+TEST(detour, fake_text)
+{
+    int cnt = 0;
+    void *org = NULL;
+    uint32_t *t = NULL;
+    uint32_t *tramp = NULL;
+    uint8_t restore[RESTORE_BUF_SIZE] = { 0 };
+    uintptr_t start = mytext.start;
+    uintptr_t end = mytext.end;
+    int valid = mysym.valid;
+    void *update_screen = myhook.fun.update_screen;
+    void *platform_get_input = myhook.fun.platform_get_input;
+    const uint32_t prologue0[] = { 0xe92d4ff0, 0xe24dd01c, 0xe59f3100, 0xe3a00000 };
+    const uint32_t prologue1[] = { 0xe92d4010, 0xeb000010, 0xe3a00000, 0xe8bd8010 };
+
+    t = mmap(NULL, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    TEST_ASSERT_TRUE(t != MAP_FAILED);
+    memcpy(&t[0], prologue0, sizeof(prologue0));
+    memcpy(&t[16], prologue1, sizeof(prologue1));
+
+    free_symbol();
+    mysym.valid = 1;
+    mytext.start = (uintptr_t)t;
+    mytext.end = (uintptr_t)t + 4096;
+    myhook.fun.update_screen = &t[0];
+    myhook.fun.platform_get_input = &t[16];
+    add_symbol("update_screen", (uintptr_t)&t[0], (const uint8_t *)prologue0, sizeof(prologue0));
+    cnt = get_hook_cnt();
+
+    // prehook: "ldr pc, [pc, #-4]" + address of the callback, original bytes kept
+    TEST_ASSERT_EQUAL_INT(0, add_prehook(&t[0], (void *)0x1000, restore));
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, t[0]);
+    TEST_ASSERT_EQUAL_HEX32(0x1000, t[1]);
+    TEST_ASSERT_EQUAL_HEX32(prologue0[2], t[2]);
+    TEST_ASSERT_EQUAL_MEMORY(prologue0, restore, sizeof(restore));
+    TEST_ASSERT_EQUAL_INT(cnt + 1, get_hook_cnt());
+    TEST_ASSERT_EQUAL_STRING("update_screen", find_hook(&t[0])->name);
+
+    TEST_ASSERT_EQUAL_INT(0, restore_prehook(&t[0], restore));
+    TEST_ASSERT_EQUAL_MEMORY(prologue0, t, sizeof(prologue0));
+    TEST_ASSERT_EQUAL_INT(cnt, get_hook_cnt());
+
+    // wrong prologue, nothing is written
+    mysym.sym[0].sig[0] ^= 0xff;
+    TEST_ASSERT_EQUAL_INT(-1, add_prehook(&t[0], (void *)0x1000, NULL));
+    TEST_ASSERT_EQUAL_MEMORY(prologue0, t, sizeof(prologue0));
+
+    // call-through: relocated bl, then back to the third instruction
+    TEST_ASSERT_EQUAL_INT(0, add_hook("ut", &t[16], (void *)0x2000, &org));
+    tramp = (uint32_t *)org;
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, t[16]);
+    TEST_ASSERT_EQUAL_HEX32(0x2000, t[17]);
+    TEST_ASSERT_EQUAL_HEX32(0xe92d4010, tramp[0]);
+    TEST_ASSERT_EQUAL_HEX32(0xe28fe004, tramp[1]);
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, tramp[2]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(uintptr_t)&t[17] + 8 + 0x40, tramp[3]);
+    TEST_ASSERT_EQUAL_HEX32(0xe51ff004, tramp[4]);
+    TEST_ASSERT_EQUAL_HEX32((uint32_t)(uintptr_t)&t[18], tramp[5]);
+    TEST_ASSERT_EQUAL_INT(0, remove_hook(&t[16]));
+    TEST_ASSERT_EQUAL_MEMORY(prologue1, &t[16], sizeof(prologue1));
+
+    // outside the text range
+    TEST_ASSERT_EQUAL_INT(-1, add_prehook(&t[1024], (void *)0x1000, NULL));
+
+    free_symbol();
+    munmap(t, 4096);
+    mysym.valid = valid;
+    mytext.start = start;
+    mytext.end = end;
+    myhook.fun.update_screen = update_screen;
+    myhook.fun.platform_get_input = platform_get_input;
+}
+#endif
+
+static int init_table(void)
+{
+    trace("call %s()\n", __func__);
+
+    myhook.var.system.base = (uintptr_t *)0x083f4000;
+    myhook.var.system.gamecard_name = (uint32_t *)0x0847e8e8;
+    myhook.var.system.savestate_num = (uint32_t *)0x08479780;
+    myhook.var.system.config.base = (uintptr_t *)0x08479328;
+    myhook.var.system.config.hires_3d = (uint32_t *)0x084797c4;
+    myhook.var.system.config.controls_a = (uint16_t *)0x084797dc;
+    myhook.var.system.config.controls_b = (uint16_t *)0x0847982c;
+    myhook.var.system.config.rom_directory = (uint32_t *)0x08479364;
+    myhook.var.system.config.file_list_display_type = (uint32_t *)0x08479764;
+    myhook.var.system.video.realtime_speed_percentage = (float *)0x0aedec08;
+    myhook.var.system.video.rendered_frames_percentage = (float *)0x0aedec0c;
+    myhook.var.system.micphone_status = (uint8_t *)0xaedee69;
+    myhook.var.system.spu.audio = (audio_struct *)0x995a000;
+    myhook.var.system.user_root_path = (uint32_t *)0x0847e0e8;
+
+    myhook.var.sdl.swap_screens = (uint32_t *)0x0aee9598;
+    myhook.var.sdl.bytes_per_pixel = (uint32_t *)0x0aee957c;
+    myhook.var.sdl.needs_reinitializing = (uint32_t *)0x0aee95a0;
+    myhook.var.sdl.window = (uintptr_t *)0x0aee9564;
+    myhook.var.sdl.renderer = (uintptr_t *)0x0aee9568;
+    myhook.var.sdl.screen[0].texture = (uintptr_t *)0x0aee952c;
+    myhook.var.sdl.screen[0].pixels = (uintptr_t *)0x0aee9530;
+    myhook.var.sdl.screen[0].x = (uint32_t *)0x0aee9534;
+    myhook.var.sdl.screen[0].y = (uint32_t *)0x0aee9538;
+    myhook.var.sdl.screen[0].w = (uint32_t *)0x0aee953c;
+    myhook.var.sdl.screen[0].h = (uint32_t *)0x0aee9540;
+    myhook.var.sdl.screen[0].show = (uint8_t *)0x0aee9544;
+    myhook.var.sdl.screen[0].hires_mode = (uint8_t *)0x0aee9545;
+    myhook.var.sdl.screen[1].texture = (uintptr_t *)0x0aee9548;
+    myhook.var.sdl.screen[1].pixels = (uintptr_t *)0x0aee954c;
+    myhook.var.sdl.screen[1].x = (uint32_t *)0x0aee9550;
+    myhook.var.sdl.screen[1].y = (uint32_t *)0x0aee9554;
+    myhook.var.sdl.screen[1].w = (uint32_t *)0x0aee9558;
+    myhook.var.sdl.screen[1].h = (uint32_t *)0x0aee955c;
+    myhook.var.sdl.screen[1].show = (uint8_t *)0x0aee9560;
+    myhook.var.sdl.screen[1].hires_mode = (uint8_t *)0x0aee9561;
+    myhook.var.adpcm.step_table = (uint32_t *)0x0815a600;
+    myhook.var.adpcm.index_step_table = (uint32_t *)0x0815a6b8;
+    myhook.var.desmume_footer_str = (uint32_t *)0x0815a740;
+    myhook.var.pcm_handler = (uint32_t *)0x083e532c;
+    myhook.var.fast_forward = (uint32_t *)0x08006ad0;
+    myhook.var.pcm_handle = (uint32_t *)0x83e532c;
+    myhook.var.capture_handle = (uint32_t *)0x83e5330;
+    myhook.var.mic_en = (uint8_t *)0x83e5310;
+    myhook.var.savestate_thread = (savestate_thread_data_struct *)0x083e4ad0;
+
+#if defined(NDS_ARM64)
+    myhook.fun.menu = (void *)0x0007fbd0;
+    // mov w2, #6 in system_frame_sync
+    myhook.var.fast_forward = (uint32_t *)0x0000ed7c;
+    myhook.fun.free = (void *)0x0000d660;
+    myhook.fun.realloc = (void *)0x0000d740;
+    myhook.fun.malloc = (void *)0x0000dfb0;
+    myhook.fun.screen_copy16 = (void *)0x00088290;
+    myhook.fun.print_string = (void *)0x00087f00;
+    myhook.fun.print_string_ext = (void *)0x00087bf0;
+    myhook.fun.load_state_index = (void *)0x00075230;
+    myhook.fun.save_state_index = (void *)0x00075150;
+    myhook.fun.quit = (void *)0x0000e8d0;
+    myhook.fun.savestate_pre = (void *)0;
+    myhook.fun.savestate_post = (void *)0;
+    myhook.fun.update_screen = (void *)0x0008a120;
+    myhook.fun.load_state = (void *)0x000746f0;
+    myhook.fun.save_state = (void *)0x00074da0;
+    myhook.fun.blit_screen_menu = (void *)0x00088570;
+    myhook.fun.initialize_backup = (void *)0x00072530;
+    myhook.fun.set_screen_menu_off = (void *)0x0008a4a0;
+    myhook.fun.get_screen_ptr = (void *)0x0008a9c0;
+    myhook.fun.select_quit = (void *)0x0007a260;
+    myhook.fun.platform_get_input = (void *)0x0008acc0;
+
+    myhook.fun.spu_adpcm_decode_block = (void *)0;
+    myhook.fun.spu_render_samples = (void *)0;
+    myhook.fun.spu_update_channel_settings = (void *)0;
+    myhook.fun.render_scanline_tiled_4bpp = (void *)0;
+    myhook.fun.render_polygon_setup_perspective_steps = (void *)0;
+#else
+    myhook.fun.menu = (void *)0x080a0a18;
+    myhook.fun.free = (void *)0x08003e58;
+    myhook.fun.realloc = (void *)0x0800435c;
+    myhook.fun.malloc = (void *)0x080046e0;
+    myhook.fun.screen_copy16 = (void *)0x080a59d8;
+    myhook.fun.print_string = (void *)0x080a5398;
+    myhook.fun.load_state_index = (void *)0x08095ce4;
+    myhook.fun.save_state_index = (void *)0x08095c10;
+    myhook.fun.quit = (void *)0x08006444;
+    myhook.fun.savestate_pre = (void *)0x08095a80;
+    myhook.fun.savestate_post = (void *)0x08095154;
+    myhook.fun.update_screen = (void *)0x080a83c0;
+    myhook.fun.load_state = (void *)0x080951c0;
+    myhook.fun.save_state = (void *)0x0809580c;
+    myhook.fun.blit_screen_menu = (void *)0x080a62d8;
+    myhook.fun.initialize_backup = (void *)0x08092f40;
+    myhook.fun.platform_get_input = (void *)0x080a8c30;
+    myhook.fun.set_screen_menu_off = (void *)0x080a8240;
+    myhook.fun.set_screen_swap = (void *)0x080a88fc;
+    myhook.fun.get_screen_ptr = (void *)0x080a890c;
+    myhook.fun.spu_adpcm_decode_block = (void *)0x0808d268;
+    myhook.fun.spu_render_samples = (void *)0x080c64c8;
+    myhook.fun.spu_update_channel_settings = (void *)0x0808d364;
+    myhook.fun.render_scanline_tiled_4bpp = (void *)0x080bcf74;
+    myhook.fun.render_polygon_setup_perspective_steps = (void *)0x080c1cd4;
+    myhook.fun.printf_chk = (void *)0x08004a04;
+    myhook.fun.puts = (void *)0x0800405c;
+    myhook.fun.select_quit = (void *)0x0809b134;
+    myhook.fun.config_setup_input_map = (void *)0x08097250;
+    myhook.fun.nds_file_get_icon_data = (void *)0x08096d90;
+    myhook.fun.audio_capture_flush = (void *)0x080aa894;
+    myhook.fun.audio_synchronous_update = (void *)0x080aa7c0;
+    myhook.fun.audio_buffer_force_feed = (void *)0x080aa760;
+    myhook.fun.save_directory_config_file = (void *)0x0809a4b0;
+#endif
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, init_table)
+{
+    TEST_ASSERT_EQUAL_INT(0, init_table());
+    TEST_ASSERT_EQUAL_INT(0x08006ad0, myhook.var.fast_forward);
+    TEST_ASSERT_EQUAL_INT(0x080a0a18, myhook.fun.menu);
+}
+#endif
+
+int write_mic_samples(const int16_t *buf, int len)
+{
+    int cc = 0;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+
+    if (!buf || (len < 0)) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    head = __atomic_load_n(&mymic.head, __ATOMIC_RELAXED);
+    tail = __atomic_load_n(&mymic.tail, __ATOMIC_ACQUIRE);
+    if (len > (MIC_RING_SIZE - (int)(head - tail))) {
+        len = MIC_RING_SIZE - (head - tail);
+    }
+
+    for (cc = 0; cc < len; cc++) {
+        mymic.ring[(head + cc) & (MIC_RING_SIZE - 1)] = buf[cc];
+    }
+    __atomic_store_n(&mymic.head, head + len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+#if defined(UT)
+TEST(detour, write_mic_samples)
+{
+    int16_t buf[MIC_CHUNK] = { 0 };
+
+    mymic.head = mymic.tail = 0;
+    TEST_ASSERT_EQUAL_INT(-1, write_mic_samples(NULL, 0));
+    TEST_ASSERT_EQUAL_INT(MIC_CHUNK, write_mic_samples(buf, MIC_CHUNK));
+    mymic.head = MIC_RING_SIZE - 1;
+    TEST_ASSERT_EQUAL_INT(1, write_mic_samples(buf, MIC_CHUNK));
+    TEST_ASSERT_EQUAL_INT(0, write_mic_samples(buf, MIC_CHUNK));
+    mymic.head = mymic.tail = 0;
+}
+#endif
+
+static int read_mic_samples(int16_t *buf, int len)
+{
+    int cc = 0;
+    uint32_t head = 0;
+    uint32_t tail = 0;
+
+    if (!buf || (len < 0)) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    tail = __atomic_load_n(&mymic.tail, __ATOMIC_RELAXED);
+    head = __atomic_load_n(&mymic.head, __ATOMIC_ACQUIRE);
+    if (len > (int)(head - tail)) {
+        len = head - tail;
+    }
+
+    for (cc = 0; cc < len; cc++) {
+        buf[cc] = mymic.ring[(tail + cc) & (MIC_RING_SIZE - 1)];
+    }
+    __atomic_store_n(&mymic.tail, tail + len, __ATOMIC_RELEASE);
+
+    return len;
+}
+
+#if defined(UT)
+TEST(detour, read_mic_samples)
+{
+    int16_t src[3] = { 1, -2, 3 };
+    int16_t dst[8] = { 0 };
+
+    mymic.head = mymic.tail = MIC_RING_SIZE - 1;
+    TEST_ASSERT_EQUAL_INT(-1, read_mic_samples(NULL, 0));
+    TEST_ASSERT_EQUAL_INT(0, read_mic_samples(dst, 8));
+    TEST_ASSERT_EQUAL_INT(3, write_mic_samples(src, 3));
+    TEST_ASSERT_EQUAL_INT(3, read_mic_samples(dst, 8));
+    TEST_ASSERT_EQUAL_INT(1, dst[0]);
+    TEST_ASSERT_EQUAL_INT(-2, dst[1]);
+    TEST_ASSERT_EQUAL_INT(3, dst[2]);
+    mymic.head = mymic.tail = 0;
+}
+#endif
+
+static int synth_mic_samples(int16_t *buf, int len)
+{
+    int cc = 0;
+    int32_t n = 0;
+
+    if (!buf) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    for (cc = 0; cc < len; cc++) {
+        mymic.seed ^= mymic.seed << 13;
+        mymic.seed ^= mymic.seed >> 17;
+        mymic.seed ^= mymic.seed << 5;
+        n = (int16_t)(mymic.seed >> 16);
+
+        if (mymic.env < MIC_BLOW_LEVEL) {
+            mymic.env += 8;
+        }
+        mymic.lp += (n - mymic.lp) >> 2;
+        buf[cc] = (int16_t)((mymic.lp * mymic.env) >> 15);
+    }
+
+    return len;
+}
+
+#if defined(UT)
+TEST(detour, synth_mic_samples)
+{
+    int cc = 0;
+    int hit = 0;
+    int16_t buf[MIC_CHUNK] = { 0 };
+
+    mymic.env = 0;
+    mymic.seed = 1;
+    TEST_ASSERT_EQUAL_INT(-1, synth_mic_samples(NULL, 0));
+    TEST_ASSERT_EQUAL_INT(MIC_CHUNK, synth_mic_samples(buf, MIC_CHUNK));
+    for (cc = 0; cc < MIC_CHUNK; cc++) {
+        hit |= (buf[cc] != 0);
+    }
+    TEST_ASSERT_EQUAL_INT(1, hit);
+    TEST_ASSERT_EQUAL_INT(MIC_CHUNK * 8, mymic.env);
+}
+#endif
+
+static int load_mic_samples(FILE *fp, int16_t *buf, int len)
+{
+    int r = 0;
+
+    if (!fp || !buf) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    r = fread(buf, sizeof(int16_t), len, fp);
+    if (r < len) {
+        rewind(fp);
+        r += fread(&buf[r], sizeof(int16_t), len - r, fp);
+    }
+    if (r < len) {
+        memset(&buf[r], 0, (len - r) * sizeof(int16_t));
+    }
+
+    return len;
+}
+
+#if defined(UT)
+TEST(detour, load_mic_samples)
+{
+    FILE *fp = NULL;
+    int16_t buf[4] = { 0 };
+    int16_t src[3] = { 10, 20, 30 };
+    const char *path = "/tmp/mic.raw";
+
+    TEST_ASSERT_EQUAL_INT(-1, load_mic_samples(NULL, buf, 4));
+
+    fp = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(fp);
+    fwrite(src, sizeof(src), 1, fp);
+    fclose(fp);
+
+    fp = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL(fp);
+    TEST_ASSERT_EQUAL_INT(4, load_mic_samples(fp, buf, 4));
+    TEST_ASSERT_EQUAL_INT(30, buf[2]);
+    TEST_ASSERT_EQUAL_INT(10, buf[3]);
+    fclose(fp);
+    unlink(path);
+}
+#endif
+
+static void* mic_handler(void *param)
+{
+    int len = 0;
+    FILE *fp = NULL;
+    int16_t buf[MIC_CHUNK] = { 0 };
+
+    trace("call %s()++\n", __func__);
+
+    init_crash_stack();
+    if (mymic.source == MIC_SRC_FILE) {
+        fp = fopen(mymic.path, "rb");
+        if (!fp) {
+            error("failed to open \"%s\", use noise instead\n", mymic.path);
+        }
+    }
+
+    len = mymic.freq / 100;
+    if ((len <= 0) || (len > MIC_CHUNK)) {
+        len = MIC_CHUNK;
+    }
+
+    // fill the ring before checking running, so a stop right after start still leaves samples behind
+    while (1) {
+        while ((mymic.head - __atomic_load_n(&mymic.tail, __ATOMIC_ACQUIRE)) < (mymic.freq / 20)) {
+            if (fp) {
+                load_mic_samples(fp, buf, len);
+            }
+            else {
+                synth_mic_samples(buf, len);
+            }
+            write_mic_samples(buf, len);
+        }
+
+        if (!__atomic_load_n(&mymic.running, __ATOMIC_ACQUIRE)) {
+            break;
+        }
+        usleep(10000);
+    }
+
+    if (fp) {
+        fclose(fp);
+    }
+
+    trace("call %s()--\n", __func__);
+    return NULL;
+}
+
+#if defined(UT)
+TEST(detour, mic_handler)
+{
+    mymic.head = mymic.tail = 0;
+    mymic.freq = 8000;
+    mymic.source = MIC_SRC_NOISE;
+    __atomic_store_n(&mymic.running, 0, __ATOMIC_RELEASE);
+    TEST_ASSERT_NULL(mic_handler(NULL));
+    TEST_ASSERT_TRUE((mymic.head - mymic.tail) >= (8000 / 20));
+    mymic.head = mymic.tail = 0;
+}
+#endif
+
+static int start_mic(mic_source_t source, uint32_t freq)
+{
+    trace("call %s(source=%d, freq=%d)\n", __func__, source, freq);
+
+    if (source >= MIC_SRC_MAX) {
+        error("invalid source\n");
+        return -1;
+    }
+
+    if (__atomic_load_n(&mymic.running, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+
+    mymic.env = 0;
+    mymic.lp = 0;
+    mymic.seed = (uint32_t)time(NULL) | 1;
+    mymic.freq = freq ? freq : MIC_DEF_FREQ;
+    mymic.tail = mymic.head;
+    snprintf(mymic.path, sizeof(mymic.path), "%s/%s", home_path, MIC_FILE);
+
+    if (source == MIC_SRC_DEVICE) {
+#if defined(FXTEC_QX1000) || defined(MOTO_XT897)
+        // the pulse record stream in snd.c fills the ring
+        mymic.source = source;
+        return 0;
+#else
+        error("no capture device on this platform, use \"%s\" or noise instead\n", mymic.path);
+        source = MIC_SRC_FILE;
+#endif
+    }
+    mymic.source = source;
+
+    __atomic_store_n(&mymic.running, 1, __ATOMIC_RELEASE);
+    if (pthread_create(&mymic.thread, NULL, mic_handler, NULL)) {
+        __atomic_store_n(&mymic.running, 0, __ATOMIC_RELEASE);
+        error("failed to create mic thread\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, start_mic)
+{
+    TEST_ASSERT_EQUAL_INT(-1, start_mic(MIC_SRC_MAX, 0));
+
+    // no pulse record stream here, the file or noise stands in
+    TEST_ASSERT_EQUAL_INT(0, start_mic(MIC_SRC_DEVICE, 0));
+    TEST_ASSERT_EQUAL_INT(1, __atomic_load_n(&mymic.running, __ATOMIC_ACQUIRE));
+    TEST_ASSERT_EQUAL_INT(MIC_SRC_FILE, mymic.source);
+    TEST_ASSERT_EQUAL_INT(MIC_DEF_FREQ, mymic.freq);
+    __atomic_store_n(&mymic.running, 0, __ATOMIC_RELEASE);
+    pthread_join(mymic.thread, NULL);
+    mymic.head = mymic.tail = 0;
+}
+#endif
+
+static int stop_mic(void)
+{
+    trace("call %s()\n", __func__);
+
+    if (__atomic_exchange_n(&mymic.running, 0, __ATOMIC_ACQ_REL)) {
+        pthread_join(mymic.thread, NULL);
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, stop_mic)
+{
+    int16_t buf[8] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(0, start_mic(MIC_SRC_NOISE, 8000));
+    TEST_ASSERT_EQUAL_INT(1, __atomic_load_n(&mymic.running, __ATOMIC_ACQUIRE));
+    TEST_ASSERT_EQUAL_INT(0, stop_mic());
+    TEST_ASSERT_EQUAL_INT(0, mymic.running);
+    TEST_ASSERT_EQUAL_INT(8, read_mic_samples(buf, 8));
+    mymic.head = mymic.tail = 0;
+}
+#endif
+
+static void prehook_audio_capture_flush(audio_struct *audio)
+{
+    int cc = 0;
+    int idx = 0;
+    int len = 0;
+    int need = 0;
+    int16_t buf[MIC_CHUNK] = { 0 };
+
+    trace("call %s(audio=%p)\n", __func__, audio);
+
+    if (!audio || !myhook.use_mic) {
+        return;
+    }
+
+    need = (audio->output_frequency / 60) + 1;
+    if (need > (int)(sizeof(audio->capture_buffer) / sizeof(int16_t) / 2)) {
+        need = sizeof(audio->capture_buffer) / sizeof(int16_t) / 2;
+    }
+
+    while (idx < need) {
+        len = read_mic_samples(buf, ((need - idx) > MIC_CHUNK) ? MIC_CHUNK : (need - idx));
+        if (len <= 0) {
+            break;
+        }
+
+        for (cc = 0; cc < len; cc++) {
+            audio->capture_buffer[((idx + cc) << 1) + 0] = buf[cc];
+            audio->capture_buffer[((idx + cc) << 1) + 1] = buf[cc];
+        }
+        idx += len;
+    }
+
+    if (idx < need) {
+        memset(&audio->capture_buffer[idx << 1], 0, (need - idx) * 2 * sizeof(int16_t));
+    }
+}
+
+#if defined(UT)
+TEST(detour, prehook_audio_capture_flush)
+{
+    int16_t src[2] = { 100, -100 };
+    static audio_struct audio = { 0 };
+
+    audio.output_frequency = 600;
+    audio.capture_buffer[20] = 1;
+    prehook_audio_capture_flush(NULL);
+
+    myhook.use_mic = 1;
+    mymic.head = mymic.tail = 0;
+    TEST_ASSERT_EQUAL_INT(2, write_mic_samples(src, 2));
+    prehook_audio_capture_flush(&audio);
+    TEST_ASSERT_EQUAL_INT(100, audio.capture_buffer[0]);
+    TEST_ASSERT_EQUAL_INT(100, audio.capture_buffer[1]);
+    TEST_ASSERT_EQUAL_INT(-100, audio.capture_buffer[2]);
+    TEST_ASSERT_EQUAL_INT(0, audio.capture_buffer[20]);
+    myhook.use_mic = 0;
+}
+#endif
+
+int32_t prehook_save_directory_config_file(void* system, char* file_name)
+{
+    FILE *f = NULL;
+    uint32_t *ptr = NULL;
+    char buf[1024] = { 0 };
+
+    if (myconfig.auto_state) {
+        printf("save state...\n");
+        save_state(DEF_AUTO_SLOT);
+        usleep(1000000);
+        printf("save state complete\n");
+    }
+
+    snprintf(buf, sizeof(buf), "%s/config/%s", (const char *)myhook.var.system.user_root_path, file_name);
+    printf("Saving directory config to file named %s\n", buf);
+
+    ptr = (uint32_t *)malloc(0x414);
+    if (!ptr) {
+        error("failed to allocate buffer to file path\n");
+        return -1;
+    }
+
+    f = fopen(buf, "wb");
+    if (!f) {
+        free(ptr);
+        error("failed to create config file (\"%s\")\n", buf);
+        return -1;
+    }
+
+    ptr[0] = 0x32435344;
+    ptr[1] = 0x00000002;
+    ptr[2] = 0x0b0600f0;
+    ptr[3] = 0x08162008;
+    memcpy(&ptr[4], (void *)myhook.var.system.config.rom_directory, 0x400);
+    ptr[0x104] = *myhook.var.system.config.file_list_display_type;
+    fwrite(ptr, 0x414, 1, f);
+    fclose(f);
+
+    free(ptr);
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, prehook_save_directory_config_file)
+{
+}
+#endif
+
+// everything below runs inside a signal handler, so only write(2) and
+// plain memory reads, no stdio, malloc or locks
+static void crash_str(const char *s)
+{
+    int len = strlen(s);
+
+    if (mycrash.fd > 0) {
+        write(mycrash.fd, s, len);
+    }
+    write(STDERR_FILENO, s, len);
+}
+
+static void crash_hex(uintptr_t v)
+{
+    int cc = 0;
+    char buf[(sizeof(v) * 2) + 3] = { 0 };
+
+    buf[0] = '0';
+    buf[1] = 'x';
+    for (cc = 0; cc < (int)(sizeof(v) * 2); cc++) {
+        buf[2 + cc] = "0123456789abcdef"[(v >> (((sizeof(v) * 2) - 1 - cc) * 4)) & 0xf];
+    }
+    crash_str(buf);
+}
+
+static void crash_dec(uint64_t v)
+{
+    int cc = 20;
+    char buf[21] = { 0 };
+
+    do {
+        buf[--cc] = '0' + (v % 10);
+        v /= 10;
+    } while (v && cc);
+    crash_str(&buf[cc]);
+}
+
+static void crash_int(int64_t v)
+{
+    if (v < 0) {
+        crash_str("-");
+        crash_dec(-(uint64_t)v);
+        return;
+    }
+    crash_dec(v);
+}
+
+#if defined(UT)
+TEST(detour, crash_hex)
+{
+    crash_hex(0x1234);
+    crash_dec(1234);
+    crash_int(-6);
+    crash_str("\n");
+    TEST_PASS();
+}
+#endif
+
+static const char* find_crash_symbol(uintptr_t pc, uintptr_t *start)
+{
+    int l = 0;
+    int r = mysym.cnt - 1;
+    int m = 0;
+    int cc = 0;
+    uintptr_t key = pc - mytext.bias + mysym.base;
+    uintptr_t v = 0;
+    const char *name = NULL;
+
+    // manifest entries are sorted by address, take the closest one below
+    while (l <= r) {
+        m = (l + r) / 2;
+        if (mysym.sym[m].addr <= key) {
+            name = mysym.sym[m].name;
+            *start = mysym.sym[m].addr - mysym.base + mytext.bias;
+            l = m + 1;
+        }
+        else {
+            r = m - 1;
+        }
     }
 
-    f = fopen(buf, "wb");
-    if (!f) {
-        free(ptr);
-        error("failed to create config file (\"%s\")\n", buf);
+    if (name) {
+        return name;
+    }
+
+    // no manifest, fall back to the nearest built-in function slot
+    for (cc = 0; cc < (int)(sizeof(mysym_slot) / sizeof(mysym_slot[0])); cc++) {
+        if (!strncmp(mysym_slot[cc].name, "var.", 4) || !*mysym_slot[cc].slot) {
+            continue;
+        }
+
+#if defined(NDS_ARM64)
+        v = mytext.bias + (uintptr_t)*mysym_slot[cc].slot;
+#else
+        v = (uintptr_t)*mysym_slot[cc].slot;
+#endif
+        if ((v >= mytext.start) && (v <= pc) && (!name || (v > *start))) {
+            name = mysym_slot[cc].name;
+            *start = v;
+        }
+    }
+
+    return name;
+}
+
+#if defined(UT)
+TEST(detour, find_crash_symbol)
+{
+    uintptr_t start = 0;
+    uintptr_t bias = mytext.bias;
+    uintptr_t text = mytext.start;
+    void *menu = myhook.fun.menu;
+
+    free_symbol();
+    mytext.bias = 0x10000;
+    mysym.base = 0x100000;
+    add_symbol("a", 0x101000, NULL, 0);
+    add_symbol("b", 0x102000, NULL, 0);
+    TEST_ASSERT_NULL(find_crash_symbol(0x10800, &start));
+    TEST_ASSERT_EQUAL_STRING("a", find_crash_symbol(0x11010, &start));
+    TEST_ASSERT_EQUAL_HEX32(0x11000, start);
+    TEST_ASSERT_EQUAL_STRING("b", find_crash_symbol(0x12000, &start));
+    free_symbol();
+
+    mytext.bias = 0;
+    mytext.start = 0x10000;
+    myhook.fun.menu = (void *)0x10000;
+    TEST_ASSERT_EQUAL_STRING("menu", find_crash_symbol(0x10010, &start));
+    myhook.fun.menu = menu;
+    mytext.start = text;
+    mytext.bias = bias;
+}
+#endif
+
+static void crash_addr(uintptr_t pc)
+{
+    int cc = 0;
+    uintptr_t start = 0;
+    const char *name = NULL;
+    const hook_t *h = NULL;
+    Dl_info info = { 0 };
+
+    crash_hex(pc);
+    for (cc = 0; cc < MAX_HOOK; cc++) {
+        h = &myreg.hook[cc];
+        if (!h->applied) {
+            continue;
+        }
+
+        name = h->name ? h->name : "(unnamed)";
+        if ((pc >= (uintptr_t)h->target) && (pc < ((uintptr_t)h->target + HOOK_PATCH_SIZE))) {
+            crash_str(" [patched entry of ");
+        }
+        else if (h->tramp && (pc >= (uintptr_t)h->tramp) && (pc < ((uintptr_t)h->tramp + HOOK_TRAMP_SIZE))) {
+            crash_str(" [trampoline of ");
+        }
+        else if (h->thunk && (pc >= (uintptr_t)h->thunk) && (pc < ((uintptr_t)h->thunk + HOOK_TRAMP_SIZE))) {
+            crash_str(" [thunk of ");
+        }
+        else {
+            continue;
+        }
+        crash_str(name);
+        crash_str("]\n");
+        return;
+    }
+
+    if ((pc >= mytext.start) && (pc < mytext.end)) {
+        name = find_crash_symbol(pc, &start);
+        crash_str(" drastic:");
+        crash_str(name ? name : "?");
+        if (name) {
+            crash_str("+");
+            crash_hex(pc - start);
+        }
+        crash_str("\n");
+        return;
+    }
+
+    // not strictly async-signal-safe, but every line that matters is
+    // already on disk if the loader lock happens to be held
+    if (dladdr((void *)pc, &info) && info.dli_fname) {
+        crash_str(" ");
+        crash_str(info.dli_fname);
+        if (info.dli_sname) {
+            crash_str(":");
+            crash_str(info.dli_sname);
+            crash_str("+");
+            crash_hex(pc - (uintptr_t)info.dli_saddr);
+        }
+    }
+    crash_str("\n");
+}
+
+#if defined(UT)
+TEST(detour, crash_addr)
+{
+    crash_addr((uintptr_t)crash_addr);
+    crash_addr(0);
+    TEST_PASS();
+}
+#endif
+
+static void dump_crash(int sig, const siginfo_t *info, const ucontext_t *uc)
+{
+    int cc = 0;
+    uint32_t pos = 0;
+    uintptr_t fp = 0;
+    uintptr_t sp = 0;
+    const char *name = NULL;
+    const char *game = NULL;
+
+    crash_str("[CRASH] signal ");
+    crash_dec(sig);
+    crash_str((sig == SIGSEGV) ? " (SIGSEGV)" : (sig == SIGBUS) ? " (SIGBUS)" : (sig == SIGILL) ? " (SIGILL)" : "");
+    crash_str(", fault address ");
+    crash_hex(info ? (uintptr_t)info->si_addr : 0);
+    crash_str(", code ");
+    // SI_USER and friends are negative
+    crash_int(info ? info->si_code : 0);
+    crash_str("\n");
+
+    if (uc) {
+#if defined(__aarch64__)
+        for (cc = 0; cc < 31; cc++) {
+            crash_str((cc < 10) ? "x0" : "x");
+            crash_dec(cc);
+            crash_str("=");
+            crash_hex(uc->uc_mcontext.regs[cc]);
+            crash_str(((cc % 4) == 3) ? "\n" : " ");
+        }
+        crash_str("\nsp=");
+        crash_hex(uc->uc_mcontext.sp);
+        crash_str(" pstate=");
+        crash_hex(uc->uc_mcontext.pstate);
+        crash_str("\n");
+        sp = uc->uc_mcontext.sp;
+        fp = uc->uc_mcontext.regs[29];
+        crash_str("pc ");
+        crash_addr(uc->uc_mcontext.pc);
+        crash_str("lr ");
+        crash_addr(uc->uc_mcontext.regs[30]);
+#elif defined(__arm__)
+        const unsigned long *r = &uc->uc_mcontext.arm_r0;
+
+        for (cc = 0; cc < 16; cc++) {
+            crash_str((cc < 10) ? "r0" : "r");
+            crash_dec(cc);
+            crash_str("=");
+            crash_hex(r[cc]);
+            crash_str(((cc % 4) == 3) ? "\n" : " ");
+        }
+        crash_str("cpsr=");
+        crash_hex(uc->uc_mcontext.arm_cpsr);
+        crash_str("\n");
+        crash_str("pc ");
+        crash_addr(uc->uc_mcontext.arm_pc);
+        crash_str("lr ");
+        crash_addr(uc->uc_mcontext.arm_lr);
+#endif
+    }
+
+    // frame records are x29/x30 pairs on arm64, arm32 has no reliable chain
+    for (cc = 0; fp && (cc < 16); cc++) {
+        if ((fp & 0xf) || (fp < sp) || (fp > (sp + (1 << 20)))) {
+            break;
+        }
+        crash_str("#");
+        crash_dec(cc);
+        crash_str(" ");
+        crash_addr(((uintptr_t *)fp)[1]);
+        sp = fp;
+        fp = ((uintptr_t *)fp)[0];
+    }
+
+    crash_str("[CRASH] active hooks on this thread\n");
+    for (cc = myprof_stack.depth - 1; cc >= 0; cc--) {
+        name = myreg.hook[myprof_stack.stack[cc].id % MAX_HOOK].name;
+        crash_str("  ");
+        crash_str(name ? name : "(unnamed)");
+        crash_str(" from ");
+        crash_addr(myprof_stack.stack[cc].lr);
+    }
+
+    crash_str("[CRASH] last hook calls\n");
+    if (!myprof.enable && !mycrash.record) {
+        crash_str("  (set crash_hook_ring or hook_profile to record them)\n");
+    }
+    pos = mycrash.pos;
+    for (cc = 1; (cc <= MAX_CRASH_RING) && (cc <= (int)pos); cc++) {
+        name = myreg.hook[mycrash.ring[(pos - cc) % MAX_CRASH_RING].id % MAX_HOOK].name;
+        crash_str("  ");
+        // only hook_profile timestamps the calls
+        if (mycrash.ring[(pos - cc) % MAX_CRASH_RING].ns) {
+            crash_dec(mycrash.ring[(pos - cc) % MAX_CRASH_RING].ns);
+            crash_str(" ");
+        }
+        crash_str(name ? name : "(unnamed)");
+        crash_str(" from ");
+        crash_addr(mycrash.ring[(pos - cc) % MAX_CRASH_RING].lr);
+    }
+
+    crash_str("[CRASH] installed hooks\n");
+    for (cc = 0; cc < MAX_HOOK; cc++) {
+        if (myreg.hook[cc].applied) {
+            crash_str("  ");
+            crash_str(myreg.hook[cc].name ? myreg.hook[cc].name : "(unnamed)");
+            crash_str(" ");
+            crash_hex((uintptr_t)myreg.hook[cc].target);
+            crash_str(" -> ");
+            crash_hex((uintptr_t)myreg.hook[cc].cb);
+            crash_str("\n");
+        }
+    }
+
+    crash_str("[CRASH] state\n  text ");
+    crash_hex(mytext.start);
+    crash_str("-");
+    crash_hex(mytext.end);
+    crash_str(", symbols ");
+    crash_dec(mysym.cnt);
+    crash_str(mysym.valid ? " verified\n" : " unverified\n");
+    for (cc = 0; cc < myrepl.cnt; cc++) {
+        crash_str("  replace ");
+        crash_str(myrepl.slot[cc].name);
+        crash_str(myrepl.slot[cc].enable ? " on\n" : " off\n");
+    }
+    for (cc = 0; cc < (int)(sizeof(mycode_table) / sizeof(mycode_table[0])); cc++) {
+        crash_str("  patch ");
+        crash_str(mycode_table[cc].name);
+        crash_str(mycode.slot[cc].active ? " active\n" : " native\n");
+    }
+    crash_str(mymtrace.active ? "  memory trace on\n" : "");
+
+#if !defined(UT)
+    game = (const char *)myhook.var.system.gamecard_name;
+#endif
+    if (mysym.valid && game && game[0]) {
+        crash_str("  game ");
+        for (cc = 0; (cc < 64) && (game[cc] >= 0x20) && (game[cc] < 0x7f); cc++) {
+            if (mycrash.fd > 0) {
+                write(mycrash.fd, &game[cc], 1);
+            }
+            write(STDERR_FILENO, &game[cc], 1);
+        }
+        crash_str("\n");
+    }
+}
+
+#if defined(UT)
+TEST(detour, dump_crash)
+{
+    FILE *fp = NULL;
+    char buf[4096] = { 0 };
+    const char *path = "/tmp/crash_ut.txt";
+
+    mycrash.fd = open(path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    TEST_ASSERT_TRUE(mycrash.fd > 0);
+    dump_crash(SIGSEGV, NULL, NULL);
+    close(mycrash.fd);
+    mycrash.fd = 0;
+
+    fp = fopen(path, "r");
+    TEST_ASSERT_NOT_NULL(fp);
+    fread(buf, 1, sizeof(buf) - 1, fp);
+    fclose(fp);
+    unlink(path);
+    TEST_ASSERT_NOT_NULL(strstr(buf, "signal 11 (SIGSEGV)"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "patch fast_forward native"));
+}
+#endif
+
+static uintptr_t get_crash_pc(const void *uc)
+{
+    if (!uc) {
+        return 0;
+    }
+
+#if defined(__aarch64__)
+    return ((const ucontext_t *)uc)->uc_mcontext.pc;
+#elif defined(__arm__)
+    return ((const ucontext_t *)uc)->uc_mcontext.arm_pc;
+#elif defined(__x86_64__)
+    return ((const ucontext_t *)uc)->uc_mcontext.gregs[REG_RIP];
+#else
+    return 0;
+#endif
+}
+
+#if defined(UT)
+TEST(detour, get_crash_pc)
+{
+    ucontext_t uc = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(0, get_crash_pc(NULL));
+    TEST_ASSERT_EQUAL_INT(0, get_crash_pc(&uc));
+}
+#endif
+
+static int load_crash_code(void)
+{
+    int cnt = 0;
+    FILE *fp = NULL;
+    char perm[8] = { 0 };
+    char buf[MAX_PATH] = { 0 };
+    unsigned long lo = 0;
+    unsigned long hi = 0;
+    unsigned long inode = 0;
+
+    trace("call %s()\n", __func__);
+
+    fp = fopen("/proc/self/maps", "r");
+    if (!fp) {
+        error("failed to open /proc/self/maps\n");
         return -1;
     }
 
-    ptr[0] = 0x32435344;
-    ptr[1] = 0x00000002;
-    ptr[2] = 0x0b0600f0;
-    ptr[3] = 0x08162008;
-    memcpy(&ptr[4], (void *)myhook.var.system.config.rom_directory, 0x400);
-    ptr[0x104] = *myhook.var.system.config.file_list_display_type;
-    fwrite(ptr, 0x414, 1, f);
-    fclose(f);
+    // the translation cache is executable memory that is writable or not
+    // backed by a file, drastic's own text comes from mytext
+    mycrash.code_cnt = 0;
+    while (fgets(buf, sizeof(buf), fp) && (cnt < MAX_CRASH_CODE)) {
+        if (sscanf(buf, "%lx-%lx %4s %*s %*s %lu", &lo, &hi, perm, &inode) != 4) {
+            continue;
+        }
+        if ((perm[2] != 'x') || ((perm[1] != 'w') && inode)) {
+            continue;
+        }
+
+        mycrash.code[cnt].start = lo;
+        mycrash.code[cnt].end = hi;
+        cnt += 1;
+    }
+    fclose(fp);
+    __atomic_store_n(&mycrash.code_cnt, cnt, __ATOMIC_RELEASE);
+
+    return cnt;
+}
+
+#if defined(UT)
+TEST(detour, load_crash_code)
+{
+    TEST_ASSERT_TRUE(load_crash_code() >= 0);
+    mycrash.code_cnt = 0;
+}
+#endif
+
+static int is_crash_code(uintptr_t pc)
+{
+    int cc = 0;
+    int cnt = __atomic_load_n(&mycrash.code_cnt, __ATOMIC_ACQUIRE);
+
+    if ((pc >= mytext.start) && (pc < mytext.end)) {
+        return 1;
+    }
+
+    for (cc = 0; cc < cnt; cc++) {
+        if ((pc >= mycrash.code[cc].start) && (pc < mycrash.code[cc].end)) {
+            return 1;
+        }
+    }
 
-    free(ptr);
     return 0;
 }
 
 #if defined(UT)
-TEST(detour, prehook_save_directory_config_file)
+TEST(detour, is_crash_code)
+{
+    TEST_ASSERT_EQUAL_INT(0, is_crash_code(0x1000));
+    mycrash.code[0].start = 0x1000;
+    mycrash.code[0].end = 0x2000;
+    mycrash.code_cnt = 1;
+    TEST_ASSERT_EQUAL_INT(1, is_crash_code(0x1000));
+    TEST_ASSERT_EQUAL_INT(0, is_crash_code(0x2000));
+    mycrash.code_cnt = 0;
+}
+#endif
+
+static int chain_crash_handler(struct sigaction *prev, int sig, siginfo_t *info, void *uc)
+{
+    uintptr_t pc = get_crash_pc(uc);
+
+    if (!prev || (prev->sa_handler == SIG_DFL) || (prev->sa_handler == SIG_IGN)) {
+        return 0;
+    }
+
+    if (prev->sa_flags & SA_SIGINFO) {
+        prev->sa_sigaction(sig, info, uc);
+    }
+    else {
+        prev->sa_handler(sig);
+    }
+
+    return get_crash_pc(uc) != pc;
+}
+
+static void crash_handler(int sig, siginfo_t *info, void *uc)
+{
+    int cc = 0;
+    int code = is_crash_code(get_crash_pc(uc));
+    struct sigaction *prev = NULL;
+
+    for (cc = 0; cc < (int)(sizeof(mycrash_sig) / sizeof(mycrash_sig[0])); cc++) {
+        if (mycrash_sig[cc] == sig) {
+            prev = &mycrash.prev[cc];
+        }
+    }
+
+    // drastic emulates faulting fastmem loads in its SIGSEGV handler and
+    // resumes at the next instruction, that is not a crash, but its handler
+    // reads the faulting instruction, so a pc anywhere else is dumped first
+    if (code && chain_crash_handler(prev, sig, info, uc)) {
+        return;
+    }
+
+    mycrash.fd = open(mycrash.path, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+    dump_crash(sig, info, (const ucontext_t *)uc);
+    if (mycrash.fd > 0) {
+        fsync(mycrash.fd);
+        close(mycrash.fd);
+    }
+
+    if (!code && chain_crash_handler(prev, sig, info, uc)) {
+        return;
+    }
+
+    // the signal stays blocked until we return, then the default action kills us
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+#if defined(UT)
+static int crash_ut_cnt = 0;
+
+static void crash_ut_handler(int sig, siginfo_t *info, void *uc)
+{
+    crash_ut_cnt += 1;
+    ((ucontext_t *)uc)->uc_mcontext.gregs[REG_RIP] += 4;
+}
+
+TEST(detour, crash_handler)
+{
+    ucontext_t uc = { 0 };
+    siginfo_t info = { 0 };
+    struct sigaction prev = mycrash.prev[0];
+
+    // a fault in drastic code is handled by the previous handler, no dump
+    // and no raise
+    crash_ut_cnt = 0;
+    mycrash.code[0].start = 0;
+    mycrash.code[0].end = 0x1000;
+    mycrash.code_cnt = 1;
+    mycrash.prev[0].sa_sigaction = crash_ut_handler;
+    mycrash.prev[0].sa_flags = SA_SIGINFO;
+    crash_handler(SIGSEGV, &info, &uc);
+    TEST_ASSERT_EQUAL_INT(1, crash_ut_cnt);
+    TEST_ASSERT_EQUAL_INT(4, get_crash_pc(&uc));
+    mycrash.code_cnt = 0;
+    mycrash.prev[0] = prev;
+}
+#endif
+
+int init_crash_stack(void)
+{
+    stack_t ss = { 0 };
+
+    trace("call %s()\n", __func__);
+
+    // sigaltstack is per thread, a thread that already has one keeps it
+    if ((sigaltstack(NULL, &ss) == 0) && !(ss.ss_flags & SS_DISABLE)) {
+        return 0;
+    }
+
+    if (!mycrash_stack) {
+        mycrash_stack = malloc(CRASH_STACK_SIZE);
+    }
+    if (!mycrash_stack) {
+        error("failed to allocate signal stack\n");
+        return -1;
+    }
+
+    memset(&ss, 0, sizeof(ss));
+    ss.ss_sp = mycrash_stack;
+    ss.ss_size = CRASH_STACK_SIZE;
+    if (sigaltstack(&ss, NULL) < 0) {
+        error("failed to set signal stack\n");
+        return -1;
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, init_crash_stack)
+{
+    stack_t ss = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(0, init_crash_stack());
+    TEST_ASSERT_EQUAL_INT(0, init_crash_stack());
+    sigaltstack(NULL, &ss);
+    TEST_ASSERT_FALSE(ss.ss_flags & SS_DISABLE);
+
+    ss.ss_flags = SS_DISABLE;
+    sigaltstack(&ss, NULL);
+}
+#endif
+
+static int arm_crash_handler(void)
+{
+    int cc = 0;
+    struct sigaction sa = { 0 };
+    struct sigaction cur = { 0 };
+
+    sa.sa_sigaction = crash_handler;
+    sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&sa.sa_mask);
+    for (cc = 0; cc < (int)(sizeof(mycrash_sig) / sizeof(mycrash_sig[0])); cc++) {
+        if (sigaction(mycrash_sig[cc], NULL, &cur) < 0) {
+            return -1;
+        }
+        if ((cur.sa_flags & SA_SIGINFO) && (cur.sa_sigaction == crash_handler)) {
+            continue;
+        }
+
+        // whoever installed a handler after us runs first from ours
+        mycrash.prev[cc] = cur;
+        if (sigaction(mycrash_sig[cc], &sa, NULL) < 0) {
+            error("failed to catch signal %d\n", mycrash_sig[cc]);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+int init_crash_handler(void)
+{
+    trace("call %s()\n", __func__);
+
+    if (mycrash.ready) {
+        return 0;
+    }
+
+    snprintf(mycrash.path, sizeof(mycrash.path), "%s/%s", home_path, CRASH_FILE);
+
+    // a blown stack still needs somewhere to run the handler
+    init_crash_stack();
+    if (arm_crash_handler() < 0) {
+        return -1;
+    }
+
+    mycrash.ready = 1;
+    return 0;
+}
+
+#if defined(UT)
+TEST(detour, init_crash_handler)
+{
+    struct sigaction sa = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(0, init_crash_handler());
+    sigaction(SIGSEGV, NULL, &sa);
+    TEST_ASSERT_EQUAL_PTR(crash_handler, sa.sa_sigaction);
+
+    // leave the test runner with the default handlers
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGBUS, SIG_DFL);
+    signal(SIGILL, SIG_DFL);
+    mycrash.ready = 0;
+}
+#endif
+
+int tick_crash_handler(void)
+{
+    struct sigaction cur = { 0 };
+
+    if (!mycrash.ready) {
+        return -1;
+    }
+
+    // drastic sets things up during the first frames, after that a check
+    // now and then is enough
+    mycrash.tick += 1;
+    if ((mycrash.tick > CRASH_TICK_EARLY) && (mycrash.tick % CRASH_TICK_FRAMES)) {
+        return 0;
+    }
+    if ((mycrash.tick == 1) || !(mycrash.tick % CRASH_TICK_FRAMES)) {
+        load_crash_code();
+    }
+
+    // platform_initialize() installs drastic's SIGSEGV handler right after
+    // SDL_Init() has brought us up, take the signals back and chain to it
+    if (sigaction(SIGSEGV, NULL, &cur) < 0) {
+        return -1;
+    }
+    if ((cur.sa_flags & SA_SIGINFO) && (cur.sa_sigaction == crash_handler)) {
+        return 0;
+    }
+
+    load_crash_code();
+    return arm_crash_handler() < 0 ? -1 : 1;
+}
+
+#if defined(UT)
+static void crash_ut_segv(int sig, siginfo_t *info, void *uc)
+{
+}
+
+TEST(detour, tick_crash_handler)
 {
+    struct sigaction sa = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, tick_crash_handler());
+    TEST_ASSERT_EQUAL_INT(0, init_crash_handler());
+    TEST_ASSERT_EQUAL_INT(0, tick_crash_handler());
+
+    sa.sa_sigaction = crash_ut_segv;
+    sa.sa_flags = SA_SIGINFO;
+    sigaction(SIGSEGV, &sa, NULL);
+    TEST_ASSERT_EQUAL_INT(1, tick_crash_handler());
+    TEST_ASSERT_EQUAL_PTR(crash_ut_segv, mycrash.prev[0].sa_sigaction);
+    sigaction(SIGSEGV, NULL, &sa);
+    TEST_ASSERT_EQUAL_PTR(crash_handler, sa.sa_sigaction);
+
+    // later on only every CRASH_TICK_FRAMES frame looks again
+    mycrash.tick = CRASH_TICK_FRAMES;
+    sa.sa_sigaction = crash_ut_segv;
+    sigaction(SIGSEGV, &sa, NULL);
+    TEST_ASSERT_EQUAL_INT(0, tick_crash_handler());
+    mycrash.tick = CRASH_TICK_FRAMES * 2 - 1;
+    TEST_ASSERT_EQUAL_INT(1, tick_crash_handler());
+
+    signal(SIGSEGV, SIG_DFL);
+    signal(SIGBUS, SIG_DFL);
+    signal(SIGILL, SIG_DFL);
+    memset(mycrash.prev, 0, sizeof(mycrash.prev));
+    mycrash.code_cnt = 0;
+    mycrash.tick = 0;
+    mycrash.ready = 0;
 }
 #endif
 
@@ -918,8 +6311,15 @@ int init_hook(const char *home, size_t page, const char *path)
     }
 
     strncpy(home_path, home, sizeof(home_path));
+    init_crash_handler();
+    myprof.enable = myconfig.profile.enable;
+    mycrash.record = myconfig.crash.ring;
     init_table();
+    if (check_symbol() < 0) {
+        return -1;
+    }
 
+    begin_patch();
     is_state_hooked = 0;
     if (path && path[0]) {
         is_state_hooked = 1;
@@ -952,10 +6352,10 @@ int init_hook(const char *home, size_t page, const char *path)
     );
 
 #if !defined(NDS_ARM64)
-    add_prehook(
+    add_replace(
+        "render_polygon_setup_perspective_steps",
         (void *)myhook.fun.render_polygon_setup_perspective_steps,
-        render_polygon_setup_perspective_steps,
-        NULL
+        render_polygon_setup_perspective_steps
     );
 
     add_prehook(
@@ -964,6 +6364,14 @@ int init_hook(const char *home, size_t page, const char *path)
         myhook.fun.org_save_directory_config_file
     );
 #endif
+    if (commit_patch() < 0) {
+        error("failed to install hooks\n");
+    }
+    print_code_patches();
+
+    if (myconfig.memtrace.rate > 0) {
+        start_mem_trace(myconfig.memtrace.rate);
+    }
 
     return 0;
 }
@@ -985,6 +6393,13 @@ int quit_hook(void)
 {
     trace("call %s()\n", __func__);
 
+    if (myprof.enable) {
+        print_hook_profile();
+    }
+
+    stop_mem_trace();
+    free_symbol();
+
     return 0;
 }
 
@@ -997,30 +6412,28 @@ TEST(detour, quit_hook)
 
 int toggle_micphone(void)
 {
-    const int buf_size = 65536;
-    static int need_clean = 0;
+    trace("call %s()\n", __func__);
 
-    myhook.use_mic ^= 1;
-    if (myhook.use_mic) {
-        int cc = 0;
-        int16_t *p = (uint16_t *)myhook.var.system.spu.audio->capture_buffer;
+    if (!myhook.use_mic) {
+        if (start_mic(myconfig.snd.mic, myhook.var.system.spu.audio->output_frequency) < 0) {
+            return -1;
+        }
 
         *myhook.var.capture_handle = 1;
         *myhook.var.system.micphone_status = 2;
-
-        need_clean = 1;
-        for (cc = 0; cc < buf_size; cc++) {
-            p[cc] = rand();
-        }
+        myhook.use_mic = 1;
     }
-    else if (need_clean) {
-        need_clean = 0;
+    else {
+        myhook.use_mic = 0;
+        stop_mic();
         memset(
             myhook.var.system.spu.audio->capture_buffer,
             0,
-            sizeof(int16_t) * buf_size
+            sizeof(myhook.var.system.spu.audio->capture_buffer)
         );
     }
+
+    return 0;
 }
 
 #if defined(UT)
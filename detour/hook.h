@@ -5,9 +5,52 @@
 #define __HOOK_H__
 
 #define MAX_STATE_SLOT      32
-#define CODE_FAST_FORWARD   0x08006ad0
+#define MAX_SPU_CHANNEL     16
+#define MIC_RING_SIZE       16384
+#define MIC_CHUNK           512
+#define MIC_DEF_FREQ        44100
+#define MIC_BLOW_LEVEL      24000
+#define MAX_HOOK            64
+#define MAX_HOOK_TRAMP      128
+#define HOOK_PATCH_SIZE32   8
+#define HOOK_PATCH_SIZE64   16
+#define HOOK_TRAMP_SIZE     256
+#define MAX_PATCH_TXN       64
+#define MAX_PATCH_PROT      (MAX_PATCH_TXN * 2)
+#define MAX_CODE_PATCH      8
+#define MAX_SYMBOL_NAME     64
+#define MAX_PROF_THREAD     8
+#define MAX_PROF_DEPTH      32
+#define MAX_REPLACE         8
+#define REPLACE_FRAMES      120
+#define MEMTRACE_MAGIC      0x5254454d
+#define MEMTRACE_VERSION    2
+#define MEMTRACE_REGIONS    16
+#define MEMTRACE_BUCKETS    2048
+#define MEMTRACE_DEF_RATE   64
+#define MEMTRACE_IO_SIZE    0x2000
+#define MEMTRACE_IO_HIGH    0x700
+#define MAX_MEMTRACE        32
+#define MAX_CRASH_RING      32
+#define MAX_CRASH_CODE      16
+#define CRASH_TICK_EARLY    120
+#define CRASH_TICK_FRAMES   600
+#define CRASH_STACK_SIZE    65536
+#define CRASH_FILE          "crash.txt"
+#define MEMTRACE_LOAD       0
+#define MEMTRACE_STORE      1
 #define ALIGN_ADDR(addr)    ((void*)((size_t)(addr) & ~(page_size - 1)))
 
+#if defined(NDS_ARM64)
+#define HOOK_PATCH_SIZE     HOOK_PATCH_SIZE64
+#define SYMBOL_FILE         "symbol64.txt"
+#define SYMBOL_TEXT_HASH    0xb25faa90
+#else
+#define HOOK_PATCH_SIZE     HOOK_PATCH_SIZE32
+#define SYMBOL_FILE         "symbol32.txt"
+#define SYMBOL_TEXT_HASH    0
+#endif
+
 enum _CONTROL_INDEX {
     CONTROL_INDEX_UP = 0,
     CONTROL_INDEX_DOWN,
@@ -225,6 +268,8 @@ typedef struct {
     void *set_screen_scale_factor;
     void *get_screen_ptr;
     void *spu_adpcm_decode_block;
+    void *spu_render_samples;
+    void *spu_update_channel_settings;
     void *render_scanline_tiled_4bpp;
     void *render_polygon_setup_perspective_steps;
     void *puts;
@@ -240,11 +285,67 @@ typedef struct {
     uint8_t org_save_directory_config_file[RESTORE_BUF_SIZE];
 } fun_t;
 
+typedef struct {
+    void *addr;
+    int len;
+    int done;
+    uint8_t data[RESTORE_BUF_SIZE];
+} patch_t;
+
+typedef struct {
+    const char *name;
+    const char *desc;
+    void **addr;
+    uint32_t org[RESTORE_BUF_SIZE / 4];
+    int len;
+    int (*encode)(uint32_t, uint32_t *);
+} code_patch_t;
+
+// memtrace_<time>.bin is this header followed by
+// uint32_t count[MEMTRACE_REGIONS][2][MEMTRACE_BUCKETS], load then store,
+// region is address bits 24-27, bucket is (address & 0xffffff) >> shift,
+// io above MEMTRACE_IO_SIZE goes to MEMTRACE_IO_HIGH + (bits 20-23 << 4) + bits 2-5
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t rate;
+    uint32_t regions;
+    uint32_t buckets;
+    uint32_t remaps;
+    uint32_t shift[MEMTRACE_REGIONS];
+    uint64_t ns;
+} memtrace_hdr_t;
+
+typedef struct {
+    const char *name;
+    void *target;
+    void *cb;
+    void *tramp;
+    void *thunk;
+    int applied;
+    int pending;
+    uintptr_t pos;
+    uint8_t org[HOOK_PATCH_SIZE];
+} hook_t;
+
+typedef struct {
+    uint64_t cnt;
+    uint64_t ns;
+} hook_prof_t;
+
+typedef struct {
+    char name[MAX_SYMBOL_NAME];
+    uintptr_t addr;
+    int sig_len;
+    uint8_t sig[HOOK_PATCH_SIZE64];
+} symbol_t;
+
 typedef struct {
     fun_t fun;
     var_t var;
 
     int use_mic;
+    int use_fast;
     int use_hinge;
 } nds_hook;
 
@@ -297,6 +398,10 @@ typedef struct {
     uint8_t capture_timer;
 } spu_channel_struct;
 
+typedef struct {
+    spu_channel_struct channels[MAX_SPU_CHANNEL];
+} spu_struct;
+
 typedef struct {
     void *capture_ptr;
     void *system;
@@ -321,6 +426,7 @@ typedef void (*nds_set_screen_scale_factor)(uint32_t);
 typedef void (*nds_quit)(void *);
 typedef void (*nds_screen_copy16)(uint16_t *, uint32_t);
 typedef void (*nds_spu_adpcm_decode_block)(spu_channel_struct *);
+typedef void (*nds_spu_update_channel_settings)(spu_struct *, spu_channel_struct *);
 typedef void* (*nds_get_screen_ptr)(uint32_t);
 typedef void* (*nds_realloc)(void *, size_t);
 typedef void* (*nds_malloc)(size_t);
@@ -347,7 +453,34 @@ int save_state(int slot);
 int set_fast_forward(uint8_t v);
 int unlock_area(const void *);
 int toggle_micphone(void);
+int write_mic_samples(const int16_t *, int);
 int add_prehook(void *, void *, uint8_t *);
+int begin_patch(void);
+int apply_patch(void *, const void *, int);
+int commit_patch(void);
+int add_hook(const char *, void *, void *, void **);
+int remove_hook(void *);
+int get_hook_cnt(void);
+int get_hook_info(int, hook_t *);
+int print_hooks(void);
+int print_hook_profile(void);
+int add_replace(const char *, void *, void *);
+int set_replace(const char *, int);
+int toggle_replace(void);
+int tick_replace(void);
+int set_code_patch(const char *, uint32_t);
+int revert_code_patch(const char *);
+int revert_code_patches(void);
+int print_code_patches(void);
+int start_mem_trace(int);
+int stop_mem_trace(void);
+int toggle_mem_trace(void);
+int tick_mem_trace(void);
+int init_crash_handler(void);
+int init_crash_stack(void);
+int tick_crash_handler(void);
+int load_symbol(const char *);
+void* get_symbol(const char *);
 void render_polygon_setup_perspective_steps(void);
 
 #ifdef __cplusplus
@@ -0,0 +1,28 @@
+#!/bin/sh
+# generate the symbol manifest loaded by detour/hook.c from the decom list
+# usage: gen_symbol.sh <decom/functions> <base> [drastic binary] > symbol.txt
+# with a binary, each function also gets its first 16 bytes as a prologue
+# signature, add_prehook refuses to patch when they differ
+
+if [ $# -lt 2 ]; then
+    echo "usage: $0 <decom/functions> <base> [drastic binary]" >&2
+    exit 1
+fi
+
+echo "# drastic symbol manifest, generated by gen_symbol.sh"
+if [ -n "$3" ]; then
+    set -- "$1" "$2" "$3" `readelf -lW "$3" | awk '/LOAD/ && / (R E|RWE) / { print $2, $3, $5; exit }'`
+    echo "text 0x`tail -c +$(($4 + 1)) "$3" | head -c $(($6)) | cksum | awk '{ printf("%08x", $1) }'`"
+fi
+echo "base $2"
+
+ls "$1" | sed -n 's/^\(.*\)_\([0-9a-f]\{8\}\)\.c$/\1 0x\2/p' | while read name addr; do
+    sig=""
+    if [ -n "$3" ]; then
+        off=$((addr - $2 - $5 + $4))
+        if [ $off -ge $(($4)) ] && [ $((off + 16)) -le $(($4 + $6)) ]; then
+            sig=" `od -An -tx1 -j $off -N 16 "$3" | tr -d ' \n'`"
+        fi
+    fi
+    echo "$name $addr$sig"
+done
@@ -12,8 +12,9 @@
 #include <errno.h>
 #include <string.h>
 #include <unistd.h>
+#include <poll.h>
 #include <pthread.h>
-#include <sys/select.h>
+#include <sys/eventfd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <linux/input.h>
@@ -225,8 +226,8 @@ static int set_uart(int fd, int speed, int flow_ctrl, int databits, int stopbits
     options.c_lflag &= ~(ICANON | ECHO | ECHOE | ISIG);
     options.c_iflag &= ~(INLCR | ICRNL | IGNCR);
     options.c_oflag &= ~(ONLCR | OCRNL);
-    options.c_cc[VTIME] = 1;
-    options.c_cc[VMIN] = 1;
+    options.c_cc[VTIME] = JOY_VTIME;
+    options.c_cc[VMIN] = FRAME_LEN;
 
 #if !defined(UT)
     tcflush(fd, TCIFLUSH);
@@ -273,14 +274,39 @@ TEST(sdl2_joystick, init_uart)
 }
 #endif
 
-static int read_uart(int fd, char *buf, int len)
+#if defined(UT)
+static int open_joy_pty(int *master)
 {
-#if !defined(UT)
-    int f_sel = 0;
-    fd_set f_read = { 0 };
-    struct timeval time = { 0 };
+    int fd = -1;
+    struct termios options = { 0 };
+
+    *master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (*master < 0) {
+        return -1;
+    }
+
+    grantpt(*master);
+    unlockpt(*master);
+    fd = open(ptsname(*master), O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        close(*master);
+        return -1;
+    }
+
+    tcgetattr(fd, &options);
+    cfmakeraw(&options);
+    options.c_cc[VTIME] = JOY_VTIME;
+    options.c_cc[VMIN] = FRAME_LEN;
+    tcsetattr(fd, TCSANOW, &options);
+
+    return fd;
+}
 #endif
 
+static int read_uart(int fd, char *buf, int len)
+{
+    struct pollfd pfd[2] = { 0 };
+
     trace("call %s(fd=%d, buf=%p, len=%d)\n", __func__, fd, buf, len);
 
     if ((fd < 0) || !buf || (len <= 0)) {
@@ -288,17 +314,21 @@ static int read_uart(int fd, char *buf, int len)
         return -1;
     }
 
-#if !defined(UT)
-    FD_ZERO(&f_read);
-    FD_SET(fd, &f_read);
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+    pfd[1].fd = myjoy.efd;
+    pfd[1].events = POLLIN;
+    if (poll(pfd, 2, -1) <= 0) {
+        return 0;
+    }
 
-    time.tv_sec = 10;
-    time.tv_usec = 0;
-    f_sel = select(fd + 1, &f_read, NULL, NULL, &time);
-    if (f_sel) {
+    if (pfd[1].revents & POLLIN) {
+        return 0;
+    }
+
+    if (pfd[0].revents & POLLIN) {
         return read(fd, buf, len);
     }
-#endif
 
     return 0;
 }
@@ -306,12 +336,33 @@ static int read_uart(int fd, char *buf, int len)
 #if defined(UT)
 TEST(sdl2_joystick, read_uart)
 {
+    int fd = -1;
+    int master = -1;
+    uint64_t v = 1;
     char buf[32] = { 0 };
+    const char frame[] = { FRAME_START, 1, 2, 3, 4, FRAME_STOP };
 
     TEST_ASSERT_EQUAL_INT(-1, read_uart(-1, NULL, 0));
     TEST_ASSERT_EQUAL_INT(-1, read_uart(0, NULL, 0));
     TEST_ASSERT_EQUAL_INT(-1, read_uart(0, buf, 0));
-    TEST_ASSERT_EQUAL_INT( 0, read_uart(0, buf, sizeof(buf)));
+
+    fd = open_joy_pty(&master);
+    TEST_ASSERT_TRUE(fd >= 0);
+
+    myjoy.efd = -1;
+    TEST_ASSERT_EQUAL_INT(3, write(master, frame, 3));
+    TEST_ASSERT_EQUAL_INT(3, write(master, frame + 3, 3));
+    TEST_ASSERT_EQUAL_INT(sizeof(frame), read_uart(fd, buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_MEMORY(frame, buf, sizeof(frame));
+
+    myjoy.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    TEST_ASSERT_EQUAL_INT(sizeof(v), write(myjoy.efd, &v, sizeof(v)));
+    TEST_ASSERT_EQUAL_INT(0, read_uart(fd, buf, sizeof(buf)));
+    close(myjoy.efd);
+    myjoy.efd = -1;
+
+    close(fd);
+    close(master);
 }
 #endif
 
@@ -355,6 +406,61 @@ TEST(sdl2_joystick, limit_value)
 }
 #endif
 
+static int publish_joy_axis(void)
+{
+    uint32_t v = 0;
+
+    trace("call %s()\n", __func__);
+
+    v |= (uint32_t)(uint8_t)myjoy.left.last.x;
+    v |= (uint32_t)(uint8_t)myjoy.left.last.y << 8;
+    v |= (uint32_t)(uint8_t)myjoy.right.last.x << 16;
+    v |= (uint32_t)(uint8_t)myjoy.right.last.y << 24;
+    __atomic_store_n(&myjoy.axis, v, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+int get_joy_axis(jval_t *left, jval_t *right)
+{
+    uint32_t v = 0;
+
+    trace("call %s()\n", __func__);
+
+    v = __atomic_load_n(&myjoy.axis, __ATOMIC_ACQUIRE);
+    if (left) {
+        left->x = (int8_t)(v);
+        left->y = (int8_t)(v >> 8);
+    }
+
+    if (right) {
+        right->x = (int8_t)(v >> 16);
+        right->y = (int8_t)(v >> 24);
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_joystick, get_joy_axis)
+{
+    jval_t l = { 0 };
+    jval_t r = { 0 };
+
+    myjoy.left.last.x = -128;
+    myjoy.left.last.y = 127;
+    myjoy.right.last.x = -1;
+    myjoy.right.last.y = 1;
+    TEST_ASSERT_EQUAL_INT(0, publish_joy_axis());
+    TEST_ASSERT_EQUAL_INT(0, get_joy_axis(&l, &r));
+    TEST_ASSERT_EQUAL_INT(-128, l.x);
+    TEST_ASSERT_EQUAL_INT(127, l.y);
+    TEST_ASSERT_EQUAL_INT(-1, r.x);
+    TEST_ASSERT_EQUAL_INT(1, r.y);
+    TEST_ASSERT_EQUAL_INT(0, get_joy_axis(NULL, NULL));
+}
+#endif
+
 static void update_axis_values(void)
 {
     int i = 0;
@@ -391,6 +497,7 @@ static void update_axis_values(void)
         }
         myjoy.last_axis[i] = myjoy.cur_axis[i];
     }
+    publish_joy_axis();
 }
 
 #if defined(UT)
@@ -472,42 +579,124 @@ TEST(sdl2_joystick, frame_to_axis)
 }
 #endif
 
-static int parse_serial_buf(const char *cmd, int len)
+static int push_joy_ring(const char *buf, int len)
 {
     int i = 0;
-    int p = 0;
-    int s = 0;
 
-    trace("call %s()\n", __func__);
+    trace("call %s(buf=%p, len=%d)\n", __func__, buf, len);
 
-    if (!cmd || (len < FRAME_LEN)) {
-        error("invalid parameters(%p, 0x%x)\n", cmd, len);
+    if (!buf || (len <= 0)) {
+        error("invalid parameters\n");
         return -1;
     }
 
-    s = len - FRAME_LEN;
-    s += 1;
-    for (i = 0; i < s; i += FRAME_LEN) {
-        for (p = 0; p < (FRAME_LEN - 1); p++) {
-            int tail = i + (FRAME_LEN - 1);
+    for (i = 0; i < len; i++) {
+        if ((myjoy.ring.head - myjoy.ring.tail) >= JOY_RING_LEN) {
+            myjoy.ring.tail += 1;
+        }
+        myjoy.ring.buf[myjoy.ring.head & (JOY_RING_LEN - 1)] = buf[i];
+        myjoy.ring.head += 1;
+    }
 
-            if (tail >= len) {
-                break;
-            }
+    return 0;
+}
 
-            if ((cmd[i] == (char)FRAME_START) &&
-                (cmd[tail] == (char)FRAME_STOP))
-            {
-                memcpy(&myjoy.cur_frame, cmd + i, sizeof(myjoy.cur_frame));
-                break;
-            }
-            else {
-                i += 1;
+#if defined(UT)
+TEST(sdl2_joystick, push_joy_ring)
+{
+    char buf[JOY_RING_LEN + 2] = { 0 };
+
+    myjoy.ring.head = 0;
+    myjoy.ring.tail = 0;
+    buf[sizeof(buf) - 1] = 0x55;
+    TEST_ASSERT_EQUAL_INT(-1, push_joy_ring(NULL, 0));
+    TEST_ASSERT_EQUAL_INT(0, push_joy_ring(buf, sizeof(buf)));
+    TEST_ASSERT_EQUAL_INT(JOY_RING_LEN, myjoy.ring.head - myjoy.ring.tail);
+    TEST_ASSERT_EQUAL_INT(2, myjoy.ring.tail);
+    TEST_ASSERT_EQUAL_INT(0x55, myjoy.ring.buf[(myjoy.ring.head - 1) & (JOY_RING_LEN - 1)]);
+}
+#endif
+
+static int pop_joy_frame(joy_frame_t *f)
+{
+    int i = 0;
+    uint32_t t = 0;
+    uint8_t *p = (uint8_t *)f;
+
+    trace("call %s(f=%p)\n", __func__, f);
+
+    if (!f) {
+        error("invalid parameter\n");
+        return -1;
+    }
+
+    while ((myjoy.ring.head - myjoy.ring.tail) >= FRAME_LEN) {
+        t = myjoy.ring.tail;
+        if ((myjoy.ring.buf[t & (JOY_RING_LEN - 1)] == FRAME_START) &&
+            (myjoy.ring.buf[(t + FRAME_LEN - 1) & (JOY_RING_LEN - 1)] == FRAME_STOP))
+        {
+            for (i = 0; i < FRAME_LEN; i++) {
+                p[i] = myjoy.ring.buf[(t + i) & (JOY_RING_LEN - 1)];
             }
+            myjoy.ring.tail += FRAME_LEN;
+            return 1;
         }
+        myjoy.ring.tail += 1;
     }
 
-#if defined(MIYOO_FLIP)
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_joystick, pop_joy_frame)
+{
+    joy_frame_t f = { 0 };
+    char buf0[] = { 9, FRAME_START, 1, 2 };
+    char buf1[] = { 3, 4, FRAME_STOP, FRAME_START };
+
+    myjoy.ring.head = 0;
+    myjoy.ring.tail = 0;
+    TEST_ASSERT_EQUAL_INT(-1, pop_joy_frame(NULL));
+
+    push_joy_ring(buf0, sizeof(buf0));
+    TEST_ASSERT_EQUAL_INT(0, pop_joy_frame(&f));
+
+    push_joy_ring(buf1, sizeof(buf1));
+    TEST_ASSERT_EQUAL_INT(1, pop_joy_frame(&f));
+    TEST_ASSERT_EQUAL_INT(FRAME_START, f.magic_start);
+    TEST_ASSERT_EQUAL_INT(1, f.left_y);
+    TEST_ASSERT_EQUAL_INT(2, f.left_x);
+    TEST_ASSERT_EQUAL_INT(3, f.right_y);
+    TEST_ASSERT_EQUAL_INT(4, f.right_x);
+    TEST_ASSERT_EQUAL_INT(FRAME_STOP, f.magic_end);
+    TEST_ASSERT_EQUAL_INT(1, myjoy.ring.head - myjoy.ring.tail);
+    TEST_ASSERT_EQUAL_INT(0, pop_joy_frame(&f));
+}
+#endif
+
+static int parse_serial_buf(const char *cmd, int len)
+{
+    int r = 0;
+    joy_frame_t f = { 0 };
+
+    trace("call %s()\n", __func__);
+
+    if (!cmd || (len <= 0)) {
+        error("invalid parameters(%p, 0x%x)\n", cmd, len);
+        return -1;
+    }
+
+    push_joy_ring(cmd, len);
+    while (pop_joy_frame(&f) > 0) {
+        r = 1;
+    }
+
+    if (!r) {
+        return 0;
+    }
+    memcpy(&myjoy.cur_frame, &f, sizeof(myjoy.cur_frame));
+
+#if defined(MIYOO_FLIP) || defined(UT)
     myjoy.cur_axis[0] = frame_to_axis(&myjoy.left.cali.x, myjoy.cur_frame.left_x);
     myjoy.cur_axis[1] = frame_to_axis(&myjoy.left.cali.y, myjoy.cur_frame.left_y);
     myjoy.cur_axis[2] = frame_to_axis(&myjoy.right.cali.x, myjoy.cur_frame.right_x);
@@ -527,6 +716,8 @@ TEST(sdl2_joystick, parse_serial_buf)
     char buf1[] = { 5, 6, FRAME_START, 1, 2, 33, 44, FRAME_STOP };
     char buf2[] = { 5, 6, FRAME_START, 1, 2, 3 };
 
+    myjoy.ring.head = 0;
+    myjoy.ring.tail = 0;
     TEST_ASSERT_EQUAL_INT(-1, parse_serial_buf(NULL, 0));
     TEST_ASSERT_EQUAL_INT(-1, parse_serial_buf(buf0, 0));
 
@@ -564,6 +755,9 @@ static int init_serial(void)
     memset(myjoy.cur_axis, 0, sizeof(myjoy.cur_axis));
     memset(myjoy.last_axis, 0, sizeof(myjoy.last_axis));
     memset(&(myjoy.cur_frame), 0, sizeof(myjoy.cur_frame));
+    memset(&(myjoy.ring), 0, sizeof(myjoy.ring));
+    myjoy.axis = 0;
+    myjoy.efd = -1;
 
     myjoy.fd = open_uart(JOY_DEV);
     if (myjoy.fd < 0) {
@@ -574,6 +768,12 @@ static int init_serial(void)
     if (init_uart(myjoy.fd, 9600, 0, 8, 1, 'N') < 0) {
         return -1;
     }
+
+    myjoy.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (myjoy.efd < 0) {
+        error("failed to create eventfd\n");
+        return -1;
+    }
     trace("joy fd=%d\n", myjoy.fd);
 
     return 0;
@@ -586,6 +786,8 @@ TEST(sdl2_joystick, init_serial)
     TEST_ASSERT_EQUAL_INT(0, myjoy.cur_frame.magic_start);
     TEST_ASSERT_EQUAL_INT(0, myjoy.cur_axis[0]);
     TEST_ASSERT_EQUAL_INT(0, myjoy.last_axis[0]);
+    TEST_ASSERT_EQUAL_INT(0, myjoy.ring.head);
+    TEST_ASSERT_EQUAL_INT(-1, myjoy.efd);
 }
 #endif
 
@@ -652,26 +854,90 @@ TEST(sdl2_joystick, read_joy_cfg)
 }
 #endif
 
-int joy_handler(void *param)
+static int read_joy_frames(int fd)
 {
-#if !defined(UT)
     int r = 0;
-    char buf[MAX_PATH] = { 0 };
+    char buf[JOY_RING_LEN] = { 0 };
+
+    trace("call %s(fd=%d)\n", __func__, fd);
+
+    r = read_uart(fd, buf, sizeof(buf));
+    if (r > 0) {
+        parse_serial_buf(buf, r);
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(sdl2_joystick, read_joy_frames)
+{
+    int i = 0;
+    int fd = -1;
+    int master = -1;
+    jval_t l = { 0 };
+    jval_t r = { 0 };
+
+    // captured from the flip uart, split where the driver returned short reads
+    const char cap0[] = { 0x80, 0x80, FRAME_STOP, FRAME_START, 0x80, 0x80 };
+    const char cap1[] = { 0xff, 0x80, FRAME_STOP, FRAME_START, 0x80, 0x00 };
+    const char cap2[] = { 0x80, 0x80, FRAME_STOP };
+
+    fd = open_joy_pty(&master);
+    TEST_ASSERT_TRUE(fd >= 0);
+
+    myjoy.efd = -1;
+    myjoy.ring.head = 0;
+    myjoy.ring.tail = 0;
+    for (i = 0; i < AXIS_MAX_LEN; i++) {
+        myjoy.last_axis[i] = 0;
+    }
+    myjoy.left.cali.x = (cali_t){ 0, 255, 128, 0 };
+    myjoy.left.cali.y = (cali_t){ 0, 255, 128, 0 };
+    myjoy.right.cali.x = (cali_t){ 0, 255, 128, 0 };
+    myjoy.right.cali.y = (cali_t){ 0, 255, 128, 0 };
+    myjoy.left.last.x = myjoy.left.last.y = 0;
+    myjoy.right.last.x = myjoy.right.last.y = 0;
+    publish_joy_axis();
+
+    TEST_ASSERT_EQUAL_INT(-1, read_joy_frames(-1));
+
+    TEST_ASSERT_EQUAL_INT(sizeof(cap0), write(master, cap0, sizeof(cap0)));
+    TEST_ASSERT_EQUAL_INT(sizeof(cap0), read_joy_frames(fd));
+    TEST_ASSERT_EQUAL_INT(0, myjoy.axis);
+
+    TEST_ASSERT_EQUAL_INT(sizeof(cap1), write(master, cap1, sizeof(cap1)));
+    TEST_ASSERT_EQUAL_INT(sizeof(cap1), read_joy_frames(fd));
+    get_joy_axis(&l, &r);
+    TEST_ASSERT_EQUAL_INT(0, l.x);
+    TEST_ASSERT_EQUAL_INT(0, l.y);
+    TEST_ASSERT_EQUAL_INT(0, r.x);
+    TEST_ASSERT_EQUAL_INT(126, r.y);
+
+    TEST_ASSERT_EQUAL_INT(sizeof(cap2), write(master, cap2, sizeof(cap2)));
+    TEST_ASSERT_EQUAL_INT(sizeof(cap2), read_joy_frames(fd));
+    get_joy_axis(&l, &r);
+    TEST_ASSERT_EQUAL_INT(-126, l.x);
+    TEST_ASSERT_EQUAL_INT(0, l.y);
+    TEST_ASSERT_EQUAL_INT(0, r.x);
+    TEST_ASSERT_EQUAL_INT(0, r.y);
+
+    close(fd);
+    close(master);
+}
 #endif
 
+int joy_handler(void *param)
+{
     trace("%s()++\n", __func__);
 
 #if !defined(UT)
     myjoy.running = 1;
 
     while (myjoy.running) {
-        r = read_uart(myjoy.fd, buf, sizeof(buf));
-
-        if (r > 0) {
-            buf[r] = 0;
-            parse_serial_buf(buf, r);
+        if (read_joy_frames(myjoy.fd) < 0) {
+            break;
         }
-        usleep(10000);
     }
 #endif
 
@@ -720,16 +986,30 @@ TEST(sdl2_joystick, JoystickInit)
 
 void JoystickQuit(void)
 {
+#if defined(MIYOO_FLIP) || defined(UT)
+    uint64_t v = 1;
+#endif
+
     trace("call %s()\n", __func__);
 
 #if defined(MIYOO_FLIP) || defined(UT)
     myjoy.running = 0;
+    if (myjoy.efd >= 0) {
+        if (write(myjoy.efd, &v, sizeof(v)) != sizeof(v)) {
+            error("failed to wake joystick handler\n");
+        }
+    }
 
     if (myjoy.thread) {
         SDL_WaitThread(myjoy.thread, NULL);
         myjoy.thread = NULL;
     }
 
+    if (myjoy.efd >= 0) {
+        close(myjoy.efd);
+        myjoy.efd = -1;
+    }
+
     if (myjoy.fd > 0) {
         close(myjoy.fd);
         myjoy.fd = -1;
@@ -992,6 +1272,8 @@ TEST(sdl2_joystick, JoystickSetSensorsEnabled)
 void JoystickUpdate(SDL_Joystick *j)
 {
 #if defined(MIYOO_FLIP)
+    jval_t l = { 0 };
+    jval_t r = { 0 };
     static int pre_lx = -1;
     static int pre_ly = -1;
     static int pre_rx = -1;
@@ -1007,23 +1289,25 @@ void JoystickUpdate(SDL_Joystick *j)
         }
 
 #if defined(MIYOO_FLIP)
-        if (myjoy.left.last.x != pre_lx) {
-            pre_lx = myjoy.left.last.x;
+        get_joy_axis(&l, &r);
+
+        if (l.x != pre_lx) {
+            pre_lx = l.x;
             SDL_PrivateJoystickAxis(j, 0, pre_lx);
         }
 
-        if (myjoy.left.last.y != pre_ly) {
-            pre_ly = myjoy.left.last.y;
+        if (l.y != pre_ly) {
+            pre_ly = l.y;
             SDL_PrivateJoystickAxis(j, 1, pre_ly);
         }
 
-        if (myjoy.right.last.x != pre_rx) {
-            pre_rx = myjoy.right.last.x;
+        if (r.x != pre_rx) {
+            pre_rx = r.x;
             SDL_PrivateJoystickAxis(j, 0, pre_rx);
         }
 
-        if (myjoy.right.last.y != pre_ry) {
-            pre_ry = myjoy.left.last.y;
+        if (r.y != pre_ry) {
+            pre_ry = r.y;
             SDL_PrivateJoystickAxis(j, 1, pre_ry);
         }
 #endif
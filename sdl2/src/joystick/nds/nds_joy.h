@@ -27,6 +27,8 @@
 #define FRAME_LEN           6
 #define FRAME_START         0xff
 #define FRAME_STOP          0xfe
+#define JOY_RING_LEN        64
+#define JOY_VTIME           1
 
 typedef struct {
     uint8_t magic_start;
@@ -48,11 +50,14 @@ typedef struct {
     int x;
     int y;
 } jval_t;
+
+int get_joy_axis(jval_t *left, jval_t *right);
 #endif
 
 typedef struct {
 #if defined(MIYOO_FLIP) || defined(UT)
     int fd;
+    int efd;
 
     int running;
     SDL_Thread *thread;
@@ -60,6 +65,13 @@ typedef struct {
     joy_frame_t cur_frame;
     int32_t cur_axis[AXIS_MAX_LEN];
     int32_t last_axis[AXIS_MAX_LEN];
+    uint32_t axis;
+
+    struct {
+        uint8_t buf[JOY_RING_LEN];
+        uint32_t head;
+        uint32_t tail;
+    } ring;
 
     struct {
         struct {
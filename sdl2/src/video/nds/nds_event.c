@@ -5,8 +5,16 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <ctype.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <dirent.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/inotify.h>
+#include <sys/ioctl.h>
+#include <errno.h>
 #include <linux/input.h>
 
 #if defined(UT)
@@ -34,6 +42,10 @@ extern nds_hook myhook;
 extern nds_video myvideo;
 extern nds_config myconfig;
 
+static int wake_input_handler(void);
+static int init_movie(void);
+static int stop_movie(void);
+
 static const SDL_Scancode nds_key_code[] = {
     SDLK_UP,            // UP
     SDLK_DOWN,          // DOWN
@@ -164,6 +176,34 @@ TEST(sdl2_event, inc_touch_axis)
 }
 #endif
 
+static int clear_key_bits(uint32_t mask)
+{
+    trace("call %s(mask=0x%x)\n", __func__, mask);
+
+    myevent.keypad.cur_bits &= ~mask;
+    myevent.keypad.done_bits |= mask;
+    __atomic_fetch_and(&myevent.keypad.raw_bits, ~mask, __ATOMIC_RELAXED);
+    __atomic_store_n(&myevent.keypad.clear_gen, myevent.keypad.clear_gen + 1, __ATOMIC_RELEASE);
+    wake_input_handler();
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, clear_key_bits)
+{
+    myevent.keypad.done_bits = 0;
+    myevent.keypad.raw_bits = (1 << KEY_BIT_A) | (1 << KEY_BIT_SAVE);
+    myevent.keypad.cur_bits = (1 << KEY_BIT_A) | (1 << KEY_BIT_SAVE);
+    TEST_ASSERT_EQUAL_INT(0, clear_key_bits(1 << KEY_BIT_SAVE));
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A), myevent.keypad.cur_bits);
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A), myevent.keypad.raw_bits);
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_SAVE), myevent.keypad.done_bits);
+    myevent.keypad.done_bits = 0;
+    myevent.keypad.raw_bits = 0;
+}
+#endif
+
 static int release_key(void)
 {
     int cc = 0;
@@ -171,13 +211,13 @@ static int release_key(void)
     trace("call %s()\n", __func__);
 
     for (cc = 0; cc <= KEY_BIT_LAST; cc++) {
-        if (myevent.keypad.cur_bits & 1) {
+        if (myevent.keypad.cur_bits & (1 << cc)) {
 #if !defined(UT)
             SDL_SendKeyboardKey(SDL_RELEASED, SDL_GetScancodeFromKey(nds_key_code[cc]));
 #endif
         }
-        myevent.keypad.cur_bits >>= 1;
     }
+    clear_key_bits(myevent.keypad.cur_bits);
     myevent.input.touch_status = 0;
     myevent.input.button_status = 0;
 
@@ -202,7 +242,7 @@ static int hit_hotkey(uint32_t bit)
 
     mask = 1 << bit;
     mask |= (1 << ((myconfig.hotkey == HOTKEY_BIND_SELECT) ? KEY_BIT_SELECT : KEY_BIT_MENU));
-    r = (myevent.keypad.cur_bits ^ mask) ? 0 : 1;
+    r = (__atomic_load_n(&myevent.keypad.raw_bits, __ATOMIC_RELAXED) ^ mask) ? 0 : 1;
 
     trace("bit=%d, r=%d\n", bit, r);
 
@@ -213,46 +253,46 @@ static int hit_hotkey(uint32_t bit)
 TEST(sdl2_event, hit_hotkey)
 {
     myconfig.hotkey = HOTKEY_BIND_SELECT;
-    myevent.keypad.cur_bits = (1 << KEY_BIT_SELECT) | (1 << KEY_BIT_A);
+    myevent.keypad.raw_bits = (1 << KEY_BIT_SELECT) | (1 << KEY_BIT_A);
     TEST_ASSERT_EQUAL_INT(1, hit_hotkey(KEY_BIT_A));
 }
 #endif
 
 static int set_key_bit(uint32_t bit, int val)
 {
-    trace("call %s(bit=%d, val=%d, cur_bits=0x%04x)\n", __func__, bit, val, myevent.keypad.cur_bits);
+    trace("call %s(bit=%d, val=%d, raw_bits=0x%04x)\n", __func__, bit, val, myevent.keypad.raw_bits);
 
     if (val) {
         if (myconfig.hotkey == HOTKEY_BIND_SELECT) {
             if (bit == KEY_BIT_SELECT) {
-                myevent.keypad.cur_bits = 0;
+                __atomic_store_n(&myevent.keypad.raw_bits, 0, __ATOMIC_RELAXED);
             }
         }
         else {
             if (bit == KEY_BIT_MENU) {
-                myevent.keypad.cur_bits = 0;
+                __atomic_store_n(&myevent.keypad.raw_bits, 0, __ATOMIC_RELAXED);
             }
         }
 
-        myevent.keypad.cur_bits |= (1 << bit);
+        __atomic_fetch_or(&myevent.keypad.raw_bits, (1 << bit), __ATOMIC_RELAXED);
     }
     else {
-        myevent.keypad.cur_bits &= ~(1 << bit);
+        __atomic_fetch_and(&myevent.keypad.raw_bits, ~(1 << bit), __ATOMIC_RELAXED);
     }
 
-    trace("cur_bits=0x%04x\n", myevent.keypad.cur_bits);
+    trace("raw_bits=0x%04x\n", myevent.keypad.raw_bits);
     return 0;
 }
 
 #if defined(UT)
 TEST(sdl2_event, set_key_bit)
 {
-    myevent.keypad.cur_bits = 0;
+    myevent.keypad.raw_bits = 0;
     TEST_ASSERT_EQUAL_INT(0, set_key_bit(KEY_BIT_UP, 1));
-    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_UP), myevent.keypad.cur_bits);
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_UP), myevent.keypad.raw_bits);
 
     TEST_ASSERT_EQUAL_INT(0, set_key_bit(KEY_BIT_UP, 0));
-    TEST_ASSERT_EQUAL_INT((0 << KEY_BIT_UP), myevent.keypad.cur_bits);
+    TEST_ASSERT_EQUAL_INT((0 << KEY_BIT_UP), myevent.keypad.raw_bits);
 }
 #endif
 
@@ -475,7 +515,7 @@ static int remap_touch(jval_t *j, int idx)
 
     if (pre_up[idx] || pre_down[idx] || pre_left[idx] || pre_right[idx]) {
         r = 1;
-        if (myevent.keypad.cur_bits &  (1 << KEY_BIT_Y)) {
+        if (myevent.keypad.raw_bits &  (1 << KEY_BIT_Y)) {
             if (pre_right[idx]) {
                 static int cc = 0;
 
@@ -493,42 +533,35 @@ static int remap_touch(jval_t *j, int idx)
             }
         }
         else {
-            int x = 0;
-            int y = 0;
-
+            // the pen itself belongs to the emulator thread, moves are handed over by sync_input_snapshot()
             if (is_book_mode() && (myconfig.key_rotate == 0)) {
                 if (pre_up[idx]) {
-                    myevent.touch.x+= inc_touch_axis(1);
+                    myevent.snap.next.touch_dx += inc_touch_axis(1);
                 }
                 if (pre_down[idx]) {
-                    myevent.touch.x-= inc_touch_axis(1);
+                    myevent.snap.next.touch_dx -= inc_touch_axis(1);
                 }
                 if (pre_left[idx]) {
-                    myevent.touch.y-= inc_touch_axis(0);
+                    myevent.snap.next.touch_dy -= inc_touch_axis(0);
                 }
                 if (pre_right[idx]) {
-                    myevent.touch.y+= inc_touch_axis(0);
+                    myevent.snap.next.touch_dy += inc_touch_axis(0);
                 }
             }
             else {
                 if (pre_up[idx]) {
-                    myevent.touch.y-= inc_touch_axis(1);
+                    myevent.snap.next.touch_dy -= inc_touch_axis(1);
                 }
                 if (pre_down[idx]) {
-                    myevent.touch.y+= inc_touch_axis(1);
+                    myevent.snap.next.touch_dy += inc_touch_axis(1);
                 }
                 if (pre_left[idx]) {
-                    myevent.touch.x-= inc_touch_axis(0);
+                    myevent.snap.next.touch_dx -= inc_touch_axis(0);
                 }
                 if (pre_right[idx]) {
-                    myevent.touch.x+= inc_touch_axis(0);
+                    myevent.snap.next.touch_dx += inc_touch_axis(0);
                 }
             }
-            limit_touch_axis();
-
-            x = (myevent.touch.x * 160) / myevent.touch.max_x;
-            y = (myevent.touch.y * 120) / myevent.touch.max_y;
-            SDL_SendMouseMotion(myvideo.win, 0, 0, x + 80, y + (*myhook.var.sdl.swap_screens ? 120 : 0));
         }
         myconfig.joy.show_cnt = MYJOY_SHOW_CNT;
     }
@@ -681,28 +714,33 @@ TEST(sdl2_event, remap_custkey)
 static int update_joy_state(void)
 {
     int r = 0;
+    jval_t left = { 0 };
+    jval_t right = { 0 };
 
     trace("call %s()\n", __func__);
 
-    if (myconfig.joy.mode == MYJOY_MODE_KEY) {
-        r |= remap_keypad(&myjoy.left.last, 0);
+    get_joy_axis(&left, &right);
+
+    // with analog mode on, left stick is evaluated once per frame by update_analog()
+    if ((myconfig.analog.mode == ANALOG_MODE_OFF) && (myconfig.joy.mode == MYJOY_MODE_KEY)) {
+        r |= remap_keypad(&left, 0);
     }
-    else if (myconfig.joy.mode == MYJOY_MODE_TOUCH) {
-        r |= remap_touch(&myjoy.left.last, 0);
+    else if ((myconfig.analog.mode == ANALOG_MODE_OFF) && (myconfig.joy.mode == MYJOY_MODE_TOUCH)) {
+        r |= remap_touch(&left, 0);
     }
-    else if (myconfig.joy.mode == MYJOY_MODE_CUST_KEY) {
-        r |= remap_custkey(&myjoy.left.last, 0);
+    else if ((myconfig.analog.mode == ANALOG_MODE_OFF) && (myconfig.joy.mode == MYJOY_MODE_CUST_KEY)) {
+        r |= remap_custkey(&left, 0);
     }
 
 #if defined(MIYOO_FLIP)
     if (myconfig.rjoy.mode == MYJOY_MODE_KEY) {
-        r |= remap_keypad(&myjoy.right.last, 1);
+        r |= remap_keypad(&right, 1);
     }
     else if (myconfig.rjoy.mode == MYJOY_MODE_TOUCH) {
-        r |= remap_touch(&myjoy.right.last, 1);
+        r |= remap_touch(&right, 1);
     }
     else if (myconfig.rjoy.mode == MYJOY_MODE_CUST_KEY) {
-        r |= remap_custkey(&myjoy.right.last, 1);
+        r |= remap_custkey(&right, 1);
     }
 #endif
 
@@ -717,6 +755,221 @@ TEST(sdl2_event, update_joy_state)
 }
 #endif
 
+static int flush_input(void)
+{
+    trace("call %s()\n", __func__);
+
+    __atomic_store_n(&myevent.keypad.raw_bits, 0, __ATOMIC_RELAXED);
+    myevent.snap.next.flush_seq += 1;
+
+    return 0;
+}
+
+static uint64_t get_sched_time(void)
+{
+#if defined(UT)
+    return myevent.sched.now;
+#else
+    return get_tick_count_us();
+#endif
+}
+
+static int arm_hotkey_timer(void)
+{
+    int cc = 0;
+    uint64_t due = 0;
+    struct itimerspec ts = {{ 0 }};
+
+    trace("call %s()\n", __func__);
+
+    for (cc = 0; cc < myevent.sched.cnt; cc++) {
+        if ((due == 0) || (myevent.sched.task[cc].due < due)) {
+            due = myevent.sched.task[cc].due;
+        }
+    }
+
+    if (myevent.sched.tfd < 0) {
+        return -1;
+    }
+
+    if (due) {
+        ts.it_value.tv_sec = due / 1000000;
+        ts.it_value.tv_nsec = (due % 1000000) * 1000;
+    }
+
+    return timerfd_settime(myevent.sched.tfd, TFD_TIMER_ABSTIME, &ts, NULL);
+}
+
+static int get_poll_timeout(void)
+{
+    int cc = 0;
+    uint64_t ms = 0;
+    uint64_t now = 0;
+    uint64_t due = 0;
+
+    // without a timerfd the due tasks run when epoll_wait() times out
+    if ((myevent.sched.tfd >= 0) || (myevent.sched.cnt <= 0)) {
+        return INPUT_POLL_MS;
+    }
+
+    for (cc = 0; cc < myevent.sched.cnt; cc++) {
+        if ((due == 0) || (myevent.sched.task[cc].due < due)) {
+            due = myevent.sched.task[cc].due;
+        }
+    }
+
+    now = get_sched_time();
+    if (due <= now) {
+        return 0;
+    }
+
+    ms = (due - now + 999) / 1000;
+    if ((INPUT_POLL_MS >= 0) && (ms > INPUT_POLL_MS)) {
+        return INPUT_POLL_MS;
+    }
+
+    return ms;
+}
+
+#if defined(UT)
+TEST(sdl2_event, get_poll_timeout)
+{
+    myevent.sched.tfd = -1;
+    myevent.sched.cnt = 0;
+    myevent.sched.now = 1000;
+    TEST_ASSERT_EQUAL_INT(INPUT_POLL_MS, get_poll_timeout());
+
+    myevent.sched.cnt = 1;
+    myevent.sched.task[0].due = 1000;
+    TEST_ASSERT_EQUAL_INT(0, get_poll_timeout());
+
+    myevent.sched.task[0].due = 1000 + 1500;
+    TEST_ASSERT_EQUAL_INT(2, get_poll_timeout());
+
+    myevent.sched.tfd = 0;
+    TEST_ASSERT_EQUAL_INT(INPUT_POLL_MS, get_poll_timeout());
+
+    myevent.sched.tfd = -1;
+    myevent.sched.cnt = 0;
+    myevent.sched.now = 0;
+}
+#endif
+
+static int schedule_hotkey(hotkey_task_type_t type, int code, int val, uint32_t delay_us)
+{
+    hotkey_task_t *t = NULL;
+
+    trace("call %s(type=%d, code=%d, val=%d, delay=%d)\n", __func__, type, code, val, delay_us);
+
+    if (myevent.sched.cnt >= MAX_HOTKEY_TASK) {
+        error("hotkey queue is full\n");
+        return -1;
+    }
+
+    t = &myevent.sched.task[myevent.sched.cnt++];
+    t->due = get_sched_time() + delay_us;
+    t->type = type;
+    t->code = code;
+    t->val = val;
+    arm_hotkey_timer();
+
+    return 0;
+}
+
+static int run_hotkey_task(hotkey_task_t *t)
+{
+    trace("call %s(t=%p)\n", __func__, t);
+
+    switch (t->type) {
+    case HOTKEY_TASK_KEY_BIT:
+        set_key_bit(t->code, t->val);
+        break;
+    case HOTKEY_TASK_SDL_KEY:
+#if !defined(UT)
+        SDL_SendKeyboardKey(t->val ? SDL_PRESSED : SDL_RELEASED, t->code);
+#endif
+        break;
+    case HOTKEY_TASK_SDL2_MENU:
+#if !defined(UT)
+        handle_sdl2_menu(t->code);
+#endif
+        flush_input();
+        break;
+    }
+
+    return 0;
+}
+
+static int run_hotkey_tasks(void)
+{
+    int r = 0;
+    int cc = 0;
+    int sel = 0;
+    uint64_t now = get_sched_time();
+    hotkey_task_t t = { 0 };
+
+    trace("call %s()\n", __func__);
+
+    while (myevent.sched.cnt > 0) {
+        sel = 0;
+        for (cc = 1; cc < myevent.sched.cnt; cc++) {
+            if (myevent.sched.task[cc].due < myevent.sched.task[sel].due) {
+                sel = cc;
+            }
+        }
+
+        if (myevent.sched.task[sel].due > now) {
+            break;
+        }
+
+        t = myevent.sched.task[sel];
+        myevent.sched.cnt -= 1;
+        for (cc = sel; cc < myevent.sched.cnt; cc++) {
+            myevent.sched.task[cc] = myevent.sched.task[cc + 1];
+        }
+
+        run_hotkey_task(&t);
+        r += 1;
+    }
+    arm_hotkey_timer();
+
+    return r;
+}
+
+#if defined(UT)
+TEST(sdl2_event, run_hotkey_tasks)
+{
+    int cc = 0;
+
+    myevent.sched.tfd = -1;
+    myevent.sched.cnt = 0;
+    myevent.sched.now = 1000;
+    myevent.keypad.raw_bits = 0;
+
+    TEST_ASSERT_EQUAL_INT(0, schedule_hotkey(HOTKEY_TASK_KEY_BIT, KEY_BIT_A, 0, 2 * HOTKEY_PULSE_US));
+    TEST_ASSERT_EQUAL_INT(0, schedule_hotkey(HOTKEY_TASK_KEY_BIT, KEY_BIT_A, 1, HOTKEY_PULSE_US));
+    TEST_ASSERT_EQUAL_INT(0, run_hotkey_tasks());
+    TEST_ASSERT_EQUAL_INT(2, myevent.sched.cnt);
+
+    myevent.sched.now += HOTKEY_PULSE_US;
+    TEST_ASSERT_EQUAL_INT(1, run_hotkey_tasks());
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A), myevent.keypad.raw_bits);
+
+    myevent.sched.now += HOTKEY_PULSE_US;
+    TEST_ASSERT_EQUAL_INT(1, run_hotkey_tasks());
+    TEST_ASSERT_EQUAL_INT(0, myevent.keypad.raw_bits);
+    TEST_ASSERT_EQUAL_INT(0, myevent.sched.cnt);
+
+    for (cc = 0; cc < MAX_HOTKEY_TASK; cc++) {
+        TEST_ASSERT_EQUAL_INT(0, schedule_hotkey(HOTKEY_TASK_SDL_KEY, 0, 0, cc));
+    }
+    TEST_ASSERT_EQUAL_INT(-1, schedule_hotkey(HOTKEY_TASK_SDL_KEY, 0, 0, 0));
+    myevent.sched.now += MAX_HOTKEY_TASK;
+    TEST_ASSERT_EQUAL_INT(MAX_HOTKEY_TASK, run_hotkey_tasks());
+    myevent.sched.now = 0;
+}
+#endif
+
 static int enter_sdl2_menu(sdl2_menu_type_t t)
 {
     trace("call %s(t=%d)\n", __func__, t);
@@ -724,13 +977,7 @@ static int enter_sdl2_menu(sdl2_menu_type_t t)
     if (myvideo.menu.sdl2.enable == 0) {
         myvideo.menu.sdl2.type = t;
         myvideo.menu.sdl2.enable = 1;
-        usleep(100000);
-
-#if !defined(UT)
-        handle_sdl2_menu(-1);
-#endif
-
-        myevent.keypad.pre_bits = myevent.keypad.cur_bits = 0;
+        schedule_hotkey(HOTKEY_TASK_SDL2_MENU, -1, 0, HOTKEY_PULSE_US);
     }
 
     return 0;
@@ -739,14 +986,23 @@ static int enter_sdl2_menu(sdl2_menu_type_t t)
 #if defined(UT)
 TEST(sdl2_event, enter_sdl2_menu)
 {
-    myevent.keypad.pre_bits = 1;
-    myevent.keypad.cur_bits = 1;
+    myevent.sched.tfd = -1;
+    myevent.sched.cnt = 0;
+    myevent.sched.now = 0;
+    myevent.keypad.raw_bits = 1;
+    myevent.snap.next.flush_seq = 0;
     myvideo.menu.sdl2.enable = 0;
 
     TEST_ASSERT_EQUAL_INT(0, enter_sdl2_menu(0));
     TEST_ASSERT_EQUAL_INT(1, myvideo.menu.sdl2.enable);
-    TEST_ASSERT_EQUAL_INT(0, myevent.keypad.pre_bits);
-    TEST_ASSERT_EQUAL_INT(0, myevent.keypad.cur_bits);
+    TEST_ASSERT_EQUAL_INT(1, myevent.keypad.raw_bits);
+    TEST_ASSERT_EQUAL_INT(1, myevent.sched.cnt);
+
+    myevent.sched.now += HOTKEY_PULSE_US;
+    TEST_ASSERT_EQUAL_INT(1, run_hotkey_tasks());
+    TEST_ASSERT_EQUAL_INT(0, myevent.keypad.raw_bits);
+    TEST_ASSERT_EQUAL_INT(1, myevent.snap.next.flush_seq);
+    myevent.sched.now = 0;
 }
 #endif
 
@@ -779,6 +1035,7 @@ TEST(sdl2_event, find_next_available_bg)
 
 static int handle_hotkey(void)
 {
+    int cc = 0;
     int check_hotkey = 0;
 
     trace("call %s()\n", __func__);
@@ -788,6 +1045,34 @@ static int handle_hotkey(void)
         check_hotkey = 0;
     }
 
+    for (cc = 0; check_hotkey && myconfig.macro.key && (cc <= KEY_BIT_LAST); cc++) {
+        if ((myconfig.macro.key & (1 << cc)) && hit_hotkey(cc)) {
+            __atomic_store_n(&myevent.macro.req, 1, __ATOMIC_RELEASE);
+            set_key_bit(cc, 0);
+        }
+    }
+
+    for (cc = 0; check_hotkey && myconfig.profile.key && (cc <= KEY_BIT_LAST); cc++) {
+        if ((myconfig.profile.key & (1 << cc)) && hit_hotkey(cc)) {
+            print_hook_profile();
+            set_key_bit(cc, 0);
+        }
+    }
+
+    for (cc = 0; check_hotkey && myconfig.replace.key && (cc <= KEY_BIT_LAST); cc++) {
+        if ((myconfig.replace.key & (1 << cc)) && hit_hotkey(cc)) {
+            toggle_replace();
+            set_key_bit(cc, 0);
+        }
+    }
+
+    for (cc = 0; check_hotkey && myconfig.memtrace.key && (cc <= KEY_BIT_LAST); cc++) {
+        if ((myconfig.memtrace.key & (1 << cc)) && hit_hotkey(cc)) {
+            toggle_mem_trace();
+            set_key_bit(cc, 0);
+        }
+    }
+
     if (check_hotkey && hit_hotkey(KEY_BIT_UP)) {
         toggle_micphone();
         set_key_bit(KEY_BIT_UP, 0);
@@ -817,7 +1102,7 @@ static int handle_hotkey(void)
                 myevent.mode = (myevent.mode == NDS_KEY_MODE) ? NDS_TOUCH_MODE : NDS_KEY_MODE;
 
                 if (myevent.mode == NDS_TOUCH_MODE) {
-                    release_key();
+                    flush_input();
                 }
                 myevent.touch.slow_down = 0;
             }
@@ -857,6 +1142,7 @@ static int handle_hotkey(void)
 #if defined(MIYOO_MINI) || defined(MIYOO_FLIP) || defined(TRIMUI_BRICK) || defined(GKD_PIXEL2) || defined(GKD_MINIPLUS) || defined(TRIMUI_SMART)
         //enter_sdl2_menu(MENU_TYPE_SHOW_HOTKEY);
 #endif
+        __atomic_store_n(&myevent.movie.req, MOVIE_REQ_TOGGLE, __ATOMIC_RELEASE);
 
         set_key_bit(KEY_BIT_X, 0);
     }
@@ -892,9 +1178,8 @@ static int handle_hotkey(void)
             load_menu_res();
 
             if (myvideo.menu.drastic.enable) {
-                SDL_SendKeyboardKey(SDL_PRESSED, SDLK_e);
-                usleep(100000);
-                SDL_SendKeyboardKey(SDL_RELEASED, SDLK_e);
+                schedule_hotkey(HOTKEY_TASK_SDL_KEY, SDLK_e, 1, 0);
+                schedule_hotkey(HOTKEY_TASK_SDL_KEY, SDLK_e, 0, HOTKEY_PULSE_US);
             }
         }
         set_key_bit(KEY_BIT_Y, 0);
@@ -963,7 +1248,7 @@ static int handle_hotkey(void)
 #endif
         set_key_bit(KEY_BIT_L2, 0);
     }
-    else if (myevent.keypad.cur_bits & (1 << KEY_BIT_L2)) {
+    else if (myevent.keypad.raw_bits & (1 << KEY_BIT_L2)) {
 #if defined(MIYOO_FLIP)
         if (myconfig.joy.mode != MYJOY_MODE_TOUCH) {
 #endif
@@ -972,7 +1257,7 @@ static int handle_hotkey(void)
                 set_key_bit(KEY_BIT_L2, 0);
 
                 if (myevent.mode == NDS_TOUCH_MODE) {
-                    release_key();
+                    flush_input();
                 }
                 myevent.touch.slow_down = 0;
             }
@@ -1092,12 +1377,12 @@ static int update_key_bit(uint32_t c, uint32_t v)
 #if defined(UT)
 TEST(sdl2_event, update_key_bit)
 {
-    myevent.keypad.cur_bits = 0;
+    myevent.keypad.raw_bits = 0;
     myevent.keypad.up = DEV_KEY_CODE_UP;
     TEST_ASSERT_EQUAL_INT(0, update_key_bit(DEV_KEY_CODE_UP, 1));
-    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_UP), myevent.keypad.cur_bits);
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_UP), myevent.keypad.raw_bits);
     TEST_ASSERT_EQUAL_INT(0, update_key_bit(DEV_KEY_CODE_UP, 0));
-    TEST_ASSERT_EQUAL_INT((0 << KEY_BIT_UP), myevent.keypad.cur_bits);
+    TEST_ASSERT_EQUAL_INT((0 << KEY_BIT_UP), myevent.keypad.raw_bits);
 }
 #endif
 
@@ -1193,22 +1478,11 @@ static int get_brick_key_code(struct input_event *e)
 
     trace("call %s(e=%p)\n", __func__, e);
 
-    if (myevent.fd < 0) {
-        error("invalid input handle\n");
-        return -1;
-    }
-
     if (!e) {
         error("e is null\n");
         return -1;
     }
 
-#if !defined(UT)
-    if (read(myevent.fd, e, sizeof(struct input_event)) == 0) {
-        return 0;
-    }
-#endif
-
     r = 1;
     switch (e->code) {
     case 17:
@@ -1269,29 +1543,84 @@ TEST(sdl2_event, get_brick_key_code)
 }
 #endif
 
-static int get_input_key_code(int fd, struct input_event *e)
+static int set_input_clock(int fd)
 {
-    trace("call %s(fd=%d, event=%p)\n", __func__, fd, e);
+    int clk = CLOCK_MONOTONIC;
+
+    trace("call %s(fd=%d)\n", __func__, fd);
 
     if (fd < 0) {
-        error("invalid handle\n");
+        error("invalid input\n");
         return -1;
     }
 
-    if (!e) {
-        error("invalid parameter\n");
+    return ioctl(fd, EVIOCSCLOCKID, &clk);
+}
+
+#if defined(UT)
+TEST(sdl2_event, set_input_clock)
+{
+    TEST_ASSERT_EQUAL_INT(-1, set_input_clock(-1));
+}
+#endif
+
+static int read_input_events(int fd, struct input_event *e, int max)
+{
+    ssize_t r = 0;
+
+    trace("call %s(fd=%d, e=%p, max=%d)\n", __func__, fd, e, max);
+
+    if ((fd < 0) || !e || (max <= 0)) {
+        error("invalid input\n");
         return -1;
     }
 
+    r = read(fd, e, sizeof(struct input_event) * max);
+    if (r <= 0) {
+        return 0;
+    }
+
+    return r / sizeof(struct input_event);
+}
+
 #if defined(UT)
-    return 0;
+TEST(sdl2_event, read_input_events)
+{
+    int fd[2] = { 0 };
+    struct input_event e[INPUT_EVENT_BATCH] = {{{ 0 }}};
+
+    TEST_ASSERT_EQUAL_INT(-1, read_input_events(-1, e, INPUT_EVENT_BATCH));
+    TEST_ASSERT_EQUAL_INT(-1, read_input_events(0, NULL, INPUT_EVENT_BATCH));
+
+    TEST_ASSERT_EQUAL_INT(0, pipe(fd));
+    TEST_ASSERT_EQUAL_INT(0, fcntl(fd[0], F_SETFL, O_NONBLOCK));
+    TEST_ASSERT_EQUAL_INT(0, read_input_events(fd[0], e, INPUT_EVENT_BATCH));
+
+    e[0].code = 1;
+    e[2].code = 3;
+    TEST_ASSERT_EQUAL_INT(sizeof(e[0]) * 3, write(fd[1], e, sizeof(e[0]) * 3));
+    memset(e, 0, sizeof(e));
+    TEST_ASSERT_EQUAL_INT(3, read_input_events(fd[0], e, INPUT_EVENT_BATCH));
+    TEST_ASSERT_EQUAL_INT(1, e[0].code);
+    TEST_ASSERT_EQUAL_INT(3, e[2].code);
+
+    close(fd[0]);
+    close(fd[1]);
+}
 #endif
 
-    if (read(fd, e, sizeof(struct input_event)) > 0) {
-        if ((e->type == EV_KEY) && (e->value != 2)) {
-            trace("got input event\n");
-            return 1;
-        }
+static int get_input_key_code(struct input_event *e)
+{
+    trace("call %s(event=%p)\n", __func__, e);
+
+    if (!e) {
+        error("invalid parameter\n");
+        return -1;
+    }
+
+    if ((e->type == EV_KEY) && (e->value != 2)) {
+        trace("got input event\n");
+        return 1;
     }
 
     trace("ignore input event\n");
@@ -1301,8 +1630,97 @@ static int get_input_key_code(int fd, struct input_event *e)
 #if defined(UT)
 TEST(sdl2_event, get_input_key_code)
 {
-    TEST_ASSERT_EQUAL_INT(-1, get_input_key_code(-1, NULL));
-    TEST_ASSERT_EQUAL_INT(0, get_input_key_code(0xdead, (void *)0xdead));
+    struct input_event e = {{ 0 }};
+
+    TEST_ASSERT_EQUAL_INT(-1, get_input_key_code(NULL));
+
+    e.type = EV_KEY;
+    e.value = 1;
+    TEST_ASSERT_EQUAL_INT(1, get_input_key_code(&e));
+
+    e.value = 2;
+    TEST_ASSERT_EQUAL_INT(0, get_input_key_code(&e));
+
+    e.type = EV_SYN;
+    e.value = 0;
+    TEST_ASSERT_EQUAL_INT(0, get_input_key_code(&e));
+}
+#endif
+
+static int handle_key_events(int fd)
+{
+    int r = 0;
+    int cc = 0;
+    int cnt = 0;
+    struct input_event e[INPUT_EVENT_BATCH] = {{{ 0 }}};
+
+    trace("call %s(fd=%d)\n", __func__, fd);
+
+    // fd is non-blocking, keep reading until EAGAIN so nothing waits for the next wakeup
+    while ((cnt = read_input_events(fd, e, INPUT_EVENT_BATCH)) > 0) {
+        for (cc = 0; cc < cnt; cc++) {
+#if defined(TRIMUI_BRICK)
+            if (get_brick_key_code(&e[cc]) <= 0) {
+                continue;
+            }
+#else
+            if (get_input_key_code(&e[cc]) <= 0) {
+                continue;
+            }
+#endif
+
+            trace("code=%d, value=%d\n", e[cc].code, e[cc].value);
+            update_key_bit(e[cc].code, e[cc].value);
+            if (!r && (myconfig.input_latency > 0)) {
+                myevent.snap.next.key_us = (e[cc].input_event_sec * 1000000ULL) + e[cc].input_event_usec;
+                myevent.snap.next.key_seq += 1;
+            }
+            r += 1;
+        }
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(sdl2_event, handle_key_events)
+{
+    int fd[2] = { 0 };
+    struct input_event e[3] = {{{ 0 }}};
+
+    TEST_ASSERT_EQUAL_INT(0, pipe(fd));
+    TEST_ASSERT_EQUAL_INT(0, fcntl(fd[0], F_SETFL, O_NONBLOCK));
+
+    e[0].type = EV_KEY;
+    e[0].code = DEV_KEY_CODE_A;
+    e[0].value = 1;
+    e[1].type = EV_SYN;
+    e[2].type = EV_KEY;
+    e[2].code = DEV_KEY_CODE_B;
+    e[2].value = 1;
+    myevent.keypad.a = DEV_KEY_CODE_A;
+    myevent.keypad.b = DEV_KEY_CODE_B;
+    myevent.keypad.raw_bits = 0;
+    TEST_ASSERT_EQUAL_INT(sizeof(e), write(fd[1], e, sizeof(e)));
+    TEST_ASSERT_EQUAL_INT(2, handle_key_events(fd[0]));
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A) | (1 << KEY_BIT_B), myevent.keypad.raw_bits);
+    TEST_ASSERT_EQUAL_INT(0, handle_key_events(fd[0]));
+
+    myconfig.input_latency = 1;
+    myevent.snap.next.key_seq = 0;
+    e[0].input_event_sec = 3;
+    e[0].input_event_usec = 500;
+    e[2].input_event_sec = 4;
+    TEST_ASSERT_EQUAL_INT(sizeof(e), write(fd[1], e, sizeof(e)));
+    TEST_ASSERT_EQUAL_INT(2, handle_key_events(fd[0]));
+    TEST_ASSERT_EQUAL_INT(1, myevent.snap.next.key_seq);
+    TEST_ASSERT_EQUAL_INT(3000500, myevent.snap.next.key_us);
+
+    myconfig.input_latency = 0;
+    myevent.keypad.raw_bits = 0;
+    memset(&myevent.snap, 0, sizeof(myevent.snap));
+    close(fd[0]);
+    close(fd[1]);
 }
 #endif
 
@@ -1419,21 +1837,21 @@ TEST(sdl2_event, handle_trimui_special_key)
 
     t = 0x800;
     myevent.cust_key.gpio = &t;
-    myevent.keypad.cur_bits = 0;
+    myevent.keypad.raw_bits = 0;
     TEST_ASSERT_EQUAL_INT(1, handle_trimui_special_key());
-    TEST_ASSERT_EQUAL_INT((0 << KEY_BIT_R2), myevent.keypad.cur_bits);
+    TEST_ASSERT_EQUAL_INT((0 << KEY_BIT_R2), myevent.keypad.raw_bits);
 
     t = 0;
     myevent.cust_key.gpio = &t;
-    myevent.keypad.cur_bits = 0;
+    myevent.keypad.raw_bits = 0;
     TEST_ASSERT_EQUAL_INT(1, handle_trimui_special_key());
-    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_R2), myevent.keypad.cur_bits);
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_R2), myevent.keypad.raw_bits);
 
     t = 0;
     myevent.cust_key.gpio = &t;
-    myevent.keypad.cur_bits = 0;
+    myevent.keypad.raw_bits = 0;
     TEST_ASSERT_EQUAL_INT(0, handle_trimui_special_key());
-    TEST_ASSERT_EQUAL_INT(0, myevent.keypad.cur_bits);
+    TEST_ASSERT_EQUAL_INT(0, myevent.keypad.raw_bits);
 }
 #endif
 
@@ -1465,7 +1883,7 @@ TEST(sdl2_event, send_touch_axis)
 #endif
 
 #if defined(MOTO_XT897) || defined(FXTEC_QX1000) || defined(UT)
-int handle_touch_event(int fd)
+int handle_touch_event(struct input_event *e)
 {
     static int tp_id = 0;
     static int tp_valid = 0;
@@ -1484,16 +1902,14 @@ int handle_touch_event(int fd)
     float tp_max_y = 1080.0;
 #endif
 
-    trace("call %s(fd=%d)\n", __func__, fd);
+    trace("call %s(e=%p)\n", __func__, e);
 
-    if (fd < 0) {
+    if (!e) {
         error("invalid parameter\n");
         return -1;
     }
 
-    if (read(fd, &ev, sizeof(struct input_event)) <= 0) {
-        return 0;
-    }
+    ev = *e;
 
     trace("touch, type:%d, code:0x%x, value:%d\n", ev.type, ev.code, ev.value);
     if (ev.type == EV_ABS) {
@@ -1534,13 +1950,12 @@ int handle_touch_event(int fd)
 #if defined(FXTEC_QX1000)
         if ((ev.code == 0) && (ev.value == 0)) {
 #endif
+            myevent.panel.ready = 1;
+            myevent.panel.pressed = tp_valid;
             if (tp_valid) {
-                int x = 0;
-                int y = 0;
-                int lcd = 0;
-                int update = 0;
-
                 tp_valid = 0;
+                myevent.panel.last = tp[tp_id];
+                myevent.panel.time = (ev.input_event_sec * 1000000ULL) + ev.input_event_usec;
                 trace(
                     "touch id=%d, x=%d, y=%d, pressure=%d\n",
                     tp_id,
@@ -1548,87 +1963,8 @@ int handle_touch_event(int fd)
                     tp[tp_id].y,
                     tp[tp_id].pressure
                 );
-
-                switch (myconfig.layout.mode.sel) {
-                case LAYOUT_MODE_N0:
-                case LAYOUT_MODE_N1:
-                case LAYOUT_MODE_N2:
-                case LAYOUT_MODE_N3:
-                case LAYOUT_MODE_N4:
-                    if (*myhook.var.sdl.swap_screens != 0) {
-                        break;
-                    }
-
-                    lcd = 1;
-                    update = 1;
-                    break;
-                default:
-                    update = 1;
-                    lcd = !(*myhook.var.sdl.swap_screens);
-                    break;
-                }
-
-                if (update) {
-
-                    switch (myconfig.layout.mode.sel) {
-                    case LAYOUT_MODE_B0:
-                    case LAYOUT_MODE_B2:
-                        x = tp[tp_id].x -
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].x;
-                        x = ((float)x /
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].h) * NDS_H;
-
-                        y = tp[tp_id].y -
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].y;
-                        y = ((float)y /
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].w) * NDS_W;
-
-                        myevent.touch.x = (NDS_H - y) + 60;
-                        myevent.touch.y = x;
-                        break;
-                    case LAYOUT_MODE_B1:
-                    case LAYOUT_MODE_B3:
-                        x = tp[tp_id].x -
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].x;
-                        x = ((float)x /
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].h) * NDS_H;
-
-                        y = tp[tp_id].y -
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].y;
-                        y = ((float)y /
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].w) * NDS_W;
-
-                        myevent.touch.x = y;
-                        myevent.touch.y = (NDS_W - x) - 60;
-                        break;
-                    default:
-                        x = tp[tp_id].x -
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].x;
-                        x = ((float)x /
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].w) * NDS_W;
-
-                        y = tp[tp_id].y -
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].y;
-                        y = ((float)y /
-                            myvideo.layout.mode[myconfig.layout.mode.sel].screen[lcd].h) * NDS_H;
-
-                        myevent.touch.x = x;
-                        myevent.touch.y = y;
-                        break;
-                    }
-                    myevent.input.touch_status = tp[tp_id].pressure * 100;
-                    limit_touch_axis();
-
-                    trace("send touch event, x=%d, y=%d, pressure=%d\n",
-                        myevent.touch.x,
-                        myevent.touch.y,
-                        myevent.input.touch_status
-                    );
-                }
-            }
-            else {
-                myevent.input.touch_status = 0;
             }
+            return 1;
 #if defined(MOTO_XT897) || defined(FXTEC_QX1000)
         }
 #endif
@@ -1640,366 +1976,2139 @@ int handle_touch_event(int fd)
 #if defined(UT)
 TEST(sdl2_event, handle_touch_event)
 {
+    struct input_event e = {{ 0 }};
+
+    TEST_ASSERT_EQUAL_INT(-1, handle_touch_event(NULL));
+
+    myevent.panel.ready = 0;
+    e.type = EV_ABS;
+    e.code = ABS_MT_PRESSURE;
+    e.value = 5;
+    TEST_ASSERT_EQUAL_INT(0, handle_touch_event(&e));
+    TEST_ASSERT_EQUAL_INT(0, myevent.panel.ready);
+
+    e.type = EV_SYN;
+    e.code = SYN_REPORT;
+    e.value = 0;
+    TEST_ASSERT_EQUAL_INT(1, handle_touch_event(&e));
+    TEST_ASSERT_EQUAL_INT(1, myevent.panel.ready);
+    TEST_ASSERT_EQUAL_INT(1, myevent.panel.pressed);
+    TEST_ASSERT_EQUAL_INT(5, myevent.panel.last.pressure);
+
+    TEST_ASSERT_EQUAL_INT(1, handle_touch_event(&e));
+    TEST_ASSERT_EQUAL_INT(0, myevent.panel.pressed);
+    myevent.panel.ready = 0;
 }
 #endif
-#endif
 
-int input_handler(void *data)
+static int update_touch_map(void)
 {
-    int rk = 0;
-    int rj = 0;
-    int sleep_us = 10000;
-    struct input_event ev = {{ 0 }};
+    int lcd = 0;
+    int sel = myconfig.layout.mode.sel;
+    int swap = myhook.var.sdl.swap_screens ? *myhook.var.sdl.swap_screens : 0;
+    touch_map_t *m = &myevent.panel.map;
+    SDL_Rect *rt = NULL;
 
     trace("call %s()\n", __func__);
 
-#if !defined(UT)
-    myevent.fd = open(INPUT_DEV, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
-    if (myevent.fd < 0) {
-        error("failed to open \"%s\"\n", INPUT_DEV);
-        exit(-1);
+    switch (sel) {
+    case LAYOUT_MODE_N0:
+    case LAYOUT_MODE_N1:
+    case LAYOUT_MODE_N2:
+    case LAYOUT_MODE_N3:
+    case LAYOUT_MODE_N4:
+        lcd = 1;
+        break;
+    default:
+        lcd = !swap;
+        break;
     }
-#endif
 
-#if defined(MOTO_XT897) || defined(FXTEC_QX1000)
-#if defined(MOTO_XT897)
-    sleep_us = 100;
-#else
-    sleep_us = 1000;
-#endif
-    myevent.tp_fd = open(TOUCH_DEV, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
-    myevent.pwr_fd = open(POWER_DEV, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
-#endif
+    rt = &myvideo.layout.mode[sel].screen[lcd];
+    if (m->valid &&
+        (m->sel == sel) &&
+        (m->swap == swap) &&
+        !memcmp(&m->rect, rt, sizeof(SDL_Rect)))
+    {
+        return 0;
+    }
 
-#if defined(UT)
-    myevent.thread.running = 0;
-#else
-    myevent.thread.running = 1;
+    m->valid = 1;
+    m->sel = sel;
+    m->swap = swap;
+    m->rect = *rt;
+    m->update = 1;
+    memset(m->m, 0, sizeof(m->m));
 
-    myevent.sem = SDL_CreateSemaphore(1);
-    if(myevent.sem == NULL) {
-        error("failed to create semaphore\n");
-        exit(-1);
+    if ((rt->w <= 0) || (rt->h <= 0)) {
+        m->update = 0;
+        return 1;
     }
-#endif
 
-    while (myevent.thread.running) {
-        update_latest_keypad_value();
+    switch (sel) {
+    case LAYOUT_MODE_N0:
+    case LAYOUT_MODE_N1:
+    case LAYOUT_MODE_N2:
+    case LAYOUT_MODE_N3:
+    case LAYOUT_MODE_N4:
+        m->update = (swap == 0);
+        m->m[0] = (float)NDS_W / rt->w;
+        m->m[2] = -rt->x * m->m[0];
+        m->m[4] = (float)NDS_H / rt->h;
+        m->m[5] = -rt->y * m->m[4];
+        break;
+    case LAYOUT_MODE_B0:
+    case LAYOUT_MODE_B2:
+        m->m[1] = -(float)NDS_W / rt->w;
+        m->m[2] = NDS_H + 60 - rt->y * m->m[1];
+        m->m[3] = (float)NDS_H / rt->h;
+        m->m[5] = -rt->x * m->m[3];
+        break;
+    case LAYOUT_MODE_B1:
+    case LAYOUT_MODE_B3:
+        m->m[1] = (float)NDS_W / rt->w;
+        m->m[2] = -rt->y * m->m[1];
+        m->m[3] = -(float)NDS_H / rt->h;
+        m->m[5] = NDS_W - 60 - rt->x * m->m[3];
+        break;
+    default:
+        m->m[0] = (float)NDS_W / rt->w;
+        m->m[2] = -rt->x * m->m[0];
+        m->m[4] = (float)NDS_H / rt->h;
+        m->m[5] = -rt->y * m->m[4];
+        break;
+    }
 
-        SDL_SemWait(myevent.sem);
+    return 1;
+}
 
-        memset(&ev, 0, sizeof(ev));
+#if defined(UT)
+TEST(sdl2_event, update_touch_map)
+{
+    SDL_Rect rt = { 100, 50, NDS_W * 2, NDS_H * 2 };
+
+    myevent.panel.map.valid = 0;
+    myconfig.layout.mode.sel = LAYOUT_MODE_N5;
+    myvideo.layout.mode[LAYOUT_MODE_N5].screen[1] = rt;
+    myvideo.layout.mode[LAYOUT_MODE_N5].screen[0] = rt;
+    TEST_ASSERT_EQUAL_INT(1, update_touch_map());
+    TEST_ASSERT_EQUAL_INT(0, update_touch_map());
+    TEST_ASSERT_EQUAL_INT(1, myevent.panel.map.update);
+    TEST_ASSERT_EQUAL_FLOAT(0.5, myevent.panel.map.m[0]);
+    TEST_ASSERT_EQUAL_FLOAT(-50.0, myevent.panel.map.m[2]);
+    TEST_ASSERT_EQUAL_FLOAT(-25.0, myevent.panel.map.m[5]);
 
-#if defined(MIYOO_FLIP) || defined(UT)
-        rk = get_flip_key_code(&ev);
-#elif defined(TRIMUI_BRICK) || defined(UT)
-        rk = get_brick_key_code(&ev);
-#else
-        rk = get_input_key_code(myevent.fd, &ev);
+    myconfig.layout.mode.sel = LAYOUT_MODE_B0;
+    myvideo.layout.mode[LAYOUT_MODE_B0].screen[1] = rt;
+    myvideo.layout.mode[LAYOUT_MODE_B0].screen[0] = rt;
+    TEST_ASSERT_EQUAL_INT(1, update_touch_map());
+    TEST_ASSERT_EQUAL_FLOAT(-0.5, myevent.panel.map.m[1]);
+    TEST_ASSERT_EQUAL_FLOAT(NDS_H + 60 + 25, myevent.panel.map.m[2]);
+    myevent.panel.map.valid = 0;
+}
 #endif
 
-        if (rk > 0) {
-            trace("code=%d, value=%d\n", ev.code, ev.value);
-            update_key_bit(ev.code, ev.value);
-        }
+static int publish_touch_sample(void)
+{
+    float x = 0;
+    float y = 0;
+    float k = 0;
+    touch_map_t *m = &myevent.panel.map;
 
-#if defined(MIYOO_FLIP)
-        rj = update_joy_state();
-#endif
+    trace("call %s()\n", __func__);
 
-        if ((rk > 0) || (rj > 0)) {
-            handle_hotkey();
-        }
+    myevent.panel.ready = 0;
+    if (!myevent.panel.pressed) {
+        myevent.panel.pre_time = 0;
+        myevent.snap.next.touch_status = 0;
+        myevent.snap.next.touch_seq += 1;
+        return 0;
+    }
 
-#if defined(TRIMUI_SMART) || defined(UT)
-        handle_trimui_special_key();
-#endif
+    update_touch_map();
+    if (!m->update) {
+        return 0;
+    }
 
-#if defined(MOTO_XT897) || defined(FXTEC_QX1000)
-        rk = get_input_key_code(myevent.pwr_fd, &ev);
-        if (rk > 0) {
-            trace("code=%d, value=%d\n", ev.code, ev.value);
-            update_key_bit(ev.code, ev.value);
+    x = (m->m[0] * myevent.panel.last.x) + (m->m[1] * myevent.panel.last.y) + m->m[2];
+    y = (m->m[3] * myevent.panel.last.x) + (m->m[4] * myevent.panel.last.y) + m->m[5];
+
+    myevent.snap.next.touch_x = x;
+    myevent.snap.next.touch_y = y;
+    if (myconfig.pen.predict && myevent.panel.pre_time && (myevent.panel.time > myevent.panel.pre_time)) {
+        k = (myconfig.pen.predict * 1000.0) / (myevent.panel.time - myevent.panel.pre_time);
+        if (k > TOUCH_PREDICT_MAX) {
+            k = TOUCH_PREDICT_MAX;
         }
+        myevent.snap.next.touch_x = x + ((x - myevent.panel.pre_x) * k);
+        myevent.snap.next.touch_y = y + ((y - myevent.panel.pre_y) * k);
+    }
+    myevent.panel.pre_x = x;
+    myevent.panel.pre_y = y;
+    myevent.panel.pre_time = myevent.panel.time;
 
-        handle_touch_event(myevent.tp_fd);
-#endif
+    myevent.snap.next.touch_status = myevent.panel.last.pressure * 100;
+    myevent.snap.next.touch_seq += 1;
 
-        SDL_SemPost(myevent.sem);
+    trace("send touch event, x=%d, y=%d, pressure=%d\n",
+        myevent.snap.next.touch_x,
+        myevent.snap.next.touch_y,
+        myevent.snap.next.touch_status
+    );
 
-        usleep(sleep_us);
-    }
-    
-    return 0;
+    return 1;
 }
 
 #if defined(UT)
-TEST(sdl2_event, input_handler)
+TEST(sdl2_event, publish_touch_sample)
 {
-    TEST_ASSERT_EQUAL_INT(0, input_handler(NULL));
+    SDL_Rect rt = { 0, 0, NDS_W, NDS_H };
+
+    myconfig.pen.predict = 0;
+    myconfig.layout.mode.sel = LAYOUT_MODE_N5;
+    myvideo.layout.mode[LAYOUT_MODE_N5].screen[0] = rt;
+    myvideo.layout.mode[LAYOUT_MODE_N5].screen[1] = rt;
+    myevent.panel.map.valid = 0;
+    myevent.snap.next.touch_seq = 0;
+
+    myevent.panel.pressed = 0;
+    TEST_ASSERT_EQUAL_INT(0, publish_touch_sample());
+    TEST_ASSERT_EQUAL_INT(1, myevent.snap.next.touch_seq);
+
+    myevent.panel.pressed = 1;
+    myevent.panel.time = 1000;
+    myevent.panel.last.x = 10;
+    myevent.panel.last.y = 20;
+    myevent.panel.last.pressure = 1;
+    TEST_ASSERT_EQUAL_INT(1, publish_touch_sample());
+    TEST_ASSERT_EQUAL_INT(10, myevent.snap.next.touch_x);
+    TEST_ASSERT_EQUAL_INT(20, myevent.snap.next.touch_y);
+    TEST_ASSERT_EQUAL_INT(100, myevent.snap.next.touch_status);
+
+    myconfig.pen.predict = 4;
+    myevent.panel.time = 9000;
+    myevent.panel.last.x = 18;
+    TEST_ASSERT_EQUAL_INT(1, publish_touch_sample());
+    TEST_ASSERT_EQUAL_INT(22, myevent.snap.next.touch_x);
+    TEST_ASSERT_EQUAL_INT(20, myevent.snap.next.touch_y);
+
+    myconfig.pen.predict = 0;
+    myevent.panel.map.valid = 0;
+    myevent.panel.pre_time = 0;
+    memset(&myevent.snap.next, 0, sizeof(myevent.snap.next));
 }
 #endif
 
-void init_event(void)
+static int handle_touch_events(int fd)
 {
-    trace("call %s()\n", __func__);
+    int r = 0;
+    int cc = 0;
+    int cnt = 0;
+    struct input_event e[INPUT_EVENT_BATCH] = {{{ 0 }}};
 
-    memset(&myevent, 0, sizeof(myevent));
+    trace("call %s(fd=%d)\n", __func__, fd);
 
-    myevent.mode = NDS_KEY_MODE;
-    myevent.touch.max_x = NDS_W;
-    myevent.touch.max_y = NDS_H;
-    myevent.touch.x = myevent.touch.max_x >> 1;
-    myevent.touch.y = myevent.touch.max_y >> 1;
+    while ((cnt = read_input_events(fd, e, INPUT_EVENT_BATCH)) > 0) {
+        for (cc = 0; cc < cnt; cc++) {
+            handle_touch_event(&e[cc]);
+        }
+        r += cnt;
+    }
 
-    myevent.keypad.up = DEV_KEY_CODE_UP;
-    myevent.keypad.down = DEV_KEY_CODE_DOWN;
-    myevent.keypad.left = DEV_KEY_CODE_LEFT;
-    myevent.keypad.right = DEV_KEY_CODE_RIGHT;
-    myevent.keypad.a = DEV_KEY_CODE_A;
-    myevent.keypad.b = DEV_KEY_CODE_B;
-    myevent.keypad.x = DEV_KEY_CODE_X;
-    myevent.keypad.y = DEV_KEY_CODE_Y;
-    myevent.keypad.l1 = DEV_KEY_CODE_L1;
-    myevent.keypad.r1 = DEV_KEY_CODE_R1;
-    myevent.keypad.l2 = DEV_KEY_CODE_L2;
-    myevent.keypad.r2 = DEV_KEY_CODE_R2;
-    myevent.keypad.select = DEV_KEY_CODE_SELECT;
-    myevent.keypad.start = DEV_KEY_CODE_START;
-    myevent.keypad.menu = DEV_KEY_CODE_MENU;
-    myevent.keypad.power = DEV_KEY_CODE_POWER;
+    if (myevent.panel.ready) {
+        publish_touch_sample();
+    }
 
-    myevent.keypad.save = -1;
-    myevent.keypad.load = -1;
-    myevent.keypad.fast = -1;
-    myevent.keypad.exit = -1;
+    return r;
+}
 
-#if defined(FXTEC_QX1000) || defined(MOTO_XT897) || defined(TRIMUI_BRICK) || defined(GKD_MINIPLUS) || defined(UT)
-    myevent.keypad.save = DEV_KEY_CODE_SAVE;
-    myevent.keypad.load = DEV_KEY_CODE_LOAD;
-#if defined(FXTEC_QX1000) || defined(MOTO_XT897) || defined(GKD_MINIPLUS) || defined(UT)
-    myevent.keypad.fast = DEV_KEY_CODE_FAST;
-    myevent.keypad.exit = DEV_KEY_CODE_EXIT;
+#if defined(UT)
+TEST(sdl2_event, handle_touch_events)
+{
+    int cc = 0;
+    int fd[2] = { 0 };
+    struct input_event e[2] = {{{ 0 }}};
+
+    TEST_ASSERT_EQUAL_INT(0, pipe(fd));
+    TEST_ASSERT_EQUAL_INT(0, fcntl(fd[0], F_SETFL, O_NONBLOCK));
+    TEST_ASSERT_EQUAL_INT(0, handle_touch_events(fd[0]));
+
+    myevent.panel.ready = 0;
+    myevent.snap.next.touch_seq = 0;
+    e[0].type = EV_SYN;
+    e[1].type = EV_SYN;
+    TEST_ASSERT_EQUAL_INT(sizeof(e), write(fd[1], e, sizeof(e)));
+    TEST_ASSERT_EQUAL_INT(2, handle_touch_events(fd[0]));
+    TEST_ASSERT_EQUAL_INT(0, myevent.panel.ready);
+    TEST_ASSERT_EQUAL_INT(1, myevent.snap.next.touch_seq);
+
+    for (cc = 0; cc < (INPUT_EVENT_BATCH + 1); cc++) {
+        TEST_ASSERT_EQUAL_INT(sizeof(e[0]), write(fd[1], e, sizeof(e[0])));
+    }
+    TEST_ASSERT_EQUAL_INT(INPUT_EVENT_BATCH + 1, handle_touch_events(fd[0]));
+    TEST_ASSERT_EQUAL_INT(0, handle_touch_events(fd[0]));
+
+    myevent.snap.next.touch_seq = 0;
+    close(fd[0]);
+    close(fd[1]);
+}
 #endif
 #endif
 
-#if defined(TRIMUI_SMART) || defined(UT)
-    myevent.cust_key.gpio = NULL;
-    myevent.cust_key.fd = open("/dev/mem", O_RDWR);
-    if (myevent.cust_key.fd > 0) {
-        myevent.cust_key.mem = mmap(
-            0,
-            4096,
-            PROT_READ | PROT_WRITE,
-            MAP_SHARED,
-            myevent.cust_key.fd,
-            0x01c20000
-        );
-
-        if (myevent.cust_key.mem != MAP_FAILED) {
-            uint32_t *p = NULL;
-
-            p = (uint32_t *)(myevent.cust_key.mem + 0x800 + (0x24 * 6) + 0x04);
-            myevent.cust_key.pre_cfg = *p;
-            *p &= 0xfff000ff;
+static int add_input_fd(int fd)
+{
+    struct epoll_event ev = { 0 };
 
-            p = (uint32_t *)(myevent.cust_key.mem + 0x800 + (0x24 * 6) + 0x1c);
-            *p |= 0x01500000;
+    trace("call %s(fd=%d)\n", __func__, fd);
 
-            myevent.cust_key.gpio = (uint32_t *)(myevent.cust_key.mem + 0x800 + (0x24 * 6) + 0x10);
-        }
+    if ((myevent.epfd < 0) || (fd < 0)) {
+        error("invalid input\n");
+        return -1;
     }
-#endif
 
-    myevent.thread.id = SDL_CreateThreadInternal(input_handler, "NDS Input Handler", 4096, NULL);
-    if (myevent.thread.id == NULL) {
-        error("failed to create thread for input handler\n");
-        exit(-1);
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(myevent.epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        error("failed to add fd %d to epoll\n", fd);
+        return -1;
     }
-}
 
-#if defined(UT)
-TEST(sdl2_event, init_event)
-{
-    init_event();
-    TEST_ASSERT_EQUAL_INT(NDS_KEY_MODE, myevent.mode);
-    TEST_ASSERT_NOT_NULL(myevent.thread.id);
-    TEST_ASSERT_EQUAL_INT(DEV_KEY_CODE_SAVE, myevent.keypad.save);
+    return 0;
 }
-#endif
 
-void quit_event(void)
+static int open_input_poll(void)
 {
+    int cc = 0;
+
     trace("call %s()\n", __func__);
 
-    myevent.thread.running = 0;
-    trace("wait for input handler complete...\n");
-    if (myevent.thread.id) {
-        SDL_WaitThread(myevent.thread.id, NULL);
+    myevent.epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (myevent.epfd < 0) {
+        error("failed to create epoll\n");
+        return -1;
     }
-    trace("completed\n");
 
-    if (myevent.sem) {
-        SDL_DestroySemaphore(myevent.sem);
+    myevent.efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (myevent.efd < 0) {
+        error("failed to create eventfd\n");
+        close(myevent.epfd);
+        myevent.epfd = -1;
+        return -1;
     }
 
-    if(myevent.fd > 0) {
-        close(myevent.fd);
-        myevent.fd = -1;
+    myevent.sched.cnt = 0;
+    myevent.sched.tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (myevent.sched.tfd < 0) {
+        error("failed to create timerfd, hotkey tasks follow the poll timeout\n");
     }
-
-#if defined(MOTO_XT897) || defined(FXTEC_QX1000)
-    if (myevent.tp_fd > 0) {
-        close(myevent.tp_fd);
-        myevent.tp_fd = -1;
+    else {
+        add_input_fd(myevent.sched.tfd);
     }
 
-    if (myevent.pwr_fd > 0) {
-        close(myevent.pwr_fd);
-        myevent.pwr_fd = -1;
+    for (cc = 0; cc < MAX_INPUT_DEV; cc++) {
+        myevent.hotplug.dev[cc].fd = -1;
     }
-#endif
-
-#if defined(TRIMUI_SMART) || defined(UT)
-    if (myevent.cust_key.fd > 0) {
-        uint32_t *p = (uint32_t *)(myevent.cust_key.mem + 0x800 + (0x24 * 6) + 0x04);
-
-        *p = myevent.cust_key.pre_cfg;
-        munmap(myevent.cust_key.mem, 4096);
-        close(myevent.cust_key.fd);
 
-        myevent.cust_key.gpio = NULL;
-        myevent.cust_key.fd = -1;
+    myevent.hotplug.ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (myevent.hotplug.ifd >= 0) {
+        if (inotify_add_watch(myevent.hotplug.ifd, INPUT_DEV_DIR, IN_CREATE | IN_ATTRIB | IN_DELETE) < 0) {
+            error("failed to watch \"%s\"\n", INPUT_DEV_DIR);
+        }
+        add_input_fd(myevent.hotplug.ifd);
     }
-#endif
-}
 
-#if defined(UT)
-TEST(sdl2_event, quit_event)
-{
-    myevent.thread.running = 1;
-    quit_event();
-    TEST_ASSERT_EQUAL_INT(0, myevent.thread.running);
+    return add_input_fd(myevent.efd);
 }
-#endif
 
-static int send_key_to_menu(void)
+static int close_input_poll(void)
 {
     int cc = 0;
-    uint32_t bit = 0;
-    uint32_t changed = myevent.keypad.pre_bits ^ myevent.keypad.cur_bits;
 
     trace("call %s()\n", __func__);
 
-    for (cc = 0; cc <= KEY_BIT_LAST; cc++) {
-        bit = 1 << cc;
-
-        if (changed & bit) {
-            if ((myevent.keypad.cur_bits & bit) == 0) {
-#if !defined(UT)
-                handle_sdl2_menu(cc);
-#endif
-            }
+    for (cc = 0; cc < MAX_INPUT_DEV; cc++) {
+        if (myevent.hotplug.dev[cc].fd >= 0) {
+            close(myevent.hotplug.dev[cc].fd);
+            myevent.hotplug.dev[cc].fd = -1;
         }
     }
-    myevent.keypad.pre_bits = myevent.keypad.cur_bits;
 
-    return 0;
-}
+    if (myevent.hotplug.ifd >= 0) {
+        close(myevent.hotplug.ifd);
+        myevent.hotplug.ifd = -1;
+    }
 
-#if defined(UT)
-TEST(sdl2_event, send_key_to_menu)
-{
-    myevent.keypad.pre_bits = 0;
-    myevent.keypad.cur_bits = (1 << KEY_BIT_A);
-    TEST_ASSERT_EQUAL_INT(0, send_key_to_menu());
-    TEST_ASSERT_EQUAL_INT(myevent.keypad.pre_bits, myevent.keypad.cur_bits);
+    if (myevent.sched.tfd >= 0) {
+        close(myevent.sched.tfd);
+        myevent.sched.tfd = -1;
+    }
+
+    if (myevent.efd >= 0) {
+        close(myevent.efd);
+        myevent.efd = -1;
+    }
+
+    if (myevent.epfd >= 0) {
+        close(myevent.epfd);
+        myevent.epfd = -1;
+    }
+
+    return 0;
 }
-#endif
 
-static int update_raw_input_statue(uint32_t kbit, int val)
+static int wake_input_handler(void)
 {
-    uint32_t b = 0;
+    uint64_t v = 1;
 
-    trace("call %s(kbit=%d, val=%d)\n", __func__, kbit, val);
+    trace("call %s()\n", __func__);
 
-    switch (kbit) {
-    case KEY_BIT_UP:        b = NDS_KEY_BIT_UP;     break;
-    case KEY_BIT_DOWN:      b = NDS_KEY_BIT_DOWN;   break;
-    case KEY_BIT_LEFT:      b = NDS_KEY_BIT_LEFT;   break;
-    case KEY_BIT_RIGHT:     b = NDS_KEY_BIT_RIGHT;  break;
-    case KEY_BIT_A:         b = NDS_KEY_BIT_A;      break;
-    case KEY_BIT_B:         b = NDS_KEY_BIT_B;      break;
-    case KEY_BIT_X:         b = NDS_KEY_BIT_X;      break;
-    case KEY_BIT_Y:         b = NDS_KEY_BIT_Y;      break;
-    case KEY_BIT_L1:        b = NDS_KEY_BIT_L;      break;
-    case KEY_BIT_R1:        b = NDS_KEY_BIT_R;      break;
-    case KEY_BIT_R2:        b = NDS_KEY_BIT_SWAP;   break;
-    case KEY_BIT_SELECT:    b = NDS_KEY_BIT_SELECT; break;
-    case KEY_BIT_START:     b = NDS_KEY_BIT_START;  break;
-    case KEY_BIT_SWAP:      b = NDS_KEY_BIT_SWAP;   break;
-    case KEY_BIT_DRASTIC:   b = NDS_KEY_BIT_MENU;   break;
-    case KEY_BIT_QUIT:      b = NDS_KEY_BIT_QUIT;   break;
-    case KEY_BIT_SAVE:      b = NDS_KEY_BIT_SAVE;   break;
-    case KEY_BIT_LOAD:      b = NDS_KEY_BIT_LOAD;   break;
-    case KEY_BIT_FAST:      b = NDS_KEY_BIT_FAST;   break;
-    case KEY_BIT_HINGE:     b = NDS_KEY_BIT_HINGE;  break;
-    default:                                        return 0;
+    if (myevent.efd < 0) {
+        return -1;
     }
 
-    if (val) {
-        myevent.input.button_status |= b;
-    }
-    else {
-        myevent.input.button_status &= ~b;
+    if (write(myevent.efd, &v, sizeof(v)) != sizeof(v)) {
+        return -1;
     }
 
     return 0;
 }
 
 #if defined(UT)
-TEST(sdl2_event, update_raw_input_statue)
+TEST(sdl2_event, input_poll)
 {
-    myevent.input.button_status = 0;
-    TEST_ASSERT_EQUAL_INT(0, update_raw_input_statue(KEY_BIT_UP, 1));
-    TEST_ASSERT_EQUAL_INT(NDS_KEY_BIT_UP, myevent.input.button_status);
-    TEST_ASSERT_EQUAL_INT(0, update_raw_input_statue(KEY_BIT_UP, 0));
-    TEST_ASSERT_EQUAL_INT(0, myevent.input.button_status);
+    uint64_t v = 0;
+    struct epoll_event ev[INPUT_EPOLL_MAX] = {{ 0 }};
+
+    myevent.epfd = -1;
+    myevent.efd = -1;
+    TEST_ASSERT_EQUAL_INT(-1, add_input_fd(0));
+    TEST_ASSERT_EQUAL_INT(-1, wake_input_handler());
+
+    TEST_ASSERT_EQUAL_INT(0, open_input_poll());
+    TEST_ASSERT_EQUAL_INT(0, epoll_wait(myevent.epfd, ev, INPUT_EPOLL_MAX, 0));
+    TEST_ASSERT_EQUAL_INT(0, wake_input_handler());
+    TEST_ASSERT_EQUAL_INT(1, epoll_wait(myevent.epfd, ev, INPUT_EPOLL_MAX, 0));
+    TEST_ASSERT_EQUAL_INT(myevent.efd, ev[0].data.fd);
+    TEST_ASSERT_EQUAL_INT(sizeof(v), read(myevent.efd, &v, sizeof(v)));
+    TEST_ASSERT_EQUAL_INT(1, v);
+    TEST_ASSERT_EQUAL_INT(0, close_input_poll());
+    TEST_ASSERT_EQUAL_INT(-1, myevent.epfd);
 }
 #endif
 
-static int send_key_event(int raw_event)
+static const char *key_bit_name[] = {
+    "UP", "DOWN", "LEFT", "RIGHT", "A", "B", "X", "Y",
+    "L1", "R1", "L2", "R2", "SELECT", "START", "MENU",
+    "SAVE", "LOAD", "FAST", "QUIT", "SWAP"
+};
+
+static int get_key_bit_by_name(const char *name)
+{
+    int cc = 0;
+
+    if (!name) {
+        return -1;
+    }
+
+    for (cc = 0; cc < (sizeof(key_bit_name) / sizeof(key_bit_name[0])); cc++) {
+        if (!strcasecmp(name, key_bit_name[cc])) {
+            return cc;
+        }
+    }
+
+    return -1;
+}
+
+#if defined(UT)
+TEST(sdl2_event, get_key_bit_by_name)
+{
+    TEST_ASSERT_EQUAL_INT(-1, get_key_bit_by_name(NULL));
+    TEST_ASSERT_EQUAL_INT(-1, get_key_bit_by_name("HOME"));
+    TEST_ASSERT_EQUAL_INT(KEY_BIT_A, get_key_bit_by_name("a"));
+    TEST_ASSERT_EQUAL_INT(KEY_BIT_SWAP, get_key_bit_by_name("SWAP"));
+}
+#endif
+
+static int load_dev_profile(input_dev_t *d)
+{
+    int r = 0;
+    int cc = 0;
+    int bit = 0;
+    long code = 0;
+    FILE *f = NULL;
+    char *p = NULL;
+    char buf[MAX_PATH] = { 0 };
+    char name[sizeof(d->name)] = { 0 };
+
+    trace("call %s(d=%p)\n", __func__, d);
+
+    if (!d) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    memset(d->map, -1, sizeof(d->map));
+    d->map[BTN_EAST] = KEY_BIT_A;
+    d->map[BTN_SOUTH] = KEY_BIT_B;
+    d->map[BTN_NORTH] = KEY_BIT_X;
+    d->map[BTN_WEST] = KEY_BIT_Y;
+    d->map[BTN_TL] = KEY_BIT_L1;
+    d->map[BTN_TR] = KEY_BIT_R1;
+    d->map[BTN_TL2] = KEY_BIT_L2;
+    d->map[BTN_TR2] = KEY_BIT_R2;
+    d->map[BTN_SELECT] = KEY_BIT_SELECT;
+    d->map[BTN_START] = KEY_BIT_START;
+    d->map[BTN_MODE] = KEY_BIT_MENU;
+    d->map[BTN_DPAD_UP] = KEY_BIT_UP;
+    d->map[BTN_DPAD_DOWN] = KEY_BIT_DOWN;
+    d->map[BTN_DPAD_LEFT] = KEY_BIT_LEFT;
+    d->map[BTN_DPAD_RIGHT] = KEY_BIT_RIGHT;
+
+    for (cc = 0; d->name[cc] && (cc < (sizeof(name) - 1)); cc++) {
+        name[cc] = isalnum((uint8_t)d->name[cc]) ? d->name[cc] : '_';
+    }
+
+    snprintf(buf, sizeof(buf), "%s/%s/%s.cfg", myconfig.home, INPUT_PROFILE_DIR, name);
+    f = fopen(buf, "r");
+    if (!f) {
+        return 0;
+    }
+
+    // 304=B
+    while (fgets(buf, sizeof(buf), f)) {
+        p = strchr(buf, '=');
+        if (!p || (buf[0] == '#')) {
+            continue;
+        }
+
+        *p++ = 0;
+        p[strcspn(p, "\r\n ")] = 0;
+        code = strtol(buf, NULL, 0);
+        bit = get_key_bit_by_name(p);
+        if ((code < 0) || (code >= INPUT_KEY_MAP_MAX)) {
+            error("invalid key code \"%s\"\n", buf);
+            continue;
+        }
+
+        d->map[code] = bit;
+        r = 1;
+    }
+    fclose(f);
+
+    return r;
+}
+
+#if defined(UT)
+TEST(sdl2_event, load_dev_profile)
+{
+    FILE *f = NULL;
+    input_dev_t d = { 0 };
+    char home[MAX_PATH] = { 0 };
+
+    strcpy(home, myconfig.home);
+    strcpy(myconfig.home, "/tmp");
+    mkdir("/tmp/" INPUT_PROFILE_DIR, 0755);
+
+    TEST_ASSERT_EQUAL_INT(-1, load_dev_profile(NULL));
+
+    strcpy(d.name, "UT Pad");
+    TEST_ASSERT_EQUAL_INT(0, load_dev_profile(&d));
+    TEST_ASSERT_EQUAL_INT(KEY_BIT_A, d.map[BTN_EAST]);
+    TEST_ASSERT_EQUAL_INT(-1, d.map[KEY_ENTER]);
+
+    f = fopen("/tmp/" INPUT_PROFILE_DIR "/UT_Pad.cfg", "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fprintf(f, "# ut\n28=START\n0x130=A\n305=none\n");
+    fclose(f);
+
+    TEST_ASSERT_EQUAL_INT(1, load_dev_profile(&d));
+    TEST_ASSERT_EQUAL_INT(KEY_BIT_START, d.map[KEY_ENTER]);
+    TEST_ASSERT_EQUAL_INT(KEY_BIT_A, d.map[BTN_SOUTH]);
+    TEST_ASSERT_EQUAL_INT(-1, d.map[BTN_EAST]);
+
+    unlink("/tmp/" INPUT_PROFILE_DIR "/UT_Pad.cfg");
+    rmdir("/tmp/" INPUT_PROFILE_DIR);
+    strcpy(myconfig.home, home);
+}
+#endif
+
+static int is_gamepad_dev(int fd)
+{
+    uint8_t bits[(KEY_MAX / 8) + 1] = { 0 };
+
+    trace("call %s(fd=%d)\n", __func__, fd);
+
+    if (ioctl(fd, EVIOCGBIT(EV_KEY, sizeof(bits)), bits) < 0) {
+        return 0;
+    }
+
+    if (bits[BTN_GAMEPAD / 8] & (1 << (BTN_GAMEPAD % 8))) {
+        return 1;
+    }
+
+    if (bits[BTN_JOYSTICK / 8] & (1 << (BTN_JOYSTICK % 8))) {
+        return 1;
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, is_gamepad_dev)
+{
+    TEST_ASSERT_EQUAL_INT(0, is_gamepad_dev(-1));
+}
+#endif
+
+static input_dev_t* find_input_dev(int fd, const char *path)
+{
+    int cc = 0;
+    input_dev_t *d = NULL;
+
+    for (cc = 0; cc < MAX_INPUT_DEV; cc++) {
+        d = &myevent.hotplug.dev[cc];
+        if (d->fd < 0) {
+            continue;
+        }
+
+        if ((fd >= 0) && (d->fd == fd)) {
+            return d;
+        }
+
+        if (path && !strcmp(d->path, path)) {
+            return d;
+        }
+    }
+
+    return NULL;
+}
+
+static int detach_input_dev(input_dev_t *d)
+{
+    trace("call %s(d=%p)\n", __func__, d);
+
+    if (!d || (d->fd < 0)) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    printf("[INPUT] detach \"%s\" (%s)\n", d->name, d->path);
+    if (myevent.epfd >= 0) {
+        epoll_ctl(myevent.epfd, EPOLL_CTL_DEL, d->fd, NULL);
+    }
+    close(d->fd);
+    d->fd = -1;
+    myevent.snap.next.axis_x = 0;
+    myevent.snap.next.axis_y = 0;
+    flush_input();
+
+    return 0;
+}
+
+static int attach_input_dev(const char *path)
+{
+    int cc = 0;
+    int fd = -1;
+    int profile = 0;
+    input_dev_t *d = NULL;
+    struct input_absinfo abs = { 0 };
+
+    trace("call %s(path=%s)\n", __func__, path ? path : "");
+
+    if (!path) {
+        error("invalid input\n");
+        return -1;
+    }
+
+#if defined(INPUT_DEV)
+    if (!strcmp(path, INPUT_DEV)) {
+        return 0;
+    }
+#endif
+#if defined(TOUCH_DEV)
+    if (!strcmp(path, TOUCH_DEV)) {
+        return 0;
+    }
+#endif
+#if defined(POWER_DEV)
+    if (!strcmp(path, POWER_DEV)) {
+        return 0;
+    }
+#endif
+
+    if (find_input_dev(-1, path)) {
+        return 0;
+    }
+
+    for (cc = 0; cc < MAX_INPUT_DEV; cc++) {
+        if (myevent.hotplug.dev[cc].fd < 0) {
+            d = &myevent.hotplug.dev[cc];
+            break;
+        }
+    }
+
+    if (!d) {
+        error("too many input devices\n");
+        return -1;
+    }
+
+    fd = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return 0;
+    }
+
+    memset(d->name, 0, sizeof(d->name));
+    if (ioctl(fd, EVIOCGNAME(sizeof(d->name) - 1), d->name) < 0) {
+        snprintf(d->name, sizeof(d->name), "%s", path);
+    }
+
+    profile = load_dev_profile(d);
+    if (!profile && !is_gamepad_dev(fd)) {
+        close(fd);
+        return 0;
+    }
+
+    set_input_clock(fd);
+    if (add_input_fd(fd) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    for (cc = 0; cc < 2; cc++) {
+        d->abs_min[cc] = 0;
+        d->abs_max[cc] = 0;
+        if (ioctl(fd, EVIOCGABS(ABS_X + cc), &abs) == 0) {
+            d->abs_min[cc] = abs.minimum;
+            d->abs_max[cc] = abs.maximum;
+        }
+    }
+
+    d->fd = fd;
+    snprintf(d->path, sizeof(d->path), "%s", path);
+    printf("[INPUT] attach \"%s\" (%s, %s profile)\n", d->name, path, profile ? "custom" : "default");
+
+    return 1;
+}
+
+#if defined(UT)
+TEST(sdl2_event, attach_input_dev)
+{
+    int cc = 0;
+    FILE *f = NULL;
+    input_dev_t *d = NULL;
+    char home[MAX_PATH] = { 0 };
+    const char *path = INPUT_DEV_DIR "/event99";
+
+    strcpy(home, myconfig.home);
+    strcpy(myconfig.home, "/tmp");
+    mkdir("/tmp/" INPUT_PROFILE_DIR, 0755);
+    mkdir(INPUT_DEV_DIR, 0755);
+    myevent.epfd = epoll_create1(EPOLL_CLOEXEC);
+    memset(&myevent.hotplug, 0, sizeof(myevent.hotplug));
+    myevent.hotplug.ifd = -1;
+    for (cc = 0; cc < MAX_INPUT_DEV; cc++) {
+        myevent.hotplug.dev[cc].fd = -1;
+    }
+
+    TEST_ASSERT_EQUAL_INT(-1, attach_input_dev(NULL));
+    TEST_ASSERT_EQUAL_INT(0, attach_input_dev(INPUT_DEV_DIR "/event98"));
+
+    TEST_ASSERT_EQUAL_INT(0, mkfifo(path, 0644));
+    TEST_ASSERT_EQUAL_INT(0, attach_input_dev(path));
+
+    f = fopen("/tmp/" INPUT_PROFILE_DIR "/" "_tmp_nds_input_event99.cfg", "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fprintf(f, "28=A\n");
+    fclose(f);
+    TEST_ASSERT_EQUAL_INT(1, attach_input_dev(path));
+    TEST_ASSERT_EQUAL_INT(0, attach_input_dev(path));
+
+    d = find_input_dev(-1, path);
+    TEST_ASSERT_NOT_NULL(d);
+    TEST_ASSERT_EQUAL_PTR(d, find_input_dev(d->fd, NULL));
+    TEST_ASSERT_EQUAL_INT(KEY_BIT_A, d->map[KEY_ENTER]);
+    TEST_ASSERT_EQUAL_INT(0, detach_input_dev(d));
+    TEST_ASSERT_EQUAL_INT(-1, detach_input_dev(d));
+    TEST_ASSERT_NULL(find_input_dev(-1, path));
+
+    close(myevent.epfd);
+    myevent.epfd = -1;
+    unlink(path);
+    unlink("/tmp/" INPUT_PROFILE_DIR "/" "_tmp_nds_input_event99.cfg");
+    rmdir("/tmp/" INPUT_PROFILE_DIR);
+    rmdir(INPUT_DEV_DIR);
+    strcpy(myconfig.home, home);
+    myevent.keypad.raw_bits = 0;
+}
+#endif
+
+static int scan_input_devs(void)
+{
+    int r = 0;
+    DIR *dir = NULL;
+    struct dirent *ent = NULL;
+    char buf[MAX_PATH] = { 0 };
+
+    trace("call %s()\n", __func__);
+
+    dir = opendir(INPUT_DEV_DIR);
+    if (!dir) {
+        error("failed to open \"%s\"\n", INPUT_DEV_DIR);
+        return -1;
+    }
+
+    while ((ent = readdir(dir))) {
+        if (strncmp(ent->d_name, "event", 5)) {
+            continue;
+        }
+
+        snprintf(buf, sizeof(buf), "%s/%s", INPUT_DEV_DIR, ent->d_name);
+        if (attach_input_dev(buf) > 0) {
+            r += 1;
+        }
+    }
+    closedir(dir);
+
+    return r;
+}
+
+#if defined(UT)
+TEST(sdl2_event, scan_input_devs)
+{
+    rmdir(INPUT_DEV_DIR);
+    TEST_ASSERT_EQUAL_INT(-1, scan_input_devs());
+
+    mkdir(INPUT_DEV_DIR, 0755);
+    TEST_ASSERT_EQUAL_INT(0, scan_input_devs());
+    rmdir(INPUT_DEV_DIR);
+}
+#endif
+
+static int handle_hotplug_events(int fd)
+{
+    int r = 0;
+    ssize_t len = 0;
+    ssize_t pos = 0;
+    input_dev_t *d = NULL;
+    char path[MAX_PATH] = { 0 };
+    struct inotify_event *e = NULL;
+    char buf[1024] __attribute__((aligned(__alignof__(struct inotify_event)))) = { 0 };
+
+    trace("call %s(fd=%d)\n", __func__, fd);
+
+    len = read(fd, buf, sizeof(buf));
+    for (pos = 0; pos < len; pos += sizeof(struct inotify_event) + e->len) {
+        e = (struct inotify_event *)(buf + pos);
+        if (!e->len || strncmp(e->name, "event", 5)) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), "%s/%s", INPUT_DEV_DIR, e->name);
+        if (e->mask & IN_DELETE) {
+            d = find_input_dev(-1, path);
+            if (d) {
+                detach_input_dev(d);
+                r += 1;
+            }
+        }
+        else if (attach_input_dev(path) > 0) {
+            r += 1;
+        }
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(sdl2_event, handle_hotplug_events)
+{
+    int cc = 0;
+    int ifd = -1;
+    FILE *f = NULL;
+    char home[MAX_PATH] = { 0 };
+    const char *path = INPUT_DEV_DIR "/event97";
+
+    strcpy(home, myconfig.home);
+    strcpy(myconfig.home, "/tmp");
+    mkdir("/tmp/" INPUT_PROFILE_DIR, 0755);
+    mkdir(INPUT_DEV_DIR, 0755);
+    myevent.epfd = epoll_create1(EPOLL_CLOEXEC);
+    for (cc = 0; cc < MAX_INPUT_DEV; cc++) {
+        myevent.hotplug.dev[cc].fd = -1;
+    }
+
+    f = fopen("/tmp/" INPUT_PROFILE_DIR "/" "_tmp_nds_input_event97.cfg", "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fprintf(f, "28=A\n");
+    fclose(f);
+
+    ifd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    TEST_ASSERT_TRUE(ifd >= 0);
+    TEST_ASSERT_TRUE(inotify_add_watch(ifd, INPUT_DEV_DIR, IN_CREATE | IN_ATTRIB | IN_DELETE) >= 0);
+    TEST_ASSERT_EQUAL_INT(0, handle_hotplug_events(ifd));
+
+    TEST_ASSERT_EQUAL_INT(0, mkfifo(path, 0644));
+    TEST_ASSERT_EQUAL_INT(1, handle_hotplug_events(ifd));
+    TEST_ASSERT_NOT_NULL(find_input_dev(-1, path));
+
+    unlink(path);
+    TEST_ASSERT_EQUAL_INT(1, handle_hotplug_events(ifd));
+    TEST_ASSERT_NULL(find_input_dev(-1, path));
+
+    close(ifd);
+    close(myevent.epfd);
+    myevent.epfd = -1;
+    unlink("/tmp/" INPUT_PROFILE_DIR "/" "_tmp_nds_input_event97.cfg");
+    rmdir("/tmp/" INPUT_PROFILE_DIR);
+    rmdir(INPUT_DEV_DIR);
+    strcpy(myconfig.home, home);
+    myevent.keypad.raw_bits = 0;
+}
+#endif
+
+static int scale_abs_axis(int v, int min, int max)
+{
+    trace("call %s(v=%d, min=%d, max=%d)\n", __func__, v, min, max);
+
+    if (max <= min) {
+        return 0;
+    }
+
+    if (v < min) {
+        v = min;
+    }
+    if (v > max) {
+        v = max;
+    }
+
+    return (int)((((int64_t)(v - min) * 255) + ((max - min) / 2)) / (max - min)) - 128;
+}
+
+#if defined(UT)
+TEST(sdl2_event, scale_abs_axis)
+{
+    TEST_ASSERT_EQUAL_INT(0, scale_abs_axis(10, 0, 0));
+    TEST_ASSERT_EQUAL_INT(0, scale_abs_axis(0, -32768, 32767));
+    TEST_ASSERT_EQUAL_INT(-128, scale_abs_axis(-40000, -32768, 32767));
+    TEST_ASSERT_EQUAL_INT(127, scale_abs_axis(255, 0, 255));
+    TEST_ASSERT_EQUAL_INT(0, scale_abs_axis(128, 0, 255));
+}
+#endif
+
+static int handle_dev_events(input_dev_t *d)
+{
+    int r = 0;
+    int cc = 0;
+    int bit = 0;
+    ssize_t len = 0;
+    struct input_event e[INPUT_EVENT_BATCH] = {{{ 0 }}};
+
+    trace("call %s(d=%p)\n", __func__, d);
+
+    if (!d || (d->fd < 0)) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    while (1) {
+        len = read(d->fd, e, sizeof(e));
+        if ((len < 0) && (errno == ENODEV)) {
+            detach_input_dev(d);
+            return r;
+        }
+
+        if (len <= 0) {
+            break;
+        }
+
+        for (cc = 0; cc < (len / (ssize_t)sizeof(e[0])); cc++) {
+            if ((e[cc].type == EV_KEY) && (e[cc].value != 2) && (e[cc].code < INPUT_KEY_MAP_MAX)) {
+                bit = d->map[e[cc].code];
+                if (bit >= 0) {
+                    set_key_bit(bit, e[cc].value);
+                    r += 1;
+                }
+            }
+            else if ((e[cc].type == EV_ABS) && (e[cc].code == ABS_HAT0X)) {
+                set_key_bit(KEY_BIT_LEFT, e[cc].value < 0);
+                set_key_bit(KEY_BIT_RIGHT, e[cc].value > 0);
+                r += 1;
+            }
+            else if ((e[cc].type == EV_ABS) && (e[cc].code == ABS_HAT0Y)) {
+                set_key_bit(KEY_BIT_UP, e[cc].value < 0);
+                set_key_bit(KEY_BIT_DOWN, e[cc].value > 0);
+                r += 1;
+            }
+            else if ((e[cc].type == EV_ABS) && (e[cc].code == ABS_X)) {
+                myevent.snap.next.axis_x = scale_abs_axis(e[cc].value, d->abs_min[0], d->abs_max[0]);
+            }
+            else if ((e[cc].type == EV_ABS) && (e[cc].code == ABS_Y)) {
+                myevent.snap.next.axis_y = scale_abs_axis(e[cc].value, d->abs_min[1], d->abs_max[1]);
+            }
+        }
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(sdl2_event, handle_dev_events)
+{
+    int fd[2] = { 0 };
+    input_dev_t d = { 0 };
+    struct input_event e[4] = {{{ 0 }}};
+
+    TEST_ASSERT_EQUAL_INT(-1, handle_dev_events(NULL));
+    TEST_ASSERT_EQUAL_INT(0, pipe(fd));
+    TEST_ASSERT_EQUAL_INT(0, fcntl(fd[0], F_SETFL, O_NONBLOCK));
+
+    d.fd = fd[0];
+    memset(d.map, -1, sizeof(d.map));
+    d.map[BTN_EAST] = KEY_BIT_A;
+    e[0].type = EV_KEY;
+    e[0].code = BTN_EAST;
+    e[0].value = 1;
+    e[1].type = EV_KEY;
+    e[1].code = BTN_SOUTH;
+    e[1].value = 1;
+    e[2].type = EV_ABS;
+    e[2].code = ABS_HAT0X;
+    e[2].value = -1;
+    e[3].type = EV_ABS;
+    e[3].code = ABS_X;
+    e[3].value = 255;
+    d.abs_max[0] = 255;
+    myevent.keypad.raw_bits = 0;
+    TEST_ASSERT_EQUAL_INT(sizeof(e), write(fd[1], e, sizeof(e)));
+    TEST_ASSERT_EQUAL_INT(2, handle_dev_events(&d));
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A) | (1 << KEY_BIT_LEFT), myevent.keypad.raw_bits);
+    TEST_ASSERT_EQUAL_INT(127, myevent.snap.next.axis_x);
+    TEST_ASSERT_EQUAL_INT(0, handle_dev_events(&d));
+
+    myevent.keypad.raw_bits = 0;
+    myevent.snap.next.axis_x = 0;
+    close(fd[0]);
+    close(fd[1]);
+}
+#endif
+
+static uint32_t apply_turbo(uint32_t bits)
+{
+    uint32_t held = bits & myconfig.turbo.mask;
+
+    trace("call %s(bits=0x%x)\n", __func__, bits);
+
+    if (!held || (myconfig.turbo.on <= 0) || (myconfig.turbo.off <= 0)) {
+        myevent.turbo.start = myevent.frame.cnt;
+        return bits;
+    }
+
+    // phase restarts on the first turbo press so the button fires right away
+    if (((myevent.frame.cnt - myevent.turbo.start) % (myconfig.turbo.on + myconfig.turbo.off)) >= myconfig.turbo.on) {
+        bits &= ~held;
+    }
+
+    return bits;
+}
+
+#if defined(UT)
+TEST(sdl2_event, apply_turbo)
+{
+    int cc = 0;
+    const uint32_t a = (1 << KEY_BIT_A);
+    const uint32_t b = (1 << KEY_BIT_B);
+    const uint32_t expect[] = { a, a, 0, 0, 0, a, a, 0 };
+
+    myevent.frame.cnt = 100;
+    myconfig.turbo.mask = a;
+    myconfig.turbo.on = 2;
+    myconfig.turbo.off = 3;
+    TEST_ASSERT_EQUAL_INT(b, apply_turbo(b));
+    for (cc = 0; cc < 8; cc++) {
+        TEST_ASSERT_EQUAL_INT(expect[cc] | b, apply_turbo(a | b));
+        myevent.frame.cnt += 1;
+    }
+
+    myconfig.turbo.off = 0;
+    TEST_ASSERT_EQUAL_INT(a, apply_turbo(a));
+    myconfig.turbo.mask = DEF_TURBO_MASK;
+    myconfig.turbo.on = DEF_TURBO_ON;
+    myconfig.turbo.off = DEF_TURBO_OFF;
+    myevent.frame.cnt = 0;
+}
+#endif
+
+static int load_macro(const char *path)
+{
+    int cc = 0;
+    int bit = 0;
+    int frames = 0;
+    FILE *f = NULL;
+    char *tok = NULL;
+    char *save = NULL;
+    uint32_t bits = 0;
+    char keys[MAX_PATH] = { 0 };
+    char buf[MAX_PATH] = { 0 };
+
+    trace("call %s(path=%s)\n", __func__, path ? path : "");
+
+    if (!path) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    myevent.macro.len = 0;
+    f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+
+    // one step per line, "A+RIGHT 4" holds A and RIGHT for 4 frames
+    while (fgets(buf, sizeof(buf), f) && (myevent.macro.len < MACRO_MAX_STEP)) {
+        if ((buf[0] == '#') || (sscanf(buf, "%254s %d", keys, &frames) != 2) || (frames <= 0)) {
+            continue;
+        }
+
+        bits = 0;
+        for (tok = strtok_r(keys, "+", &save); tok; tok = strtok_r(NULL, "+", &save)) {
+            bit = get_key_bit_by_name(tok);
+            if (bit >= 0) {
+                bits |= (1 << bit);
+            }
+        }
+
+        cc = myevent.macro.len++;
+        myevent.macro.step[cc].bits = bits;
+        myevent.macro.step[cc].frames = frames;
+    }
+    fclose(f);
+
+    return myevent.macro.len;
+}
+
+#if defined(UT)
+TEST(sdl2_event, load_macro)
+{
+    FILE *f = NULL;
+    const char *path = "/tmp/ut_macro.txt";
+
+    unlink(path);
+    TEST_ASSERT_EQUAL_INT(-1, load_macro(NULL));
+    TEST_ASSERT_EQUAL_INT(0, load_macro(path));
+
+    f = fopen(path, "w");
+    TEST_ASSERT_NOT_NULL(f);
+    fprintf(f, "# test\nA+right 4\nNONE 2\nB 0\nL1\n");
+    fclose(f);
+    TEST_ASSERT_EQUAL_INT(2, load_macro(path));
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A) | (1 << KEY_BIT_RIGHT), myevent.macro.step[0].bits);
+    TEST_ASSERT_EQUAL_INT(4, myevent.macro.step[0].frames);
+    TEST_ASSERT_EQUAL_INT(0, myevent.macro.step[1].bits);
+    TEST_ASSERT_EQUAL_INT(2, myevent.macro.step[1].frames);
+
+    myevent.macro.len = 0;
+    unlink(path);
+}
+#endif
+
+static int save_macro(const char *path)
+{
+    int cc = 0;
+    int bit = 0;
+    int cnt = 0;
+    FILE *f = NULL;
+
+    trace("call %s(path=%s)\n", __func__, path ? path : "");
+
+    if (!path) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    f = fopen(path, "w");
+    if (!f) {
+        error("failed to create \"%s\"\n", path);
+        return -1;
+    }
+
+    for (cc = 0; cc < myevent.macro.len; cc++) {
+        cnt = 0;
+        for (bit = 0; bit < (sizeof(key_bit_name) / sizeof(key_bit_name[0])); bit++) {
+            if (myevent.macro.step[cc].bits & (1 << bit)) {
+                fprintf(f, "%s%s", cnt++ ? "+" : "", key_bit_name[bit]);
+            }
+        }
+        fprintf(f, "%s %u\n", cnt ? "" : "NONE", myevent.macro.step[cc].frames);
+    }
+    fclose(f);
+
+    return myevent.macro.len;
+}
+
+#if defined(UT)
+TEST(sdl2_event, save_macro)
+{
+    const char *path = "/tmp/ut_macro.txt";
+
+    TEST_ASSERT_EQUAL_INT(-1, save_macro(NULL));
+    myevent.macro.len = 2;
+    myevent.macro.step[0].bits = (1 << KEY_BIT_B) | (1 << KEY_BIT_UP);
+    myevent.macro.step[0].frames = 3;
+    myevent.macro.step[1].bits = 0;
+    myevent.macro.step[1].frames = 1;
+    TEST_ASSERT_EQUAL_INT(2, save_macro(path));
+
+    memset(myevent.macro.step, 0, sizeof(myevent.macro.step));
+    TEST_ASSERT_EQUAL_INT(2, load_macro(path));
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_B) | (1 << KEY_BIT_UP), myevent.macro.step[0].bits);
+    TEST_ASSERT_EQUAL_INT(3, myevent.macro.step[0].frames);
+    TEST_ASSERT_EQUAL_INT(1, myevent.macro.step[1].frames);
+
+    myevent.macro.len = 0;
+    unlink(path);
+}
+#endif
+
+static int stop_macro(void)
+{
+    trace("call %s()\n", __func__);
+
+    if (myevent.macro.mode == MACRO_RECORD) {
+        save_macro(myevent.macro.path);
+        printf("[MACRO] recorded %d steps to \"%s\"\n", myevent.macro.len, myevent.macro.path);
+    }
+
+    myevent.macro.mode = MACRO_IDLE;
+    myevent.macro.bits = 0;
+    myevent.macro.pos = 0;
+    myevent.macro.left = 0;
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, stop_macro)
+{
+    myevent.macro.mode = MACRO_PLAY;
+    myevent.macro.bits = (1 << KEY_BIT_A);
+    TEST_ASSERT_EQUAL_INT(0, stop_macro());
+    TEST_ASSERT_EQUAL_INT(MACRO_IDLE, myevent.macro.mode);
+    TEST_ASSERT_EQUAL_INT(0, myevent.macro.bits);
+}
+#endif
+
+static int start_macro(macro_mode_t mode)
+{
+    trace("call %s(mode=%d)\n", __func__, mode);
+
+    stop_macro();
+
+    if (mode == MACRO_RECORD) {
+        myevent.macro.len = 0;
+        myevent.macro.mode = MACRO_RECORD;
+        printf("[MACRO] recording\n");
+    }
+    else if ((mode == MACRO_PLAY) && (myevent.macro.len > 0)) {
+        myevent.macro.mode = MACRO_PLAY;
+        myevent.macro.bits = myevent.macro.step[0].bits;
+        myevent.macro.left = myevent.macro.step[0].frames;
+    }
+
+    return myevent.macro.mode;
+}
+
+#if defined(UT)
+TEST(sdl2_event, start_macro)
+{
+    memset(&myevent.macro, 0, sizeof(myevent.macro));
+    TEST_ASSERT_EQUAL_INT(MACRO_IDLE, start_macro(MACRO_PLAY));
+
+    myevent.macro.len = 1;
+    myevent.macro.step[0].bits = (1 << KEY_BIT_X);
+    myevent.macro.step[0].frames = 5;
+    TEST_ASSERT_EQUAL_INT(MACRO_PLAY, start_macro(MACRO_PLAY));
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_X), myevent.macro.bits);
+    TEST_ASSERT_EQUAL_INT(5, myevent.macro.left);
+
+    snprintf(myevent.macro.path, sizeof(myevent.macro.path), "/tmp/ut_macro.txt");
+    TEST_ASSERT_EQUAL_INT(MACRO_RECORD, start_macro(MACRO_RECORD));
+    TEST_ASSERT_EQUAL_INT(0, myevent.macro.len);
+    TEST_ASSERT_EQUAL_INT(0, stop_macro());
+
+    unlink(myevent.macro.path);
+    memset(&myevent.macro, 0, sizeof(myevent.macro));
+}
+#endif
+
+static uint32_t update_macro_key(uint32_t bits)
+{
+    uint32_t key = bits & myconfig.macro.key;
+
+    trace("call %s(bits=0x%x)\n", __func__, bits);
+
+    if (key && !myevent.macro.pre_key && (myevent.macro.mode == MACRO_IDLE)) {
+        start_macro(MACRO_PLAY);
+    }
+    myevent.macro.pre_key = key;
+
+    bits &= ~myconfig.macro.key;
+    myevent.macro.in = bits;
+
+    return bits;
+}
+
+#if defined(UT)
+TEST(sdl2_event, update_macro_key)
+{
+    memset(&myevent.macro, 0, sizeof(myevent.macro));
+    myevent.macro.len = 1;
+    myevent.macro.step[0].bits = (1 << KEY_BIT_Y);
+    myevent.macro.step[0].frames = 1;
+    myconfig.macro.key = (1 << KEY_BIT_R2);
+
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A), update_macro_key((1 << KEY_BIT_A) | (1 << KEY_BIT_R2)));
+    TEST_ASSERT_EQUAL_INT(MACRO_PLAY, myevent.macro.mode);
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A), myevent.macro.in);
+
+    stop_macro();
+    update_macro_key(1 << KEY_BIT_R2);
+    TEST_ASSERT_EQUAL_INT(MACRO_IDLE, myevent.macro.mode);
+
+    myconfig.macro.key = DEF_MACRO_KEY;
+    memset(&myevent.macro, 0, sizeof(myevent.macro));
+}
+#endif
+
+static int step_macro(void)
+{
+    macro_step_t *s = NULL;
+
+    trace("call %s()\n", __func__);
+
+    if (myevent.macro.mode == MACRO_RECORD) {
+        if (myevent.macro.len && (myevent.macro.step[myevent.macro.len - 1].bits == myevent.macro.in)) {
+            myevent.macro.step[myevent.macro.len - 1].frames += 1;
+        }
+        else if (myevent.macro.len < MACRO_MAX_STEP) {
+            s = &myevent.macro.step[myevent.macro.len++];
+            s->bits = myevent.macro.in;
+            s->frames = 1;
+        }
+        else {
+            stop_macro();
+        }
+    }
+    else if (myevent.macro.mode == MACRO_PLAY) {
+        if (myevent.macro.left > 1) {
+            myevent.macro.left -= 1;
+        }
+        else if (++myevent.macro.pos < myevent.macro.len) {
+            myevent.macro.bits = myevent.macro.step[myevent.macro.pos].bits;
+            myevent.macro.left = myevent.macro.step[myevent.macro.pos].frames;
+        }
+        else {
+            stop_macro();
+        }
+    }
+
+    return myevent.macro.mode;
+}
+
+#if defined(UT)
+TEST(sdl2_event, step_macro)
+{
+    memset(&myevent.macro, 0, sizeof(myevent.macro));
+    snprintf(myevent.macro.path, sizeof(myevent.macro.path), "/tmp/ut_macro.txt");
+    TEST_ASSERT_EQUAL_INT(MACRO_IDLE, step_macro());
+
+    start_macro(MACRO_RECORD);
+    myevent.macro.in = (1 << KEY_BIT_A);
+    TEST_ASSERT_EQUAL_INT(MACRO_RECORD, step_macro());
+    TEST_ASSERT_EQUAL_INT(MACRO_RECORD, step_macro());
+    myevent.macro.in = 0;
+    TEST_ASSERT_EQUAL_INT(MACRO_RECORD, step_macro());
+    TEST_ASSERT_EQUAL_INT(2, myevent.macro.len);
+    TEST_ASSERT_EQUAL_INT(2, myevent.macro.step[0].frames);
+    stop_macro();
+
+    TEST_ASSERT_EQUAL_INT(MACRO_PLAY, start_macro(MACRO_PLAY));
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A), myevent.macro.bits);
+    TEST_ASSERT_EQUAL_INT(MACRO_PLAY, step_macro());
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A), myevent.macro.bits);
+    TEST_ASSERT_EQUAL_INT(MACRO_PLAY, step_macro());
+    TEST_ASSERT_EQUAL_INT(0, myevent.macro.bits);
+    TEST_ASSERT_EQUAL_INT(MACRO_IDLE, step_macro());
+
+    unlink(myevent.macro.path);
+    memset(&myevent.macro, 0, sizeof(myevent.macro));
+}
+#endif
+
+int tick_input_frame(void)
+{
+    trace("call %s()\n", __func__);
+
+    myevent.frame.cnt += 1;
+
+    if (__atomic_exchange_n(&myevent.macro.req, 0, __ATOMIC_ACQUIRE)) {
+        if (myevent.macro.mode == MACRO_RECORD) {
+            stop_macro();
+        }
+        else {
+            start_macro(MACRO_RECORD);
+        }
+    }
+
+    if (myevent.macro.mode != MACRO_IDLE) {
+        step_macro();
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, tick_input_frame)
+{
+    memset(&myevent.macro, 0, sizeof(myevent.macro));
+    snprintf(myevent.macro.path, sizeof(myevent.macro.path), "/tmp/ut_macro.txt");
+    myevent.frame.cnt = 0;
+
+    myevent.macro.req = 1;
+    TEST_ASSERT_EQUAL_INT(0, tick_input_frame());
+    TEST_ASSERT_EQUAL_INT(1, myevent.frame.cnt);
+    TEST_ASSERT_EQUAL_INT(MACRO_RECORD, myevent.macro.mode);
+    TEST_ASSERT_EQUAL_INT(1, myevent.macro.len);
+
+    myevent.macro.req = 1;
+    TEST_ASSERT_EQUAL_INT(0, tick_input_frame());
+    TEST_ASSERT_EQUAL_INT(MACRO_IDLE, myevent.macro.mode);
+    TEST_ASSERT_EQUAL_INT(0, access(myevent.macro.path, F_OK));
+
+    unlink(myevent.macro.path);
+    memset(&myevent.macro, 0, sizeof(myevent.macro));
+    myevent.frame.cnt = 0;
+}
+#endif
+
+static int publish_input_snapshot(void)
+{
+    uint32_t seq = myevent.snap.seq;
+
+    trace("call %s()\n", __func__);
+
+    myevent.snap.next.clear_gen = __atomic_load_n(&myevent.keypad.clear_gen, __ATOMIC_ACQUIRE);
+    myevent.snap.next.bits = __atomic_load_n(&myevent.keypad.raw_bits, __ATOMIC_RELAXED);
+
+    __atomic_store_n(&myevent.snap.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(&myevent.snap.data, &myevent.snap.next, sizeof(input_snap_t));
+    __atomic_store_n(&myevent.snap.seq, seq + 2, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+static int read_input_snapshot(input_snap_t *s)
+{
+    uint32_t seq0 = 0;
+    uint32_t seq1 = 0;
+
+    trace("call %s(s=%p)\n", __func__, s);
+
+    if (!s) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    do {
+        seq0 = __atomic_load_n(&myevent.snap.seq, __ATOMIC_ACQUIRE);
+        memcpy(s, &myevent.snap.data, sizeof(input_snap_t));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        seq1 = __atomic_load_n(&myevent.snap.seq, __ATOMIC_RELAXED);
+    } while ((seq0 & 1) || (seq0 != seq1));
+
+    return 0;
+}
+
+static int sync_input_snapshot(void)
+{
+    int dx = 0;
+    int dy = 0;
+    uint32_t bits = 0;
+    input_snap_t s = { 0 };
+
+    trace("call %s()\n", __func__);
+
+    read_input_snapshot(&s);
+
+    if (s.flush_seq != myevent.snap.flush_seq) {
+        myevent.snap.flush_seq = s.flush_seq;
+        myevent.keypad.cur_bits = myevent.keypad.pre_bits;
+        release_key();
+        myevent.keypad.pre_bits = 0;
+    }
+
+    if (s.clear_gen == myevent.keypad.clear_gen) {
+        myevent.keypad.done_bits = 0;
+    }
+    bits = s.bits | myevent.analog.bits;
+    if (myconfig.macro.key) {
+        bits = update_macro_key(bits);
+    }
+    if (myconfig.turbo.mask) {
+        bits = apply_turbo(bits);
+    }
+    bits |= myevent.macro.bits;
+    myevent.keypad.cur_bits = bits & ~myevent.keypad.done_bits;
+
+    if (s.key_seq != myevent.snap.key_seq) {
+        myevent.snap.key_seq = s.key_seq;
+        if (!myevent.lat.key_us) {
+            myevent.lat.key_us = s.key_us;
+        }
+    }
+
+    if (s.touch_seq != myevent.snap.touch_seq) {
+        myevent.snap.touch_seq = s.touch_seq;
+        myevent.touch.x = s.touch_x;
+        myevent.touch.y = s.touch_y;
+        myevent.input.touch_status = s.touch_status;
+        limit_touch_axis();
+    }
+
+    dx = s.touch_dx - myevent.snap.touch_dx;
+    dy = s.touch_dy - myevent.snap.touch_dy;
+    myevent.snap.touch_dx = s.touch_dx;
+    myevent.snap.touch_dy = s.touch_dy;
+    if (dx || dy || myevent.analog.dx || myevent.analog.dy) {
+        myevent.touch.x += dx + myevent.analog.dx;
+        myevent.touch.y += dy + myevent.analog.dy;
+        myevent.analog.dx = 0;
+        myevent.analog.dy = 0;
+        limit_touch_axis();
+        if (dx || dy) {
+            send_touch_axis();
+        }
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, input_snapshot)
+{
+    input_snap_t s = { 0 };
+
+    memset(&myevent.snap, 0, sizeof(myevent.snap));
+    myevent.keypad.raw_bits = (1 << KEY_BIT_A) | (1 << KEY_BIT_SAVE);
+    myevent.keypad.clear_gen = 0;
+    myevent.keypad.done_bits = 0;
+    myevent.touch.max_x = NDS_W;
+    myevent.touch.max_y = NDS_H;
+
+    TEST_ASSERT_EQUAL_INT(-1, read_input_snapshot(NULL));
+    TEST_ASSERT_EQUAL_INT(0, publish_input_snapshot());
+    TEST_ASSERT_EQUAL_INT(2, myevent.snap.seq);
+    TEST_ASSERT_EQUAL_INT(0, read_input_snapshot(&s));
+    TEST_ASSERT_EQUAL_INT(myevent.keypad.raw_bits, s.bits);
+
+    TEST_ASSERT_EQUAL_INT(0, sync_input_snapshot());
+    TEST_ASSERT_EQUAL_INT(myevent.keypad.raw_bits, myevent.keypad.cur_bits);
+
+    clear_key_bits(1 << KEY_BIT_SAVE);
+    TEST_ASSERT_EQUAL_INT(0, sync_input_snapshot());
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A), myevent.keypad.cur_bits);
+
+    set_key_bit(KEY_BIT_SAVE, 1);
+    TEST_ASSERT_EQUAL_INT(0, publish_input_snapshot());
+    TEST_ASSERT_EQUAL_INT(0, sync_input_snapshot());
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_A) | (1 << KEY_BIT_SAVE), myevent.keypad.cur_bits);
+
+    myevent.snap.next.touch_x = 10000;
+    myevent.snap.next.touch_y = 20;
+    myevent.snap.next.touch_status = 1;
+    myevent.snap.next.touch_seq += 1;
+    TEST_ASSERT_EQUAL_INT(0, publish_input_snapshot());
+    TEST_ASSERT_EQUAL_INT(0, sync_input_snapshot());
+    TEST_ASSERT_EQUAL_INT(NDS_W, myevent.touch.x);
+    TEST_ASSERT_EQUAL_INT(20, myevent.touch.y);
+    TEST_ASSERT_EQUAL_INT(1, myevent.input.touch_status);
+
+    myevent.snap.next.touch_dx = -5;
+    myevent.snap.next.touch_dy = 3;
+    myevent.analog.dx = -2;
+    TEST_ASSERT_EQUAL_INT(0, publish_input_snapshot());
+    TEST_ASSERT_EQUAL_INT(0, sync_input_snapshot());
+    TEST_ASSERT_EQUAL_INT(NDS_W - 7, myevent.touch.x);
+    TEST_ASSERT_EQUAL_INT(23, myevent.touch.y);
+    TEST_ASSERT_EQUAL_INT(0, myevent.analog.dx);
+    TEST_ASSERT_EQUAL_INT(0, sync_input_snapshot());
+    TEST_ASSERT_EQUAL_INT(NDS_W - 7, myevent.touch.x);
+
+    myevent.keypad.raw_bits = 0;
+    myevent.keypad.cur_bits = 0;
+    myevent.input.touch_status = 0;
+    memset(&myevent.snap, 0, sizeof(myevent.snap));
+}
+#endif
+
+int input_handler(void *data)
+{
+    int cc = 0;
+    int rk = 0;
+    int rj = 0;
+    int fd = 0;
+    int cnt = 0;
+    uint64_t v = 0;
+    struct input_event ev = {{ 0 }};
+    input_dev_t *dev = NULL;
+    struct epoll_event evs[INPUT_EPOLL_MAX] = {{ 0 }};
+
+    trace("call %s()\n", __func__);
+
+#if !defined(UT)
+    myevent.fd = open(INPUT_DEV, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if (myevent.fd < 0) {
+        error("failed to open \"%s\"\n", INPUT_DEV);
+        exit(-1);
+    }
+
+#if !defined(MIYOO_FLIP)
+    set_input_clock(myevent.fd);
+    add_input_fd(myevent.fd);
+#endif
+#endif
+
+#if defined(MOTO_XT897) || defined(FXTEC_QX1000)
+    myevent.tp_fd = open(TOUCH_DEV, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    myevent.pwr_fd = open(POWER_DEV, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    set_input_clock(myevent.tp_fd);
+    set_input_clock(myevent.pwr_fd);
+    add_input_fd(myevent.tp_fd);
+    add_input_fd(myevent.pwr_fd);
+#endif
+
+#if !defined(UT)
+    scan_input_devs();
+#endif
+
+#if defined(UT)
+    myevent.thread.running = 0;
+#else
+    myevent.thread.running = 1;
+#endif
+
+    while (myevent.thread.running) {
+        cnt = epoll_wait(myevent.epfd, evs, INPUT_EPOLL_MAX, get_poll_timeout());
+        if (!myevent.thread.running) {
+            break;
+        }
+
+        update_latest_keypad_value();
+
+        rk = 0;
+        rj = 0;
+        for (cc = 0; cc < cnt; cc++) {
+            fd = evs[cc].data.fd;
+
+            if (fd == myevent.efd) {
+                read(fd, &v, sizeof(v));
+                continue;
+            }
+
+            if (fd == myevent.sched.tfd) {
+                read(fd, &v, sizeof(v));
+                run_hotkey_tasks();
+                continue;
+            }
+
+            if (fd == myevent.hotplug.ifd) {
+                handle_hotplug_events(fd);
+                continue;
+            }
+
+            dev = find_input_dev(fd, NULL);
+            if (dev) {
+                rk += handle_dev_events(dev);
+                continue;
+            }
+
+#if defined(MOTO_XT897) || defined(FXTEC_QX1000)
+            if (fd == myevent.tp_fd) {
+                handle_touch_events(fd);
+                continue;
+            }
+
+            if (fd == myevent.pwr_fd) {
+                handle_key_events(fd);
+                continue;
+            }
+#endif
+
+            rk += handle_key_events(fd);
+        }
+
+        if (myevent.sched.tfd < 0) {
+            run_hotkey_tasks();
+        }
+
+#if defined(MIYOO_FLIP)
+        memset(&ev, 0, sizeof(ev));
+        rk = get_flip_key_code(&ev);
+        rj = update_joy_state();
+#endif
+
+        if ((rk > 0) || (rj > 0)) {
+            handle_hotkey();
+        }
+
+#if defined(TRIMUI_SMART) || defined(UT)
+        handle_trimui_special_key();
+#endif
+
+        publish_input_snapshot();
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, input_handler)
+{
+    TEST_ASSERT_EQUAL_INT(0, input_handler(NULL));
+}
+#endif
+
+void init_event(void)
+{
+    trace("call %s()\n", __func__);
+
+    memset(&myevent, 0, sizeof(myevent));
+
+    myevent.fd = -1;
+    myevent.epfd = -1;
+    myevent.efd = -1;
+    myevent.sched.tfd = -1;
+    init_movie();
+    snprintf(myevent.macro.path, sizeof(myevent.macro.path), "%s/%s", myconfig.home, MACRO_FILE);
+    load_macro(myevent.macro.path);
+    if (open_input_poll() < 0) {
+        error("failed to create input poll\n");
+        exit(-1);
+    }
+
+    myevent.mode = NDS_KEY_MODE;
+    myevent.touch.max_x = NDS_W;
+    myevent.touch.max_y = NDS_H;
+    myevent.touch.x = myevent.touch.max_x >> 1;
+    myevent.touch.y = myevent.touch.max_y >> 1;
+
+    myevent.keypad.up = DEV_KEY_CODE_UP;
+    myevent.keypad.down = DEV_KEY_CODE_DOWN;
+    myevent.keypad.left = DEV_KEY_CODE_LEFT;
+    myevent.keypad.right = DEV_KEY_CODE_RIGHT;
+    myevent.keypad.a = DEV_KEY_CODE_A;
+    myevent.keypad.b = DEV_KEY_CODE_B;
+    myevent.keypad.x = DEV_KEY_CODE_X;
+    myevent.keypad.y = DEV_KEY_CODE_Y;
+    myevent.keypad.l1 = DEV_KEY_CODE_L1;
+    myevent.keypad.r1 = DEV_KEY_CODE_R1;
+    myevent.keypad.l2 = DEV_KEY_CODE_L2;
+    myevent.keypad.r2 = DEV_KEY_CODE_R2;
+    myevent.keypad.select = DEV_KEY_CODE_SELECT;
+    myevent.keypad.start = DEV_KEY_CODE_START;
+    myevent.keypad.menu = DEV_KEY_CODE_MENU;
+    myevent.keypad.power = DEV_KEY_CODE_POWER;
+
+    myevent.keypad.save = -1;
+    myevent.keypad.load = -1;
+    myevent.keypad.fast = -1;
+    myevent.keypad.exit = -1;
+
+#if defined(FXTEC_QX1000) || defined(MOTO_XT897) || defined(TRIMUI_BRICK) || defined(GKD_MINIPLUS) || defined(UT)
+    myevent.keypad.save = DEV_KEY_CODE_SAVE;
+    myevent.keypad.load = DEV_KEY_CODE_LOAD;
+#if defined(FXTEC_QX1000) || defined(MOTO_XT897) || defined(GKD_MINIPLUS) || defined(UT)
+    myevent.keypad.fast = DEV_KEY_CODE_FAST;
+    myevent.keypad.exit = DEV_KEY_CODE_EXIT;
+#endif
+#endif
+
+#if defined(TRIMUI_SMART) || defined(UT)
+    myevent.cust_key.gpio = NULL;
+    myevent.cust_key.fd = open("/dev/mem", O_RDWR);
+    if (myevent.cust_key.fd > 0) {
+        myevent.cust_key.mem = mmap(
+            0,
+            4096,
+            PROT_READ | PROT_WRITE,
+            MAP_SHARED,
+            myevent.cust_key.fd,
+            0x01c20000
+        );
+
+        if (myevent.cust_key.mem != MAP_FAILED) {
+            uint32_t *p = NULL;
+
+            p = (uint32_t *)(myevent.cust_key.mem + 0x800 + (0x24 * 6) + 0x04);
+            myevent.cust_key.pre_cfg = *p;
+            *p &= 0xfff000ff;
+
+            p = (uint32_t *)(myevent.cust_key.mem + 0x800 + (0x24 * 6) + 0x1c);
+            *p |= 0x01500000;
+
+            myevent.cust_key.gpio = (uint32_t *)(myevent.cust_key.mem + 0x800 + (0x24 * 6) + 0x10);
+        }
+    }
+#endif
+
+    myevent.thread.id = SDL_CreateThreadInternal(input_handler, "NDS Input Handler", 4096, NULL);
+    if (myevent.thread.id == NULL) {
+        error("failed to create thread for input handler\n");
+        exit(-1);
+    }
+}
+
+#if defined(UT)
+TEST(sdl2_event, init_event)
+{
+    init_event();
+    TEST_ASSERT_EQUAL_INT(NDS_KEY_MODE, myevent.mode);
+    TEST_ASSERT_NOT_NULL(myevent.thread.id);
+    TEST_ASSERT_EQUAL_INT(DEV_KEY_CODE_SAVE, myevent.keypad.save);
+}
+#endif
+
+void quit_event(void)
+{
+    trace("call %s()\n", __func__);
+
+    myevent.thread.running = 0;
+    wake_input_handler();
+    trace("wait for input handler complete...\n");
+    if (myevent.thread.id) {
+        SDL_WaitThread(myevent.thread.id, NULL);
+    }
+    trace("completed\n");
+    close_input_poll();
+    stop_movie();
+    stop_macro();
+
+    if(myevent.fd > 0) {
+        close(myevent.fd);
+        myevent.fd = -1;
+    }
+
+#if defined(MOTO_XT897) || defined(FXTEC_QX1000)
+    if (myevent.tp_fd > 0) {
+        close(myevent.tp_fd);
+        myevent.tp_fd = -1;
+    }
+
+    if (myevent.pwr_fd > 0) {
+        close(myevent.pwr_fd);
+        myevent.pwr_fd = -1;
+    }
+#endif
+
+#if defined(TRIMUI_SMART) || defined(UT)
+    if (myevent.cust_key.fd > 0) {
+        uint32_t *p = (uint32_t *)(myevent.cust_key.mem + 0x800 + (0x24 * 6) + 0x04);
+
+        *p = myevent.cust_key.pre_cfg;
+        munmap(myevent.cust_key.mem, 4096);
+        close(myevent.cust_key.fd);
+
+        myevent.cust_key.gpio = NULL;
+        myevent.cust_key.fd = -1;
+    }
+#endif
+}
+
+#if defined(UT)
+TEST(sdl2_event, quit_event)
+{
+    myevent.thread.running = 1;
+    quit_event();
+    TEST_ASSERT_EQUAL_INT(0, myevent.thread.running);
+}
+#endif
+
+static int send_key_to_menu(void)
+{
+    int cc = 0;
+    uint32_t bit = 0;
+    uint32_t changed = myevent.keypad.pre_bits ^ myevent.keypad.cur_bits;
+
+    trace("call %s()\n", __func__);
+
+    for (cc = 0; cc <= KEY_BIT_LAST; cc++) {
+        bit = 1 << cc;
+
+        if (changed & bit) {
+            if ((myevent.keypad.cur_bits & bit) == 0) {
+#if !defined(UT)
+                handle_sdl2_menu(cc);
+#endif
+            }
+        }
+    }
+    myevent.keypad.pre_bits = myevent.keypad.cur_bits;
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, send_key_to_menu)
+{
+    myevent.keypad.pre_bits = 0;
+    myevent.keypad.cur_bits = (1 << KEY_BIT_A);
+    TEST_ASSERT_EQUAL_INT(0, send_key_to_menu());
+    TEST_ASSERT_EQUAL_INT(myevent.keypad.pre_bits, myevent.keypad.cur_bits);
+}
+#endif
+
+static int update_raw_input_statue(uint32_t kbit, int val)
+{
+    uint32_t b = 0;
+
+    trace("call %s(kbit=%d, val=%d)\n", __func__, kbit, val);
+
+    switch (kbit) {
+    case KEY_BIT_UP:        b = NDS_KEY_BIT_UP;     break;
+    case KEY_BIT_DOWN:      b = NDS_KEY_BIT_DOWN;   break;
+    case KEY_BIT_LEFT:      b = NDS_KEY_BIT_LEFT;   break;
+    case KEY_BIT_RIGHT:     b = NDS_KEY_BIT_RIGHT;  break;
+    case KEY_BIT_A:         b = NDS_KEY_BIT_A;      break;
+    case KEY_BIT_B:         b = NDS_KEY_BIT_B;      break;
+    case KEY_BIT_X:         b = NDS_KEY_BIT_X;      break;
+    case KEY_BIT_Y:         b = NDS_KEY_BIT_Y;      break;
+    case KEY_BIT_L1:        b = NDS_KEY_BIT_L;      break;
+    case KEY_BIT_R1:        b = NDS_KEY_BIT_R;      break;
+    case KEY_BIT_R2:        b = NDS_KEY_BIT_SWAP;   break;
+    case KEY_BIT_SELECT:    b = NDS_KEY_BIT_SELECT; break;
+    case KEY_BIT_START:     b = NDS_KEY_BIT_START;  break;
+    case KEY_BIT_SWAP:      b = NDS_KEY_BIT_SWAP;   break;
+    case KEY_BIT_DRASTIC:   b = NDS_KEY_BIT_MENU;   break;
+    case KEY_BIT_QUIT:      b = NDS_KEY_BIT_QUIT;   break;
+    case KEY_BIT_SAVE:      b = NDS_KEY_BIT_SAVE;   break;
+    case KEY_BIT_LOAD:      b = NDS_KEY_BIT_LOAD;   break;
+    case KEY_BIT_FAST:      b = NDS_KEY_BIT_FAST;   break;
+    case KEY_BIT_HINGE:     b = NDS_KEY_BIT_HINGE;  break;
+    default:                                        return 0;
+    }
+
+    if (val) {
+        myevent.input.button_status |= b;
+    }
+    else {
+        myevent.input.button_status &= ~b;
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, update_raw_input_statue)
+{
+    myevent.input.button_status = 0;
+    TEST_ASSERT_EQUAL_INT(0, update_raw_input_statue(KEY_BIT_UP, 1));
+    TEST_ASSERT_EQUAL_INT(NDS_KEY_BIT_UP, myevent.input.button_status);
+    TEST_ASSERT_EQUAL_INT(0, update_raw_input_statue(KEY_BIT_UP, 0));
+    TEST_ASSERT_EQUAL_INT(0, myevent.input.button_status);
+}
+#endif
+
+static int send_key_event(int raw_event)
 {
     int cc = 0;
     int pressed = 0;
     uint32_t bit = 0;
     uint32_t changed = myevent.keypad.pre_bits ^ myevent.keypad.cur_bits;
 
-    trace("call %s(raw_event=%d)\n", __func__, raw_event);
+    trace("call %s(raw_event=%d)\n", __func__, raw_event);
+
+    for (cc=0; cc<=KEY_BIT_LAST; cc++) {
+        bit = 1 << cc;
+        pressed = !!(myevent.keypad.cur_bits & bit);
+
+#if !defined(TRIMUI_SMART)
+        if ((myconfig.hotkey == HOTKEY_BIND_MENU) && (cc == KEY_BIT_MENU)) {
+            continue;
+        }
+#endif
+
+#if defined(TRIMUI_SMART)
+        if (cc == KEY_BIT_MENU) {
+            continue;
+        }
+#endif
+
+        if (changed & bit) {
+            if (raw_event) {
+                trace("input bit=0x%x, pressed=%d\n", cc, pressed);
+                update_raw_input_statue(cc, pressed);
+            }
+            else {
+                trace("send code[%d]=0x%04x, pressed=%d\n", cc, nds_key_code[cc], pressed);
+
+#if !defined(UT)
+                SDL_SendKeyboardKey(
+                    pressed ? SDL_PRESSED : SDL_RELEASED,
+                    SDL_GetScancodeFromKey(nds_key_code[cc])
+                );
+#endif
+            }
+        }
+    }
+
+#if defined(TRIMUI_SMART)
+    if (myevent.keypad.pre_bits & (1 << KEY_BIT_R2)) {
+        clear_key_bits(1 << KEY_BIT_R2);
+    }
+    if (myevent.keypad.pre_bits & (1 << KEY_BIT_L2)) {
+        clear_key_bits(1 << KEY_BIT_L2);
+    }
+#endif
+    if (myevent.keypad.pre_bits & (1 << KEY_BIT_SAVE)) {
+        myvideo.lcd.status |= NDS_STATE_SAVE;
+        clear_key_bits(1 << KEY_BIT_SAVE);
+        update_raw_input_statue(KEY_BIT_SAVE, 0);
+    }
+    if (myevent.keypad.pre_bits & (1 << KEY_BIT_LOAD)) {
+        myvideo.lcd.status |= NDS_STATE_LOAD;
+        clear_key_bits(1 << KEY_BIT_LOAD);
+        update_raw_input_statue(KEY_BIT_LOAD, 0);
+    }
+    if (myevent.keypad.pre_bits & (1 << KEY_BIT_FAST)) {
+        myvideo.lcd.status ^= NDS_STATE_FAST;
+        myhook.use_fast = !!(myvideo.lcd.status & NDS_STATE_FAST);
+        clear_key_bits(1 << KEY_BIT_FAST);
+        update_raw_input_statue(KEY_BIT_FAST, 0);
+    }
+    if (myevent.keypad.pre_bits & (1 << KEY_BIT_DRASTIC)) {
+        clear_key_bits(1 << KEY_BIT_DRASTIC);
+        update_raw_input_statue(KEY_BIT_DRASTIC, 0);
+    }
+    if (myevent.keypad.pre_bits & (1 << KEY_BIT_SWAP)) {
+        clear_key_bits(1 << KEY_BIT_SWAP);
+        update_raw_input_statue(KEY_BIT_SWAP, 0);
+    }
+    if (myevent.keypad.pre_bits & (1 << KEY_BIT_QUIT)) {
+        release_key();
+        update_raw_input_statue(KEY_BIT_QUIT, 0);
+    }
+    myevent.keypad.pre_bits = myevent.keypad.cur_bits;
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, send_key_event)
+{
+    myevent.keypad.pre_bits = 0;
+    myevent.keypad.cur_bits = (1 << KEY_BIT_QUIT);
+    TEST_ASSERT_EQUAL_INT(0, send_key_event(0));
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_QUIT), myevent.keypad.cur_bits);
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_QUIT), myevent.keypad.pre_bits);
+}
+#endif
+
+static int update_touch_axis(void)
+{
+    int r = 0;
+
+    trace("call %s()\n", __func__);
+
+    if (is_book_mode() && (myconfig.key_rotate == 0)) {
+        if (myevent.keypad.cur_bits & (1 << KEY_BIT_UP)) {
+            r = 1;
+            myevent.touch.x+= inc_touch_axis(1);
+        }
+        if (myevent.keypad.cur_bits & (1 << KEY_BIT_DOWN)) {
+            r = 1;
+            myevent.touch.x-= inc_touch_axis(1);
+        }
+        if (myevent.keypad.cur_bits & (1 << KEY_BIT_LEFT)) {
+            r = 1;
+            myevent.touch.y-= inc_touch_axis(0);
+        }
+        if (myevent.keypad.cur_bits & (1 << KEY_BIT_RIGHT)) {
+            r = 1;
+            myevent.touch.y+= inc_touch_axis(0);
+        }
+    }
+    else {
+        if (myevent.keypad.cur_bits & (1 << KEY_BIT_UP)) {
+            r = 1;
+            myevent.touch.y-= inc_touch_axis(1);
+        }
+        if (myevent.keypad.cur_bits & (1 << KEY_BIT_DOWN)) {
+            r = 1;
+            myevent.touch.y+= inc_touch_axis(1);
+        }
+        if (myevent.keypad.cur_bits & (1 << KEY_BIT_LEFT)) {
+            r = 1;
+            myevent.touch.x-= inc_touch_axis(0);
+        }
+        if (myevent.keypad.cur_bits & (1 << KEY_BIT_RIGHT)) {
+            r = 1;
+            myevent.touch.x+= inc_touch_axis(0);
+        }
+    }
+
+    return r;
+}
+
+#if defined(UT)
+TEST(sdl2_event, update_touch_axis)
+{
+    myevent.touch.x = 0;
+    myevent.touch.y = 0;
+    myevent.keypad.cur_bits = (1 << KEY_BIT_RIGHT);
+    TEST_ASSERT_EQUAL_INT(1, update_touch_axis());
+    TEST_ASSERT_EQUAL_INT(1, !!myevent.touch.x);
+}
+#endif
+
+static int send_touch_key(int raw_event)
+{
+    uint32_t cc = 0;
+    uint32_t bit = 0;
+    uint32_t pressed = 0;
+    uint32_t changed = myevent.keypad.pre_bits ^ myevent.keypad.cur_bits;
+
+    trace("call %s(changed=0x%x)\n", __func__, changed);
 
-    for (cc=0; cc<=KEY_BIT_LAST; cc++) {
-        bit = 1 << cc;
-        pressed = !!(myevent.keypad.cur_bits & bit);
+    if (changed & (1 << KEY_BIT_A)) {
+        pressed = !!(myevent.keypad.cur_bits & (1 << KEY_BIT_A));
+        trace("send touch key (pressed=%d)\n", pressed);
 
-#if !defined(TRIMUI_SMART)
-        if ((myconfig.hotkey == HOTKEY_BIND_MENU) && (cc == KEY_BIT_MENU)) {
-            continue;
+        if (raw_event) {
+            myevent.input.touch_status = pressed;
         }
+        else {
+#if !defined(UT)
+            SDL_SendMouseButton(
+                myvideo.win,
+                0,
+                pressed ? SDL_PRESSED : SDL_RELEASED,
+                SDL_BUTTON_LEFT
+            );
 #endif
-
-#if defined(TRIMUI_SMART)
-        if (cc == KEY_BIT_MENU) {
-            continue;
         }
-#endif
+    }
 
-        if (changed & bit) {
-            if (raw_event) {
-                trace("input bit=0x%x, pressed=%d\n", cc, pressed);
-                update_raw_input_statue(cc, pressed);
-            }
-            else {
-                trace("send code[%d]=0x%04x, pressed=%d\n", cc, nds_key_code[cc], pressed);
+    for (cc = 0; cc <= KEY_BIT_LAST; cc++) {
+        bit = 1 << cc;
+
+        if ((cc == KEY_BIT_FAST) ||
+            (cc == KEY_BIT_SAVE) ||
+            (cc == KEY_BIT_LOAD) ||
+            (cc == KEY_BIT_QUIT) ||
+            (cc == KEY_BIT_HINGE))
+        {
+            if (changed & bit) {
+                pressed = myevent.keypad.cur_bits & bit;
 
 #if !defined(UT)
                 SDL_SendKeyboardKey(
@@ -2009,277 +4118,936 @@ static int send_key_event(int raw_event)
 #endif
             }
         }
+        if (cc == KEY_BIT_R1) {
+            if (changed & bit) {
+                myevent.touch.slow_down = (myevent.keypad.cur_bits & bit) ? 1 : 0;
+            }
+        }
+    }
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, send_touch_key)
+{
+    myevent.input.touch_status = 0;
+    myevent.keypad.pre_bits = 0;
+    myevent.keypad.cur_bits = (1 << KEY_BIT_A);
+    TEST_ASSERT_EQUAL_INT(0, send_touch_key(1));
+    TEST_ASSERT_EQUAL_INT(1, myevent.input.touch_status);
+}
+#endif
+
+static int send_touch_event(int raw_event)
+{
+    int r = 0;
+
+    trace("call %s()\n", __func__);
+
+    if (myevent.keypad.pre_bits != myevent.keypad.cur_bits) {
+        send_touch_key(raw_event);
+    }
+
+    r |= update_touch_axis();
+    r |= limit_touch_axis();
+    if (r) {
+        send_touch_axis();
     }
 
 #if defined(TRIMUI_SMART)
     if (myevent.keypad.pre_bits & (1 << KEY_BIT_R2)) {
-        set_key_bit(KEY_BIT_R2, 0);
+        clear_key_bits(1 << KEY_BIT_R2);
     }
     if (myevent.keypad.pre_bits & (1 << KEY_BIT_L2)) {
-        set_key_bit(KEY_BIT_L2, 0);
+        clear_key_bits(1 << KEY_BIT_L2);
     }
 #endif
     if (myevent.keypad.pre_bits & (1 << KEY_BIT_SAVE)) {
-        myvideo.lcd.status |= NDS_STATE_SAVE;
-        set_key_bit(KEY_BIT_SAVE, 0);
-        update_raw_input_statue(KEY_BIT_SAVE, 0);
+        clear_key_bits(1 << KEY_BIT_SAVE);
     }
     if (myevent.keypad.pre_bits & (1 << KEY_BIT_LOAD)) {
-        myvideo.lcd.status |= NDS_STATE_LOAD;
-        set_key_bit(KEY_BIT_LOAD, 0);
-        update_raw_input_statue(KEY_BIT_LOAD, 0);
+        clear_key_bits(1 << KEY_BIT_LOAD);
     }
     if (myevent.keypad.pre_bits & (1 << KEY_BIT_FAST)) {
-        myvideo.lcd.status ^= NDS_STATE_FAST;
-        set_key_bit(KEY_BIT_FAST, 0);
-        update_raw_input_statue(KEY_BIT_FAST, 0);
-    }
-    if (myevent.keypad.pre_bits & (1 << KEY_BIT_DRASTIC)) {
-        set_key_bit(KEY_BIT_DRASTIC, 0);
-        update_raw_input_statue(KEY_BIT_DRASTIC, 0);
+        clear_key_bits(1 << KEY_BIT_FAST);
     }
     if (myevent.keypad.pre_bits & (1 << KEY_BIT_SWAP)) {
-        set_key_bit(KEY_BIT_SWAP, 0);
-        update_raw_input_statue(KEY_BIT_SWAP, 0);
+        clear_key_bits(1 << KEY_BIT_SWAP);
     }
     if (myevent.keypad.pre_bits & (1 << KEY_BIT_QUIT)) {
         release_key();
-        update_raw_input_statue(KEY_BIT_QUIT, 0);
     }
-    myevent.keypad.pre_bits = myevent.keypad.cur_bits;
+    myevent.keypad.pre_bits = myevent.keypad.cur_bits;
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, send_touch_event)
+{
+    myevent.keypad.cur_bits = 0;
+    myevent.keypad.pre_bits = (1 << KEY_BIT_QUIT);
+    TEST_ASSERT_EQUAL_INT(0, send_touch_event(1));
+    TEST_ASSERT_EQUAL_INT(0, myevent.keypad.pre_bits);
+    TEST_ASSERT_EQUAL_INT(0, myevent.keypad.cur_bits);
+}
+#endif
+
+void pump_event(_THIS)
+{
+    trace("call %s()\n", __func__);
+
+    sync_input_snapshot();
+
+    if (myvideo.menu.sdl2.enable) {
+        send_key_to_menu();
+    }
+    else {
+        if (myevent.mode == NDS_KEY_MODE) {
+            if (myevent.keypad.pre_bits != myevent.keypad.cur_bits) {
+                send_key_event(0);
+            }
+        }
+        else if (myevent.mode == NDS_TOUCH_MODE) {
+            send_touch_event(0);
+        }
+    }
+}
+
+#if defined(UT)
+TEST(sdl2_event, pump_event)
+{
+    pump_event(NULL);
+    TEST_PASS();
+}
+#endif
+
+static int get_latency_bin(uint64_t us)
+{
+    uint64_t r = us / LAT_BIN_US;
+
+    return (r >= LAT_BINS) ? (LAT_BINS - 1) : (int)r;
+}
+
+#if defined(UT)
+TEST(sdl2_event, get_latency_bin)
+{
+    TEST_ASSERT_EQUAL_INT(0, get_latency_bin(0));
+    TEST_ASSERT_EQUAL_INT(0, get_latency_bin(LAT_BIN_US - 1));
+    TEST_ASSERT_EQUAL_INT(4, get_latency_bin(LAT_BIN_US * 4));
+    TEST_ASSERT_EQUAL_INT(LAT_BINS - 1, get_latency_bin(-1));
+}
+#endif
+
+static int get_latency_pct(const uint32_t *hist, int pct)
+{
+    int cc = 0;
+    uint32_t sum = 0;
+    uint32_t cnt = 0;
+
+    if (!hist) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    for (cc = 0; cc < LAT_BINS; cc++) {
+        cnt += hist[cc];
+    }
+
+    if (!cnt) {
+        return 0;
+    }
+
+    for (cc = 0; cc < LAT_BINS; cc++) {
+        sum += hist[cc];
+        if (((uint64_t)sum * 100) >= ((uint64_t)cnt * pct)) {
+            break;
+        }
+    }
+
+    return (cc + 1) * LAT_BIN_US;
+}
+
+#if defined(UT)
+TEST(sdl2_event, get_latency_pct)
+{
+    uint32_t hist[LAT_BINS] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, get_latency_pct(NULL, 50));
+    TEST_ASSERT_EQUAL_INT(0, get_latency_pct(hist, 50));
+
+    hist[3] = 98;
+    hist[40] = 2;
+    TEST_ASSERT_EQUAL_INT(4 * LAT_BIN_US, get_latency_pct(hist, 50));
+    TEST_ASSERT_EQUAL_INT(41 * LAT_BIN_US, get_latency_pct(hist, 99));
+}
+#endif
+
+static int record_input_latency(int written)
+{
+    uint64_t now = 0;
+
+    myevent.lat.enable = (myconfig.input_latency > 0);
+    if (!myevent.lat.enable || !myevent.lat.key_us) {
+        return 0;
+    }
+
+    if (written) {
+        now = get_sched_time();
+        myevent.lat.input_hist[get_latency_bin(now - myevent.lat.key_us)] += 1;
+        if (!myevent.lat.flip_us) {
+            myevent.lat.flip_us = myevent.lat.key_us;
+        }
+    }
+    myevent.lat.key_us = 0;
+
+    return written;
+}
+
+#if defined(UT)
+TEST(sdl2_event, record_input_latency)
+{
+    memset(&myevent.lat, 0, sizeof(myevent.lat));
+
+    myconfig.input_latency = 0;
+    myevent.lat.key_us = 100;
+    TEST_ASSERT_EQUAL_INT(0, record_input_latency(1));
+
+    myconfig.input_latency = 1;
+    myevent.sched.now = 100 + (LAT_BIN_US * 2);
+    TEST_ASSERT_EQUAL_INT(1, record_input_latency(1));
+    TEST_ASSERT_EQUAL_INT(1, myevent.lat.input_hist[2]);
+    TEST_ASSERT_EQUAL_INT(100, myevent.lat.flip_us);
+    TEST_ASSERT_EQUAL_INT(0, myevent.lat.key_us);
+
+    myevent.lat.key_us = 200;
+    TEST_ASSERT_EQUAL_INT(0, record_input_latency(0));
+    TEST_ASSERT_EQUAL_INT(0, myevent.lat.key_us);
+    TEST_ASSERT_EQUAL_INT(100, myevent.lat.flip_us);
+
+    myconfig.input_latency = 0;
+    myevent.sched.now = 0;
+    memset(&myevent.lat, 0, sizeof(myevent.lat));
+}
+#endif
+
+static int report_input_latency(void)
+{
+    uint64_t now = get_sched_time();
+
+    if (!myevent.lat.last_us) {
+        myevent.lat.last_us = now;
+    }
+    if ((now - myevent.lat.last_us) < (myconfig.input_latency * 1000000ULL)) {
+        return 0;
+    }
+
+    printf("[LATENCY] samples=%d input p50=%dus p99=%dus flip p50=%dus p99=%dus\n",
+        myevent.lat.samples,
+        get_latency_pct(myevent.lat.input_hist, 50),
+        get_latency_pct(myevent.lat.input_hist, 99),
+        get_latency_pct(myevent.lat.flip_hist, 50),
+        get_latency_pct(myevent.lat.flip_hist, 99)
+    );
+
+    myevent.lat.samples = 0;
+    myevent.lat.last_us = now;
+    memset(myevent.lat.input_hist, 0, sizeof(myevent.lat.input_hist));
+    memset(myevent.lat.flip_hist, 0, sizeof(myevent.lat.flip_hist));
+
+    return 1;
+}
+
+int record_flip_latency(void)
+{
+    uint64_t now = 0;
+
+    if (!myevent.lat.enable) {
+        return 0;
+    }
+
+    if (myevent.lat.flip_us) {
+        now = get_sched_time();
+        myevent.lat.flip_hist[get_latency_bin(now - myevent.lat.flip_us)] += 1;
+        myevent.lat.samples += 1;
+        myevent.lat.flip_us = 0;
+    }
+
+    return report_input_latency();
+}
+
+#if defined(UT)
+TEST(sdl2_event, record_flip_latency)
+{
+    int fd[2] = { 0 };
+    input_snap_t s = { 0 };
+    struct input_event e[2] = {{{ 0 }}};
+    input_struct *in = malloc(sizeof(input_struct));
+
+    TEST_ASSERT_NOT_NULL(in);
+    TEST_ASSERT_EQUAL_INT(0, pipe(fd));
+    TEST_ASSERT_EQUAL_INT(0, fcntl(fd[0], F_SETFL, O_NONBLOCK));
+
+    memset(&myevent.lat, 0, sizeof(myevent.lat));
+    memset(&myevent.snap, 0, sizeof(myevent.snap));
+    TEST_ASSERT_EQUAL_INT(0, record_flip_latency());
+
+    myconfig.input_latency = 10;
+    myevent.keypad.a = DEV_KEY_CODE_A;
+    myevent.keypad.raw_bits = 0;
+    myevent.keypad.cur_bits = 0;
+    myevent.keypad.pre_bits = 0;
+    myevent.mode = NDS_KEY_MODE;
+    myvideo.menu.sdl2.enable = 0;
+
+    e[0].type = EV_KEY;
+    e[0].code = DEV_KEY_CODE_A;
+    e[0].value = 1;
+    e[0].input_event_sec = 1;
+    e[1].type = EV_SYN;
+    TEST_ASSERT_EQUAL_INT(sizeof(e), write(fd[1], e, sizeof(e)));
+
+    myevent.sched.now = 1000000 + 1000;
+    TEST_ASSERT_EQUAL_INT(1, handle_key_events(fd[0]));
+    TEST_ASSERT_EQUAL_INT(0, publish_input_snapshot());
+    TEST_ASSERT_EQUAL_INT(0, read_input_snapshot(&s));
+    TEST_ASSERT_EQUAL_INT(1000000, s.key_us);
+
+    myevent.sched.now = 1000000 + 3000;
+    prehook_platform_get_input((uintptr_t)((uint8_t *)in - NDS_INPUT_OFFSET));
+    TEST_ASSERT_EQUAL_INT(NDS_KEY_BIT_A, in->button_status);
+    TEST_ASSERT_EQUAL_INT(1, myevent.lat.input_hist[get_latency_bin(3000)]);
+
+    myevent.sched.now = 1000000 + 16000;
+    TEST_ASSERT_EQUAL_INT(0, record_flip_latency());
+    TEST_ASSERT_EQUAL_INT(1, myevent.lat.samples);
+    TEST_ASSERT_EQUAL_INT(1, myevent.lat.flip_hist[get_latency_bin(16000)]);
+    TEST_ASSERT_EQUAL_INT(get_latency_pct(myevent.lat.flip_hist, 50), get_latency_pct(myevent.lat.flip_hist, 99));
+
+    myevent.sched.now = 1000000 + 16000 + (10 * 1000000);
+    TEST_ASSERT_EQUAL_INT(1, record_flip_latency());
+    TEST_ASSERT_EQUAL_INT(0, myevent.lat.samples);
+
+    myconfig.input_latency = 0;
+    myevent.sched.now = 0;
+    myevent.keypad.raw_bits = 0;
+    myevent.keypad.cur_bits = 0;
+    myevent.keypad.pre_bits = 0;
+    memset(&myevent.lat, 0, sizeof(myevent.lat));
+    memset(&myevent.snap, 0, sizeof(myevent.snap));
+    close(fd[0]);
+    close(fd[1]);
+    free(in);
+}
+#endif
+
+static int get_movie_game(char *buf, int len)
+{
+    trace("call %s(buf=%p, len=%d)\n", __func__, buf, len);
+
+    if (!buf || (len <= 0)) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    memset(buf, 0, len);
+#if !defined(UT)
+    if (myhook.var.system.gamecard_name) {
+        strncpy(buf, (const char *)myhook.var.system.gamecard_name, len - 1);
+    }
+#endif
+
+    return 0;
+}
+
+#if defined(UT)
+TEST(sdl2_event, get_movie_game)
+{
+    char buf[16] = { 0 };
+
+    TEST_ASSERT_EQUAL_INT(-1, get_movie_game(NULL, 0));
+    TEST_ASSERT_EQUAL_INT(0, get_movie_game(buf, sizeof(buf)));
+}
+#endif
+
+static int stop_movie(void)
+{
+    trace("call %s()\n", __func__);
+
+    if (!myevent.movie.fp) {
+        myevent.movie.mode = MOVIE_IDLE;
+        return 0;
+    }
+
+    if (myevent.movie.mode == MOVIE_RECORD) {
+        myevent.movie.hdr.frames = myevent.movie.frame;
+        fseek(myevent.movie.fp, 0, SEEK_SET);
+        fwrite(&myevent.movie.hdr, sizeof(myevent.movie.hdr), 1, myevent.movie.fp);
+    }
+
+    printf("[MOVIE] %s stopped at frame %d\n",
+        (myevent.movie.mode == MOVIE_RECORD) ? "record" : "playback",
+        myevent.movie.frame
+    );
+
+    fclose(myevent.movie.fp);
+    myevent.movie.fp = NULL;
+    myevent.movie.mode = MOVIE_IDLE;
 
     return 0;
 }
 
 #if defined(UT)
-TEST(sdl2_event, send_key_event)
+TEST(sdl2_event, stop_movie)
 {
-    myevent.keypad.pre_bits = 0;
-    myevent.keypad.cur_bits = (1 << KEY_BIT_QUIT);
-    TEST_ASSERT_EQUAL_INT(0, send_key_event(0));
-    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_QUIT), myevent.keypad.cur_bits);
-    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_QUIT), myevent.keypad.pre_bits);
+    memset(&myevent.movie, 0, sizeof(myevent.movie));
+    myevent.movie.mode = MOVIE_PLAY;
+    TEST_ASSERT_EQUAL_INT(0, stop_movie());
+    TEST_ASSERT_EQUAL_INT(MOVIE_IDLE, myevent.movie.mode);
 }
 #endif
 
-static int update_touch_axis(void)
+static int start_movie(const char *path, movie_mode_t mode)
 {
-    int r = 0;
+    char game[sizeof(myevent.movie.hdr.game)] = { 0 };
 
-    trace("call %s()\n", __func__);
+    trace("call %s(path=%s, mode=%d)\n", __func__, path ? path : "", mode);
 
-    if (is_book_mode() && (myconfig.key_rotate == 0)) {
-        if (myevent.keypad.cur_bits & (1 << KEY_BIT_UP)) {
-            r = 1;
-            myevent.touch.x+= inc_touch_axis(1);
-        }
-        if (myevent.keypad.cur_bits & (1 << KEY_BIT_DOWN)) {
-            r = 1;
-            myevent.touch.x-= inc_touch_axis(1);
-        }
-        if (myevent.keypad.cur_bits & (1 << KEY_BIT_LEFT)) {
-            r = 1;
-            myevent.touch.y-= inc_touch_axis(0);
-        }
-        if (myevent.keypad.cur_bits & (1 << KEY_BIT_RIGHT)) {
-            r = 1;
-            myevent.touch.y+= inc_touch_axis(0);
+    if (!path || ((mode != MOVIE_RECORD) && (mode != MOVIE_PLAY))) {
+        error("invalid input\n");
+        return -1;
+    }
+
+    stop_movie();
+    get_movie_game(game, sizeof(game));
+
+    myevent.movie.fp = fopen(path, (mode == MOVIE_RECORD) ? "wb" : "rb");
+    if (!myevent.movie.fp) {
+        error("failed to open \"%s\"\n", path);
+        return -1;
+    }
+
+    if (mode == MOVIE_RECORD) {
+        memset(&myevent.movie.hdr, 0, sizeof(myevent.movie.hdr));
+        myevent.movie.hdr.magic = MOVIE_MAGIC;
+        myevent.movie.hdr.version = MOVIE_VERSION;
+        myevent.movie.hdr.slot = MOVIE_STATE_SLOT;
+        memcpy(myevent.movie.hdr.game, game, sizeof(game));
+
+        if ((save_state(MOVIE_STATE_SLOT) < 0) ||
+            (fwrite(&myevent.movie.hdr, sizeof(myevent.movie.hdr), 1, myevent.movie.fp) != 1))
+        {
+            error("failed to start recording\n");
+            fclose(myevent.movie.fp);
+            myevent.movie.fp = NULL;
+            return -1;
         }
     }
     else {
-        if (myevent.keypad.cur_bits & (1 << KEY_BIT_UP)) {
-            r = 1;
-            myevent.touch.y-= inc_touch_axis(1);
-        }
-        if (myevent.keypad.cur_bits & (1 << KEY_BIT_DOWN)) {
-            r = 1;
-            myevent.touch.y+= inc_touch_axis(1);
-        }
-        if (myevent.keypad.cur_bits & (1 << KEY_BIT_LEFT)) {
-            r = 1;
-            myevent.touch.x-= inc_touch_axis(0);
-        }
-        if (myevent.keypad.cur_bits & (1 << KEY_BIT_RIGHT)) {
-            r = 1;
-            myevent.touch.x+= inc_touch_axis(0);
+        if ((fread(&myevent.movie.hdr, sizeof(myevent.movie.hdr), 1, myevent.movie.fp) != 1) ||
+            (myevent.movie.hdr.magic != MOVIE_MAGIC) ||
+            (myevent.movie.hdr.version != MOVIE_VERSION) ||
+            memcmp(myevent.movie.hdr.game, game, sizeof(game)) ||
+            (load_state(myevent.movie.hdr.slot) < 0))
+        {
+            error("invalid movie \"%s\"\n", path);
+            fclose(myevent.movie.fp);
+            myevent.movie.fp = NULL;
+            return -1;
         }
     }
 
-    return r;
+    myevent.movie.mode = mode;
+    myevent.movie.frame = 0;
+    if (path != myevent.movie.path) {
+        snprintf(myevent.movie.path, sizeof(myevent.movie.path), "%s", path);
+    }
+    printf("[MOVIE] %s \"%s\"\n", (mode == MOVIE_RECORD) ? "record" : "playback", path);
+
+    return 0;
 }
 
 #if defined(UT)
-TEST(sdl2_event, update_touch_axis)
+TEST(sdl2_event, start_movie)
 {
-    myevent.touch.x = 0;
-    myevent.touch.y = 0;
-    myevent.keypad.cur_bits = (1 << KEY_BIT_RIGHT);
-    TEST_ASSERT_EQUAL_INT(1, update_touch_axis());
-    TEST_ASSERT_EQUAL_INT(1, !!myevent.touch.x);
+    FILE *f = NULL;
+    movie_hdr_t h = { 0 };
+    const char *path = "/tmp/ut_movie.ndm";
+
+    memset(&myevent.movie, 0, sizeof(myevent.movie));
+    TEST_ASSERT_EQUAL_INT(-1, start_movie(NULL, MOVIE_RECORD));
+    TEST_ASSERT_EQUAL_INT(-1, start_movie(path, MOVIE_IDLE));
+    TEST_ASSERT_EQUAL_INT(-1, start_movie("/tmp/ut_movie_none.ndm", MOVIE_PLAY));
+
+    TEST_ASSERT_EQUAL_INT(0, start_movie(path, MOVIE_RECORD));
+    TEST_ASSERT_EQUAL_INT(MOVIE_RECORD, myevent.movie.mode);
+    myevent.movie.frame = 3;
+    TEST_ASSERT_EQUAL_INT(0, stop_movie());
+    TEST_ASSERT_EQUAL_INT(MOVIE_IDLE, myevent.movie.mode);
+    TEST_ASSERT_NULL(myevent.movie.fp);
+
+    f = fopen(path, "rb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL_INT(1, fread(&h, sizeof(h), 1, f));
+    fclose(f);
+    TEST_ASSERT_EQUAL_INT(MOVIE_MAGIC, h.magic);
+    TEST_ASSERT_EQUAL_INT(MOVIE_STATE_SLOT, h.slot);
+    TEST_ASSERT_EQUAL_INT(3, h.frames);
+
+    TEST_ASSERT_EQUAL_INT(0, start_movie(path, MOVIE_PLAY));
+    TEST_ASSERT_EQUAL_INT(MOVIE_PLAY, myevent.movie.mode);
+    TEST_ASSERT_EQUAL_INT(0, stop_movie());
+
+    h.magic = 0;
+    f = fopen(path, "wb");
+    TEST_ASSERT_NOT_NULL(f);
+    TEST_ASSERT_EQUAL_INT(1, fwrite(&h, sizeof(h), 1, f));
+    fclose(f);
+    TEST_ASSERT_EQUAL_INT(-1, start_movie(path, MOVIE_PLAY));
+    TEST_ASSERT_EQUAL_INT(MOVIE_IDLE, myevent.movie.mode);
+
+    unlink(path);
 }
 #endif
 
-static int send_touch_key(int raw_event)
+static int update_movie(input_struct *in)
 {
-    uint32_t cc = 0;
-    uint32_t bit = 0;
-    uint32_t pressed = 0;
-    uint32_t changed = myevent.keypad.pre_bits ^ myevent.keypad.cur_bits;
+    int req = 0;
+    movie_frame_t f = { 0 };
 
-    trace("call %s(changed=0x%x)\n", __func__, changed);
+    trace("call %s(in=%p)\n", __func__, in);
 
-    if (changed & (1 << KEY_BIT_A)) {
-        pressed = !!(myevent.keypad.cur_bits & (1 << KEY_BIT_A));
-        trace("send touch key (pressed=%d)\n", pressed);
+    if (!in) {
+        error("invalid input\n");
+        return -1;
+    }
 
-        if (raw_event) {
-            myevent.input.touch_status = pressed;
+    req = __atomic_exchange_n(&myevent.movie.req, MOVIE_REQ_NONE, __ATOMIC_ACQUIRE);
+    if (req == MOVIE_REQ_TOGGLE) {
+        req = (myevent.movie.mode == MOVIE_IDLE) ? MOVIE_REQ_RECORD : MOVIE_REQ_STOP;
+    }
+
+    switch (req) {
+    case MOVIE_REQ_RECORD:
+        start_movie(myevent.movie.path, MOVIE_RECORD);
+        break;
+    case MOVIE_REQ_PLAY:
+        start_movie(myevent.movie.path, MOVIE_PLAY);
+        break;
+    case MOVIE_REQ_STOP:
+        stop_movie();
+        in->button_status = myevent.input.button_status;
+        break;
+    }
+
+    if (myevent.movie.mode == MOVIE_RECORD) {
+        f.button_status = in->button_status & MOVIE_KEY_MASK;
+        f.touch_x = in->touch_x;
+        f.touch_y = in->touch_y;
+        f.touch_status = in->touch_status;
+        f.touch_pressure = in->touch_pressure;
+        if (fwrite(&f, sizeof(f), 1, myevent.movie.fp) != 1) {
+            error("failed to write movie frame\n");
+            stop_movie();
+            return -1;
         }
-        else {
-#if !defined(UT)
-            SDL_SendMouseButton(
-                myvideo.win,
-                0,
-                pressed ? SDL_PRESSED : SDL_RELEASED,
-                SDL_BUTTON_LEFT
-            );
-#endif
+        myevent.movie.frame += 1;
+    }
+    else if (myevent.movie.mode == MOVIE_PLAY) {
+        if (fread(&f, sizeof(f), 1, myevent.movie.fp) != 1) {
+            stop_movie();
+            in->button_status = myevent.input.button_status;
+            in->touch_x = myevent.touch.x;
+            in->touch_y = myevent.touch.y;
+            in->touch_status = myevent.input.touch_status;
+            if (myevent.movie.quit) {
+                in->button_status |= NDS_KEY_BIT_QUIT;
+            }
+            return 0;
         }
+
+        in->button_status &= ~MOVIE_KEY_MASK;
+        in->button_status |= (f.button_status & MOVIE_KEY_MASK);
+        in->touch_x = f.touch_x;
+        in->touch_y = f.touch_y;
+        in->touch_status = f.touch_status;
+        in->touch_pressure = f.touch_pressure;
+        myevent.movie.frame += 1;
     }
 
-    for (cc = 0; cc <= KEY_BIT_LAST; cc++) {
-        bit = 1 << cc;
+    return myevent.movie.mode;
+}
 
-        if ((cc == KEY_BIT_FAST) ||
-            (cc == KEY_BIT_SAVE) ||
-            (cc == KEY_BIT_LOAD) ||
-            (cc == KEY_BIT_QUIT) ||
-            (cc == KEY_BIT_HINGE))
-        {
-            if (changed & bit) {
-                pressed = myevent.keypad.cur_bits & bit;
+#if defined(UT)
+TEST(sdl2_event, update_movie)
+{
+    int cc = 0;
+    input_struct in = { 0 };
+    const char *path = "/tmp/ut_movie.ndm";
+
+    memset(&myevent.movie, 0, sizeof(myevent.movie));
+    snprintf(myevent.movie.path, sizeof(myevent.movie.path), "%s", path);
+    TEST_ASSERT_EQUAL_INT(-1, update_movie(NULL));
+    TEST_ASSERT_EQUAL_INT(MOVIE_IDLE, update_movie(&in));
+
+    myevent.movie.req = MOVIE_REQ_TOGGLE;
+    for (cc = 0; cc < 4; cc++) {
+        in.button_status = (cc & 1) ? NDS_KEY_BIT_A : (NDS_KEY_BIT_B | NDS_KEY_BIT_MENU);
+        in.touch_x = cc;
+        TEST_ASSERT_EQUAL_INT(MOVIE_RECORD, update_movie(&in));
+    }
+    myevent.movie.req = MOVIE_REQ_TOGGLE;
+    TEST_ASSERT_EQUAL_INT(MOVIE_IDLE, update_movie(&in));
+
+    myevent.input.button_status = NDS_KEY_BIT_X;
+    myevent.movie.quit = 1;
+    myevent.movie.req = MOVIE_REQ_PLAY;
+    for (cc = 0; cc < 4; cc++) {
+        in.button_status = 0;
+        TEST_ASSERT_EQUAL_INT(MOVIE_PLAY, update_movie(&in));
+        TEST_ASSERT_EQUAL_INT((cc & 1) ? NDS_KEY_BIT_A : NDS_KEY_BIT_B, in.button_status);
+        TEST_ASSERT_EQUAL_INT(cc, in.touch_x);
+    }
+    TEST_ASSERT_EQUAL_INT(MOVIE_IDLE, update_movie(&in));
+    TEST_ASSERT_EQUAL_INT(NDS_KEY_BIT_X | NDS_KEY_BIT_QUIT, in.button_status);
 
-#if !defined(UT)
-                SDL_SendKeyboardKey(
-                    pressed ? SDL_PRESSED : SDL_RELEASED,
-                    SDL_GetScancodeFromKey(nds_key_code[cc])
-                );
+    myevent.input.button_status = 0;
+    memset(&myevent.movie, 0, sizeof(myevent.movie));
+    unlink(path);
+}
 #endif
-            }
-        }
-        if (cc == KEY_BIT_R1) {
-            if (changed & bit) {
-                myevent.touch.slow_down = (myevent.keypad.cur_bits & bit) ? 1 : 0;
-            }
-        }
+
+static int init_movie(void)
+{
+    const char *rec = getenv("NDS_MOVIE_RECORD");
+    const char *play = getenv("NDS_MOVIE_PLAY");
+    const char *quit = getenv("NDS_MOVIE_QUIT");
+
+    trace("call %s()\n", __func__);
+
+    // export NDS_MOVIE_PLAY=/path/to/movie.ndm NDS_MOVIE_QUIT=1
+    snprintf(myevent.movie.path, sizeof(myevent.movie.path), "%s/%s", myconfig.home, MOVIE_FILE);
+    myevent.movie.quit = quit ? atoi(quit) : 0;
+
+    if (play) {
+        snprintf(myevent.movie.path, sizeof(myevent.movie.path), "%s", play);
+        myevent.movie.req = MOVIE_REQ_PLAY;
+    }
+    else if (rec) {
+        snprintf(myevent.movie.path, sizeof(myevent.movie.path), "%s", rec);
+        myevent.movie.req = MOVIE_REQ_RECORD;
     }
 
     return 0;
 }
 
 #if defined(UT)
-TEST(sdl2_event, send_touch_key)
+TEST(sdl2_event, init_movie)
 {
-    myevent.input.touch_status = 0;
-    myevent.keypad.pre_bits = 0;
-    myevent.keypad.cur_bits = (1 << KEY_BIT_A);
-    TEST_ASSERT_EQUAL_INT(0, send_touch_key(1));
-    TEST_ASSERT_EQUAL_INT(1, myevent.input.touch_status);
+    memset(&myevent.movie, 0, sizeof(myevent.movie));
+
+    setenv("NDS_MOVIE_PLAY", "/tmp/ut_movie.ndm", 1);
+    TEST_ASSERT_EQUAL_INT(0, init_movie());
+    TEST_ASSERT_EQUAL_INT(MOVIE_REQ_PLAY, myevent.movie.req);
+    TEST_ASSERT_EQUAL_STRING("/tmp/ut_movie.ndm", myevent.movie.path);
+    unsetenv("NDS_MOVIE_PLAY");
+
+    TEST_ASSERT_EQUAL_INT(0, init_movie());
+    TEST_ASSERT_EQUAL_INT(0, myevent.movie.quit);
+    memset(&myevent.movie, 0, sizeof(myevent.movie));
 }
 #endif
 
-static int send_touch_event(int raw_event)
+static int get_analog_vector(int x, int y, float *vx, float *vy)
 {
-    int r = 0;
+    float m = 0.0;
+    float s = 0.0;
+    float dz = (float)myconfig.analog.dzone / 100.0;
 
-    trace("call %s()\n", __func__);
+    trace("call %s(x=%d, y=%d, vx=%p, vy=%p)\n", __func__, x, y, vx, vy);
 
-    if (myevent.keypad.pre_bits != myevent.keypad.cur_bits) {
-        send_touch_key(raw_event);
+    if (!vx || !vy) {
+        error("invalid input\n");
+        return -1;
     }
 
-    r |= update_touch_axis();
-    r |= limit_touch_axis();
-    if (r) {
-        send_touch_axis();
+    *vx = 0.0;
+    *vy = 0.0;
+
+    // radial dead zone, so diagonals are not cut short like a per-axis one
+    m = SDL_sqrtf((float)((x * x) + (y * y))) / ANALOG_AXIS_MAX;
+    if ((m <= dz) || (dz >= 1.0)) {
+        return 0;
     }
 
-#if defined(TRIMUI_SMART)
-    if (myevent.keypad.pre_bits & (1 << KEY_BIT_R2)) {
-        set_key_bit(KEY_BIT_R2, 0);
+    s = (m > 1.0) ? 1.0 : m;
+    s = (s - dz) / (1.0 - dz);
+    *vx = ((float)x / (m * ANALOG_AXIS_MAX)) * s;
+    *vy = ((float)y / (m * ANALOG_AXIS_MAX)) * s;
+
+    return 1;
+}
+
+#if defined(UT)
+TEST(sdl2_event, get_analog_vector)
+{
+    float vx = 0.0;
+    float vy = 0.0;
+
+    myconfig.analog.dzone = 20;
+    TEST_ASSERT_EQUAL_INT(-1, get_analog_vector(0, 0, NULL, &vy));
+    TEST_ASSERT_EQUAL_INT(0, get_analog_vector(17, 17, &vx, &vy));
+    TEST_ASSERT_EQUAL_FLOAT(0.0, vx);
+
+    TEST_ASSERT_EQUAL_INT(1, get_analog_vector(127, 0, &vx, &vy));
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 1.0, vx);
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.0, vy);
+
+    TEST_ASSERT_EQUAL_INT(1, get_analog_vector(-90, 90, &vx, &vy));
+    TEST_ASSERT_FLOAT_WITHIN(0.01, -0.707, vx);
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 0.707, vy);
+    myconfig.analog.dzone = DEF_ANALOG_DZONE;
+}
+#endif
+
+static float apply_analog_curve(float v)
+{
+    float e = (float)myconfig.analog.curve / 10.0;
+
+    trace("call %s(v=%f)\n", __func__, v);
+
+    if (v <= 0.0) {
+        return 0.0;
     }
-    if (myevent.keypad.pre_bits & (1 << KEY_BIT_L2)) {
-        set_key_bit(KEY_BIT_L2, 0);
+
+    if (v >= 1.0) {
+        return 1.0;
+    }
+
+    if (e <= 1.0) {
+        return v;
     }
+    return SDL_powf(v, e);
+}
+
+#if defined(UT)
+TEST(sdl2_event, apply_analog_curve)
+{
+    myconfig.analog.curve = 20;
+    TEST_ASSERT_EQUAL_FLOAT(0.0, apply_analog_curve(-1.0));
+    TEST_ASSERT_EQUAL_FLOAT(1.0, apply_analog_curve(2.0));
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.25, apply_analog_curve(0.5));
+
+    myconfig.analog.curve = 0;
+    TEST_ASSERT_FLOAT_WITHIN(0.001, 0.5, apply_analog_curve(0.5));
+    myconfig.analog.curve = DEF_ANALOG_CURVE;
+}
 #endif
-    if (myevent.keypad.pre_bits & (1 << KEY_BIT_SAVE)) {
-        set_key_bit(KEY_BIT_SAVE, 0);
+
+static int update_analog_dpad(float vx, float vy)
+{
+    int cc = 0;
+    uint32_t bits = myevent.analog.bits;
+    float on = (float)ANALOG_DPAD_ON / 100.0;
+    float off = on - ((float)myconfig.analog.hyst / 100.0);
+    const int bit[] = { KEY_BIT_RIGHT, KEY_BIT_LEFT, KEY_BIT_DOWN, KEY_BIT_UP };
+    const float v[] = { vx, -vx, vy, -vy };
+
+    trace("call %s(vx=%f, vy=%f)\n", __func__, vx, vy);
+
+    if (off < 0.0) {
+        off = 0.0;
     }
-    if (myevent.keypad.pre_bits & (1 << KEY_BIT_LOAD)) {
-        set_key_bit(KEY_BIT_LOAD, 0);
+
+    // press above "on" and release below "off" so a stick resting on the
+    // threshold does not chatter the d-pad every frame
+    for (cc = 0; cc < 4; cc++) {
+        if (bits & (1 << bit[cc])) {
+            if (v[cc] <= off) {
+                bits &= ~(1 << bit[cc]);
+            }
+        }
+        else if (v[cc] >= on) {
+            bits |= (1 << bit[cc]);
+        }
     }
-    if (myevent.keypad.pre_bits & (1 << KEY_BIT_FAST)) {
-        set_key_bit(KEY_BIT_FAST, 0);
+
+    if (bits == myevent.analog.bits) {
+        return 0;
     }
-    if (myevent.keypad.pre_bits & (1 << KEY_BIT_SWAP)) {
-        set_key_bit(KEY_BIT_SWAP, 0);
+    myevent.analog.bits = bits;
+
+    return 1;
+}
+
+#if defined(UT)
+TEST(sdl2_event, update_analog_dpad)
+{
+    myevent.analog.bits = 0;
+    myconfig.analog.hyst = 10;
+    TEST_ASSERT_EQUAL_INT(0, update_analog_dpad(0.45, 0.0));
+    TEST_ASSERT_EQUAL_INT(1, update_analog_dpad(0.55, -0.6));
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_RIGHT) | (1 << KEY_BIT_UP), myevent.analog.bits);
+    TEST_ASSERT_EQUAL_INT(0, update_analog_dpad(0.45, -0.45));
+    TEST_ASSERT_EQUAL_INT(1, update_analog_dpad(0.35, -0.45));
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_UP), myevent.analog.bits);
+    TEST_ASSERT_EQUAL_INT(1, update_analog_dpad(0.0, 0.0));
+    TEST_ASSERT_EQUAL_INT(0, myevent.analog.bits);
+    myconfig.analog.hyst = DEF_ANALOG_HYST;
+}
+#endif
+
+static int update_analog_stylus(float vx, float vy)
+{
+    int dx = 0;
+    int dy = 0;
+    float c = 0.0;
+    float m = SDL_sqrtf((vx * vx) + (vy * vy));
+    float speed = (float)myconfig.analog.speed;
+
+    trace("call %s(vx=%f, vy=%f)\n", __func__, vx, vy);
+
+    if (m <= 0.0) {
+        myevent.analog.fx = 0.0;
+        myevent.analog.fy = 0.0;
+        return 0;
     }
-    if (myevent.keypad.pre_bits & (1 << KEY_BIT_QUIT)) {
-        release_key();
+
+    if (myevent.touch.slow_down) {
+        speed /= 2.0;
     }
-    myevent.keypad.pre_bits = myevent.keypad.cur_bits;
 
-    return 0;
+    // sub-pixel remainder is carried so slow tilts still move the pen
+    c = apply_analog_curve(m) * speed;
+    myevent.analog.fx += (vx / m) * c;
+    myevent.analog.fy += (vy / m) * c;
+    dx = (int)myevent.analog.fx;
+    dy = (int)myevent.analog.fy;
+    myevent.analog.fx -= dx;
+    myevent.analog.fy -= dy;
+
+    if (!dx && !dy) {
+        return 0;
+    }
+
+    // applied by sync_input_snapshot(), the only writer of the pen position
+    myevent.analog.dx += dx;
+    myevent.analog.dy += dy;
+
+    return 1;
 }
 
 #if defined(UT)
-TEST(sdl2_event, send_touch_event)
+TEST(sdl2_event, update_analog_stylus)
 {
-    myevent.keypad.cur_bits = 0;
-    myevent.keypad.pre_bits = (1 << KEY_BIT_QUIT);
-    TEST_ASSERT_EQUAL_INT(0, send_touch_event(1));
-    TEST_ASSERT_EQUAL_INT(0, myevent.keypad.pre_bits);
-    TEST_ASSERT_EQUAL_INT(0, myevent.keypad.cur_bits);
+    myevent.touch.x = 100;
+    myevent.touch.y = 100;
+    myevent.touch.max_x = NDS_W;
+    myevent.touch.max_y = NDS_H;
+    myevent.touch.slow_down = 0;
+    myconfig.analog.curve = 20;
+    myconfig.analog.speed = 8;
+    memset(&myevent.analog, 0, sizeof(myevent.analog));
+
+    TEST_ASSERT_EQUAL_INT(0, update_analog_stylus(0.0, 0.0));
+    TEST_ASSERT_EQUAL_INT(1, update_analog_stylus(1.0, 0.0));
+    TEST_ASSERT_EQUAL_INT(8, myevent.analog.dx);
+    TEST_ASSERT_EQUAL_INT(0, myevent.analog.dy);
+    TEST_ASSERT_EQUAL_INT(100, myevent.touch.x);
+
+    TEST_ASSERT_EQUAL_INT(0, update_analog_stylus(0.0, 0.25));
+    TEST_ASSERT_EQUAL_INT(1, update_analog_stylus(0.0, 0.25));
+    TEST_ASSERT_EQUAL_INT(1, myevent.analog.dy);
+
+    TEST_ASSERT_EQUAL_INT(0, update_analog_stylus(0.0, 0.0));
+    TEST_ASSERT_EQUAL_FLOAT(0.0, myevent.analog.fy);
+    memset(&myevent.analog, 0, sizeof(myevent.analog));
+    myconfig.analog.speed = DEF_ANALOG_SPEED;
+    myconfig.analog.curve = DEF_ANALOG_CURVE;
 }
 #endif
 
-void pump_event(_THIS)
+static int update_analog(void)
 {
+    int x = 0;
+    int y = 0;
+    float vx = 0.0;
+    float vy = 0.0;
+    input_snap_t s = { 0 };
+#if defined(MIYOO_FLIP) || defined(UT)
+    jval_t left = { 0 };
+    jval_t right = { 0 };
+#endif
+
     trace("call %s()\n", __func__);
 
-#if !defined(UT)
-    SDL_SemWait(myevent.sem);
+    if (myconfig.analog.mode == ANALOG_MODE_OFF) {
+        myevent.analog.bits = 0;
+        return 0;
+    }
+
+    read_input_snapshot(&s);
+    x = s.axis_x;
+    y = s.axis_y;
+
+#if defined(MIYOO_FLIP) || defined(UT)
+    get_joy_axis(&left, &right);
+    if (((left.x * left.x) + (left.y * left.y)) > ((x * x) + (y * y))) {
+        x = left.x;
+        y = left.y;
+    }
 #endif
 
-    if (myvideo.menu.sdl2.enable) {
-        send_key_to_menu();
+    get_analog_vector(x, y, &vx, &vy);
+
+    if (myconfig.analog.mode == ANALOG_MODE_DPAD) {
+        return update_analog_dpad(vx, vy);
     }
-    else {
-        if (myevent.mode == NDS_KEY_MODE) {
-            if (myevent.keypad.pre_bits != myevent.keypad.cur_bits) {
-                send_key_event(0);
-            }
-        }
-        else if (myevent.mode == NDS_TOUCH_MODE) {
-            send_touch_event(0);
-        }
+
+    myevent.analog.bits = 0;
+    if (myconfig.analog.mode == ANALOG_MODE_STYLUS) {
+        return update_analog_stylus(vx, vy);
     }
 
-#if !defined(UT)
-    SDL_SemPost(myevent.sem);
-#endif
+    return 0;
 }
 
 #if defined(UT)
-TEST(sdl2_event, pump_event)
+TEST(sdl2_event, update_analog)
 {
-    pump_event(NULL);
-    TEST_PASS();
+    memset(&myevent.snap, 0, sizeof(myevent.snap));
+    memset(&myevent.analog, 0, sizeof(myevent.analog));
+    myjoy.axis = 0;
+    myconfig.analog.dzone = DEF_ANALOG_DZONE;
+    myconfig.analog.hyst = DEF_ANALOG_HYST;
+
+    myconfig.analog.mode = ANALOG_MODE_OFF;
+    myevent.analog.bits = (1 << KEY_BIT_UP);
+    TEST_ASSERT_EQUAL_INT(0, update_analog());
+    TEST_ASSERT_EQUAL_INT(0, myevent.analog.bits);
+
+    myconfig.analog.mode = ANALOG_MODE_DPAD;
+    myevent.snap.next.axis_x = -127;
+    publish_input_snapshot();
+    TEST_ASSERT_EQUAL_INT(1, update_analog());
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_LEFT), myevent.analog.bits);
+
+    myevent.keypad.raw_bits = 0;
+    myevent.keypad.done_bits = 0;
+    sync_input_snapshot();
+    TEST_ASSERT_EQUAL_INT((1 << KEY_BIT_LEFT), myevent.keypad.cur_bits);
+
+    myconfig.analog.mode = ANALOG_MODE_OFF;
+    update_analog();
+    myevent.keypad.cur_bits = 0;
+    memset(&myevent.snap, 0, sizeof(myevent.snap));
 }
 #endif
 
 void prehook_platform_get_input(uintptr_t p)
 {
+    int written = 0;
     static int pre_tp_x = 0;
     static int pre_tp_y = 0;
     static uint32_t pre_tp_bits = 0;
@@ -2289,6 +5057,9 @@ void prehook_platform_get_input(uintptr_t p)
 
     trace("call %s(p=%p)\n", __func__, input);
 
+    update_analog();
+    sync_input_snapshot();
+
     if (myvideo.menu.sdl2.enable) {
         send_key_to_menu();
     }
@@ -2307,6 +5078,7 @@ void prehook_platform_get_input(uintptr_t p)
         pre_key_bits = myevent.input.button_status;
         if (p) {
             input->button_status = myevent.input.button_status;
+            written = 1;
             trace("button_status=0x%x\n", input->button_status);
         }
         else {
@@ -2337,6 +5109,11 @@ void prehook_platform_get_input(uintptr_t p)
             error("p is null\n");
         }
     }
+
+    if (p) {
+        update_movie(input);
+    }
+    record_input_latency(written);
 }
 
 #if defined(UT)
@@ -2346,7 +5123,8 @@ TEST(sdl2_event, prehook_platform_get_input)
 
     TEST_ASSERT_NOT_NULL(in);
     prehook_platform_get_input(0);
-    myevent.keypad.cur_bits = (1 << KEY_BIT_A);
+    myevent.keypad.raw_bits = (1 << KEY_BIT_A);
+    publish_input_snapshot();
     prehook_platform_get_input((uintptr_t)((uint8_t *)in - NDS_INPUT_OFFSET));
     TEST_ASSERT_EQUAL_INT(in->button_status, NDS_KEY_BIT_A);
     free(in);
@@ -7,6 +7,7 @@
 #include "../../SDL_internal.h"
 #include "nds_event.h"
 #include "hook.h"
+#include "common.h"
 
 #if defined(MIYOO_MINI)
 #define INPUT_DEV   "/dev/input/event0"
@@ -30,8 +31,46 @@
 #define INPUT_DEV   "/dev/input/event0"
 #endif
 
+#if defined(UT)
+#define INPUT_DEV_DIR           "/tmp/nds_input"
+#else
+#define INPUT_DEV_DIR           "/dev/input"
+#endif
+#define INPUT_PROFILE_DIR       "input"
+
 #define CHECK_ONION_FILE "/mnt/SDCARD/.tmp_update"
 
+#define INPUT_EVENT_BATCH       64
+#define INPUT_EPOLL_MAX         8
+
+#define MAX_HOTKEY_TASK         16
+#define MAX_INPUT_DEV           8
+#define INPUT_KEY_MAP_MAX       0x2c0
+#define TOUCH_PREDICT_MAX       2.0
+
+#if !defined(input_event_sec)
+#define input_event_sec         time.tv_sec
+#define input_event_usec        time.tv_usec
+#endif
+#define HOTKEY_PULSE_US         100000
+#define LAT_BINS                128
+#define LAT_BIN_US              250
+#define MOVIE_MAGIC             0x4d53444e
+#define MOVIE_VERSION           1
+#define MOVIE_STATE_SLOT        11
+#define MOVIE_KEY_MASK          0x1fff
+#define MOVIE_FILE              "movie.ndm"
+#define ANALOG_AXIS_MAX         127
+#define ANALOG_DPAD_ON          50
+#define MACRO_MAX_STEP          256
+#define MACRO_FILE              "macro.txt"
+
+#if defined(MIYOO_FLIP) || defined(TRIMUI_SMART)
+#define INPUT_POLL_MS           10
+#else
+#define INPUT_POLL_MS           -1
+#endif
+
 #if defined(MIYOO_FLIP)
 #define DEV_KEY_BUF_MAX         32
 #define DEV_KEY_IDX_MAX         19
@@ -319,17 +358,124 @@ typedef struct {
     int pressure;
 } touch_data_t;
 
+typedef struct {
+    int valid;
+    int update;
+    int sel;
+    int swap;
+    SDL_Rect rect;
+    float m[6];
+} touch_map_t;
+
+typedef enum {
+    HOTKEY_TASK_KEY_BIT = 0,
+    HOTKEY_TASK_SDL_KEY,
+    HOTKEY_TASK_SDL2_MENU
+} hotkey_task_type_t;
+
+typedef struct {
+    uint64_t due;
+    hotkey_task_type_t type;
+    int code;
+    int val;
+} hotkey_task_t;
+
+typedef struct {
+    int fd;
+    char path[MAX_PATH];
+    char name[64];
+    int abs_min[2];
+    int abs_max[2];
+    int8_t map[INPUT_KEY_MAP_MAX];
+} input_dev_t;
+
+typedef enum {
+    MOVIE_IDLE = 0,
+    MOVIE_RECORD,
+    MOVIE_PLAY
+} movie_mode_t;
+
+typedef enum {
+    MOVIE_REQ_NONE = 0,
+    MOVIE_REQ_RECORD,
+    MOVIE_REQ_PLAY,
+    MOVIE_REQ_STOP,
+    MOVIE_REQ_TOGGLE
+} movie_req_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slot;
+    uint32_t frames;
+    char game[16];
+} movie_hdr_t;
+
+typedef struct {
+    uint32_t button_status;
+    uint16_t touch_x;
+    uint16_t touch_y;
+    uint8_t touch_status;
+    uint8_t touch_pressure;
+    uint16_t reserved;
+} movie_frame_t;
+
+typedef enum {
+    MACRO_IDLE = 0,
+    MACRO_RECORD,
+    MACRO_PLAY
+} macro_mode_t;
+
+typedef struct {
+    uint32_t bits;
+    uint32_t frames;
+} macro_step_t;
+
+typedef struct {
+    uint32_t bits;
+    uint32_t clear_gen;
+    uint32_t flush_seq;
+    uint32_t touch_seq;
+    uint32_t key_seq;
+    uint64_t key_us;
+    int touch_x;
+    int touch_y;
+    int touch_status;
+    int touch_dx;
+    int touch_dy;
+    int axis_x;
+    int axis_y;
+} input_snap_t;
+
 typedef struct {
     int fd;
+    int epfd;
+    int efd;
 
 #if defined(MOTO_XT897) || defined(FXTEC_QX1000)
     int tp_fd;
     int pwr_fd;
 #endif
 
+#if defined(MOTO_XT897) || defined(FXTEC_QX1000) || defined(UT)
+    struct {
+        int ready;
+        int pressed;
+        touch_data_t last;
+        uint64_t time;
+        uint64_t pre_time;
+        float pre_x;
+        float pre_y;
+        touch_map_t map;
+    } panel;
+#endif
+
     struct _keypad{
+        uint32_t raw_bits;
         uint32_t cur_bits;
         uint32_t pre_bits;
+        uint32_t done_bits;
+        uint32_t clear_gen;
 
         uint32_t up;
         uint32_t down;
@@ -365,7 +511,78 @@ typedef struct {
     input_struct input;
 
     int mode;
-    SDL_sem *sem;
+
+    struct {
+        uint32_t seq;
+        input_snap_t data;
+        input_snap_t next;
+        uint32_t flush_seq;
+        uint32_t touch_seq;
+        uint32_t key_seq;
+        int touch_dx;
+        int touch_dy;
+    } snap;
+
+    struct {
+        int enable;
+        uint64_t key_us;
+        uint64_t flip_us;
+        uint64_t last_us;
+        uint32_t samples;
+        uint32_t input_hist[LAT_BINS];
+        uint32_t flip_hist[LAT_BINS];
+    } lat;
+
+    struct {
+        int req;
+        int quit;
+        movie_mode_t mode;
+        uint32_t frame;
+        FILE *fp;
+        movie_hdr_t hdr;
+        char path[MAX_PATH];
+    } movie;
+
+    struct {
+        int ifd;
+        input_dev_t dev[MAX_INPUT_DEV];
+    } hotplug;
+
+    struct {
+        uint32_t bits;
+        int dx;
+        int dy;
+        float fx;
+        float fy;
+    } analog;
+
+    struct {
+        uint32_t cnt;
+    } frame;
+
+    struct {
+        uint32_t start;
+    } turbo;
+
+    struct {
+        int req;
+        macro_mode_t mode;
+        int len;
+        int pos;
+        uint32_t left;
+        uint32_t bits;
+        uint32_t in;
+        uint32_t pre_key;
+        macro_step_t step[MACRO_MAX_STEP];
+        char path[MAX_PATH];
+    } macro;
+
+    struct {
+        int tfd;
+        int cnt;
+        uint64_t now;
+        hotkey_task_t task[MAX_HOTKEY_TASK];
+    } sched;
 
     struct {
         int running;
@@ -381,6 +598,8 @@ void init_event(void);
 void quit_event(void);
 void pump_event(_THIS);
 void prehook_platform_get_input(uintptr_t);
+int record_flip_latency(void);
+int tick_input_frame(void);
 
 #endif
 
@@ -471,6 +471,7 @@ static void* wl_disp_handler(void* pParam)
 {
     trace("call %s()++\n", __func__);
 
+    init_crash_stack();
     myvideo.wl.thread.running = 1;
 
 #if !defined(UT)
@@ -2200,10 +2201,6 @@ TEST(sdl2_video, process_screen)
 
 static void* kill_handler(void *param)
 {
-#if !defined(UT)
-    char buf[32] = { 0 };
-#endif
-
     trace("call %s()\n", __func__);
 
     if (!param) {
@@ -2213,9 +2210,8 @@ static void* kill_handler(void *param)
 
 #if !defined(UT)
     usleep(1000000);
-    sprintf(buf, "kill -9 %d", (uint32_t)param);
     trace("killed by sdl2 library\n");
-    system(buf);
+    kill((pid_t)(uintptr_t)param, SIGKILL);
 #endif
 
     return NULL;
@@ -2383,6 +2379,10 @@ static void prehook_update_screen(void)
 
     trace("call %s(%d)\n", __func__, prepare_time);
 
+    tick_input_frame();
+    tick_replace();
+    tick_mem_trace();
+    tick_crash_handler();
     if (prepare_time) {
         prepare_time -= 1;
         myvideo.lcd.update = 0;
@@ -2410,6 +2410,7 @@ static void prehook_update_screen(void)
 
         trace("set lcd.update=1\n");
         myvideo.lcd.update = 1;
+        record_flip_latency();
     }
 }
 
@@ -2817,6 +2818,7 @@ static void* video_handler(void *param)
 
     trace("call %s()++\n", __func__);
 
+    init_crash_stack();
 #if !defined(UT)
     myvideo.thread.running = 1;
 #endif
@@ -6534,9 +6536,13 @@ static int init_device(void)
 
     init_event();
     load_bg_image();
-    init_hook(myconfig.home, sysconf(_SC_PAGESIZE), myconfig.state_path);
+    if (init_hook(myconfig.home, sysconf(_SC_PAGESIZE), myconfig.state_path) < 0) {
+        error("failed to initialize hook, check %s in \"%s\"\n", SYMBOL_FILE, myconfig.home);
+        exit(-1);
+    }
 
     r = 0;
+    begin_patch();
 
 #if !defined(NDS_ARM64)
     trace("hook prehook_malloc\n");
@@ -6570,6 +6576,7 @@ static int init_device(void)
     trace("hook prehook_savestate_post\n");
     r |= add_prehook(myhook.fun.savestate_post, prehook_savestate_post, NULL);
 #endif
+    r |= commit_patch();
 
 #if defined(NDS_ARM64)
     if (r) {